@@ -174,6 +174,11 @@ class ClientOptions {
   // Default: 2 minutes
   std::chrono::milliseconds heartbeat_timeout;
 
+  // Exchange messages with servers on the same host through shared memory
+  // rather than TCP, when the server accepts it. Linux only.
+  // Default: false
+  bool local_transport;
+
   /** Creates options with default values. */
   ClientOptions();
 };
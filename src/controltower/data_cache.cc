@@ -7,13 +7,15 @@
 #include "src/controltower/data_cache.h"
 #include "src/util/xxhash.h"
 
+#include <algorithm>
+#include <cstring>
 #include <unordered_map>
 
 namespace rocketspeed {
 
 /*
- * Each Entry in the cache is an array of message pointers. The start
- * sequence number in an Entry is always a multiple of block_size_.
+ * Each Entry in the cache is a block of consecutive records of a log. The
+ * start sequence number in an Entry is always a multiple of block_size_.
  * This is done so that the LRU cache can deal with fewer number of Entries
  * rather than having an Entry for each individual message.
  */
@@ -48,6 +50,75 @@ static void GenerateKey(size_t block_size, LogID logid,
          sizeof(seqno));
 }
 
+// Minimum size of the arena allocated for records in a CacheEntry.
+static constexpr size_t kMinArenaCapacity = 4096;
+
+//
+// A MessageData read from the arena of a CacheEntry. It shares ownership of
+// the arena, so that the payload may outlive the entry.
+//
+class CachedMessageData : public MessageData {
+ public:
+  CachedMessageData(std::shared_ptr<char> arena,
+                    Slice record,
+                    SequenceNumber seqno)
+  : MessageData(MessageType::mDeliver) {
+    buffer_ = std::move(arena);
+    Status st = DeSerializeStorage(&record);
+    RS_ASSERT(st.ok());
+    (void)st;
+    SetSequenceNumbers(seqno - 1, seqno);
+  }
+};
+
+// Location of a record in the arena of a block.
+struct RecordLocation {
+  uint32_t offset;
+  uint32_t size;
+};
+
+//
+// Read-only view of the records of a block, either held by a CacheEntry or
+// spilled to the second tier.
+//
+struct BlockView {
+  // Shares ownership of the memory that records are read from.
+  std::shared_ptr<char> owner;
+  const char* arena;
+  const RecordLocation* locations;
+  const uint16_t* hcache;
+  Slice bloom_bits;
+
+  Slice GetRecord(size_t index) const {
+    RS_ASSERT(hcache[index] != 0);
+    const RecordLocation& location = locations[index];
+    return Slice(arena + location.offset, location.size);
+  }
+};
+
+//
+// Header of a block spilled to the second tier. It is followed by topic
+// hashes and record locations of all offsets in the block, bloom bits and
+// the arena. Arrays are aligned, so that they are read in place.
+//
+struct SpilledBlockHeader {
+  uint32_t bloom_size;
+  uint32_t arena_size;
+};
+
+static size_t AlignSpilled(size_t offset) {
+  return (offset + 7) & ~size_t(7);
+}
+
+// Number of records at offsets [from, to) of a block.
+static size_t CountHashes(const uint16_t* hcache, size_t from, size_t to) {
+  size_t count = 0;
+  for (size_t i = from; i < to; ++i) {
+    count += hcache[i] != 0;
+  }
+  return count;
+}
+
 //
 // A CacheEntry stores data for a specified log
 //
@@ -59,14 +130,65 @@ class CacheEntry {
 #endif /* NO_RS_ASSERT */
   std::string bloom_bits_;      // bloom filters are stored here
   unsigned short num_messages_; // number of msg in this entry
-  std::unique_ptr<MessageData>* mcache_;
 
-  // hcache_[i] stores the lower 16-bits of the hash of mcache_[i]'s topic name.
-  // This allows quick strides across the cache without accessing the message.
-  // Only 16-bits are stores to save memory.
+  // Records in log storage format, packed back to back in the order they
+  // were stored. Messages handed out to visitors share ownership of the arena,
+  // so stored bytes are never modified. When the arena is full, it is replaced
+  // by a larger copy.
+  std::shared_ptr<char> arena_;
+  size_t arena_capacity_;
+  size_t arena_used_;
+
+  // locations_[i] is the location in the arena of the record at offset i.
+  std::unique_ptr<RecordLocation[]> locations_;
+
+  // hcache_[i] stores the lower 16-bits of the hash of the topic name of the
+  // record at offset i. This allows quick strides across the cache without
+  // accessing the record. Only 16-bits are stores to save memory.
   // If the entry is 0 then there is no message.
   std::unique_ptr<uint16_t[]> hcache_;
 
+  // Second tier the entry is spilled to when deleted, if any, and the cache
+  // it is spilled on behalf of.
+  std::shared_ptr<DataCacheSpill> spill_;
+  const Cache* spill_owner_;
+  size_t block_size_;
+
+  BlockView GetView() const {
+    BlockView view;
+    view.owner = arena_;
+    view.arena = arena_.get();
+    view.locations = locations_.get();
+    view.hcache = hcache_.get();
+    view.bloom_bits = Slice(bloom_bits_);
+    return view;
+  }
+
+  Slice GetRecord(size_t index) const {
+    RS_ASSERT(hcache_[index] != 0);
+    const RecordLocation& location = locations_[index];
+    return Slice(arena_.get() + location.offset, location.size);
+  }
+
+  // Makes room for a record of specified size in the arena.
+  // Returns the increase in charge, if any
+  size_t ReserveArena(size_t size) {
+    if (arena_used_ + size <= arena_capacity_) {
+      return 0;
+    }
+    size_t capacity = std::max(arena_capacity_ * 2, arena_used_ + size);
+    capacity = std::max(capacity, kMinArenaCapacity);
+    std::shared_ptr<char> arena(new char[capacity],
+                                std::default_delete<char[]>());
+    if (arena_used_) {
+      memcpy(arena.get(), arena_.get(), arena_used_);
+    }
+    arena_ = std::move(arena);
+    size_t delta = capacity - arena_capacity_;
+    arena_capacity_ = capacity;
+    return delta;
+  }
+
  public:
   explicit CacheEntry(DataCache* data_cache,
                       LogID logid, SequenceNumber seqno_block) {
@@ -77,16 +199,86 @@ class CacheEntry {
     num_messages_ = 0;
     RS_ASSERT((1U << 8 * sizeof(num_messages_)) >
       (data_cache->block_size_ + 1U));
-    mcache_ = new std::unique_ptr<MessageData> [data_cache->block_size_];
+    arena_capacity_ = 0;
+    arena_used_ = 0;
+    locations_.reset(new RecordLocation[data_cache->block_size_]);
     hcache_.reset(new uint16_t[data_cache->block_size_]);
     std::fill(hcache_.get(), hcache_.get() + data_cache->block_size_, 0);
+    spill_ = data_cache->spill_;
+    spill_owner_ = data_cache->rs_cache_.get();
+    block_size_ = data_cache->block_size_;
+  }
+
+  // Writes the entry to the second tier, if any.
+  void Spill(const Slice& key) {
+    if (!spill_ || num_messages_ == 0) {
+      return;
+    }
+    SpilledBlockHeader header;
+    header.bloom_size = static_cast<uint32_t>(bloom_bits_.size());
+    header.arena_size = static_cast<uint32_t>(arena_used_);
+    const size_t hcache_end =
+      sizeof(header) + block_size_ * sizeof(hcache_[0]);
+    static const char kPadding[8] = {0};
+    const Slice parts[] = {
+      Slice(reinterpret_cast<const char*>(&header), sizeof(header)),
+      Slice(reinterpret_cast<const char*>(hcache_.get()),
+            block_size_ * sizeof(hcache_[0])),
+      Slice(kPadding, AlignSpilled(hcache_end) - hcache_end),
+      Slice(reinterpret_cast<const char*>(locations_.get()),
+            block_size_ * sizeof(locations_[0])),
+      Slice(bloom_bits_),
+      Slice(arena_.get(), arena_used_),
+    };
+    spill_->Append(spill_owner_, key, parts, sizeof(parts) / sizeof(parts[0]));
+  }
+
+  // Reads a block spilled to the second tier.
+  // Returns false if the block was not spilled.
+  static bool ReadSpilled(const DataCache* data_cache,
+                          const Slice& key,
+                          BlockView* view) {
+    Slice block;
+    if (!data_cache->spill_->Lookup(key, &view->owner, &block)) {
+      return false;
+    }
+    const size_t block_size = data_cache->block_size_;
+    SpilledBlockHeader header;
+    RS_ASSERT(block.size() >= sizeof(header));
+    memcpy(&header, block.data(), sizeof(header));
+    const size_t locations_offset =
+      AlignSpilled(sizeof(header) + block_size * sizeof(view->hcache[0]));
+    const size_t bloom_offset =
+      locations_offset + block_size * sizeof(view->locations[0]);
+    RS_ASSERT(block.size() ==
+              bloom_offset + header.bloom_size + header.arena_size);
+    view->hcache =
+      reinterpret_cast<const uint16_t*>(block.data() + sizeof(header));
+    view->locations =
+      reinterpret_cast<const RecordLocation*>(block.data() + locations_offset);
+    view->bloom_bits = Slice(block.data() + bloom_offset, header.bloom_size);
+    view->arena = block.data() + bloom_offset + header.bloom_size;
+    return true;
   }
 
-  ~CacheEntry() {
-    delete [] mcache_;
+  // Removes the record at offset from the copy of a block spilled to the
+  // second tier, if any. The rest of the block remains readable.
+  static void EraseSpilled(const DataCache* data_cache,
+                           const Slice& key,
+                           size_t offset) {
+    std::shared_ptr<char> owner;
+    Slice block;
+    if (!data_cache->spill_->Lookup(key, &owner, &block)) {
+      return;
+    }
+    // Blocks of a log are only read by the room that erases from them, hence
+    // the record can be hidden in place.
+    uint16_t* hcache =
+      reinterpret_cast<uint16_t*>(owner.get() + sizeof(SpilledBlockHeader));
+    hcache[offset] = 0;
   }
 
-  uint16_t HashTopic(const Slice topic) {
+  static uint16_t HashTopic(const Slice topic) {
     auto hash = XXH64(topic.data(), topic.size(), 0x3bd14b007c8b7733ULL);
     // 0 is special so we modulo to a smaller range.
     return static_cast<uint16_t>(hash % 0xFFFF + 1);
@@ -110,17 +302,16 @@ class CacheEntry {
 #endif /* NO_RS_ASSERT */
 
     // if there already is an entry, then there is nothing more to do
-    if (mcache_[offset] != nullptr) {
-      RS_ASSERT(mcache_[offset].get()->GetSequenceNumber() ==
-             msg->GetSequenceNumber());
-      RS_ASSERT(mcache_[offset].get()->GetTotalSize() ==
-             msg->GetTotalSize());
-      RS_ASSERT(hcache_[offset] != 0);
+    Slice record = msg->GetStorageSlice();
+    if (hcache_[offset] != 0) {
+      RS_ASSERT(GetRecord(offset) == record);
       return 0;
     }
-    RS_ASSERT(hcache_[offset] == 0);
-    size_t size = msg->GetTotalSize();
-    mcache_[offset] = std::move(msg); // store message
+    size_t delta = ReserveArena(record.size());
+    memcpy(arena_.get() + arena_used_, record.data(), record.size());
+    locations_[offset].offset = static_cast<uint32_t>(arena_used_);
+    locations_[offset].size = static_cast<uint32_t>(record.size());
+    arena_used_ += record.size();
     hcache_[offset] = HashTopic(topic); // store hash
     num_messages_++;                  // one more message
     data_cache->stats_.cache_inserts->Add(1);
@@ -134,12 +325,15 @@ class CacheEntry {
       RS_ASSERT(bloom_bits_.size() == 0);
       std::vector<Slice> topics;
       for (unsigned int i = 0; i <num_messages_; i++) {
-        topics.push_back(mcache_[i]->GetTopicName());
+        if (hcache_[i] != 0) {
+          CachedMessageData data(nullptr, GetRecord(i), seqno_block + i);
+          topics.push_back(data.GetTopicName());
+        }
       }
       bloom_filter->CreateFilter(topics, &bloom_bits_); // update blooms
       data_cache->stats_.bloom_inserts->Add(1);  // create one more bloom
     }
-    return size;
+    return delta;
   }
 
   // Remove specified record from the cache
@@ -156,15 +350,10 @@ class CacheEntry {
     RS_ASSERT(seqno_block_ == seqno_block);
 #endif /* NO_RS_ASSERT */
 
-    // if there isn't an entry, then there is nothing more to do
-    if (mcache_[offset] == nullptr) {
-      RS_ASSERT(hcache_[offset] == 0);
-      return 0;
-    }
-    size_t size = mcache_[offset]->GetTotalSize();
-    mcache_[offset] = nullptr;        // erase
+    // The record stays in the arena until the whole entry is evicted, hence
+    // the charge is unchanged.
     hcache_[offset] = 0;
-    return size;
+    return 0;
   }
 
   // Visit the records starting from the specified seqno.
@@ -178,22 +367,35 @@ class CacheEntry {
       const Slice& lookup_topicname,
       bool* stop,
       const std::function<bool(MessageData* data_raw, bool* deliver)>& visit) {
+#ifndef NO_RS_ASSERT
+    RS_ASSERT(logid_ == logid);
+    RS_ASSERT(seqno_block_ ==
+              AlignToBlockStart(data_cache->block_size_, seqno));
+#endif /* NO_RS_ASSERT */
+    return VisitBlock(data_cache, GetView(), seqno, bloom_filter,
+                      lookup_topicname, stop, visit);
+  }
+
+  // Visit the records of a block starting from the specified seqno.
+  static SequenceNumber VisitBlock(
+      DataCache* data_cache,
+      const BlockView& view,
+      SequenceNumber seqno,
+      const FilterPolicy* bloom_filter,
+      const Slice& lookup_topicname,
+      bool* stop,
+      const std::function<bool(MessageData* data_raw, bool* deliver)>& visit) {
     SequenceNumber seqno_block = AlignToBlockStart(
             data_cache->block_size_, seqno);
     size_t offset = seqno - seqno_block;
     bool did_bloom_check = false;
 
-#ifndef NO_RS_ASSERT
-    RS_ASSERT(logid_ == logid);
-    RS_ASSERT(seqno_block_ == seqno_block);
-#endif /* NO_RS_ASSERT */
-
     // If bloom filter enabled, then check bloom filter
     if (bloom_filter) {
       // If caller has specified a topic that it is interested in, then
       // use for bloom filter matching.
-      if (lookup_topicname.size() > 0 && bloom_bits_.size() > 0) {
-        if (!bloom_filter->KeyMayMatch(lookup_topicname, Slice(bloom_bits_))) {
+      if (lookup_topicname.size() > 0 && view.bloom_bits.size() > 0) {
+        if (!bloom_filter->KeyMayMatch(lookup_topicname, view.bloom_bits)) {
           data_cache->stats_.bloom_hits->Add(1);  // successful use of blooms
           return seqno_block + data_cache->block_size_;  // record not found
         }
@@ -206,13 +408,16 @@ class CacheEntry {
     size_t index = offset;
     bool delivered = false;
     const auto block_size = data_cache->block_size_;
-    const auto mcache = mcache_;
-    const auto hcache = hcache_.get();
+    const auto hcache = view.hcache;
+    auto visit_record = [&] (size_t i) {
+      CachedMessageData data(view.owner, view.GetRecord(i), seqno_block + i);
+      return visit(&data, &delivered);
+    };
     if (lookup_topicname.size() == 0) {
       // Unknown lookup topic.
       // In this case, we visit every message in the cache.
-      for (; index < block_size && mcache[index]; index++) {
-        if (!visit(mcache[index].get(), &delivered)) {
+      for (; index < block_size && hcache[index]; index++) {
+        if (!visit_record(index)) {
           ++index;
           *stop = true;
           break;
@@ -222,19 +427,23 @@ class CacheEntry {
       // Lookup topic is known.
       // We can test the topic hash against hcache_ as a fail fast filter.
       // This avoids cache misses and CPU reading the message and visiting.
+      // Hashes are compared several at a time, skipping to the next record
+      // that is either a match or missing.
       const uint16_t hash = HashTopic(lookup_topicname);
-      for (; index < block_size && hcache[index]; ++index) {
-        if (hcache[index] == hash) {
-          if (!visit(mcache[index].get(), &delivered)) {
-            ++index;
-            *stop = true;
-            break;
-          }
+      const auto hash_scan = data_cache->hash_scan_;
+      for (;;) {
+        index = hash_scan(hcache, index, block_size, hash);
+        if (index == block_size || !hcache[index]) {
+          break;
+        }
+        if (!visit_record(index++)) {
+          *stop = true;
+          break;
         }
       }
     }
     // found records in cache
-    data_cache->stats_.cache_hits->Add(index - offset);
+    data_cache->stats_.RecordHits(index - offset);
 
     // The bloom check said that the topic may exist in the Entry
     // but an exhaustive check proved that the topic does not really
@@ -246,69 +455,147 @@ class CacheEntry {
   }
 
   bool HasEntry(size_t offset) {
-    RS_ASSERT((mcache_[offset] == nullptr) == (hcache_[offset] == 0));
-    return mcache_[offset] != nullptr;
+    return hcache_[offset] != 0;
   }
 
-  size_t GetInitialCharge(DataCache* data_cache) {
+  size_t CountEntries(size_t from, size_t to) const {
+    if (from == 0 && to == block_size_) {
+      return num_messages_;
+    }
+    return CountHashes(hcache_.get(), from, to);
+  }
+
+  static size_t GetInitialCharge(DataCache* data_cache) {
     return sizeof(CacheEntry)
-           + (data_cache->block_size_ * sizeof(mcache_[0]))
+           + (data_cache->block_size_ * sizeof(locations_[0]))
            + (data_cache->block_size_ * sizeof(hcache_[0]))
            + (data_cache->block_size_ * data_cache->bloom_bits_per_msg_)/8;
   }
 };
 
 // utility to release memory from the cache callback.
-template <class T>
+// The entry is written to the second tier first, if any.
 static void DeleteEntry(const Slice& key, void* value) {
-  T* typed_value = reinterpret_cast<T*>(value);
-  delete typed_value;
+  CacheEntry* entry = reinterpret_cast<CacheEntry*>(value);
+  entry->Spill(key);
+  delete entry;
 }
 
 DataCache::DataCache(size_t size_in_bytes,
+                     bool cache_data_from_system_namespaces,
+                     int bloom_bits_per_msg,
+                     size_t block_size,
+                     bool admission_filter) :
+  shared_(false),
+  admission_filter_(admission_filter),
+  bloom_bits_per_msg_(bloom_bits_per_msg),
+  block_size_(block_size),
+  hash_scan_(GetHashScanFunction()),
+  rs_cache_(size_in_bytes ?
+            NewDataCache(size_in_bytes, 0, admission_filter) : nullptr),
+  stats_(-1) {
+  Init(cache_data_from_system_namespaces);
+}
+
+DataCache::DataCache(std::shared_ptr<Cache> shared_cache,
+                     int room,
                      bool cache_data_from_system_namespaces,
                      int bloom_bits_per_msg,
                      size_t block_size) :
+  shared_(true),
+  admission_filter_(false),
   bloom_bits_per_msg_(bloom_bits_per_msg),
   block_size_(block_size),
-  rs_cache_(size_in_bytes ? NewLRUCache(size_in_bytes) : nullptr) {
+  hash_scan_(GetHashScanFunction()),
+  rs_cache_(std::move(shared_cache)),
+  stats_(room) {
+  RS_ASSERT(rs_cache_);
+  Init(cache_data_from_system_namespaces);
+}
+
+void DataCache::Init(bool cache_data_from_system_namespaces) {
   characteristics_ = Characteristics::StoreUserTopics |
                      Characteristics::StoreSystemTopics |
                      Characteristics::StoreDataRecords |
                      Characteristics::StoreGapRecords;
   // block size must be power of 2.
-  RS_ASSERT((block_size & (block_size - 1)) == 0);
+  RS_ASSERT((block_size_ & (block_size_ - 1)) == 0);
   if (!cache_data_from_system_namespaces) {
     characteristics_ &= ~Characteristics::StoreSystemTopics;
   }
-  if (bloom_bits_per_msg > 0) {
-    bloom_filter_.reset(FilterPolicy::NewBloomFilterPolicy(bloom_bits_per_msg));
+  if (bloom_bits_per_msg_ > 0) {
+    bloom_filter_.reset(
+      FilterPolicy::NewBloomFilterPolicy(bloom_bits_per_msg_));
   }
 }
 
 DataCache::~DataCache() {
 }
 
+void DataCache::SetSpill(std::shared_ptr<DataCacheSpill> spill) {
+  RS_ASSERT(!rs_cache_ || rs_cache_->GetUsage() == 0);
+  spill_ = std::move(spill);
+  if (spill_ && rs_cache_) {
+    spill_->AddOwner(rs_cache_.get());
+  }
+}
+
 // create a new cache with the existing capacity
 void DataCache::ClearCache() {
   if (rs_cache_ == nullptr) { // No caching specified
     return;
   }
-  size_t capacity = rs_cache_->GetCapacity();
-  rs_cache_ = NewLRUCache(capacity);
+  rejected_blocks_.clear();
+  // Drop the spilled blocks of this cache, and do not spill the blocks that
+  // are about to be evicted. Blocks of other caches sharing the tier stay.
+  if (spill_) {
+    spill_->RemoveOwner(rs_cache_.get());
+  }
+  if (shared_) {
+    // Other rooms keep using the same cache, so just empty it.
+    rs_cache_->EraseUnRefEntries();
+  } else {
+    size_t capacity = rs_cache_->GetCapacity();
+    rs_cache_ = NewDataCache(capacity, 0, admission_filter_);
+  }
+  if (spill_) {
+    spill_->AddOwner(rs_cache_.get());
+  }
 }
 
 // sets a new cache size. If the newly set size is 0, then the
 // cache is disabled.
 void DataCache::SetCapacity(size_t capacity) {
+  // Blocks refused at the previous capacity may fit now.
+  rejected_blocks_.clear();
+  if (shared_) {
+    // A shared cache with no capacity evicts every entry and is skipped by
+    // StoreData, hence it behaves as disabled. Its blocks are dropped from
+    // the second tier rather than spilled.
+    if (spill_) {
+      if (capacity == 0) {
+        spill_->RemoveOwner(rs_cache_.get());
+      } else {
+        spill_->AddOwner(rs_cache_.get());
+      }
+    }
+    rs_cache_->SetCapacity(capacity);
+    return;
+  }
   if (capacity == 0) {
+    if (spill_ && rs_cache_) {
+      spill_->RemoveOwner(rs_cache_.get());
+    }
     rs_cache_ = nullptr; // delete existing cache, if any
     return;
   }
   if (rs_cache_ != nullptr) {
     rs_cache_->SetCapacity(capacity);
   } else {
-    rs_cache_ = NewLRUCache(capacity);
+    rs_cache_ = NewDataCache(capacity, 0, admission_filter_);
+    if (spill_) {
+      spill_->AddOwner(rs_cache_.get());
+    }
   }
 }
 
@@ -341,12 +628,16 @@ void DataCache::StoreGap(LogID log_id, GapType type, SequenceNumber from,
 
 void DataCache::StoreData(const Slice& namespace_id, const Slice& topic,
                           LogID log_id,
-                          std::unique_ptr<MessageData> msg) {
+                          std::unique_ptr<MessageData> msg,
+                          bool tail) {
   if (rs_cache_ == nullptr) { // No caching specified
     return;
   }
-  // Assert that no blocks are pinned
-  RS_ASSERT(rs_cache_->GetPinnedUsage() == 0);
+  if (shared_ && rs_cache_->GetCapacity() == 0) { // Shared cache disabled
+    return;
+  }
+  // Assert that no blocks are pinned, unless other rooms may pin them
+  RS_ASSERT(shared_ || rs_cache_->GetPinnedUsage() == 0);
 
   // Check to see if we do not need to store data
   if (!(characteristics_ & Characteristics::StoreDataRecords)) {
@@ -377,11 +668,36 @@ void DataCache::StoreData(const Slice& namespace_id, const Slice& topic,
     entry = static_cast<CacheEntry *>(rs_cache_->Value(handle));
   } else {
     // Entry does not exist in the cache.
-    // Create a new entry and insert into cache.
+    auto rejected = rejected_blocks_.find(log_id);
+    if (rejected != rejected_blocks_.end()) {
+      if (rejected->second == seqno_block) {
+        return;  // the block was refused already
+      }
+      rejected_blocks_.erase(rejected);
+    }
+    if (tail) {
+      // The tail is what subscribers read, so it always gets in, and is
+      // counted as an access so that it competes with blocks read since.
+      rs_cache_->Touch(cache_key);
+    } else {
+      // Unless the admission filter finds that the new block is looked up
+      // less often than the one it would evict, create a new entry and
+      // insert it. The block is charged for the arena as soon as the record
+      // is stored.
+      const size_t arena_size = std::max(msg->GetStorageSlice().size(),
+                                         kMinArenaCapacity);
+      if (!rs_cache_->Admit(cache_key,
+                            CacheEntry::GetInitialCharge(this) + arena_size)) {
+        stats_.admission_rejects->Add(1);
+        rejected_blocks_.emplace(log_id, seqno_block);
+        return;
+      }
+    }
+    stats_.admission_accepts->Add(1);
     entry = new CacheEntry(this, log_id, seqno_block);
     handle = rs_cache_->Insert(cache_key, entry,
-                               entry->GetInitialCharge(this),
-                               &DeleteEntry<CacheEntry>);
+                               CacheEntry::GetInitialCharge(this),
+                               &DeleteEntry);
   }
 
   // Insert this record into the Entry
@@ -417,6 +733,10 @@ void DataCache::Erase(LogID log_id, GapType type, SequenceNumber seqno) {
     rs_cache_->ChargeDelta(handle, -delta);
     rs_cache_->Release(handle);
   }
+  // The spilled copy of the block may still have the record.
+  if (spill_) {
+    CacheEntry::EraseSpilled(this, cache_key, seqno - seqno_block);
+  }
 }
 
 SequenceNumber DataCache::VisitCache(LogID logid,
@@ -426,8 +746,8 @@ SequenceNumber DataCache::VisitCache(LogID logid,
   if (rs_cache_ == nullptr) { // No caching specified
     return start;
   }
-  // Assert that no blocks are pinned
-  RS_ASSERT(rs_cache_->GetPinnedUsage() == 0);
+  // Assert that no blocks are pinned, unless other rooms may pin them
+  RS_ASSERT(shared_ || rs_cache_->GetPinnedUsage() == 0);
 
   // compute sequence number of block start
   SequenceNumber seqno_block = AlignToBlockStart(block_size_, start);
@@ -439,19 +759,32 @@ SequenceNumber DataCache::VisitCache(LogID logid,
     GenerateKey(block_size_, logid, seqno_block, &buffer);
     Slice cache_key(buffer.buf, sizeof(buffer.buf));
 
-    // Fetch the appropriate entry from the cache
+    // Fetch the appropriate entry from the cache. Block lookups by readers
+    // are what the admission filter counts as demand for a block.
+    rs_cache_->Touch(cache_key);
     Cache::Handle* handle = rs_cache_->Lookup(cache_key);
-    if (!handle) {
-      break;
-    }
-
-    // visit the relevant records in this entry
-    CacheEntry* entry = static_cast<CacheEntry *>(rs_cache_->Value(handle));
     bool stop = false;
-    SequenceNumber next =
-      entry->VisitEntry(this, logid, start, bloom_filter_.get(),
-                        lookup_topicname, &stop, on_message);
-    rs_cache_->Release(handle);
+    SequenceNumber next;
+    if (handle) {
+      stats_.block_hits->Add(1);
+
+      // visit the relevant records in this entry
+      CacheEntry* entry = static_cast<CacheEntry *>(rs_cache_->Value(handle));
+      next = entry->VisitEntry(this, logid, start, bloom_filter_.get(),
+                               lookup_topicname, &stop, on_message);
+      rs_cache_->Release(handle);
+    } else {
+      stats_.block_misses->Add(1);
+
+      // The block may have been evicted to the second tier.
+      BlockView view;
+      if (!spill_ || !CacheEntry::ReadSpilled(this, cache_key, &view)) {
+        break;
+      }
+      stats_.spill_block_hits->Add(1);
+      next = CacheEntry::VisitBlock(this, view, start, bloom_filter_.get(),
+                                    lookup_topicname, &stop, on_message);
+    }
 
     // If the new seqnumber is in the same block, then we are done
     if (next < seqno_block + block_size_ || stop) {
@@ -463,7 +796,7 @@ SequenceNumber DataCache::VisitCache(LogID logid,
   }
 
   if (orig_start == start) {
-    stats_.cache_misses->Add(1);  // no relevant records in cache
+    stats_.RecordMiss();  // no relevant records in cache
   }
   return start;         // return next message that is not yet processed
 }
@@ -485,15 +818,75 @@ bool DataCache::HasEntry(LogID logid, SequenceNumber seqno) const {
     CacheEntry* entry = static_cast<CacheEntry*>(rs_cache_->Value(handle));
     result = entry->HasEntry(seqno - seqno_block);
     rs_cache_->Release(handle);
+  } else if (spill_) {
+    // Check the block evicted to the second tier, if any
+    BlockView view;
+    if (CacheEntry::ReadSpilled(this, cache_key, &view)) {
+      result = view.hcache[seqno - seqno_block] != 0;
+    }
   }
   if (!result) {
-    stats_.cache_misses->Add(1);  // no relevant records in cache
+    stats_.RecordMiss();  // no relevant records in cache
   }
   return result;
 }
 
+size_t DataCache::CountEntries(LogID logid,
+                               SequenceNumber from,
+                               SequenceNumber to) const {
+  if (rs_cache_ == nullptr) { // No caching specified
+    return 0;
+  }
+  size_t count = 0;
+  for (SequenceNumber seqno_block = AlignToBlockStart(block_size_, from);
+       seqno_block < to;
+       seqno_block += block_size_) {
+    const size_t begin = std::max(from, seqno_block) - seqno_block;
+    const size_t end = static_cast<size_t>(
+      std::min<SequenceNumber>(to - seqno_block, block_size_));
+    CacheKey buffer;
+    GenerateKey(block_size_, logid, seqno_block, &buffer);
+    Slice cache_key(buffer.buf, sizeof(buffer.buf));
+
+    // Planning is not a use of the block, so it keeps its place for
+    // eviction.
+    const bool found = rs_cache_->Peek(cache_key, [&] (void* value) {
+      count += static_cast<CacheEntry*>(value)->CountEntries(begin, end);
+    });
+    if (!found && spill_) {
+      BlockView view;
+      if (CacheEntry::ReadSpilled(this, cache_key, &view)) {
+        count += CountHashes(view.hcache, begin, end);
+      }
+    }
+  }
+  return count;
+}
+
 
 Statistics DataCache::GetStatistics() const {
   return stats_.all;
 }
+
+std::shared_ptr<Cache> NewDataCache(size_t capacity,
+                                    int num_shard_bits,
+                                    bool admission_filter) {
+  // Blocks are large, so shards must not be too small to hold a few of them.
+  const size_t kMinShardCapacity = 512 * 1024;
+  while (num_shard_bits > 0 &&
+         (capacity >> num_shard_bits) < kMinShardCapacity) {
+    --num_shard_bits;
+  }
+  // Every block holds at least one arena, so this bounds the number of
+  // blocks in the cache, which the frequency sketch is sized for.
+  const size_t kMaxSketchEntries = 1 << 24;
+  size_t sketch_entries = 0;
+  if (admission_filter) {
+    sketch_entries = std::min(std::max(capacity / kMinArenaCapacity,
+                                       size_t(1)),
+                              kMaxSketchEntries);
+  }
+  return NewLRUCache(capacity, num_shard_bits, CacheEvictionPolicy::kLRU,
+                     sketch_entries);
+}
 }  // namespace rocketspeed
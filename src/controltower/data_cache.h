@@ -6,29 +6,53 @@
 #pragma once
 
 #include "include/RocketSpeed.h"
+#include "src/controltower/data_cache_spill.h"
+#include "src/controltower/hash_scan.h"
 #include "src/messages/messages.h"
 #include "src/util/cache.h"
 #include "src/util/filter_policy.h"
 #include "src/util/storage.h"
 #include "src/util/common/statistics.h"
 #include <gtest/gtest.h>
+#include <unordered_map>
 
 namespace rocketspeed {
 
-// Create a new cache with a fixed size capacity.
+// Create a new cache with a fixed size capacity, which may be shared by
+// DataCaches on different threads. The cache is split into at most
+// 2^num_shard_bits shards. If admission_filter is set, new blocks are only
+// inserted if they are looked up at least as often as the blocks they evict.
 //
-extern std::shared_ptr<Cache> NewDataCache(size_t capacity);
+extern std::shared_ptr<Cache> NewDataCache(size_t capacity,
+                                           int num_shard_bits,
+                                           bool admission_filter);
 
 class DataCache {
  friend class CacheEntry;
  FRIEND_TEST(DataCacheTest, Check);
  FRIEND_TEST(DataCacheTest, CheckBloom);
+ FRIEND_TEST(DataCacheTest, Shared);
+ FRIEND_TEST(DataCacheTest, Admission);
+ FRIEND_TEST(DataCacheTest, AdmissionTail);
+ FRIEND_TEST(DataCacheTest, Spill);
+ FRIEND_TEST(DataCacheTest, SpillClearScoped);
 
  public:
   DataCache(size_t size_in_bytes,
             bool cache_data_from_system_namespaces, // true: cache system ns
             int bloom_bits_per_msg,                 // bits per message
-            size_t block_size);                     // # of messages in a block
+            size_t block_size,                      // # of messages in a block
+            bool admission_filter = false);         // TinyLFU admission
+
+  // Creates a DataCache that stores blocks in a cache shared with DataCaches
+  // of other rooms, see NewDataCache. Capacity, usage and clearing apply to
+  // the shared cache as a whole, while statistics are kept per room.
+  // Blocks of a log must be stored and visited by a single room only.
+  DataCache(std::shared_ptr<Cache> shared_cache,
+            int room,
+            bool cache_data_from_system_namespaces,
+            int bloom_bits_per_msg,
+            size_t block_size);
   ~DataCache();
 
   // Sets a new capacity for the cache. Evict data from cache if the
@@ -40,9 +64,13 @@ class DataCache {
                 SequenceNumber to);
 
   // store data message into cache
+  // Records read at the tail of the log are always cached, and count as an
+  // access to their block for the admission filter. Other blocks are only
+  // cached if the admission filter admits them.
   void StoreData(const Slice& namespace_id, const Slice& topic,
                  LogID log_id,
-                 std::unique_ptr<MessageData> msg);
+                 std::unique_ptr<MessageData> msg,
+                 bool tail = false);
 
   // remove specified record from the cache
   void Erase(LogID log_id, GapType type, SequenceNumber seqno);
@@ -74,13 +102,38 @@ class DataCache {
   // Checks if there is an entry at a specific position.
   bool HasEntry(LogID logid, SequenceNumber seqno) const;
 
+  // Counts the records stored for sequence numbers in [from, to), in memory
+  // or in the second tier. Does not count as a cache hit or miss, nor as a
+  // use of the blocks for eviction.
+  size_t CountEntries(LogID logid,
+                      SequenceNumber from,
+                      SequenceNumber to) const;
+
+  // Is the cache shared with other rooms?
+  bool IsShared() const { return shared_; }
+
+  // Sets the second tier that blocks evicted from memory are written to,
+  // and looked up in when missing from memory. The tier may be shared with
+  // DataCaches of other rooms, clearing this cache only drops the blocks
+  // spilled from it. Must be set before anything is stored.
+  void SetSpill(std::shared_ptr<DataCacheSpill> spill);
+
  private:
+  // true if rs_cache_ is shared with other rooms
+  const bool shared_;
+
+  // true if a private cache uses an admission filter
+  bool admission_filter_;
+
   // number of bloom bits per message
   int bloom_bits_per_msg_;
 
   // The number of messages in a single block in the cache
   size_t block_size_;
 
+  // Scans topic hashes of a block, chosen for the CPU at runtime.
+  HashScanFunction hash_scan_;
+
   // What is the cache used for?
   enum Characteristics : unsigned int {
     StoreUserTopics   = (0x1<<0), // store data from topics in user namespace
@@ -97,11 +150,21 @@ class DataCache {
   // The bloom filter used for this cache
   std::unique_ptr<FilterPolicy> bloom_filter_;
 
+  // Second tier for blocks evicted from rs_cache_, if any
+  std::shared_ptr<DataCacheSpill> spill_;
+
+  // Last block of each log refused by the admission filter, so that the
+  // filter runs once per block rather than once per record.
+  std::unordered_map<LogID, SequenceNumber> rejected_blocks_;
+
   size_t GetBlockSize() const { return block_size_; }
 
+  // Sets up characteristics and bloom filter, used by both constructors.
+  void Init(bool cache_data_from_system_namespaces);
+
   // Collect statistics about cache lookups
   struct Stats {
-    Stats() {
+    explicit Stats(int room) {
       const std::string prefix = "tower.data_cache.";
 
       cache_hits =
@@ -118,6 +181,41 @@ class DataCache {
         all.AddCounter(prefix + "bloom_inserts");
       bloom_falsepositives =
         all.AddCounter(prefix + "bloom_falsepositives");
+      block_hits =
+        all.AddCounter(prefix + "block_hits");
+      block_misses =
+        all.AddCounter(prefix + "block_misses");
+      admission_accepts =
+        all.AddCounter(prefix + "admission_accepts");
+      admission_rejects =
+        all.AddCounter(prefix + "admission_rejects");
+      spill_block_hits =
+        all.AddCounter(prefix + "spill_block_hits");
+
+      // Rooms sharing a cache also count their own lookups.
+      room_cache_hits = room_cache_misses = nullptr;
+      if (room >= 0) {
+        const std::string room_prefix =
+          prefix + "room" + std::to_string(room) + ".";
+        room_cache_hits =
+          all.AddCounter(room_prefix + "cache_hits");
+        room_cache_misses =
+          all.AddCounter(room_prefix + "cache_misses");
+      }
+    }
+
+    void RecordHits(uint64_t count) const {
+      cache_hits->Add(count);
+      if (room_cache_hits) {
+        room_cache_hits->Add(count);
+      }
+    }
+
+    void RecordMiss() const {
+      cache_misses->Add(1);
+      if (room_cache_misses) {
+        room_cache_misses->Add(1);
+      }
     }
 
     Statistics all;
@@ -129,6 +227,14 @@ class DataCache {
     Counter* bloom_inserts; // number of blooms computed
     Counter* bloom_falsepositives;// number of times blooms said that topic
                             // exist but the topic did-not exist in the cache
+    Counter* block_hits;    // number of block lookups that found the block
+    Counter* block_misses;  // number of block lookups that did not
+    Counter* admission_accepts; // number of new blocks inserted into cache
+    Counter* admission_rejects; // number of new blocks not cached because
+                                // the admission filter refused them
+    Counter* spill_block_hits;  // number of block_misses found in the spill
+    Counter* room_cache_hits;   // cache_hits of this room, if shared
+    Counter* room_cache_misses; // cache_misses of this room, if shared
   } stats_;
 };
 
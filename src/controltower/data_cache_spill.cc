@@ -0,0 +1,305 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/controltower/data_cache_spill.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "src/util/common/mutexlock.h"
+
+namespace rocketspeed {
+
+// Blocks are aligned in segments, so that fixed-size arrays in them may be
+// read in place.
+static constexpr size_t kBlockAlignment = 8;
+
+// A mapped segment file.
+struct DataCacheSpill::Segment {
+  Segment(char* _data, size_t _size) : data(_data), size(_size) {}
+
+  ~Segment() {
+    munmap(data, size);
+  }
+
+  char* const data;
+  const size_t size;
+
+  // Keys of all blocks appended to this segment.
+  std::vector<std::string> keys;
+};
+
+Status DataCacheSpill::Open(Env* env,
+                            const std::string& directory,
+                            size_t capacity,
+                            size_t segment_size,
+                            std::shared_ptr<DataCacheSpill>* spill) {
+  if (segment_size == 0 || capacity < segment_size) {
+    return Status::InvalidArgument(
+      "Spill capacity must hold at least one segment");
+  }
+  Status st = env->CreateDirIfMissing(directory);
+  if (!st.ok()) {
+    return st;
+  }
+  std::shared_ptr<DataCacheSpill> result(
+    new DataCacheSpill(env, directory, capacity, segment_size));
+  // The first segment is mapped right away, so that errors are reported.
+  st = result->MapSegment(result->next_file_++, &result->spare_);
+  if (!st.ok()) {
+    return st;
+  }
+  DataCacheSpill* raw = result.get();
+  raw->thread_ = env->StartThread([raw] () { raw->Run(); }, "cache_spill");
+  *spill = std::move(result);
+  return Status::OK();
+}
+
+DataCacheSpill::DataCacheSpill(Env* env,
+                               std::string directory,
+                               size_t capacity,
+                               size_t segment_size)
+: env_(env)
+, directory_(std::move(directory))
+, capacity_(capacity)
+, segment_size_(segment_size)
+, cond_(&mutex_)
+, thread_(0)
+, stop_(false)
+, next_file_(0)
+, first_segment_(0)
+, next_segment_(0)
+, write_offset_(segment_size)
+, closed_(false) {
+}
+
+DataCacheSpill::~DataCacheSpill() {
+  {
+    MutexLock lock(&mutex_);
+    stop_ = true;
+  }
+  cond_.Signal();
+  if (thread_) {
+    env_->WaitForJoin(thread_);
+  }
+}
+
+Status DataCacheSpill::MapSegment(uint64_t file,
+                                  std::shared_ptr<Segment>* segment) const {
+  const std::string fname =
+    directory_ + "/spill-" + std::to_string(file) + ".seg";
+  int fd = open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return Status::IOError(fname + ": " + strerror(errno));
+  }
+  // The mapping keeps the file alive, nobody else needs its name.
+  unlink(fname.c_str());
+  if (ftruncate(fd, static_cast<off_t>(segment_size_)) != 0) {
+    Status st = Status::IOError(fname + ": " + strerror(errno));
+    close(fd);
+    return st;
+  }
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  // Fault the pages in now, rather than when blocks are copied.
+  flags |= MAP_POPULATE;
+#endif
+  void* data = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE,
+                    flags, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return Status::IOError(fname + ": " + strerror(errno));
+  }
+  *segment = std::make_shared<Segment>(static_cast<char*>(data),
+                                       segment_size_);
+  return Status::OK();
+}
+
+void DataCacheSpill::Run() {
+  MutexLock lock(&mutex_);
+  while (!stop_) {
+    if (!retired_.empty()) {
+      std::vector<std::shared_ptr<Segment>> retired;
+      retired.swap(retired_);
+      mutex_.Unlock();
+      // Segments that readers still hold stay mapped until released.
+      retired.clear();
+      mutex_.Lock();
+    } else if (!spare_ && !closed_) {
+      const uint64_t file = next_file_++;
+      mutex_.Unlock();
+      std::shared_ptr<Segment> segment;
+      Status st = MapSegment(file, &segment);
+      mutex_.Lock();
+      if (st.ok()) {
+        spare_ = std::move(segment);
+      } else if (!stop_) {
+        // Retry later, blocks are not spilled meanwhile.
+        cond_.TimedWait(env_->NowMicros() + 1000000);
+      }
+    } else {
+      cond_.Wait();
+    }
+  }
+}
+
+bool DataCacheSpill::AddSegment() {
+  mutex_.AssertHeld();
+  if (!spare_) {
+    return false;
+  }
+  while (!segments_.empty() &&
+         (segments_.size() + 1) * segment_size_ > capacity_) {
+    DropSegment();
+  }
+  if (segments_.empty()) {
+    first_segment_ = next_segment_;
+  }
+  ++next_segment_;
+  segments_.emplace_back(std::move(spare_));
+  write_offset_ = 0;
+  // Map the next one ahead.
+  cond_.Signal();
+  return true;
+}
+
+void DataCacheSpill::DropSegment() {
+  mutex_.AssertHeld();
+  RS_ASSERT(!segments_.empty());
+  for (const std::string& key : segments_.front()->keys) {
+    auto it = index_.find(key);
+    if (it != index_.end() && it->second.segment == first_segment_) {
+      index_.erase(it);
+    }
+  }
+  // Readers still holding the segment keep it mapped.
+  retired_.emplace_back(std::move(segments_.front()));
+  segments_.pop_front();
+  cond_.Signal();
+  ++first_segment_;
+}
+
+void DataCacheSpill::AddOwner(const void* owner) {
+  MutexLock lock(&mutex_);
+  owners_.insert(owner);
+}
+
+void DataCacheSpill::RemoveOwner(const void* owner) {
+  MutexLock lock(&mutex_);
+  owners_.erase(owner);
+  for (auto it = index_.begin(); it != index_.end(); ) {
+    if (it->second.owner == owner) {
+      it = index_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (index_.empty()) {
+    // Nothing left to read, reclaim the segments now.
+    ClearLocked();
+  }
+}
+
+bool DataCacheSpill::Append(const void* owner,
+                            const Slice& key,
+                            const Slice* parts,
+                            size_t num_parts) {
+  size_t size = 0;
+  for (size_t i = 0; i < num_parts; ++i) {
+    size += parts[i].size();
+  }
+  if (size > segment_size_) {
+    return false;
+  }
+
+  // Reserve room for the block, then copy it without holding the lock.
+  std::shared_ptr<Segment> segment;
+  Location location;
+  {
+    MutexLock lock(&mutex_);
+    if (closed_ || !owners_.count(owner)) {
+      return false;
+    }
+    if (write_offset_ + size > segment_size_ || segments_.empty()) {
+      if (!AddSegment()) {
+        return false;
+      }
+    }
+    segment = segments_.back();
+    location.segment = first_segment_ + segments_.size() - 1;
+    location.offset = write_offset_;
+    location.size = size;
+    location.owner = owner;
+    write_offset_ += (size + kBlockAlignment - 1) & ~(kBlockAlignment - 1);
+    write_offset_ = std::min(write_offset_, segment_size_);
+  }
+
+  char* dest = segment->data + location.offset;
+  for (size_t i = 0; i < num_parts; ++i) {
+    memcpy(dest, parts[i].data(), parts[i].size());
+    dest += parts[i].size();
+  }
+
+  MutexLock lock(&mutex_);
+  if (location.segment < first_segment_ || !owners_.count(owner)) {
+    return false;  // segment dropped or owner removed meanwhile
+  }
+  segment->keys.emplace_back(key.data(), key.size());
+  index_[segment->keys.back()] = location;
+  return true;
+}
+
+bool DataCacheSpill::Lookup(const Slice& key,
+                            std::shared_ptr<char>* owner,
+                            Slice* block) const {
+  MutexLock lock(&mutex_);
+  auto it = index_.find(key.ToString());
+  if (it == index_.end()) {
+    return false;
+  }
+  const Location& location = it->second;
+  RS_ASSERT(location.segment >= first_segment_);
+  const std::shared_ptr<Segment>& segment =
+    segments_[location.segment - first_segment_];
+  char* data = segment->data + location.offset;
+  // Share ownership of the whole segment.
+  *owner = std::shared_ptr<char>(segment, data);
+  *block = Slice(data, location.size);
+  return true;
+}
+
+void DataCacheSpill::Clear() {
+  MutexLock lock(&mutex_);
+  ClearLocked();
+}
+
+void DataCacheSpill::ClearLocked() {
+  mutex_.AssertHeld();
+  index_.clear();
+  for (auto& segment : segments_) {
+    retired_.emplace_back(std::move(segment));
+  }
+  segments_.clear();
+  cond_.Signal();
+  first_segment_ = next_segment_;
+  write_offset_ = segment_size_;
+}
+
+void DataCacheSpill::Close() {
+  Clear();
+  MutexLock lock(&mutex_);
+  closed_ = true;
+}
+
+size_t DataCacheSpill::GetUsage() const {
+  MutexLock lock(&mutex_);
+  return segments_.size() * segment_size_;
+}
+
+}  // namespace rocketspeed
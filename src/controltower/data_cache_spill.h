@@ -0,0 +1,162 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "include/Env.h"
+#include "include/Slice.h"
+#include "include/Status.h"
+#include "src/port/port.h"
+
+namespace rocketspeed {
+
+//
+// Second tier of the tower DataCache, on local disk.
+//
+// Blocks evicted from the in-memory cache are appended to segment files that
+// are memory-mapped, so that spilled records are read in place. An in-memory
+// index maps a cache key to the latest copy of its block. When the segments
+// exceed the capacity, the oldest segment is dropped with all blocks in it.
+// Segment files are unlinked as soon as they are mapped, hence nothing is
+// left behind on disk and the tier does not survive restarts.
+//
+// Segments are created and populated by a background thread, one segment
+// ahead of the writes, and dropped segments are unmapped there too, so that
+// appending a block is only a memory copy. A block evicted before the next
+// segment is ready is not spilled.
+//
+// Blocks are appended on behalf of an owner, the in-memory cache they were
+// evicted from, so that caches sharing the tier may be cleared separately.
+//
+// Thread safe.
+//
+class DataCacheSpill {
+ public:
+  // Creates a spill tier with segment files in the specified directory.
+  // The directory is created if missing.
+  static Status Open(Env* env,
+                     const std::string& directory,
+                     size_t capacity,
+                     size_t segment_size,
+                     std::shared_ptr<DataCacheSpill>* spill);
+
+  ~DataCacheSpill();
+
+  // Starts accepting blocks appended by owner.
+  void AddOwner(const void* owner);
+
+  // Forgets all blocks appended by owner, and ignores blocks that it appends
+  // until it is added again.
+  void RemoveOwner(const void* owner);
+
+  // Appends a block, made of concatenated parts, as the latest copy of the
+  // block with the specified key. Returns false if the block was not written,
+  // e.g. because owner was not added.
+  bool Append(const void* owner,
+              const Slice& key,
+              const Slice* parts,
+              size_t num_parts);
+
+  // Finds the latest copy of a block. The block remains readable as long as
+  // the owner is held, even if it is dropped from the spill tier. The owner
+  // points at the block, which the only reader of the block may modify.
+  bool Lookup(const Slice& key,
+              std::shared_ptr<char>* owner,
+              Slice* block) const;
+
+  // Forgets all blocks.
+  void Clear();
+
+  // Forgets all blocks and stops accepting new ones, so that blocks evicted
+  // while the cache is torn down are not written.
+  void Close();
+
+  // Number of bytes of segments currently mapped.
+  size_t GetUsage() const;
+
+  // Maximum number of bytes of segments.
+  size_t GetCapacity() const { return capacity_; }
+
+ private:
+  struct Segment;
+
+  // Location of a block in a segment.
+  struct Location {
+    uint64_t segment;
+    size_t offset;
+    size_t size;
+    const void* owner;
+  };
+
+  DataCacheSpill(Env* env,
+                 std::string directory,
+                 size_t capacity,
+                 size_t segment_size);
+
+  // Creates, maps and populates a segment file.
+  Status MapSegment(uint64_t file, std::shared_ptr<Segment>* segment) const;
+
+  // Maps segments ahead of the writes, and unmaps dropped segments.
+  void Run();
+
+  // Starts appending to the spare segment, dropping the oldest segments if
+  // needed. Returns false if the spare segment is not mapped yet.
+  // REQUIRES: mutex_ held.
+  bool AddSegment();
+
+  // Drops the oldest segment and all index entries that point to it.
+  // REQUIRES: mutex_ held.
+  void DropSegment();
+
+  // Forgets all blocks.
+  // REQUIRES: mutex_ held.
+  void ClearLocked();
+
+  Env* const env_;
+  const std::string directory_;
+  const size_t capacity_;
+  const size_t segment_size_;
+
+  mutable port::Mutex mutex_;
+  // Signals the background thread.
+  port::CondVar cond_;
+  Env::ThreadId thread_;
+  // Set once the background thread should exit.
+  bool stop_;
+
+  // Segment mapped ahead, null until the background thread has mapped it.
+  std::shared_ptr<Segment> spare_;
+  // Dropped segments, unmapped by the background thread.
+  std::vector<std::shared_ptr<Segment>> retired_;
+  // Number used in the name of the next segment file.
+  uint64_t next_file_;
+
+  // Mapped segments, oldest first. The last one is appended to.
+  std::deque<std::shared_ptr<Segment>> segments_;
+  // ID of the oldest segment.
+  uint64_t first_segment_;
+  // ID of the next segment to be appended to.
+  uint64_t next_segment_;
+  // Offset of the first free byte of the last segment.
+  size_t write_offset_;
+  // Set once closed.
+  bool closed_;
+
+  // Owners whose blocks are accepted.
+  std::unordered_set<const void*> owners_;
+
+  // Location of the latest copy of every block.
+  std::unordered_map<std::string, Location> index_;
+};
+
+}  // namespace rocketspeed
@@ -0,0 +1,94 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/controltower/hash_scan.h"
+
+#ifdef ROCKETSPEED_HASH_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace rocketspeed {
+
+size_t HashScanScalar(const uint16_t* hashes,
+                      size_t begin,
+                      size_t end,
+                      uint16_t hash) {
+  for (; begin < end; ++begin) {
+    if (hashes[begin] == hash || hashes[begin] == 0) {
+      break;
+    }
+  }
+  return begin;
+}
+
+#ifdef ROCKETSPEED_HASH_SCAN_X86
+
+__attribute__((target("sse2")))
+size_t HashScanSSE2(const uint16_t* hashes,
+                    size_t begin,
+                    size_t end,
+                    uint16_t hash) {
+  const __m128i needle = _mm_set1_epi16(static_cast<short>(hash));
+  const __m128i zero = _mm_setzero_si128();
+  for (; begin + 8 <= end; begin += 8) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(hashes + begin));
+    const __m128i match =
+        _mm_or_si128(_mm_cmpeq_epi16(v, needle), _mm_cmpeq_epi16(v, zero));
+    // Two bits per matching hash.
+    const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(match));
+    if (mask) {
+      return begin + __builtin_ctz(mask) / 2;
+    }
+  }
+  return HashScanScalar(hashes, begin, end, hash);
+}
+
+__attribute__((target("avx2")))
+size_t HashScanAVX2(const uint16_t* hashes,
+                    size_t begin,
+                    size_t end,
+                    uint16_t hash) {
+  const __m256i needle = _mm256_set1_epi16(static_cast<short>(hash));
+  const __m256i zero = _mm256_setzero_si256();
+  for (; begin + 16 <= end; begin += 16) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hashes + begin));
+    const __m256i match = _mm256_or_si256(_mm256_cmpeq_epi16(v, needle),
+                                          _mm256_cmpeq_epi16(v, zero));
+    // Two bits per matching hash.
+    const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(match));
+    if (mask) {
+      return begin + __builtin_ctz(mask) / 2;
+    }
+  }
+  return HashScanSSE2(hashes, begin, end, hash);
+}
+
+#endif  // ROCKETSPEED_HASH_SCAN_X86
+
+namespace {
+
+HashScanFunction SelectHashScanFunction() {
+#ifdef ROCKETSPEED_HASH_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &HashScanAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return &HashScanSSE2;
+  }
+#endif
+  return &HashScanScalar;
+}
+
+}  // namespace
+
+HashScanFunction GetHashScanFunction() {
+  static const HashScanFunction scan = SelectHashScanFunction();
+  return scan;
+}
+
+}  // namespace rocketspeed
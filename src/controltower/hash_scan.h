@@ -0,0 +1,59 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rocketspeed {
+
+/**
+ * Scans an array of 16-bit topic hashes, as stored in DataCache blocks.
+ *
+ * @param hashes The array of hashes.
+ * @param begin Index of the first hash to inspect.
+ * @param end Index past the last hash to inspect.
+ * @param hash The hash to look for, must be non-zero.
+ * @return The smallest index i in [begin, end) such that hashes[i] is either
+ *         equal to hash or zero, or end if there is no such index.
+ */
+typedef size_t (*HashScanFunction)(const uint16_t* hashes,
+                                   size_t begin,
+                                   size_t end,
+                                   uint16_t hash);
+
+/** Portable implementation of HashScanFunction. */
+size_t HashScanScalar(const uint16_t* hashes,
+                      size_t begin,
+                      size_t end,
+                      uint16_t hash);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ROCKETSPEED_HASH_SCAN_X86
+
+/** Implementation using SSE2, compares 8 hashes at a time. */
+size_t HashScanSSE2(const uint16_t* hashes,
+                    size_t begin,
+                    size_t end,
+                    uint16_t hash);
+
+/**
+ * Implementation using AVX2, compares 16 hashes at a time.
+ * Must only be used if the CPU supports AVX2.
+ */
+size_t HashScanAVX2(const uint16_t* hashes,
+                    size_t begin,
+                    size_t end,
+                    uint16_t hash);
+#endif  // defined(__x86_64__) || defined(__i386__)
+
+/**
+ * @return The fastest implementation of HashScanFunction supported by the
+ *         CPU, as detected at runtime.
+ */
+HashScanFunction GetHashScanFunction();
+
+}  // namespace rocketspeed
@@ -16,26 +16,33 @@
 
 namespace rocketspeed {
 
-// Version of MessageData that holds a std::unique_ptr<LogRecord> to
-// persist the LogDevice buffer.
+// Version of MessageData that holds a LogRecord to persist the LogDevice
+// buffer. The record is shared by all holders of the payload, so that it can
+// be sent to subscribers and kept in the cache without being copied.
 struct LogRecordMessageData : public MessageData {
  public:
   explicit LogRecordMessageData(LogRecord record,
                                 Status* status)
   : MessageData(MessageType::mDeliver)
-  , record_(std::move(record)) {
+  , record_(std::make_shared<LogRecord>(std::move(record))) {
+    // All slices of the message point into the record.
+    buffer_ = std::shared_ptr<char>(
+        record_, const_cast<char*>(record_->payload.data()));
     // Deserialize
-    Slice payload = record_.payload;
+    Slice payload = record_->payload;
     *status = DeSerializeStorage(&payload);
-    SetSequenceNumbers(record_.seqno - 1, record_.seqno);
+    SetSequenceNumbers(record_->seqno - 1, record_->seqno);
   }
 
   LogRecord MoveRecord() {
-    return std::move(record_);
+    buffer_.reset();
+    // Nobody else may be holding the record at this point.
+    RS_ASSERT(record_.use_count() == 1);
+    return std::move(*record_);
   }
 
  private:
-  LogRecord record_;
+  std::shared_ptr<LogRecord> record_;
 };
 
 LogTailer::LogTailer(std::shared_ptr<LogStorage> storage,
@@ -291,13 +298,14 @@ LogTailer::CreateNewInstance(Env* env,
 
 Status LogTailer::StartReading(LogID logid,
                             SequenceNumber start,
-                            size_t reader_id) {
+                            size_t reader_id,
+                            SequenceNumber end) {
   if (readers_.size() == 0) {
     return Status::NotInitialized();
   }
   RS_ASSERT(reader_id < readers_.size());
   Reader& reader = readers_[reader_id];
-  Status st = reader.log_reader->Open(logid, start);
+  Status st = reader.log_reader->Open(logid, start, end);
   if (st.ok()) {
     LOG_INFO(info_log_,
              "AsyncReader %zu start reading Log(%" PRIu64 ")@%" PRIu64 ".",
@@ -306,10 +314,12 @@ Status LogTailer::StartReading(LogID logid,
              start);
     auto it = reader.log_state.find(logid);
     if (it == reader.log_state.end()) {
-      it = reader.log_state.emplace(logid, Reader::LogState(start)).first;
+      it = reader.log_state.emplace(logid,
+                                    Reader::LogState(start, end)).first;
       stats_.readers_started->Add(1);
     } else {
       it->second.next_seqno = start;
+      it->second.end_seqno = end;
       stats_.readers_restarted->Add(1);
       restart_events_.RemoveEvent(it->second.restart_event_handle);
     }
@@ -396,11 +406,13 @@ bool LogTailer::TryForward(std::function<void(Flow*)> command) {
 }
 
 void LogTailer::Tick() {
-  // Process due events on LogReaders.
-  auto now = std::chrono::steady_clock::now();
-  while (!restart_events_.empty() &&
-         restart_events_.begin()->restart_time < now) {
-    auto& ev = *restart_events_.begin();
+  // Collect due events on LogReaders first, since restarting a reader adds
+  // a new event.
+  std::vector<RestartEvent> due;
+  restart_events_.ProcessExpired(std::chrono::steady_clock::now(),
+    [&] (RestartEvent ev) { due.push_back(ev); });
+
+  for (const RestartEvent& ev : due) {
     auto reader_id = ev.reader_id;
     auto log_id = ev.log_id;
 
@@ -412,8 +424,13 @@ void LogTailer::Tick() {
     auto seqno = it->second.next_seqno;
 
     // Restart reading at this sequence number.
-    // Note: this will remove and re-add the event to restart_events_.
-    StartReading(log_id, seqno, reader_id);
+    // Note: this will add a new event to restart_events_.
+    Status st = StartReading(log_id, seqno, reader_id, it->second.end_seqno);
+    if (!st.ok()) {
+      // Try again later.
+      it->second.restart_event_handle =
+        restart_events_.AddEvent(reader_id, log_id);
+    }
     stats_.forced_restarts->Add(1);
   }
 }
@@ -428,14 +445,12 @@ LogTailer::RestartEvents::AddEvent(size_t reader_id, LogID log_id) {
   auto restart_time = std::chrono::steady_clock::now() +
     std::chrono::milliseconds(distribution(prng));
 
-  // Add to ordered set of events.
-  auto result = emplace(restart_time, reader_id, log_id);
-  RS_ASSERT(result.second);
-  return result.first;
+  return Add(RestartEvent(reader_id, log_id), restart_time);
 }
 
 void LogTailer::RestartEvents::RemoveEvent(Handle handle) {
-  erase(handle);
+  // Fired events have been removed already.
+  Cancel(handle);
 }
 
 }  // namespace rocketspeed
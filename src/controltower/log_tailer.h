@@ -4,14 +4,15 @@
 // of patent rights can be found in the PATENTS file in the same directory.
 #pragma once
 
+#include <chrono>
 #include <memory>
-#include <set>
 #include <vector>
 #include "include/Status.h"
 #include "include/Types.h"
 #include "include/Env.h"
 #include "src/util/common/statistics.h"
 #include "src/util/storage.h"
+#include "src/util/timer_wheel.h"
 #include "src/controltower/options.h"
 
 namespace rocketspeed {
@@ -81,11 +82,13 @@ class LogTailer {
 
   /**
    * Opens the specified log at specified position or reseeks to the position if
-   * the log was opened. This call is not thread-safe.
+   * the log was opened. The reader stops after the end position.
+   * This call is not thread-safe.
    */
   Status StartReading(LogID logid,
                       SequenceNumber start,
-                      size_t reader_id);
+                      size_t reader_id,
+                      SequenceNumber end = kEndOfTimeSeqno);
 
   // No more records from this log anymore
   // This call is not thread-safe.
@@ -111,41 +114,32 @@ class LogTailer {
  private:
   /**
    * LogReaders are restarted periodically. This structure represents a
-   * the restart event for a particular reader and log. It is ordered by
-   * time.
+   * the restart event for a particular reader and log.
    */
   struct RestartEvent {
-    RestartEvent(std::chrono::steady_clock::time_point _restart_time,
-                 size_t _reader_id,
-                 LogID _log_id)
-    : restart_time(_restart_time)
-    , reader_id(_reader_id)
+    RestartEvent() = default;
+
+    RestartEvent(size_t _reader_id, LogID _log_id)
+    : reader_id(_reader_id)
     , log_id(_log_id) {
     }
 
-    std::chrono::steady_clock::time_point restart_time;
-    size_t reader_id;
-    LogID log_id;
-
-    bool operator<(const RestartEvent& rhs) const {
-      return std::tie(restart_time, reader_id, log_id) <
-        std::tie(rhs.restart_time, rhs.reader_id, rhs.log_id);
-    }
+    size_t reader_id = 0;
+    LogID log_id = 0;
   };
 
   /**
-   * An ordered set of RestartEvents.
-   * Is a thin wrapper around std::set<RestartEvent>, providing convenient
+   * A timer wheel of RestartEvents.
+   * Is a thin wrapper around TimerWheel<RestartEvent>, providing convenient
    * interface for adding new events with random expiry time.
    */
-  class RestartEvents : public std::set<RestartEvent> {
+  class RestartEvents : public TimerWheel<RestartEvent> {
    public:
-    /** Opaque handle used for removing events. */
-    using Handle = iterator;
-
     RestartEvents(std::chrono::milliseconds min_restart_duration,
                   std::chrono::milliseconds max_restart_duration)
-    : min_restart_duration_(min_restart_duration)
+    // Restarts are spread over tens of seconds, so need not be precise.
+    : TimerWheel<RestartEvent>(std::chrono::milliseconds(10))
+    , min_restart_duration_(min_restart_duration)
     , max_restart_duration_(max_restart_duration) {
     }
 
@@ -209,10 +203,14 @@ class LogTailer {
     , on_gap(std::move(_on_gap)) {}
 
     struct LogState {
-      explicit LogState(SequenceNumber _next_seqno)
-      : next_seqno(_next_seqno) {}
+      explicit LogState(SequenceNumber _next_seqno,
+                        SequenceNumber _end_seqno)
+      : next_seqno(_next_seqno)
+      , end_seqno(_end_seqno)
+      , restart_event_handle(RestartEvents::kInvalidHandle) {}
 
       SequenceNumber next_seqno;
+      SequenceNumber end_seqno;
       RestartEvents::Handle restart_event_handle;
     };
 
@@ -238,7 +236,6 @@ class LogTailer {
   // a certain point in time. Readers are restarted occasionally to allow
   // the storage layer to rebalance threads, and provides some extra resilience
   // against unexpected log reader failures.
-  // The set is ordered by time.
   RestartEvents restart_events_;
 
   struct Stats {
@@ -20,7 +20,8 @@ ControlTowerOptions::ControlTowerOptions()
     max_subscription_lag(10000),
     readers_per_room(2),
     timer_interval(std::chrono::milliseconds(100)),
-    room_to_client_queue_size(1000) {
+    room_to_client_queue_size(1000),
+    multicast_delivery(false) {
 }
 
 ControlTowerOptions::LogTailer::LogTailer()
@@ -32,10 +33,19 @@ ControlTowerOptions::LogTailer::LogTailer()
 
 ControlTowerOptions::TopicTailer::TopicTailer()
 : max_find_time_requests(100)
+, tail_seqno_cache_ttl(std::chrono::seconds(1))
 , cache_size(0)
 , cache_data_from_system_namespaces(true)
 , cache_block_size(1024)
-, bloom_bits_per_msg(10) {
+, bloom_bits_per_msg(10)
+, shared_cache(true)
+, cache_shard_bits(4)
+, cache_admission_filter(true)
+, cache_spill_size(16ULL * 1024 * 1024 * 1024)
+, cache_spill_segment_size(64 * 1024 * 1024)
+, catch_up_readers(4)
+, catch_up_min_backlog(100000)
+, catch_up_range_size(10000) {
 }
 
 
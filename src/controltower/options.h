@@ -109,6 +109,12 @@ struct ControlTowerOptions {
     // Default: 100
     size_t max_find_time_requests;
 
+    // How long the result of a find time request is used as the tail seqno
+    // of its log, for subscriptions at 0 and tail seqno requests, once the
+    // log is not read. Zero disables.
+    // Default: 1 second
+    std::chrono::milliseconds tail_seqno_cache_ttl;
+
     // Cache size in bytes. A size of 0 indicates no cache.
     // Default: 0
     size_t cache_size;
@@ -125,6 +131,55 @@ struct ControlTowerOptions {
     // only if cache_size is non-zero.
     // Default: 10 bits per message
     int bloom_bits_per_msg;
+
+    // Should all rooms share a single cache of cache_size bytes? If false,
+    // every room has a private cache of an equal part of cache_size.
+    // Default: true
+    bool shared_cache;
+
+    // The shared cache is split into 2^cache_shard_bits shards, each with its
+    // own lock. Shards are never made smaller than 512KB.
+    // Default: 4
+    int cache_shard_bits;
+
+    // Should new cache blocks be admitted only if they have been looked up
+    // at least as often recently as the blocks they would evict (TinyLFU)?
+    // Prevents a single subscriber reading far back from flushing the blocks
+    // that other subscribers are replaying.
+    // Blocks read at the tail of logs are always admitted.
+    // Default: true
+    bool cache_admission_filter;
+
+    // Directory for the second tier of the cache, on local disk. Blocks
+    // evicted from the cache are written there and read back in place.
+    // Segment files are unlinked once mapped. If empty, there is no second
+    // tier.
+    // Default: empty
+    std::string cache_spill_directory;
+
+    // Size of the second tier of the cache in bytes.
+    // Default: 16GB
+    size_t cache_spill_size;
+
+    // Size of a single segment file of the second tier. When the tier is
+    // full, the oldest segment is dropped.
+    // Default: 64MB
+    size_t cache_spill_segment_size;
+
+    // Number of extra log readers per room that read the backlog of
+    // subscriptions far behind the tail in parallel ranges. Once caught up,
+    // subscriptions are handed to the regular readers. 0 disables.
+    // Default: 4
+    size_t catch_up_readers;
+
+    // Subscriptions at least this many sequence numbers behind the tail are
+    // caught up by the catch-up readers.
+    // Default: 100K
+    uint64_t catch_up_min_backlog;
+
+    // Number of sequence numbers read by one catch-up reader at a time.
+    // Default: 10K
+    uint64_t catch_up_range_size;
   } topic_tailer;
 
   // Interval for tower timer tick for running time-based logic.
@@ -135,6 +190,14 @@ struct ControlTowerOptions {
   // Default: 1000
   size_t room_to_client_queue_size;
 
+  // Deliver a record to all subscriptions on the same stream in a single
+  // MessageDeliverMulticast, rather than in one MessageDeliverData per
+  // subscription. There is no protocol version negotiation for it, so enable
+  // this only once every copilot and client of the tower can decode
+  // MessageDeliverMulticast.
+  // Default: false
+  bool multicast_delivery;
+
   // Create ControlTowerOptions with default values for all fields
   ControlTowerOptions();
 };
@@ -6,6 +6,7 @@
 #define __STDC_FORMAT_MACROS
 #include "src/controltower/room.h"
 
+#include <algorithm>
 #include <map>
 #include <mutex>
 #include <string>
@@ -141,7 +142,7 @@ ControlRoom::OnTailerMessage(Flow* flow,
 void
 ControlRoom::ProcessDeliver(Flow* flow,
                             const Message& msg,
-                            const std::vector<CopilotSub>& recipients) {
+                            std::vector<CopilotSub> recipients) {
   ControlTower* ct = control_tower_;
   ControlTowerOptions& options = ct->GetOptions();
   Status st;
@@ -159,33 +160,76 @@ ControlRoom::ProcessDeliver(Flow* flow,
       request->GetNamespaceId().ToString().c_str(),
       request->GetTopicName().ToString().c_str());
 
+  // Group recipients by stream, so that a stream with many subscriptions on
+  // this topic receives the record only once.
+  std::stable_sort(recipients.begin(), recipients.end(),
+    [](const CopilotSub& lhs, const CopilotSub& rhs) {
+      return lhs.stream_id < rhs.stream_id;
+    });
+
   // For each subscriber on this topic at prev_seqno, deliver the message and
-  // advance the subscription to next_seqno.
+  // advance the subscription to next_seqno. If the record is backed by shared
+  // storage, the payload is referenced by outgoing messages, not copied.
   TopicUUID uuid(request->GetNamespaceId(), request->GetTopicName());
-  for (CopilotSub recipient : recipients) {
+  MessageDeliverMulticast::SubscriptionIDs sub_ids;
+  for (size_t i = 0; i < recipients.size(); ) {
+    const StreamID stream_id = recipients[i].stream_id;
     // Send to correct worker loop.
-    const int worker_id = CopilotWorker(recipient);
-    if (worker_id == -1) {
-      LOG_WARN(options.info_log,
-        "Unknown worker for subscription %s",
-        recipient.ToString().c_str());
-      continue;
+    int worker_id = -1;
+    sub_ids.clear();
+    for (; i < recipients.size() && recipients[i].stream_id == stream_id; ++i) {
+      const CopilotSub& recipient = recipients[i];
+      const int sub_worker_id = CopilotWorker(recipient);
+      if (sub_worker_id == -1) {
+        LOG_WARN(options.info_log,
+          "Unknown worker for subscription %s",
+          recipient.ToString().c_str());
+        continue;
+      }
+      // All subscriptions on a stream are handled by the same worker.
+      RS_ASSERT(worker_id == -1 || worker_id == sub_worker_id);
+      worker_id = sub_worker_id;
+      sub_ids.push_back(recipient.sub_id);
     }
 
-    MessageDeliverData deliver(request->GetTenantID(),
-                               recipient.sub_id,
-                               request->GetMessageId(),
-                               request->GetPayload());
-    deliver.SetSequenceNumbers(prev_seqno, next_seqno);
-    auto command = MsgLoop::ResponseCommand(deliver, recipient.stream_id);
+    if (sub_ids.size() > 1 && options.multicast_delivery) {
+      MessageDeliverMulticast deliver(request->GetTenantID(),
+                                      sub_ids,
+                                      request->GetMessageId(),
+                                      request->GetPayload(),
+                                      request->GetPayloadOwner());
+      deliver.SetSequenceNumbers(prev_seqno, next_seqno);
+      auto command = MsgLoop::ResponseCommand(deliver, stream_id);
+
+      flow->Write(room_to_client_queues_[worker_id].get(), command);
+      LOG_DEBUG(options.info_log,
+               "Sent data (%.16s)@%" PRIu64 " for %s to %zu subscriptions "
+               "on stream %llu",
+               request->GetPayload().ToString().c_str(),
+               request->GetSequenceNumber(),
+               uuid.ToString().c_str(),
+               sub_ids.size(),
+               stream_id);
+      continue;
+    }
 
-    flow->Write(room_to_client_queues_[worker_id].get(), command);
-    LOG_DEBUG(options.info_log,
-             "Sent data (%.16s)@%" PRIu64 " for %s to %s",
-             request->GetPayload().ToString().c_str(),
-             request->GetSequenceNumber(),
-             uuid.ToString().c_str(),
-             recipient.ToString().c_str());
+    for (SubscriptionID sub_id : sub_ids) {
+      MessageDeliverData deliver(request->GetTenantID(),
+                                 sub_id,
+                                 request->GetMessageId(),
+                                 request->GetPayload(),
+                                 request->GetPayloadOwner());
+      deliver.SetSequenceNumbers(prev_seqno, next_seqno);
+      auto command = MsgLoop::ResponseCommand(deliver, stream_id);
+
+      flow->Write(room_to_client_queues_[worker_id].get(), command);
+      LOG_DEBUG(options.info_log,
+               "Sent data (%.16s)@%" PRIu64 " for %s to %s",
+               request->GetPayload().ToString().c_str(),
+               request->GetSequenceNumber(),
+               uuid.ToString().c_str(),
+               CopilotSub(stream_id, sub_id).ToString().c_str());
+    }
   }
 
   if (recipients.empty()) {
@@ -80,7 +80,7 @@ class ControlRoom {
                           StreamID origin);
   void ProcessDeliver(Flow* flow,
                       const Message& msg,
-                      const std::vector<CopilotSub>& recipients);
+                      std::vector<CopilotSub> recipients);
   void ProcessGap(Flow* flow,
                   const Message& msg,
                   const std::vector<CopilotSub>& recipients);
@@ -5,12 +5,15 @@
 //
 
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
 #include <string>
 #include <vector>
 
+#include "src/controltower/data_cache.h"
 #include "src/controltower/log_tailer.h"
 #include "src/controltower/room.h"
+#include "src/controltower/topic_tailer.h"
 #include "src/controltower/tower.h"
 #include "src/port/port.h"
 #include "src/test/test_cluster.h"
@@ -37,6 +40,48 @@ class ControlTowerTest : public ::testing::Test {
     return
       ct->GetStatisticsSync().GetCounterValue("tower.log_tailer.open_logs");
   }
+
+  // Reader planning of the TopicTailer.
+  typedef TopicTailer::ReaderProgress ReaderProgress;
+  typedef TopicTailer::DistanceFunction DistanceFunction;
+  typedef std::vector<std::pair<size_t, size_t>> Merges;
+
+  static Merges PlanMerges(const std::vector<ReaderProgress>& readers,
+                           bool pending,
+                           const DistanceFunction& uncached_distance,
+                           SequenceNumber tail_seqno = 0) {
+    return TopicTailer::PlanMerges(readers, pending, tail_seqno,
+                                   uncached_distance);
+  }
+
+  static uint64_t CatchUpCost(SequenceNumber next_seqno,
+                              SequenceNumber seqno,
+                              double read_rate,
+                              const DistanceFunction& uncached_distance) {
+    return TopicTailer::CatchUpCost(next_seqno, seqno, read_rate,
+                                    uncached_distance);
+  }
+
+  static uint64_t UncachedDistance(const DataCache& data_cache,
+                                   LogID log_id,
+                                   SequenceNumber from,
+                                   SequenceNumber to) {
+    return TopicTailer::UncachedDistance(data_cache, log_id, from, to);
+  }
+
+  static size_t PlanPendingSteal(const std::vector<bool>& log_open) {
+    return TopicTailer::PlanPendingSteal(log_open);
+  }
+
+  // Distance function of a log that has [cached_from, cached_to) cached.
+  static DistanceFunction Cached(SequenceNumber cached_from,
+                                 SequenceNumber cached_to) {
+    return [=] (SequenceNumber from, SequenceNumber to) {
+      const SequenceNumber begin = std::max(from, cached_from);
+      const SequenceNumber end = std::min(to, cached_to);
+      return (to - from) - (begin < end ? end - begin : 0);
+    };
+  }
 };
 
 TEST_F(ControlTowerTest, Subscribe) {
@@ -176,6 +221,99 @@ TEST_F(ControlTowerTest, MultipleSubscribers) {
 }
 
 
+TEST_F(ControlTowerTest, PlanMerges) {
+  const DistanceFunction nothing_cached = Cached(0, 0);
+
+  // Records between the readers are in the cache, so the reader ahead is
+  // merged into the one behind.
+  ASSERT_EQ(PlanMerges({{100, 10}, {5000, 10}}, false, Cached(100, 5000)),
+            Merges({{1, 0}}));
+
+  // Not if they are read from the log again, unless subscriptions are
+  // waiting on the virtual reader.
+  ASSERT_EQ(PlanMerges({{100, 10}, {5000, 10}}, false, nothing_cached),
+            Merges());
+  ASSERT_EQ(PlanMerges({{100, 10}, {5000, 10}}, true, nothing_cached),
+            Merges({{1, 0}}));
+
+  // Not if the reader behind is about to catch up anyway.
+  ASSERT_EQ(PlanMerges({{100, 200}, {5000, 10}}, false, Cached(100, 5000)),
+            Merges());
+
+  // Not if a small part of a short gap is read from the log again.
+  ASSERT_EQ(PlanMerges({{100, 0}, {600, 0}}, false, Cached(100, 400)),
+            Merges());
+  ASSERT_EQ(PlanMerges({{100, 0}, {600, 0}}, false, Cached(100, 560)),
+            Merges({{1, 0}}));
+
+  // A merged reader is replaced by the one behind it, which may then take
+  // more readers.
+  ASSERT_EQ(PlanMerges({{100, 0}, {200, 0}, {900, 0}, {10000, 0}}, false,
+                       Cached(100, 10000)),
+            Merges({{1, 0}, {2, 0}, {3, 0}}));
+  ASSERT_EQ(PlanMerges({{100, 0}, {200, 0}, {900, 0}, {10000, 0}}, false,
+                       nothing_cached),
+            Merges());
+
+  // A reader at the tail is never merged into a reader behind it.
+  ASSERT_EQ(PlanMerges({{100, 10}, {5000, 10}}, false, Cached(100, 5000),
+                       5000),
+            Merges());
+  ASSERT_EQ(PlanMerges({{100, 10}, {5000, 10}}, true, nothing_cached, 5000),
+            Merges());
+  ASSERT_EQ(PlanMerges({{100, 0}, {3000, 0}, {4500, 0}}, true,
+                       nothing_cached, 4000),
+            Merges({{1, 0}}));
+
+  // The cheapest merge frees a reader for waiting subscriptions.
+  ASSERT_EQ(PlanMerges({{100, 0}, {3000, 0}, {4500, 0}}, true,
+                       nothing_cached),
+            Merges({{2, 1}}));
+
+  // A single reader has nothing to merge with.
+  ASSERT_EQ(PlanMerges({{100, 0}}, true, nothing_cached), Merges());
+}
+
+TEST_F(ControlTowerTest, CatchUpCost) {
+  // Records that are not cached are read again.
+  ASSERT_EQ(CatchUpCost(100, 600, 0, Cached(0, 0)), 501);
+  ASSERT_EQ(CatchUpCost(100, 600, 0, Cached(100, 400)), 201);
+  ASSERT_EQ(CatchUpCost(100, 600, 0, Cached(0, 1000)), 1);
+
+  // A reader that is too slow to get there costs as much as a new one.
+  ASSERT_EQ(CatchUpCost(100, 600, 1, Cached(0, 1000)), 1001);
+  ASSERT_EQ(CatchUpCost(100, 600, 20, Cached(0, 1000)), 1);
+}
+
+TEST_F(ControlTowerTest, UncachedDistance) {
+  DataCache cache(1024 * 1024, false, 0, 16);
+  const LogID logid = 1;
+  // Every other seqno of two and a half blocks.
+  for (SequenceNumber seqno = 2; seqno < 40; seqno += 2) {
+    const std::string payload = std::to_string(seqno);
+    MessageData data(MessageType::mDeliver, Tenant::GuestTenant, "topic",
+                     "dhruba", payload);
+    data.SetSequenceNumbers(seqno - 2, seqno);
+    std::unique_ptr<Message> copy = Message::Copy(data);
+    cache.StoreData("dhruba", "topic", logid,
+      std::unique_ptr<MessageData>(static_cast<MessageData*>(copy.release())));
+  }
+  ASSERT_EQ(UncachedDistance(cache, logid, 0, 16), 9);
+  ASSERT_EQ(UncachedDistance(cache, logid, 0, 100), 81);
+  ASSERT_EQ(UncachedDistance(cache, logid + 1, 0, 100), 100);
+
+  // Far away readers are assumed to find nothing in the cache.
+  const SequenceNumber far = 1 << 21;
+  ASSERT_EQ(UncachedDistance(cache, logid, 0, far), far);
+}
+
+TEST_F(ControlTowerTest, PlanPendingSteal) {
+  // Waiting subscriptions go to the first reader not reading their log.
+  ASSERT_EQ(PlanPendingSteal({true, false, false}), 1);
+  ASSERT_EQ(PlanPendingSteal({false, true}), 0);
+  ASSERT_EQ(PlanPendingSteal({true, true}), 2);
+}
+
 TEST_F(ControlTowerTest, NoLogger) {
   // Create cluster with tower only (only need this for the log storage).
   LocalTestCluster cluster(info_log_, true, false, false);
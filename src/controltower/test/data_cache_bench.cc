@@ -0,0 +1,111 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/controltower/data_cache.h"
+#include "src/controltower/hash_scan.h"
+
+#include <gflags/gflags.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+DEFINE_uint64(block_size, 1024, "number of records in a cache block");
+DEFINE_uint64(blocks, 1024, "number of cache blocks to fill");
+DEFINE_uint64(topics, 10000, "number of distinct topics in the log");
+DEFINE_uint64(iterations, 100, "number of scans over the cache");
+
+namespace rocketspeed {
+
+namespace {
+
+/** Runs fn iterations times and returns records scanned per second. */
+template <typename Fn>
+double RecordsPerSecond(size_t records, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < FLAGS_iterations; ++i) {
+    fn();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return static_cast<double>(records * FLAGS_iterations) / elapsed.count();
+}
+
+/** Scans hashes as VisitEntry does for a topic that is never found. */
+void BenchHashScan(const char* name, HashScanFunction scan) {
+  const size_t block_size = FLAGS_block_size;
+  std::mt19937 rng(42);
+  std::vector<uint16_t> hashes(block_size * FLAGS_blocks);
+  for (auto& hash : hashes) {
+    hash = static_cast<uint16_t>(rng() % 0xFFFE + 2);
+  }
+  size_t found = 0;
+  double rate = RecordsPerSecond(hashes.size(), [&] () {
+    for (size_t block = 0; block < FLAGS_blocks; ++block) {
+      const uint16_t* begin = hashes.data() + block * block_size;
+      found += scan(begin, 0, block_size, 1) != block_size;
+    }
+  });
+  printf("%-20s %15.0f records/s (%zu found)\n", name, rate, found);
+}
+
+/** Visits the whole cache looking for a single sparse topic. */
+void BenchVisitCache() {
+  const size_t records = FLAGS_block_size * FLAGS_blocks;
+  DataCache cache(records * 1024, true, 0, FLAGS_block_size);
+  const LogID log_id = 1;
+  const std::string ns = "guest";
+  std::vector<std::string> topics;
+  for (uint64_t i = 0; i < FLAGS_topics; ++i) {
+    topics.push_back("topic" + std::to_string(i));
+  }
+  std::mt19937 rng(42);
+  for (SequenceNumber seqno = 1; seqno <= records; ++seqno) {
+    const std::string& topic = topics[rng() % topics.size()];
+    MessageData data(MessageType::mDeliver,
+                     Tenant::GuestTenant,
+                     topic,
+                     ns,
+                     "payload");
+    data.SetSequenceNumbers(seqno - 1, seqno);
+    std::unique_ptr<Message> copy = Message::Copy(data);
+    cache.StoreData(ns, topic, log_id,
+      std::unique_ptr<MessageData>(static_cast<MessageData*>(copy.release())));
+  }
+
+  size_t visited = 0;
+  double rate = RecordsPerSecond(records, [&] () {
+    cache.VisitCache(log_id, 1, topics[0],
+      [&] (MessageData*, bool* processed) {
+        ++visited;
+        *processed = true;
+        return true;
+      });
+  });
+  printf("%-20s %15.0f records/s (%zu visited)\n", "VisitCache", rate,
+         visited);
+}
+
+}  // namespace
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  GFLAGS::ParseCommandLineFlags(&argc, &argv, true);
+  using namespace rocketspeed;
+
+  BenchHashScan("HashScanScalar", &HashScanScalar);
+#ifdef ROCKETSPEED_HASH_SCAN_X86
+  BenchHashScan("HashScanSSE2", &HashScanSSE2);
+  if (__builtin_cpu_supports("avx2")) {
+    BenchHashScan("HashScanAVX2", &HashScanAVX2);
+  }
+#endif
+  BenchVisitCache();
+  return 0;
+}
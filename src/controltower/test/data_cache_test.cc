@@ -12,6 +12,23 @@
 namespace rocketspeed {
 
 class DataCacheTest : public ::testing::Test {
+ protected:
+  // Stores a copy of a record on topic, with its seqno as the payload.
+  static void StoreRecord(DataCache* cache,
+                          LogID logid,
+                          Slice topic,
+                          SequenceNumber prev_seqno,
+                          SequenceNumber seqno,
+                          bool tail = false) {
+    const std::string payload = std::to_string(seqno);
+    MessageData data(MessageType::mDeliver, Tenant::GuestTenant, topic,
+                     "dhruba", payload);
+    data.SetSequenceNumbers(prev_seqno, seqno);
+    std::unique_ptr<Message> copy = Message::Copy(data);
+    cache->StoreData("dhruba", topic, logid,
+      std::unique_ptr<MessageData>(static_cast<MessageData*>(copy.release())),
+      tail);
+  }
 };
 
 // Check that data_cache is sane
@@ -224,6 +241,300 @@ TEST_F(DataCacheTest, CheckBloom) {
   ASSERT_EQ(cache.stats_.bloom_falsepositives->Get(), 0);
 }
 
+// Check that visited records may outlive the cache
+TEST_F(DataCacheTest, PayloadOwner) {
+  DataCache cache(1024 * 1024, false, 0, 16);
+  Slice topic("topic");
+  const LogID logid = 1;
+  for (SequenceNumber seqno = 1; seqno <= 100; ++seqno) {
+    StoreRecord(&cache, logid, topic, seqno - 1, seqno);
+  }
+
+  std::vector<std::pair<Slice, std::shared_ptr<const void>>> payloads;
+  SequenceNumber next = cache.VisitCache(logid, 1, topic,
+    [&] (MessageData* data_raw, bool* processed) {
+      EXPECT_EQ(data_raw->GetSequenceNumber(), payloads.size() + 1);
+      payloads.emplace_back(data_raw->GetPayload(),
+                            data_raw->GetPayloadOwner());
+      *processed = true;
+      return true;
+    });
+  ASSERT_EQ(next, 101);
+  ASSERT_EQ(payloads.size(), 100);
+
+  // Payloads remain valid after the cache has been emptied.
+  cache.ClearCache();
+  for (size_t i = 0; i < payloads.size(); ++i) {
+    ASSERT_TRUE(payloads[i].second != nullptr);
+    ASSERT_EQ(payloads[i].first.ToString(), std::to_string(i + 1));
+  }
+}
+
+// Check that records in a range are counted across blocks
+TEST_F(DataCacheTest, CountEntries) {
+  DataCache cache(1024 * 1024, false, 0, 16);
+  Slice topic("topic");
+  const LogID logid = 1;
+  // Every other seqno of two and a half blocks.
+  for (SequenceNumber seqno = 2; seqno < 40; seqno += 2) {
+    StoreRecord(&cache, logid, topic, seqno - 2, seqno);
+  }
+  ASSERT_EQ(cache.CountEntries(logid, 0, 16), 7);
+  ASSERT_EQ(cache.CountEntries(logid, 16, 32), 8);
+  ASSERT_EQ(cache.CountEntries(logid, 3, 37), 17);
+  ASSERT_EQ(cache.CountEntries(logid, 40, 100), 0);
+  ASSERT_EQ(cache.CountEntries(logid + 1, 0, 100), 0);
+  ASSERT_EQ(cache.CountEntries(logid, 10, 10), 0);
+}
+
+// Check that rooms sharing a cache share capacity but not statistics
+TEST_F(DataCacheTest, Shared) {
+  auto shared = NewDataCache(1024 * 1024, 4, false);
+  DataCache room0(shared, 0, false, 10, 16);
+  DataCache room1(shared, 1, false, 10, 16);
+  ASSERT_TRUE(room0.IsShared());
+  ASSERT_EQ(room0.GetCapacity(), 1024 * 1024);
+  ASSERT_EQ(room1.GetCapacity(), 1024 * 1024);
+
+  Slice topic("topic");
+  for (SequenceNumber seqno = 1; seqno <= 100; ++seqno) {
+    StoreRecord(&room0, 1, topic, seqno - 1, seqno);
+  }
+  ASSERT_GT(room0.GetUsage(), 0);
+  ASSERT_EQ(room0.GetUsage(), room1.GetUsage());
+
+  // Records stored by one room are visible in the other.
+  auto visit = [] (MessageData* data_raw, bool* processed) {
+    *processed = true;
+    return true;
+  };
+  ASSERT_EQ(room1.VisitCache(1, 1, topic, visit), 101);
+  ASSERT_EQ(room1.VisitCache(2, 1, topic, visit), 1);
+  ASSERT_EQ(room0.stats_.cache_hits->Get(), 0);
+  ASSERT_EQ(room1.stats_.cache_hits->Get(), 100);
+  ASSERT_EQ(room1.stats_.room_cache_hits->Get(), 100);
+  ASSERT_EQ(room1.stats_.room_cache_misses->Get(), 1);
+  ASSERT_EQ(room1.GetStatistics().GetCounterValue(
+    "tower.data_cache.room1.cache_hits"), 100);
+
+  // Capacity and clearing apply to all rooms.
+  room1.SetCapacity(2 * 1024 * 1024);
+  ASSERT_EQ(room0.GetCapacity(), 2 * 1024 * 1024);
+  room1.ClearCache();
+  ASSERT_EQ(room0.GetUsage(), 0);
+  ASSERT_EQ(room0.VisitCache(1, 1, topic, visit), 1);
+
+  // Shared cache with no capacity is disabled.
+  room0.SetCapacity(0);
+  ASSERT_EQ(room1.GetCapacity(), 0);
+  StoreRecord(&room1, 1, topic, 0, 1);
+  ASSERT_EQ(room0.GetUsage(), 0);
+}
+
+// Check that a scan of cold blocks does not evict blocks that are looked up
+TEST_F(DataCacheTest, Admission) {
+  Slice topic("topic");
+  auto visit = [] (MessageData* data_raw, bool* processed) {
+    *processed = true;
+    return true;
+  };
+
+  for (bool admission_filter : {false, true}) {
+    DataCache cache(1024 * 1024, false, 0, 16, admission_filter);
+
+    // Ten hot blocks, looked up several times.
+    for (SequenceNumber seqno = 16; seqno < 176; ++seqno) {
+      StoreRecord(&cache, 1, topic, seqno - 1, seqno);
+    }
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_EQ(cache.VisitCache(1, 16, topic, visit), 176);
+    }
+
+    // A long scan of blocks that are never looked up.
+    for (SequenceNumber seqno = 1; seqno <= 16 * 400; ++seqno) {
+      StoreRecord(&cache, 2, topic, seqno - 1, seqno);
+    }
+    ASSERT_LE(cache.GetUsage(), cache.GetCapacity());
+
+    if (admission_filter) {
+      // Hot blocks survived the scan.
+      ASSERT_EQ(cache.VisitCache(1, 16, topic, visit), 176);
+      ASSERT_GT(cache.stats_.admission_rejects->Get(), 0);
+    } else {
+      // Hot blocks were evicted by the scan.
+      ASSERT_EQ(cache.VisitCache(1, 16, topic, visit), 16);
+      ASSERT_EQ(cache.stats_.admission_rejects->Get(), 0);
+    }
+    ASSERT_GT(cache.stats_.admission_accepts->Get(), 10);
+    ASSERT_EQ(cache.stats_.block_hits->Get(), admission_filter ? 40 : 30);
+  }
+}
+
+// Check that a full cache with admission filter keeps caching the tail
+TEST_F(DataCacheTest, AdmissionTail) {
+  Slice topic("topic");
+  auto visit = [] (MessageData* data_raw, bool* processed) {
+    *processed = true;
+    return true;
+  };
+  DataCache cache(1024 * 1024, false, 0, 16, true);
+
+  // Fill the cache with blocks that are looked up several times.
+  for (SequenceNumber seqno = 1; seqno <= 16 * 400; seqno += 16) {
+    for (SequenceNumber i = seqno; i < seqno + 16; ++i) {
+      StoreRecord(&cache, 1, topic, i - 1, i);
+    }
+    for (int i = 0; i < 3; ++i) {
+      cache.VisitCache(1, seqno, topic, visit);
+    }
+  }
+  ASSERT_LE(cache.GetUsage(), cache.GetCapacity());
+  ASSERT_GT(cache.stats_.admission_rejects->Get(), 0);
+
+  // New blocks at the tail of another log are cached all the same.
+  const auto rejects = cache.stats_.admission_rejects->Get();
+  for (SequenceNumber seqno = 1; seqno <= 16 * 10; seqno += 16) {
+    for (SequenceNumber i = seqno; i < seqno + 16; ++i) {
+      StoreRecord(&cache, 2, topic, i - 1, i, true);
+      ASSERT_TRUE(cache.HasEntry(2, i));
+    }
+  }
+  ASSERT_EQ(cache.stats_.admission_rejects->Get(), rejects);
+
+  // A block read behind the tail is refused, and admission runs once for it.
+  for (SequenceNumber seqno = 1; seqno <= 16; ++seqno) {
+    StoreRecord(&cache, 3, topic, seqno - 1, seqno);
+  }
+  ASSERT_TRUE(!cache.HasEntry(3, 1));
+  ASSERT_EQ(cache.stats_.admission_rejects->Get(), rejects + 1);
+}
+
+// Check that blocks evicted from memory are read back from the spill tier
+TEST_F(DataCacheTest, Spill) {
+  std::shared_ptr<DataCacheSpill> spill;
+  ASSERT_OK(DataCacheSpill::Open(Env::Default(),
+                                 test::TmpDir() + "/data_cache_spill",
+                                 1024 * 1024, 256 * 1024, &spill));
+
+  // Holds only a few blocks in memory.
+  DataCache cache(16 * 1024, false, 10, 16);
+  cache.SetSpill(spill);
+  Slice topic("topic");
+  const LogID logid = 1;
+  for (SequenceNumber seqno = 1; seqno <= 160; ++seqno) {
+    StoreRecord(&cache, logid, topic, seqno - 1, seqno);
+  }
+  ASSERT_LE(cache.GetUsage(), cache.GetCapacity());
+  ASSERT_GT(spill->GetUsage(), 0);
+  ASSERT_TRUE(cache.HasEntry(logid, 1));
+
+  std::vector<std::pair<Slice, std::shared_ptr<const void>>> payloads;
+  SequenceNumber next = cache.VisitCache(logid, 1, topic,
+    [&] (MessageData* data_raw, bool* processed) {
+      EXPECT_EQ(data_raw->GetSequenceNumber(), payloads.size() + 1);
+      payloads.emplace_back(data_raw->GetPayload(),
+                            data_raw->GetPayloadOwner());
+      *processed = true;
+      return true;
+    });
+  ASSERT_EQ(next, 161);
+  ASSERT_EQ(payloads.size(), 160);
+  ASSERT_GT(cache.stats_.spill_block_hits->Get(), 0);
+
+  // Bloom filters of spilled blocks are used too.
+  auto skip = [] (MessageData* data_raw, bool* processed) { return true; };
+  ASSERT_EQ(cache.VisitCache(logid, 1, "other", skip), 161);
+  ASSERT_GT(cache.stats_.bloom_hits->Get(), 0);
+
+  // Erased records are not read back, the rest of their block is.
+  cache.Erase(logid, GapType::kBenign, 1);
+  ASSERT_TRUE(!cache.HasEntry(logid, 1));
+  ASSERT_TRUE(cache.HasEntry(logid, 2));
+  ASSERT_EQ(cache.VisitCache(logid, 2, topic, skip), 161);
+
+  // Payloads remain valid after the tiers have been emptied.
+  cache.ClearCache();
+  ASSERT_EQ(spill->GetUsage(), 0);
+  ASSERT_EQ(cache.VisitCache(logid, 1, topic, skip), 1);
+  for (size_t i = 0; i < payloads.size(); ++i) {
+    ASSERT_EQ(payloads[i].first.ToString(), std::to_string(i + 1));
+  }
+}
+
+// Check that clearing a cache keeps blocks that other caches spilled
+TEST_F(DataCacheTest, SpillClearScoped) {
+  std::shared_ptr<DataCacheSpill> spill;
+  ASSERT_OK(DataCacheSpill::Open(Env::Default(),
+                                 test::TmpDir() + "/data_cache_spill_scoped",
+                                 1024 * 1024, 256 * 1024, &spill));
+
+  // Two rooms with private caches, each holding only a few blocks.
+  DataCache room0(16 * 1024, false, 10, 16);
+  DataCache room1(16 * 1024, false, 10, 16);
+  room0.SetSpill(spill);
+  room1.SetSpill(spill);
+  Slice topic("topic");
+  for (SequenceNumber seqno = 1; seqno <= 160; ++seqno) {
+    StoreRecord(&room0, 1, topic, seqno - 1, seqno);
+    StoreRecord(&room1, 2, topic, seqno - 1, seqno);
+  }
+  auto visit = [] (MessageData* data_raw, bool* processed) {
+    *processed = true;
+    return true;
+  };
+
+  // Blocks spilled by room1 survive clearing room0.
+  room0.ClearCache();
+  ASSERT_GT(spill->GetUsage(), 0);
+  ASSERT_EQ(room0.VisitCache(1, 1, topic, visit), 1);
+  ASSERT_EQ(room1.VisitCache(2, 1, topic, visit), 161);
+  ASSERT_GT(room1.stats_.spill_block_hits->Get(), 0);
+
+  // Disabling room1 drops its blocks too, leaving nothing to read.
+  room1.SetCapacity(0);
+  ASSERT_EQ(spill->GetUsage(), 0);
+
+  // room0 spills again after it was cleared.
+  for (SequenceNumber seqno = 1; seqno <= 160; ++seqno) {
+    StoreRecord(&room0, 1, topic, seqno - 1, seqno);
+  }
+  ASSERT_GT(spill->GetUsage(), 0);
+  ASSERT_EQ(room0.VisitCache(1, 1, topic, visit), 161);
+}
+
+// Check that all hash scan implementations agree
+TEST_F(DataCacheTest, HashScan) {
+  std::vector<HashScanFunction> scans = { &HashScanScalar };
+#ifdef ROCKETSPEED_HASH_SCAN_X86
+  scans.push_back(&HashScanSSE2);
+  if (__builtin_cpu_supports("avx2")) {
+    scans.push_back(&HashScanAVX2);
+  }
+#endif
+  scans.push_back(GetHashScanFunction());
+
+  std::mt19937 rng(42);
+  const size_t block_size = 1024;
+  std::vector<uint16_t> hashes(block_size);
+  for (int iteration = 0; iteration < 1000; ++iteration) {
+    // Few distinct hashes, so that some of them match.
+    for (auto& hash : hashes) {
+      hash = static_cast<uint16_t>(rng() % 64 + 1);
+    }
+    if (iteration % 2) {
+      // Missing record somewhere in the block.
+      hashes[rng() % block_size] = 0;
+    }
+    const uint16_t hash = static_cast<uint16_t>(rng() % 1024 + 1);
+    const size_t begin = rng() % block_size;
+    const size_t end = begin + rng() % (block_size - begin + 1);
+    const size_t expected = HashScanScalar(hashes.data(), begin, end, hash);
+    for (HashScanFunction scan : scans) {
+      ASSERT_EQ(expected, scan(hashes.data(), begin, end, hash));
+    }
+  }
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
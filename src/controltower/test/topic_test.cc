@@ -0,0 +1,103 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/controltower/topic.h"
+#include "src/util/testharness.h"
+
+#include <map>
+#include <random>
+
+namespace rocketspeed {
+
+class TopicManagerTest : public ::testing::Test {
+};
+
+// Check that subscriptions are visited correctly, in both representations
+// of the subscriptions of a topic
+TEST_F(TopicManagerTest, VisitSubscribers) {
+  TopicManager manager;
+  const TopicHandle topic = 1;
+  std::map<SubscriptionID, SequenceNumber> expected;
+  std::mt19937 rng(42);
+
+  auto check = [&] (SequenceNumber from, SequenceNumber to) {
+    std::map<SubscriptionID, SequenceNumber> visited;
+    manager.VisitSubscribers(topic, from, to,
+      [&] (TopicSubscription* sub) {
+        EXPECT_TRUE(visited.emplace(sub->GetID().sub_id,
+                                    sub->GetSequenceNumber()).second);
+        // Advance, like a delivered record does.
+        sub->SetSequenceNumber(to + 1);
+      });
+    for (auto& entry : expected) {
+      if (entry.second >= from && entry.second <= to) {
+        ASSERT_EQ(visited[entry.first], entry.second);
+        visited.erase(entry.first);
+        entry.second = to + 1;
+      }
+    }
+    ASSERT_TRUE(visited.empty());
+  };
+
+  // Grow above the bucketing threshold, then shrink below it.
+  const size_t max_subs = 4 * TopicList::kMaxLinearSubscriptions;
+  for (int phase = 0; phase < 2; ++phase) {
+    for (size_t i = 0; i < 20 * max_subs; ++i) {
+      const SubscriptionID sub_id = SubscriptionID::Unsafe(rng() % max_subs);
+      const bool grow = phase == 0 ? rng() % 4 != 0 : rng() % 4 == 0;
+      if (grow) {
+        const SequenceNumber seqno = 1 + rng() % 100;
+        const bool added = manager.AddSubscriber(topic, seqno,
+                                                 CopilotSub(1, sub_id));
+        ASSERT_EQ(added, expected.find(sub_id) == expected.end());
+        expected[sub_id] = seqno;
+      } else {
+        const bool all_removed =
+          manager.RemoveSubscriber(topic, CopilotSub(1, sub_id));
+        expected.erase(sub_id);
+        ASSERT_EQ(all_removed, expected.empty());
+      }
+      const SequenceNumber from = rng() % 110;
+      check(from, from + rng() % 10);
+    }
+  }
+  check(0, 1000);
+}
+
+// Check that a large topic switches to seqno buckets and back
+TEST_F(TopicManagerTest, Bucketing) {
+  TopicList list;
+  const size_t n = TopicList::kMaxLinearSubscriptions + 1;
+  for (size_t i = 0; i < n; ++i) {
+    ASSERT_TRUE(list.Update(CopilotSub(1, SubscriptionID::Unsafe(i)), 10));
+    ASSERT_EQ(list.IsBucketed(), i + 1 > TopicList::kMaxLinearSubscriptions);
+  }
+
+  // Only subscriptions in range are visited.
+  ASSERT_TRUE(!list.Update(CopilotSub(1, SubscriptionID::Unsafe(0)), 20));
+  size_t visited = 0;
+  list.Visit(20, 30, [&] (TopicSubscription* sub) { visited++; });
+  ASSERT_EQ(visited, 1);
+  list.Visit(10, 10, [&] (TopicSubscription* sub) {
+    visited++;
+    sub->SetSequenceNumber(11);
+  });
+  ASSERT_EQ(visited, n);
+  list.Visit(11, 11, [&] (TopicSubscription* sub) { visited++; });
+  ASSERT_EQ(visited, 2 * n - 1);
+
+  for (size_t i = 0; i < n; ++i) {
+    ASSERT_EQ(list.Remove(CopilotSub(1, SubscriptionID::Unsafe(i))),
+              i + 1 == n);
+    ASSERT_EQ(list.IsBucketed(),
+              n - i - 1 >= TopicList::kMinBucketedSubscriptions);
+  }
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests(argc, argv);
+}
@@ -5,56 +5,127 @@
 //
 #include "src/controltower/topic.h"
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 
 namespace rocketspeed {
 
-/// @return true iff new subscription was inserted.
-static bool UpdateSubscription(TopicList& list,
-                               CopilotSub id,
-                               SequenceNumber seqno) {
-  for (TopicSubscription& sub : list) {
-    if (sub.GetID() == id) {
-      sub.SetSequenceNumber(seqno);
-      return false;
+constexpr size_t TopicList::kMaxLinearSubscriptions;
+constexpr size_t TopicList::kMinBucketedSubscriptions;
+
+bool TopicList::Update(CopilotSub id, SequenceNumber seqno) {
+  if (!buckets_) {
+    for (TopicSubscription& sub : linear_) {
+      if (sub.GetID() == id) {
+        sub.SetSequenceNumber(seqno);
+        return false;
+      }
+    }
+    linear_.emplace_back(id, seqno);
+    if (linear_.size() > kMaxLinearSubscriptions) {
+      ConvertToBuckets();
     }
+    return true;
   }
-  list.emplace_back(id, seqno);
-  return true;
+
+  auto it = buckets_->positions.find(id);
+  if (it == buckets_->positions.end()) {
+    AddToBucket(id, seqno);
+    return true;
+  }
+  if (it->second.seqno != seqno) {
+    RemoveFromBucket(it->second);
+    buckets_->positions.erase(it);
+    AddToBucket(id, seqno);
+  }
+  return false;
+}
+
+bool TopicList::Remove(CopilotSub id) {
+  if (!buckets_) {
+    for (auto it = linear_.begin(); it != linear_.end(); ++it) {
+      if (it->GetID() == id) {
+        linear_.erase(it);
+        break;
+      }
+    }
+    return linear_.empty();
+  }
+
+  auto it = buckets_->positions.find(id);
+  if (it != buckets_->positions.end()) {
+    RemoveFromBucket(it->second);
+    buckets_->positions.erase(it);
+    if (buckets_->positions.size() < kMinBucketedSubscriptions) {
+      ConvertToLinear();
+    }
+  }
+  return empty();
+}
+
+void TopicList::AddToBucket(CopilotSub id, SequenceNumber seqno) {
+  std::vector<CopilotSub>& bucket = buckets_->by_seqno[seqno];
+  buckets_->positions.emplace(id, Position{seqno, bucket.size()});
+  bucket.push_back(id);
+}
+
+void TopicList::RemoveFromBucket(const Position& position) {
+  auto bucket_it = buckets_->by_seqno.find(position.seqno);
+  RS_ASSERT(bucket_it != buckets_->by_seqno.end());
+  std::vector<CopilotSub>& bucket = bucket_it->second;
+  RS_ASSERT(position.index < bucket.size());
+  // Order within a bucket does not matter, the last subscription takes the
+  // place of the removed one.
+  if (position.index + 1 != bucket.size()) {
+    bucket[position.index] = bucket.back();
+    buckets_->positions[bucket.back()].index = position.index;
+  }
+  bucket.pop_back();
+  if (bucket.empty()) {
+    buckets_->by_seqno.erase(bucket_it);
+  }
+}
+
+void TopicList::ConvertToBuckets() {
+  RS_ASSERT(!buckets_);
+  buckets_.reset(new Buckets());
+  for (const TopicSubscription& sub : linear_) {
+    AddToBucket(sub.GetID(), sub.GetSequenceNumber());
+  }
+  linear_.clear();
 }
 
-/// @return true iff no more subscriptions on this topic.
-static bool RemoveSubscription(TopicList& list,
-                               CopilotSub id) {
-  for (auto it = list.begin(); it != list.end(); ++it) {
-    if (it->GetID() == id) {
-      list.erase(it);
-      break;
+void TopicList::ConvertToLinear() {
+  RS_ASSERT(buckets_);
+  RS_ASSERT(linear_.empty());
+  for (const auto& bucket : buckets_->by_seqno) {
+    for (const CopilotSub& id : bucket.second) {
+      linear_.emplace_back(id, bucket.first);
     }
   }
-  return list.empty();
+  buckets_.reset();
 }
 
 // Add a new subscriber to the topic. The name of the topic and the
 // start sequence number from where to start the subscription is
 // specified by the caller.
 bool
-TopicManager::AddSubscriber(const TopicUUID& topic,
+TopicManager::AddSubscriber(TopicHandle topic,
                             SequenceNumber start,
                             CopilotSub subscriber) {
   thread_check_.Check();
-  return UpdateSubscription(topic_map_[topic], subscriber, start);
+  return topic_map_[topic].Update(subscriber, start);
 }
 
 // remove a subscriber to the topic
 bool
-TopicManager::RemoveSubscriber(const TopicUUID& topic, CopilotSub subscriber) {
+TopicManager::RemoveSubscriber(TopicHandle topic, CopilotSub subscriber) {
   thread_check_.Check();
   // find list of subscribers for this topic
   auto iter = topic_map_.find(topic);
   if (iter != topic_map_.end()) {
-    bool all_removed = RemoveSubscription(iter->second, subscriber);
+    bool all_removed = iter->second.Remove(subscriber);
     if (all_removed) {
       RS_ASSERT(iter->second.empty());
       topic_map_.erase(iter);
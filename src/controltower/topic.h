@@ -4,11 +4,13 @@
 // of patent rights can be found in the PATENTS file in the same directory.
 #pragma once
 
+#include <map>
+#include <memory>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
 #include "include/Types.h"
-#include "src/util/topic_uuid.h"
+#include "src/util/topic_table.h"
 #include "src/util/common/autovector.h"
 #include "src/util/common/thread_check.h"
 #include "src/controltower/tower.h"
@@ -42,17 +44,85 @@ class TopicSubscription {
 // Set of subscriptions for a topic.
 //
 // The vast majority of the time, a particular topic will only have one
-// subscriber. In the worst case, the number of subscribers will be the
-// number of copilots, which will be on the order of 100s or maybe 1000s.
-// In the worst case, the number of messages being fanned out to those
-// subscribers will likely be low, so we can manage the linear search.
-// Memory usage is more important in general.
-typedef autovector<TopicSubscription, 1> TopicList;
+// subscriber, so subscriptions are kept in a small vector and searched
+// linearly. Memory usage is more important in general.
+//
+// Hot topics may be subscribed by most copilots, which is on the order of
+// 1000s of subscriptions. Such topics switch to subscriptions bucketed by
+// next expected seqno, so that visiting a range of sequence numbers costs
+// in proportion to the subscriptions in the range, rather than to all.
+class TopicList {
+ public:
+  // Number of subscriptions above which subscriptions are bucketed.
+  static constexpr size_t kMaxLinearSubscriptions = 64;
+
+  // Number of subscriptions below which bucketed subscriptions go back to
+  // the small vector. Lower than kMaxLinearSubscriptions, so that a topic
+  // does not switch back and forth.
+  static constexpr size_t kMinBucketedSubscriptions = 16;
+
+  TopicList() {}
+
+  // Adds a subscription or updates its next expected seqno.
+  // Returns true iff the subscription is new.
+  bool Update(CopilotSub id, SequenceNumber seqno);
+
+  // Removes a subscription, if present.
+  // Returns true iff no subscriptions are left.
+  bool Remove(CopilotSub id);
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  size_t size() const {
+    return buckets_ ? buckets_->positions.size() : linear_.size();
+  }
+
+  // Are subscriptions bucketed by seqno?
+  bool IsBucketed() const {
+    return buckets_ != nullptr;
+  }
+
+  // Visits subscriptions with next expected seqno in [from, to].
+  // The visitor may change the seqno of visited subscriptions.
+  template <typename Visitor>
+  void Visit(SequenceNumber from,
+             SequenceNumber to,
+             const Visitor& visitor);
+
+ private:
+  // Bucket of a subscription, and its index in the bucket.
+  struct Position {
+    SequenceNumber seqno;
+    size_t index;
+  };
+
+  struct Buckets {
+    // Subscriptions by next expected seqno.
+    std::map<SequenceNumber, std::vector<CopilotSub>> by_seqno;
+    // Position of each subscription.
+    std::unordered_map<CopilotSub, Position> positions;
+  };
+
+  // Adds a subscription that is not bucketed yet.
+  void AddToBucket(CopilotSub id, SequenceNumber seqno);
+
+  // Removes a subscription from its bucket, leaving its position stale.
+  void RemoveFromBucket(const Position& position);
+
+  // Switches between the representations.
+  void ConvertToBuckets();
+  void ConvertToLinear();
+
+  autovector<TopicSubscription, 1> linear_;  // unless bucketed
+  std::unique_ptr<Buckets> buckets_;         // null unless bucketed
+};
 
 //
 // The Topic Manager maintains information between topics
-// and its subscribers. The topic name is actually
-// the NamespaceId concatenated with the user-specified topic name.
+// and its subscribers. Topics are identified by their handles in the
+// TopicTable of the worker.
 //
 class TopicManager {
  public:
@@ -64,7 +134,7 @@ class TopicManager {
    *
    * @return true iff new subscriber.
    */
-  bool AddSubscriber(const TopicUUID& topic,
+  bool AddSubscriber(TopicHandle topic,
                      SequenceNumber start,
                      CopilotSub subscriber);
 
@@ -73,7 +143,7 @@ class TopicManager {
    *
    * @return true iff no subscribers left on this topic.
    */
-  bool RemoveSubscriber(const TopicUUID& topic,
+  bool RemoveSubscriber(TopicHandle topic,
                         CopilotSub subscriber);
 
   /**
@@ -82,13 +152,13 @@ class TopicManager {
    * number is not less than 'from', and not greater than 'to'. The visitation
    * order is unspecified.
    *
-   * @param topic Topic UUID.
+   * @param topic Topic handle.
    * @param from Lower threshold of subscriptions.
    * @param to Upper threshold of subscriptions.
    * @param visitor Visiting function for subscriptions. Mutation is allowed.
    */
   template <typename Visitor>
-  void VisitSubscribers(const TopicUUID& topic,
+  void VisitSubscribers(TopicHandle topic,
                         SequenceNumber from,
                         SequenceNumber to,
                         const Visitor& visitor);
@@ -103,24 +173,69 @@ class TopicManager {
 
  private:
   // Map a topic name to a list of TopicEntries.
-  std::unordered_map<TopicUUID, TopicList> topic_map_;
+  std::unordered_map<TopicHandle, TopicList> topic_map_;
   ThreadCheck thread_check_;
 };
 
+template <typename Visitor>
+void TopicList::Visit(SequenceNumber from,
+                      SequenceNumber to,
+                      const Visitor& visitor) {
+  if (!buckets_) {
+    for (TopicSubscription& sub : linear_) {
+      if (sub.GetSequenceNumber() >= from && sub.GetSequenceNumber() <= to) {
+        visitor(&sub);
+      }
+    }
+    return;
+  }
+
+  auto& by_seqno = buckets_->by_seqno;
+  auto first = by_seqno.lower_bound(from);
+  auto last = by_seqno.upper_bound(to);
+  if (first == last) {
+    return;
+  }
+  // Detach the buckets in range first, so that subscriptions moved by the
+  // visitor are not visited twice.
+  autovector<std::pair<SequenceNumber, std::vector<CopilotSub>>, 1> matched;
+  for (auto it = first; it != last; ++it) {
+    matched.emplace_back(it->first, std::move(it->second));
+  }
+  by_seqno.erase(first, last);
+
+  // Visitors usually advance all subscriptions to the same seqno, so the
+  // destination bucket is remembered.
+  std::vector<CopilotSub>* dest = nullptr;
+  SequenceNumber dest_seqno = 0;
+  for (auto& bucket : matched) {
+    for (const CopilotSub& id : bucket.second) {
+      TopicSubscription sub(id, bucket.first);
+      visitor(&sub);
+      RS_ASSERT(sub.GetID() == id);
+      const SequenceNumber seqno = sub.GetSequenceNumber();
+      if (!dest || dest_seqno != seqno) {
+        dest = &by_seqno[seqno];
+        dest_seqno = seqno;
+      }
+      Position& position = buckets_->positions[id];
+      position.seqno = seqno;
+      position.index = dest->size();
+      dest->push_back(id);
+    }
+  }
+}
+
 template <typename Visitor>
 void TopicManager::VisitSubscribers(
-    const TopicUUID& topic,
+    TopicHandle topic,
     SequenceNumber from,
     SequenceNumber to,
     const Visitor& visitor) {
   thread_check_.Check();
   auto iter = topic_map_.find(topic);
   if (iter != topic_map_.end()) {
-    for (TopicSubscription& sub : iter->second) {
-      if (sub.GetSequenceNumber() >= from && sub.GetSequenceNumber() <= to) {
-        visitor(&sub);
-      }
-    }
+    iter->second.Visit(from, to, visitor);
   }
 }
 
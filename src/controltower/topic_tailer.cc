@@ -6,8 +6,11 @@
 #define __STDC_FORMAT_MACROS
 #include "src/controltower/topic_tailer.h"
 
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <inttypes.h>
 
@@ -40,8 +43,33 @@ enum : uint64_t {
    * it would be better for the reader at 100 to take on the subscription than
    * to start a new reader. The break-even point where a new reader is
    * preferable is when the old reader is kSubscriptionCostStart behind.
+   * Records that the old reader would find in the cache are not counted.
    */
-  kSubscriptionCostStart = 1000
+  kSubscriptionCostStart = 1000,
+
+  /**
+   * Readers further behind than this are assumed to find nothing in the
+   * cache, bounding the cache lookups made to cost a subscription or merge.
+   */
+  kMaxCachePlanningDistance = 1 << 20,
+
+  /**
+   * A reader that is projected to take longer than this many ticks to reach
+   * a sequence number is charged as much as starting a new reader there.
+   */
+  kMaxCatchUpTicks = 50,
+
+  /**
+   * Readers are only merged when at least this percentage of the records in
+   * between is in the cache, unless subscriptions are waiting for a reader.
+   */
+  kMinMergeCachedPercent = 90,
+
+  /**
+   * Merges of the readers of a log are planned every this many ticks, as
+   * costing them probes the cache for every block in between.
+   */
+  kPlanMergesTicks = 10,
 };
 
 /**
@@ -53,16 +81,19 @@ class LogReader {
    * Create a LogReader.
    *
    * @param info_log Logger.
+   * @param topic_table Table of the topics this reader is given.
    * @param tailer LogTailer to read from (or nullptr for virtual readers).
    * @param reader_id LogTailer reader ID.
    * @param max_subscription_lag Maximum number of sequence numbers a
    *                             subscription can lag behind before sending gap.
    */
   explicit LogReader(std::shared_ptr<Logger> info_log,
+                     const TopicTable* topic_table,
                      LogTailer* tailer,
                      size_t reader_id,
                      int64_t max_subscription_lag)
   : info_log_(info_log)
+  , topic_table_(topic_table)
   , tailer_(tailer)
   , reader_id_(reader_id)
   , max_subscription_lag_(max_subscription_lag) {
@@ -73,7 +104,8 @@ class LogReader {
    *
    * @param log_id Log ID of record.
    * @param seqno Sequence number of record.
-   * @param topic UUID of record topic.
+   * @param topic Handle of record topic, or kInvalidTopicHandle if the
+   *              topic has no subscriptions.
    * @param prev_seqno Output location for previous sequence number processed
    *                   for the topic. If this is the first record processed on
    *                   this topic then prev_seqno is set to the starting
@@ -81,7 +113,7 @@ class LogReader {
    */
   void ProcessRecord(LogID log_id,
                      SequenceNumber seqno,
-                     const TopicUUID& topic,
+                     TopicHandle topic,
                      SequenceNumber* prev_seqno);
 
   /**
@@ -95,7 +127,7 @@ class LogReader {
    * @param type Type of gap.
    */
   void ProcessGap(LogID log_id,
-                  const TopicUUID& topic,
+                  TopicHandle topic,
                   GapType type,
                   SequenceNumber from,
                   SequenceNumber to,
@@ -110,7 +142,7 @@ class LogReader {
    * @param seqno Starting seqno to read from.
    * @return ok() if successful, otherwise error.
    */
-  Status StartReading(const TopicUUID& topic,
+  Status StartReading(TopicHandle topic,
                       LogID log_id,
                       SequenceNumber seqno);
 
@@ -124,7 +156,7 @@ class LogReader {
    * @param log_id ID of log to free.
    * @return ok() if successful, otherwise error.
    */
-  Status StopReading(const TopicUUID& topic, LogID log_id);
+  Status StopReading(TopicHandle topic, LogID log_id);
 
   /**
    * Stops reading a log without throwing away any state.
@@ -182,7 +214,7 @@ class LogReader {
   /**
    * Returns the cost of accepting a new subscription (lower better).
    */
-  uint64_t SubscriptionCost(const TopicUUID& topic,
+  uint64_t SubscriptionCost(TopicHandle topic,
                             LogID log_id,
                             SequenceNumber seqno) const;
 
@@ -195,6 +227,11 @@ class LogReader {
   /**
    * Merges subscriptions state into another LogReader for a particular log.
    * This reader will stop reading on log_id, and its state removed.
+   *
+   * The other reader may be behind this one, in which case it re-reads the
+   * records in between. This is safe, as topic positions are merged by
+   * taking the minimum, and subscriptions are only sent records past their
+   * own sequence number.
    */
   void MergeInto(LogReader* reader, LogID log_id);
 
@@ -237,6 +274,25 @@ class LogReader {
     }
   }
 
+  /**
+   * Returns the sequence numbers read per tick on a log, as a moving average
+   * updated by UpdateReadRates, or 0 if log not open.
+   */
+  double GetReadRate(LogID log_id) const {
+    auto it = log_state_.find(log_id);
+    return it != log_state_.end() ? it->second.read_rate : 0.0;
+  }
+
+  /**
+   * Updates the read rate of all open logs. Should be called once per tick.
+   */
+  void UpdateReadRates();
+
+  /**
+   * Returns the IDs of all open logs.
+   */
+  std::vector<LogID> GetOpenLogs() const;
+
   /**
    * Get human-readable information about a log.
    */
@@ -258,13 +314,19 @@ class LogReader {
     SequenceNumber ComputeStartSeqno() const;
 
     // State of subscriptions on each topic.
-    LinkedMap<TopicUUID, TopicState> topics;
+    LinkedMap<TopicHandle, TopicState> topics;
 
     // Last read sequence number on this log.
     SequenceNumber last_read;
 
     // If the reader is currently paused or not.
     bool is_reading = false;
+
+    // last_read when the read rate was last updated.
+    SequenceNumber rate_last_read;
+
+    // Moving average of sequence numbers read per tick.
+    double read_rate = 0.0;
   };
 
   // Starts a log reader at seqno (if not already started).
@@ -276,8 +338,14 @@ class LogReader {
   // Restarts a log reader, even if already reading.
   void RestartLogReader(LogID log_id, LogState& log_state);
 
+  // Returns the topic name for logging.
+  std::string TopicToString(TopicHandle topic) const {
+    return topic_table_->GetUUID(topic).ToString();
+  }
+
   ThreadCheck thread_check_;
   std::shared_ptr<Logger> info_log_;
+  const TopicTable* topic_table_;
   LogTailer* tailer_;
   size_t reader_id_;
   std::unordered_map<LogID, LogState> log_state_;
@@ -315,7 +383,7 @@ void LogReader::RestartLogReader(LogID log_id,
 
 void LogReader::ProcessRecord(LogID log_id,
                               SequenceNumber seqno,
-                              const TopicUUID& topic,
+                              TopicHandle topic,
                               SequenceNumber* prev_seqno) {
   thread_check_.Check();
 
@@ -341,7 +409,7 @@ void LogReader::ProcessRecord(LogID log_id,
 
 void LogReader::ProcessGap(
     LogID log_id,
-    const TopicUUID& topic,
+    TopicHandle topic,
     GapType type,
     SequenceNumber from,
     SequenceNumber to,
@@ -406,10 +474,10 @@ void LogReader::BumpLaggingSubscriptions(
       // Is it older than the trim point?
       if (tseqno + max_subscription_lag_ < seqno) {
         // Eligible for bump.
-        const TopicUUID& topic = it->first;
+        TopicHandle topic = it->first;
         LOG_DEBUG(info_log_,
           "Bumping %s from %" PRIu64 " to %" PRIu64 " on Log(%" PRIu64 ")",
-          topic.ToString().c_str(),
+          TopicToString(topic).c_str(),
           tseqno,
           seqno,
           log_id);
@@ -423,7 +491,7 @@ void LogReader::BumpLaggingSubscriptions(
   }
 }
 
-Status LogReader::StartReading(const TopicUUID& topic,
+Status LogReader::StartReading(TopicHandle topic,
                                LogID log_id,
                                SequenceNumber seqno) {
   thread_check_.Check();
@@ -435,6 +503,7 @@ Status LogReader::StartReading(const TopicUUID& topic,
     // First time opening this log.
     LogState log_state;
     log_state.last_read = seqno - 1;
+    log_state.rate_last_read = log_state.last_read;
     log_it = log_state_.emplace(log_id, std::move(log_state)).first;
   }
 
@@ -463,7 +532,7 @@ Status LogReader::StartReading(const TopicUUID& topic,
       LOG_INFO(info_log_,
         "%sReader(%zu) now reading Log(%" PRIu64 ") from %" PRIu64 " for %s",
         IsVirtual() ? "Virtual" : "",
-        reader_id_, log_id, seqno, topic.ToString().c_str());
+        reader_id_, log_id, seqno, TopicToString(topic).c_str());
     } else {
       LOG_INFO(info_log_,
         "%sReader(%zu) rewinding Log(%" PRIu64 ") from %" PRIu64 " to %" PRIu64
@@ -473,7 +542,7 @@ Status LogReader::StartReading(const TopicUUID& topic,
         log_id,
         log_state.last_read + 1,
         seqno,
-        topic.ToString().c_str());
+        TopicToString(topic).c_str());
     }
 
     // Start the LogTailer.
@@ -482,7 +551,7 @@ Status LogReader::StartReading(const TopicUUID& topic,
   return st;
 }
 
-Status LogReader::StopReading(const TopicUUID& topic, LogID log_id) {
+Status LogReader::StopReading(TopicHandle topic, LogID log_id) {
   thread_check_.Check();
 
   Status st;
@@ -493,7 +562,7 @@ Status LogReader::StopReading(const TopicUUID& topic, LogID log_id) {
     if (it != log_state.topics.end()) {
       LOG_INFO(info_log_,
         "No more subscribers on %s for Log(%" PRIu64 ") %sReader(%zu)",
-        topic.ToString().c_str(),
+        TopicToString(topic).c_str(),
         log_id,
         IsVirtual() ? "Virtual" : "",
         reader_id_);
@@ -528,7 +597,7 @@ void LogReader::RestartReading(LogID log_id) {
   RestartLogReader(log_id, log_it->second);
 }
 
-uint64_t LogReader::SubscriptionCost(const TopicUUID& topic,
+uint64_t LogReader::SubscriptionCost(TopicHandle topic,
                                      LogID log_id,
                                      SequenceNumber seqno) const {
   auto log_it = log_state_.find(log_id);
@@ -586,7 +655,8 @@ bool LogReader::CanMergeInto(LogReader* reader, LogID log_id) const {
     return false;
   }
 
-  // Can merge when they are at the same sequence number.
+  // Can merge when they are at the same sequence number. MergeInto also
+  // accepts a reader that is behind, but only when planned by the caller.
   const LogState& src = log_it1->second;
   const LogState& dest = log_it2->second;
   return dest.last_read == src.last_read;
@@ -595,7 +665,9 @@ bool LogReader::CanMergeInto(LogReader* reader, LogID log_id) const {
 void LogReader::MergeInto(LogReader* reader, LogID log_id) {
   thread_check_.Check();
   RS_ASSERT(reader);
-  RS_ASSERT(CanMergeInto(reader, log_id));
+  RS_ASSERT(reader != this);
+  RS_ASSERT(!IsVirtual());
+  RS_ASSERT(!reader->IsVirtual());
 
   // Extract LogStates for this log.
   auto log_it1 = log_state_.find(log_id);
@@ -606,18 +678,20 @@ void LogReader::MergeInto(LogReader* reader, LogID log_id) {
   // Verify last_read.
   LogState& src = log_it1->second;
   LogState& dest = log_it2->second;
-  RS_ASSERT(dest.last_read == src.last_read);
+  RS_ASSERT(dest.last_read <= src.last_read);
 
   LOG_INFO(info_log_,
-    "Merging Reader(%zu) into Reader(%zu) on Log(%" PRIu64 ")@%" PRIu64,
+    "Merging Reader(%zu)@%" PRIu64 " into Reader(%zu)@%" PRIu64
+    " on Log(%" PRIu64 ")",
     reader_id_,
+    src.last_read + 1,
     reader->reader_id_,
-    log_id,
-    src.last_read + 1);
+    dest.last_read + 1,
+    log_id);
 
   // Now just merge the topic state by taking the min of next_seqno for each.
   for (auto& src_topic_entry : src.topics) {
-    const TopicUUID& topic = src_topic_entry.first;
+    TopicHandle topic = src_topic_entry.first;
     TopicState& src_topic = src_topic_entry.second;
     auto it = dest.topics.find(topic);
     if (it != dest.topics.end()) {
@@ -696,6 +770,29 @@ std::string LogReader::GetLogInfo(LogID log_id) const {
   return std::string(buffer);
 }
 
+void LogReader::UpdateReadRates() {
+  thread_check_.Check();
+  for (auto& log_entry : log_state_) {
+    LogState& log_state = log_entry.second;
+    // Rewinds and flushed history move the reader back, which is no progress.
+    const SequenceNumber read =
+      log_state.last_read > log_state.rate_last_read ?
+      log_state.last_read - log_state.rate_last_read : 0;
+    log_state.read_rate = (log_state.read_rate + static_cast<double>(read)) / 2;
+    log_state.rate_last_read = log_state.last_read;
+  }
+}
+
+std::vector<LogID> LogReader::GetOpenLogs() const {
+  thread_check_.Check();
+  std::vector<LogID> logs;
+  logs.reserve(log_state_.size());
+  for (const auto& log_entry : log_state_) {
+    logs.push_back(log_entry.first);
+  }
+  return logs;
+}
+
 std::string LogReader::GetAllLogsInfo() const {
   thread_check_.Check();
   std::string result;
@@ -722,6 +819,8 @@ TopicTailer::TopicTailer(
     std::shared_ptr<LogRouter> log_router,
     std::shared_ptr<Logger> info_log,
     size_t cache_size_per_room,
+    std::shared_ptr<Cache> shared_cache,
+    std::shared_ptr<DataCacheSpill> cache_spill,
     bool cache_data_from_system_namespaces,
     size_t cache_block_size,
     int bloom_bits_per_msg,
@@ -737,12 +836,22 @@ TopicTailer::TopicTailer(
   log_router_(std::move(log_router)),
   info_log_(std::move(info_log)),
   on_message_(std::move(on_message)),
-  data_cache_(cache_size_per_room, cache_data_from_system_namespaces,
-              bloom_bits_per_msg, cache_block_size),
+  data_cache_(shared_cache ?
+              new DataCache(std::move(shared_cache), worker_id,
+                            cache_data_from_system_namespaces,
+                            bloom_bits_per_msg, cache_block_size) :
+              new DataCache(cache_size_per_room,
+                            cache_data_from_system_namespaces,
+                            bloom_bits_per_msg, cache_block_size,
+                            options.cache_admission_filter)),
   prng_(ThreadLocalPRNG()),
   options_(options),
   event_loop_(msg_loop_->GetEventLoop(worker_id_)),
-  copilot_worker_(std::move(copilot_worker)) {
+  copilot_worker_(std::move(copilot_worker)),
+  plan_ticks_(0) {
+  if (cache_spill) {
+    data_cache_->SetSpill(std::move(cache_spill));
+  }
 
   latest_seqno_queues_.reset(
     new ThreadLocalQueues<FindLatestSeqnoResponse>(
@@ -792,6 +901,7 @@ void TopicTailer::SendFindLatestSeqnoRequest(LogID logid) {
     }
   };
 
+  stats_.find_time_requests->Add(1);
   Status seqno_status = log_tailer_->FindLatestSeqno(logid, callback);
   if (!seqno_status.ok()) {
     LOG_ERROR(info_log_,
@@ -826,15 +936,17 @@ void TopicTailer::ProcessFindLatestSeqnoResponse(Flow* flow,
   }
 
   // Find all copilots pending this response.
+  bool subscribed = false;
   for (auto id : pending_find_time_response_[logid]) {
     // IMPORTANT: Since this callback is asynchronous, the subscriber
     // may have unsubscribed since they issued the subscribe(0) request.
     // We need to check this otherwise we may open a reader for a
     // non-existent subscription, which will never be closed.
-    TopicUUID* topic = stream_subscriptions_.Find(id.stream_id, id.sub_id);
+    TopicHandle* topic = stream_subscriptions_.Find(id.stream_id, id.sub_id);
     if (topic) {
       // Subscription exists: add subscriber.
       AddTailSubscriber(flow, *topic, id, logid, seqno);
+      subscribed = true;
     } else {
       LOG_DEBUG(info_log_,
         "%s unsubscribed before FindLatestSeqno response arrived.",
@@ -848,13 +960,36 @@ void TopicTailer::ProcessFindLatestSeqnoResponse(Flow* flow,
     logid,
     seqno);
 
+  // Only logs that are read keep their estimate up to date.
   auto ts_it = tail_seqno_cached_.find(logid);
   if (ts_it == tail_seqno_cached_.end()) {
-    tail_seqno_cached_.emplace(logid, seqno);
+    if (subscribed) {
+      tail_seqno_cached_.emplace(logid, seqno);
+    }
   } else {
     ts_it->second = std::max(ts_it->second, seqno);
   }
 
+  // Remember the result for a while, for when the log is no longer read.
+  if (options_.tail_seqno_cache_ttl.count() > 0) {
+    recent_tail_seqnos_.erase(logid);
+    RecentTailSeqno recent;
+    recent.seqno = seqno;
+    recent.expiry_micros = env_->NowMicros() +
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        options_.tail_seqno_cache_ttl).count();
+    recent_tail_seqnos_.emplace_back(logid, recent);
+  }
+
+  auto cb_it = pending_find_time_callbacks_.find(logid);
+  if (cb_it != pending_find_time_callbacks_.end()) {
+    auto callbacks = std::move(cb_it->second);
+    pending_find_time_callbacks_.erase(cb_it);
+    for (auto& callback : callbacks) {
+      callback(Status::OK(), seqno);
+    }
+  }
+
   // One less request in flight now, so send any pending requests that were
   // blocked due to having too many in flight.
   if (!pending_find_time_requests_.empty()) {
@@ -875,6 +1010,46 @@ size_t TopicTailer::InFlightFindLatestSeqnoRequests() const {
          pending_find_time_requests_.size();
 }
 
+void TopicTailer::RequestLatestSeqno(LogID logid) {
+  if (pending_find_time_response_.count(logid)) {
+    // Already a FindLatestSeqno request in flight, so we'll just wait for
+    // that to finish and use the same result.
+    stats_.find_time_requests_coalesced->Add(1);
+    LOG_DEBUG(info_log_,
+      "Piggy-backing in flight FindLatestSeqno request on Log(%" PRIu64 ")",
+      logid);
+    return;
+  }
+
+  const size_t in_flight = InFlightFindLatestSeqnoRequests();
+  pending_find_time_response_[logid];
+  if (in_flight < options_.max_find_time_requests) {
+    // Not too many in flight, so send the request now.
+    SendFindLatestSeqnoRequest(logid);
+  } else {
+    // Too many FindLatestSeqno requests in flight.
+    // Mark it pending for later. These will be picked up when the
+    // next response comes back.
+    pending_find_time_requests_.emplace_back(logid);
+  }
+}
+
+void TopicTailer::FindTailSeqno(
+    LogID log_id,
+    std::function<void(Status, SequenceNumber)> callback) {
+  thread_check_.Check();
+  stats_.find_tail_seqno_requests->Add(1);
+
+  SequenceNumber seqno = GetTailSeqnoEstimate(log_id);
+  if (seqno != 0) {
+    stats_.find_tail_seqno_requests_fast->Add(1);
+    callback(Status::OK(), seqno);
+  } else {
+    pending_find_time_callbacks_[log_id].emplace_back(std::move(callback));
+    RequestLatestSeqno(log_id);
+  }
+}
+
 
 void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
                                    LogID log_id,
@@ -887,11 +1062,13 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
   stats_.log_records_received->Add(1);
   stats_.log_records_received_payload_size->Add(data->GetPayload().
                                                 size());
-  TopicUUID uuid(data->GetNamespaceId(), data->GetTopicName());
+  // Topics without subscriptions are not interned.
+  const TopicHandle topic =
+    topic_table_.Find(data->GetNamespaceId(), data->GetTopicName());
   SequenceNumber next_seqno = data->GetSequenceNumber();
   SequenceNumber prev_seqno = 0;
   RS_ASSERT(next_seqno == reader->GetNextSequenceNumber(log_id));
-  reader->ProcessRecord(log_id, next_seqno, uuid, &prev_seqno);
+  reader->ProcessRecord(log_id, next_seqno, topic, &prev_seqno);
   if (0) {
     LOG_DEBUG(info_log_,
               "Inserted seqno %" PRIu64 " on Log(%" PRIu64 ")"
@@ -923,7 +1100,7 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
 
     std::vector<CopilotSub> recipients;
     topic_manager.VisitSubscribers(
-      uuid, prev_seqno, next_seqno,
+      topic, prev_seqno, next_seqno,
       [&] (TopicSubscription* sub) {
         const CopilotSub id = sub->GetID();
         recipients.emplace_back(id);
@@ -932,7 +1109,7 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
           "%s advanced to %s@%" PRIu64 " on Log(%" PRIu64 ")"
           " Reader(%zu)",
           id.ToString().c_str(),
-          uuid.ToString().c_str(),
+          topic_table_.GetUUID(topic).ToString().c_str(),
           next_seqno + 1,
           log_id,
           reader->GetReaderId());
@@ -949,7 +1126,7 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
         "Reader(%zu) found no hosts for %smessage on %s@%" PRIu64 "-%" PRIu64,
         reader->GetReaderId(),
         is_tail ? "tail " : "",
-        uuid.ToString().c_str(),
+        topic_table_.GetUUID(topic).ToString().c_str(),
         prev_seqno,
         next_seqno);
     }
@@ -963,14 +1140,14 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
     reader->BumpLaggingSubscriptions(
       log_id,            // Log to bump
       next_seqno,        // Current seqno
-      [&] (const TopicUUID& topic, SequenceNumber bump_seqno) {
+      [&] (TopicHandle bumped_topic, SequenceNumber bump_seqno) {
         // This will be called for each bumped topic.
         // bump_seqno is the last known seqno for the topic.
 
         // Find subscribed hosts between bump_seqno and next_seqno.
         std::vector<CopilotSub> bumped_subscriptions;
         topic_manager.VisitSubscribers(
-          topic, bump_seqno, next_seqno,
+          bumped_topic, bump_seqno, next_seqno,
           [&] (TopicSubscription* sub) {
             const CopilotSub id = sub->GetID();
             // Add host to list.
@@ -982,7 +1159,7 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
               "%s bumped to %s@%" PRIu64 " on Log(%" PRIu64 ")"
               " Reader(%zu)",
               id.ToString().c_str(),
-              topic.ToString().c_str(),
+              topic_table_.GetUUID(bumped_topic).ToString().c_str(),
               next_seqno + 1,
               log_id,
               reader->GetReaderId());
@@ -992,7 +1169,8 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
           // Send gap message.
           Slice namespace_id;
           Slice topic_name;
-          topic.GetTopicID(&namespace_id, &topic_name);
+          topic_table_.GetUUID(bumped_topic).GetTopicID(&namespace_id,
+                                                        &topic_name);
           MessageGap trim_msg(Tenant::GuestTenant,
                            namespace_id.ToString(),
                            topic_name.ToString(),
@@ -1008,7 +1186,8 @@ void TopicTailer::ReceiveLogRecord(std::unique_ptr<MessageData> data,
   // Transfer ownership of this message to the cache.
   Slice namespace_id = data->GetNamespaceId();
   Slice topic_name = data->GetTopicName();
-  data_cache_.StoreData(namespace_id, topic_name, log_id, std::move(data));
+  data_cache_->StoreData(namespace_id, topic_name, log_id, std::move(data),
+                         is_tail);
 }
 
 TopicTailer::CacheRead
@@ -1018,7 +1197,7 @@ TopicTailer::AdvanceReaderFromCache(Flow* flow,
   thread_check_.Check();
 
   // if cache is not enabled, then short-circuit
-  if (data_cache_.GetCapacity() == 0) {
+  if (data_cache_->GetCapacity() == 0) {
     return CacheRead::kNoneRead;
   }
 
@@ -1032,18 +1211,19 @@ TopicTailer::AdvanceReaderFromCache(Flow* flow,
 
   // callback to process a data message from cache
   auto on_message_cache = [&] (MessageData* data, bool* delivered) {
-    TopicUUID uuid(data->GetNamespaceId(), data->GetTopicName());
+    const TopicHandle topic =
+      topic_table_.Find(data->GetNamespaceId(), data->GetTopicName());
     SequenceNumber next_seqno = data->GetSequenceNumber();
     SequenceNumber prev_seqno = 0;
     RS_ASSERT(next_seqno >= reader->GetNextSequenceNumber(log_id));
-    reader->ProcessRecord(log_id, next_seqno, uuid, &prev_seqno);
+    reader->ProcessRecord(log_id, next_seqno, topic, &prev_seqno);
 
     // However, may still be no subscribers for this topic.
     if (prev_seqno != 0) {
       // Find subscribed hosts.
       std::vector<CopilotSub> recipients;
       topic_map_[log_id].VisitSubscribers(
-        uuid, prev_seqno, next_seqno,
+        topic, prev_seqno, next_seqno,
         [&] (TopicSubscription* sub) {
           const CopilotSub id = sub->GetID();
           recipients.emplace_back(id);
@@ -1052,7 +1232,7 @@ TopicTailer::AdvanceReaderFromCache(Flow* flow,
             "%s advanced to %s@%" PRIu64 " on Log(%" PRIu64 ")"
             " Reader(%zu) by cache",
             id.ToString().c_str(),
-            uuid.ToString().c_str(),
+            topic_table_.GetUUID(topic).ToString().c_str(),
             next_seqno + 1,
             log_id,
             reader->GetReaderId());
@@ -1078,10 +1258,10 @@ TopicTailer::AdvanceReaderFromCache(Flow* flow,
   Slice lookup_topic;
   int topic_count = 0;
   topic_map_[log_id].VisitTopics(
-    [&] (const TopicUUID& topic) {
+    [&] (TopicHandle topic) {
       Slice namespace_id;
       Slice topic_name;
-      topic.GetTopicID(&namespace_id, &topic_name);
+      topic_table_.GetUUID(topic).GetTopicID(&namespace_id, &topic_name);
       topic_count++;
       if (topic_count > 1) {
         lookup_topic.clear();
@@ -1095,7 +1275,7 @@ TopicTailer::AdvanceReaderFromCache(Flow* flow,
 
   // Deliver as much data as possible from the cache.
   SequenceNumber old = seqno;
-  seqno = data_cache_.VisitCache(log_id, seqno, lookup_topic,
+  seqno = data_cache_->VisitCache(log_id, seqno, lookup_topic,
                                  std::move(on_message_cache));
 
   if (old != seqno) {
@@ -1153,6 +1333,11 @@ void TopicTailer::SendLogRecord(
     size_t reader_id) {
   thread_check_.Check();
 
+  if (CatchUpReader* catch_up_reader = FindCatchUpReader(reader_id)) {
+    ReceiveCatchUpRecord(flow, std::move(msg), catch_up_reader);
+    return;
+  }
+
   // Find reader.
   LogReader* reader = FindLogReader(reader_id);
   RS_ASSERT(reader != nullptr);
@@ -1163,7 +1348,7 @@ void TopicTailer::SendLogRecord(
   // Check if we can advance from cache.
   SequenceNumber seqno = reader->GetNextSequenceNumber(log_id);
   RS_ASSERT(seqno != 0);
-  if (data_cache_.HasEntry(log_id, seqno)) {
+  if (data_cache_->HasEntry(log_id, seqno)) {
     // Pause reading log, and start reading from cache.
     reader->PauseReading(log_id);
     reentry_cache_readers_->Write(LogReaderId(log_id, reader), nullptr);
@@ -1182,14 +1367,18 @@ void TopicTailer::SendGapRecord(
     size_t reader_id) {
   thread_check_.Check();
 
+  stats_.gap_records_received->Add(1);
+  if (CatchUpReader* catch_up_reader = FindCatchUpReader(reader_id)) {
+    ReceiveCatchUpGap(flow, type, to, catch_up_reader);
+    return;
+  }
+
   LogReader* reader = FindLogReader(reader_id);
   RS_ASSERT(reader != nullptr);
 
-  stats_.gap_records_received->Add(1);
-
   // Send per-topic gap messages for subscribed topics.
   topic_map_[log_id].VisitTopics(
-    [&] (const TopicUUID& topic) {
+    [&] (TopicHandle topic) {
       // Get the last known seqno for topic.
       SequenceNumber prev_seqno;
       reader->ProcessGap(log_id, topic, type, from, to, &prev_seqno);
@@ -1212,7 +1401,7 @@ void TopicTailer::SendGapRecord(
             "%s advanced to %s@%" PRIu64 " on Log(%" PRIu64 ")"
             " Reader(%zu)",
             sub->GetID().ToString().c_str(),
-            topic.ToString().c_str(),
+            topic_table_.GetUUID(topic).ToString().c_str(),
             to,
             log_id,
             reader_id);
@@ -1222,7 +1411,7 @@ void TopicTailer::SendGapRecord(
       if (!recipients.empty()){
         Slice namespace_id;
         Slice topic_name;
-        topic.GetTopicID(&namespace_id, &topic_name);
+        topic_table_.GetUUID(topic).GetTopicID(&namespace_id, &topic_name);
         MessageGap mgap(Tenant::GuestTenant,
                          namespace_id.ToString(),
                          topic_name.ToString(),
@@ -1256,29 +1445,221 @@ void TopicTailer::SendGapRecord(
 }
 
 void TopicTailer::Tick() {
+  thread_check_.Check();
+  PlanReaders();
+  ScheduleCatchUpReaders();
+
+  // Forget expired tail seqnos.
+  const uint64_t now = env_->NowMicros();
+  while (!recent_tail_seqnos_.empty() &&
+         recent_tail_seqnos_.front().second.expiry_micros <= now) {
+    recent_tail_seqnos_.pop_front();
+  }
+}
+
+void TopicTailer::PlanReaders() {
+  for (auto& reader : log_readers_) {
+    reader->UpdateReadRates();
+  }
+
+  // Subscriptions waiting on the virtual reader are taken over by a reader
+  // that is not reading their log, if any, rather than waiting for a merge.
+  for (LogID log_id : pending_reader_->GetOpenLogs()) {
+    std::vector<bool> log_open;
+    for (auto& reader : log_readers_) {
+      log_open.push_back(reader->IsLogOpen(log_id));
+    }
+    const size_t thief = PlanPendingSteal(log_open);
+    if (thief < log_readers_.size()) {
+      log_readers_[thief]->StealLogSubscriptions(pending_reader_.get(),
+                                                 log_id);
+      if (!pending_reader_->IsLogOpen(log_id)) {
+        stats_.pending_reader_steals->Add(1);
+      }
+    }
+  }
+
+  // Logs are spread over ticks, so that each tick only costs a fraction of
+  // them, except those with subscriptions waiting for a reader.
+  const uint64_t tick = plan_ticks_++;
+  if (log_readers_.size() > 1) {
+    std::unordered_set<LogID> planned;
+    for (auto& reader : log_readers_) {
+      for (LogID log_id : reader->GetOpenLogs()) {
+        if ((tick + log_id) % kPlanMergesTicks != 0 &&
+            !pending_reader_->IsLogOpen(log_id)) {
+          continue;
+        }
+        if (planned.insert(log_id).second) {
+          PlanReaderMerges(log_id);
+        }
+      }
+    }
+  }
+}
+
+void TopicTailer::PlanReaderMerges(LogID log_id) {
+  std::vector<LogReader*> readers;
+  for (auto& reader : log_readers_) {
+    if (reader->IsLogOpen(log_id)) {
+      readers.push_back(reader.get());
+    }
+  }
+  if (readers.size() < 2) {
+    return;
+  }
+  std::sort(readers.begin(), readers.end(),
+    [log_id] (LogReader* a, LogReader* b) {
+      return a->GetNextSequenceNumber(log_id) <
+             b->GetNextSequenceNumber(log_id);
+    });
+
+  std::vector<ReaderProgress> progress;
+  for (LogReader* reader : readers) {
+    progress.push_back(ReaderProgress {
+      reader->GetNextSequenceNumber(log_id),
+      reader->GetReadRate(log_id)
+    });
+  }
+  const DataCache& data_cache = *data_cache_;
+  auto merges = PlanMerges(progress,
+    pending_reader_->IsLogOpen(log_id),
+    GetTailSeqnoEstimate(log_id),
+    [&] (SequenceNumber from, SequenceNumber to) {
+      return UncachedDistance(data_cache, log_id, from, to);
+    });
+  for (const auto& merge : merges) {
+    MergeReaders(readers[merge.first], readers[merge.second], log_id);
+    stats_.planned_reader_merges->Add(1);
+  }
+}
+
+std::vector<std::pair<size_t, size_t>> TopicTailer::PlanMerges(
+    const std::vector<ReaderProgress>& readers,
+    bool pending,
+    SequenceNumber tail_seqno,
+    const DistanceFunction& uncached_distance) {
+  std::vector<std::pair<size_t, size_t>> merges;
+
+  // Merging a reader into the one behind it frees a reader at the cost of
+  // delaying its subscriptions until the reader behind catches up. That is
+  // worth it when the records in between are mostly in the cache, and the
+  // readers are not about to converge on their own anyway. Subscriptions at
+  // the tail are never delayed that way.
+  size_t behind = 0;
+  bool have_cheapest = false;
+  uint64_t cheapest_cost = kSubscriptionCostRewind;
+  std::pair<size_t, size_t> cheapest_merge;
+  for (size_t ahead = 1; ahead < readers.size(); ++ahead) {
+    const SequenceNumber from = readers[behind].next_seqno;
+    const SequenceNumber to = readers[ahead].next_seqno;
+    RS_ASSERT(from <= to);
+    if (from != to && tail_seqno != 0 && to >= tail_seqno) {
+      behind = ahead;
+      continue;
+    }
+    const double closing_rate =
+      readers[behind].read_rate - readers[ahead].read_rate;
+    const bool converging = closing_rate > 0 &&
+      static_cast<double>(to - from) <= closing_rate * kMaxCatchUpTicks;
+    if (converging && !pending) {
+      behind = ahead;
+      continue;
+    }
+    const uint64_t cost = uncached_distance(from, to);
+    const bool mostly_cached = static_cast<double>(cost) * 100 <=
+      static_cast<double>(to - from) * (100 - kMinMergeCachedPercent);
+    if (!converging && mostly_cached && cost <= kSubscriptionCostStart) {
+      merges.emplace_back(ahead, behind);
+      continue;
+    }
+    if (cost < cheapest_cost) {
+      cheapest_merge = std::make_pair(ahead, behind);
+      cheapest_cost = cost;
+      have_cheapest = true;
+    }
+    behind = ahead;
+  }
+
+  // Subscriptions on the virtual reader wait until a reader is freed, so
+  // free the cheapest one rather than letting them wait indefinitely.
+  if (merges.empty() && have_cheapest && pending) {
+    merges.push_back(cheapest_merge);
+  }
+  return merges;
+}
+
+size_t TopicTailer::PlanPendingSteal(const std::vector<bool>& log_open) {
+  for (size_t i = 0; i < log_open.size(); ++i) {
+    if (!log_open[i]) {
+      return i;
+    }
+  }
+  return log_open.size();
+}
+
+uint64_t TopicTailer::CatchUpCost(SequenceNumber next_seqno,
+                                  SequenceNumber seqno,
+                                  double read_rate,
+                                  const DistanceFunction& uncached_distance) {
+  RS_ASSERT(next_seqno <= seqno);
+  // Only records the reader cannot find in the cache count, but a reader
+  // that is slow to get there is no better than a new one.
+  uint64_t cost = uncached_distance(next_seqno, seqno) + 1;
+  if (read_rate > 0 &&
+      static_cast<double>(seqno - next_seqno) > read_rate * kMaxCatchUpTicks) {
+    cost += kSubscriptionCostStart;
+  }
+  return cost;
+}
+
+uint64_t TopicTailer::UncachedDistance(const DataCache& data_cache,
+                                       LogID log_id,
+                                       SequenceNumber from,
+                                       SequenceNumber to) {
+  RS_ASSERT(from <= to);
+  const uint64_t distance = to - from;
+  if (distance > kMaxCachePlanningDistance) {
+    return distance;
+  }
+  return distance - data_cache.CountEntries(log_id, from, to);
 }
 
 SequenceNumber TopicTailer::GetTailSeqnoEstimate(LogID log_id) const {
   thread_check_.Check();
   auto ts_it = tail_seqno_cached_.find(log_id);
-  return ts_it == tail_seqno_cached_.end() ? 0 : ts_it->second;
+  if (ts_it != tail_seqno_cached_.end()) {
+    return ts_it->second;
+  }
+  auto recent_it = recent_tail_seqnos_.find(log_id);
+  if (recent_it != recent_tail_seqnos_.end() &&
+      recent_it->second.expiry_micros > env_->NowMicros()) {
+    return recent_it->second.seqno;
+  }
+  return 0;
 }
 
 Status TopicTailer::Initialize(const std::vector<size_t>& reader_ids,
+                               const std::vector<size_t>& catch_up_reader_ids,
                                int64_t max_subscription_lag) {
   // Initialize log_readers_.
   for (size_t reader_id : reader_ids) {
     log_readers_.emplace_back(
       new LogReader(info_log_,
+                    &topic_table_,
                     log_tailer_,
                     reader_id,
                     max_subscription_lag));
   }
   pending_reader_.reset(
     new LogReader(info_log_,
+                  &topic_table_,
                   nullptr,  // null LogTailer <=> virtual reader
                   0,
                   max_subscription_lag));
+  for (size_t reader_id : catch_up_reader_ids) {
+    catch_up_readers_.emplace_back(reader_id);
+  }
   return Status::OK();
 }
 
@@ -1292,6 +1673,8 @@ TopicTailer::CreateNewInstance(
     std::shared_ptr<LogRouter> log_router,
     std::shared_ptr<Logger> info_log,
     size_t cache_size_per_room,
+    std::shared_ptr<Cache> shared_cache,
+    std::shared_ptr<DataCacheSpill> cache_spill,
     bool cache_data_from_system_namespaces,
     size_t cache_block_size,
     int bloom_bits_per_msg,
@@ -1308,6 +1691,8 @@ TopicTailer::CreateNewInstance(
                             std::move(log_router),
                             std::move(info_log),
                             cache_size_per_room,
+                            std::move(shared_cache),
+                            std::move(cache_spill),
                             cache_data_from_system_namespaces,
                             cache_block_size,
                             bloom_bits_per_msg,
@@ -1317,7 +1702,7 @@ TopicTailer::CreateNewInstance(
   return Status::OK();
 }
 
-Status TopicTailer::AddSubscriber(const TopicUUID& topic,
+Status TopicTailer::AddSubscriber(const TopicUUID& uuid,
                                   SequenceNumber start,
                                   CopilotSub id) {
   thread_check_.Check();
@@ -1325,11 +1710,14 @@ Status TopicTailer::AddSubscriber(const TopicUUID& topic,
 
   // Map topic to log.
   LogID logid;
-  Status st = log_router_->GetLogID(topic, &logid);
+  Status st = log_router_->GetLogID(uuid, &logid);
   if (!st.ok()) {
     return st;
   }
 
+  // Referenced until the subscription takes its own reference, if added.
+  const TopicHandle topic = topic_table_.Acquire(uuid);
+
   // Handle to 0 sequence number special case.
   // Zero means to start reading from the latest records, so we first need
   // to asynchronously consult the LogTailer for the latest seqno, and then
@@ -1355,37 +1743,17 @@ Status TopicTailer::AddSubscriber(const TopicUUID& topic,
 
       // First insert into the stream subscriptions map to indicate that the
       // subscription exists (and allow unsubscriptions to work).
-      stream_subscriptions_.Insert(id.stream_id, id.sub_id, topic);
+      InsertSubscription(topic, id);
 
       // Add to the list of copilots waiting on a FindLatestSeqno request.
-      const size_t in_flight = InFlightFindLatestSeqnoRequests();
-      auto& pending = pending_find_time_response_[logid];
-      pending.emplace_back(id);
-
-      if (pending.size() > 1) {
-        // Already a FindLatestSeqno request in flight, so we'll just wait for
-        // that to finish and use the same result.
-        LOG_DEBUG(info_log_,
-          "Piggy-backing in flight FindLatestSeqno request on Log(%" PRIu64 ")"
-          " for %s",
-          logid,
-          id.ToString().c_str());
-      } else if (in_flight < options_.max_find_time_requests) {
-        // Not too many in flight, so send the request now.
-        SendFindLatestSeqnoRequest(logid);
-      } else {
-        // Too many FindLatestSeqno requests in flight.
-        // Mark it pending for later. These will be picked up when the
-        // next response comes back.
-        if (!pending_find_time_requests_.contains(logid)) {
-          pending_find_time_requests_.emplace_back(logid);
-        }
-      }
+      RequestLatestSeqno(logid);
+      pending_find_time_response_[logid].emplace_back(id);
     }
   } else {
     // Non-zero sequence number.
     AddSubscriberInternal(topic, id, logid, start);
   }
+  topic_table_.Release(topic);
   return Status::OK();
 }
 
@@ -1394,7 +1762,7 @@ Status TopicTailer::RemoveSubscriber(CopilotSub id) {
   thread_check_.Check();
   stats_.remove_subscriber_requests->Add(1);
 
-  TopicUUID topic;
+  TopicHandle topic;
   if (!stream_subscriptions_.MoveOut(id.stream_id, id.sub_id, &topic)) {
     LOG_WARN(info_log_,
       "Cannot remove unknown subscription %s",
@@ -1404,17 +1772,17 @@ Status TopicTailer::RemoveSubscriber(CopilotSub id) {
 
   // Map topic to log.
   LogID logid;
-  Status st = log_router_->GetLogID(topic, &logid);
-  if (!st.ok()) {
-    return st;
+  Status st = log_router_->GetLogID(topic_table_.GetUUID(topic), &logid);
+  if (st.ok()) {
+    LOG_DEBUG(info_log_,
+      "%s unsubscribed for %s",
+      id.ToString().c_str(),
+      topic_table_.GetUUID(topic).ToString().c_str());
+    RemoveSubscriberInternal(topic, id, logid);
   }
-
-  LOG_DEBUG(info_log_,
-    "%s unsubscribed for %s",
-    id.ToString().c_str(),
-    topic.ToString().c_str());
-  RemoveSubscriberInternal(topic, id, logid);
-  return Status::OK();
+  // Drop the reference of the subscription.
+  topic_table_.Release(topic);
+  return st;
 }
 
 Status TopicTailer::RemoveSubscriber(StreamID stream_id) {
@@ -1427,7 +1795,7 @@ Status TopicTailer::RemoveSubscriber(StreamID stream_id) {
 std::string TopicTailer::ClearCache() {
   thread_check_.Check();
   LOG_INFO(info_log_, "Clearing cache for worker_id %d", worker_id_);
-  data_cache_.ClearCache();
+  data_cache_->ClearCache();
   return "";
 }
 
@@ -1435,18 +1803,18 @@ std::string TopicTailer::SetCacheCapacity(size_t newcapacity) {
   thread_check_.Check();
   LOG_INFO(info_log_, "Setting new cache capacity %lu for worker_id %d",
            newcapacity, worker_id_);
-  data_cache_.SetCapacity(newcapacity);
+  data_cache_->SetCapacity(newcapacity);
   return "";
 }
 
 std::string TopicTailer::GetCacheUsage() {
   thread_check_.Check();
-  return std::to_string(data_cache_.GetUsage());
+  return std::to_string(data_cache_->GetUsage());
 }
 
 std::string TopicTailer::GetCacheCapacity() {
   thread_check_.Check();
-  return std::to_string(data_cache_.GetCapacity());
+  return std::to_string(data_cache_->GetCapacity());
 }
 
 std::string TopicTailer::GetLogInfo(LogID log_id) const {
@@ -1479,19 +1847,19 @@ std::string TopicTailer::GetAllLogsInfo() const {
 }
 
 void TopicTailer::AddTailSubscriber(Flow* flow,
-                                    const TopicUUID& topic,
+                                    TopicHandle topic,
                                     CopilotSub id,
                                     LogID logid,
                                     SequenceNumber seqno) {
   // Send message to inform subscriber of latest seqno.
   LOG_DEBUG(info_log_,
     "Sending gap message on %s@0-%" PRIu64 " Log(%" PRIu64 ")",
-    topic.ToString().c_str(),
+    topic_table_.GetUUID(topic).ToString().c_str(),
     seqno - 1,
     logid);
   Slice namespace_id;
   Slice topic_name;
-  topic.GetTopicID(&namespace_id, &topic_name);
+  topic_table_.GetUUID(topic).GetTopicID(&namespace_id, &topic_name);
   MessageGap mgap(Tenant::GuestTenant,
                    namespace_id.ToString(),
                    topic_name.ToString(),
@@ -1504,12 +1872,12 @@ void TopicTailer::AddTailSubscriber(Flow* flow,
 }
 
 bool TopicTailer::DeliverFromCache(Flow* flow,
-                                   const TopicUUID& topic,
+                                   TopicHandle topic,
                                    CopilotSub copilot,
                                    LogID logid,
                                    SequenceNumber* seqno) {
   // if cache is not enabled, then short-circuit
-  if (data_cache_.GetCapacity() == 0) {
+  if (data_cache_->GetCapacity() == 0) {
     return true;
   }
 
@@ -1540,13 +1908,13 @@ bool TopicTailer::DeliverFromCache(Flow* flow,
         logid);
 
     // If this message is for our topic, then deliver
-    if (topic == uuid_pair) {
+    if (topic_table_.GetUUID(topic) == uuid_pair) {
       this->stats_.records_served_from_cache->Add(1);
       if (0) {
         LOG_DEBUG(info_log_,
                   "Delivering data to %s@%" PRIu64 " on Log(%" PRIu64
                   ") from cache",
-                  topic.ToString().c_str(),
+                  topic_table_.GetUUID(topic).ToString().c_str(),
                   msg_seqno,
                   logid);
       }
@@ -1567,11 +1935,11 @@ bool TopicTailer::DeliverFromCache(Flow* flow,
   };
 
   Slice ns, topic_name;
-  topic.GetTopicID(&ns, &topic_name);
+  topic_table_.GetUUID(topic).GetTopicID(&ns, &topic_name);
 
   // Deliver as much data as possible from the cache.
   SequenceNumber old = *seqno;
-  *seqno = data_cache_.VisitCache(logid, *seqno, topic_name,
+  *seqno = data_cache_->VisitCache(logid, *seqno, topic_name,
                                   std::move(on_message_cache));
 
   if (backoff) {
@@ -1618,7 +1986,7 @@ bool TopicTailer::DeliverFromCache(Flow* flow,
 }
 
 void TopicTailer::ProcessPendingSubscription(Flow* flow,
-                                             const TopicUUID& topic,
+                                             TopicHandle topic,
                                              CopilotSub id,
                                              LogID logid,
                                              SequenceNumber seqno) {
@@ -1627,25 +1995,11 @@ void TopicTailer::ProcessPendingSubscription(Flow* flow,
 
   // Deliver the earliest part of this topic from cache if available.
   if (DeliverFromCache(flow, topic, id, logid, &seqno)) {
-    // Done delivering what we can from cache, open reader for the rest.
-    LogReader* reader = ReaderForNewSubscription(id, topic, logid, seqno);
-    RS_ASSERT(reader);
-    reader->StartReading(topic, logid, seqno);
-
-    // Add the new subscription.
-    bool was_added = topic_map_[logid].AddSubscriber(topic, seqno, id);
-    if (was_added) {
-      stats_.updated_subscriptions->Add(1);
+    // Done delivering what we can from cache, read the backlog in parallel
+    // if it is long, otherwise open reader for the rest.
+    if (!StartCatchUp(topic, id, logid, seqno)) {
+      AddSubscriptionToReader(topic, id, logid, seqno);
     }
-
-    LOG_DEBUG(info_log_,
-      "%s subscribed for %s@%" PRIu64 " (%s) on %sReader(%zu)",
-      id.ToString().c_str(),
-      topic.ToString().c_str(),
-      seqno,
-      was_added ? "new" : "update",
-      reader->IsVirtual() ? "Virtual" : "",
-      reader->GetReaderId());
   } else {
     // Didn't deliver everything we could from the cache, so add to the cache
     // readers list. This will be checked later to see if we can deliver more.
@@ -1654,23 +2008,265 @@ void TopicTailer::ProcessPendingSubscription(Flow* flow,
     LOG_INFO(info_log_,
       "Failed to deliver all from cache for %s on %s (will retry later)",
       id.ToString().c_str(),
-      topic.ToString().c_str());
+      topic_table_.GetUUID(topic).ToString().c_str());
     stats_.cache_reader_backoff->Add(1);
   }
 }
 
-void TopicTailer::AddSubscriberInternal(const TopicUUID& topic,
+void TopicTailer::AddSubscriptionToReader(TopicHandle topic,
+                                          CopilotSub id,
+                                          LogID logid,
+                                          SequenceNumber seqno) {
+  LogReader* reader = ReaderForNewSubscription(id, topic, logid, seqno);
+  RS_ASSERT(reader);
+  reader->StartReading(topic, logid, seqno);
+
+  // Add the new subscription.
+  bool was_added = topic_map_[logid].AddSubscriber(topic, seqno, id);
+  if (was_added) {
+    stats_.updated_subscriptions->Add(1);
+  }
+
+  LOG_DEBUG(info_log_,
+    "%s subscribed for %s@%" PRIu64 " (%s) on %sReader(%zu)",
+    id.ToString().c_str(),
+    topic_table_.GetUUID(topic).ToString().c_str(),
+    seqno,
+    was_added ? "new" : "update",
+    reader->IsVirtual() ? "Virtual" : "",
+    reader->GetReaderId());
+}
+
+bool TopicTailer::StartCatchUp(TopicHandle topic,
+                               CopilotSub id,
+                               LogID logid,
+                               SequenceNumber seqno) {
+  const SequenceNumber tail = GetTailSeqnoEstimate(logid);
+  if (catch_up_readers_.empty() ||
+      tail <= seqno ||
+      tail - seqno < options_.catch_up_min_backlog) {
+    return false;
+  }
+  RS_ASSERT(catch_ups_.find(id) == catch_ups_.end());
+
+  // Ranges are numbered from 0, and there are never more ranges read but not
+  // delivered than there are readers.
+  CatchUp& catch_up = catch_ups_[id];
+  catch_up.topic = topic;
+  catch_up.log_id = logid;
+  catch_up.next_range = seqno;
+  catch_up.end = tail;
+  catch_up.prev_seqno = seqno;
+  catch_up.ranges_started = 0;
+  catch_up.ranges_delivered = 0;
+  CatchUp* catch_up_ptr = &catch_up;
+  catch_up.ordered.reset(new OrderedProcessor<CatchUpRange>(
+    info_log_,
+    static_cast<int>(catch_up_readers_.size()),
+    [catch_up_ptr] (CatchUpRange range) {
+      for (CatchUpRecord& record : range) {
+        catch_up_ptr->ready.emplace_back(std::move(record));
+      }
+      catch_up_ptr->ranges_delivered++;
+    }));
+  stats_.catch_ups_started->Add(1);
+
+  LOG_INFO(info_log_,
+    "%s catching up %s on Log(%" PRIu64 ") from %" PRIu64 " to %" PRIu64,
+    id.ToString().c_str(),
+    topic_table_.GetUUID(topic).ToString().c_str(),
+    logid,
+    seqno,
+    tail);
+  ScheduleCatchUpReaders();
+  return true;
+}
+
+void TopicTailer::CancelCatchUp(CopilotSub id) {
+  auto it = catch_ups_.find(id);
+  if (it == catch_ups_.end()) {
+    return;
+  }
+  for (CatchUpReader& reader : catch_up_readers_) {
+    if (reader.active && reader.id == id) {
+      log_tailer_->StopReading(it->second.log_id, reader.reader_id);
+      reader.active = false;
+      reader.records.clear();
+    }
+  }
+  catch_ups_.erase(it);
+  ScheduleCatchUpReaders();
+}
+
+void TopicTailer::ScheduleCatchUpReaders() {
+  for (CatchUpReader& reader : catch_up_readers_) {
+    if (reader.active) {
+      continue;
+    }
+
+    // Give the reader to the subscription with fewest ranges in flight.
+    CopilotSub id;
+    CatchUp* next = nullptr;
+    uint64_t next_in_flight = catch_up_readers_.size();
+    for (auto& entry : catch_ups_) {
+      CatchUp& catch_up = entry.second;
+      const uint64_t in_flight =
+        catch_up.ranges_started - catch_up.ranges_delivered;
+      if (catch_up.next_range < catch_up.end && in_flight < next_in_flight) {
+        id = entry.first;
+        next = &catch_up;
+        next_in_flight = in_flight;
+      }
+    }
+    if (!next) {
+      break;
+    }
+
+    const SequenceNumber from = next->next_range;
+    const SequenceNumber to =
+      std::min<SequenceNumber>(next->end - from, options_.catch_up_range_size) +
+      from - 1;
+    Status st = log_tailer_->StartReading(next->log_id,
+                                          from,
+                                          reader.reader_id,
+                                          to);
+    if (!st.ok()) {
+      // Retried on next tick.
+      break;
+    }
+    reader.active = true;
+    reader.id = id;
+    reader.index = next->ranges_started++;
+    reader.to = to;
+    next->next_range = to + 1;
+  }
+}
+
+TopicTailer::CatchUpReader* TopicTailer::FindCatchUpReader(size_t reader_id) {
+  for (CatchUpReader& reader : catch_up_readers_) {
+    if (reader.reader_id == reader_id) {
+      return &reader;
+    }
+  }
+  return nullptr;
+}
+
+void TopicTailer::ReceiveCatchUpRecord(Flow* flow,
+                                       std::unique_ptr<MessageData> data,
+                                       CatchUpReader* reader) {
+  thread_check_.Check();
+  RS_ASSERT(reader->active);
+  stats_.catch_up_records_received->Add(1);
+
+  // Only records on the topic of the subscription are kept.
+  const CatchUp& catch_up = catch_ups_.find(reader->id)->second;
+  const SequenceNumber seqno = data->GetSequenceNumber();
+  if (topic_table_.GetUUID(catch_up.topic) ==
+      std::make_pair(data->GetNamespaceId(), data->GetTopicName())) {
+    CatchUpRecord record;
+    record.data = std::move(data);
+    record.type = GapType::kBenign;
+    record.to = seqno;
+    reader->records.emplace_back(std::move(record));
+  }
+  if (seqno >= reader->to) {
+    FinishCatchUpRange(flow, reader);
+  }
+}
+
+void TopicTailer::ReceiveCatchUpGap(Flow* flow,
+                                    GapType type,
+                                    SequenceNumber to,
+                                    CatchUpReader* reader) {
+  thread_check_.Check();
+  RS_ASSERT(reader->active);
+
+  // Benign gaps need not be delivered, the next record covers them.
+  if (type != GapType::kBenign) {
+    CatchUpRecord record;
+    record.type = type;
+    record.to = std::min(to, reader->to);
+    reader->records.emplace_back(std::move(record));
+  }
+  if (to >= reader->to) {
+    FinishCatchUpRange(flow, reader);
+  }
+}
+
+void TopicTailer::FinishCatchUpRange(Flow* flow, CatchUpReader* reader) {
+  const CopilotSub id = reader->id;
+  CatchUp& catch_up = catch_ups_.find(id)->second;
+  log_tailer_->StopReading(catch_up.log_id, reader->reader_id);
+  reader->active = false;
+  stats_.catch_up_ranges_read->Add(1);
+
+  Status st = catch_up.ordered->Process(std::move(reader->records),
+                                        reader->index);
+  RS_ASSERT(st.ok());
+  reader->records.clear();
+
+  // Deliver the ranges that are now in order.
+  Slice namespace_id;
+  Slice topic_name;
+  topic_table_.GetUUID(catch_up.topic).GetTopicID(&namespace_id, &topic_name);
+  for (CatchUpRecord& record : catch_up.ready) {
+    if (record.data) {
+      record.data->SetPreviousSequenceNumber(catch_up.prev_seqno);
+      on_message_(flow, *record.data, std::vector<CopilotSub>(1, id));
+      stats_.catch_up_records_delivered->Add(1);
+    } else {
+      MessageGap mgap(Tenant::GuestTenant,
+                      namespace_id.ToString(),
+                      topic_name.ToString(),
+                      record.type,
+                      catch_up.prev_seqno,
+                      record.to);
+      on_message_(flow, mgap, std::vector<CopilotSub>(1, id));
+    }
+    catch_up.prev_seqno = record.to + 1;
+  }
+  catch_up.ready.clear();
+
+  if (catch_up.next_range == catch_up.end &&
+      catch_up.ranges_delivered == catch_up.ranges_started) {
+    // Caught up, the log readers take it from here.
+    const TopicHandle topic = catch_up.topic;
+    const LogID log_id = catch_up.log_id;
+    const SequenceNumber end = catch_up.end;
+    catch_ups_.erase(id);
+    stats_.catch_ups_completed->Add(1);
+    LOG_INFO(info_log_,
+      "%s caught up on Log(%" PRIu64 ")@%" PRIu64,
+      id.ToString().c_str(),
+      log_id,
+      end);
+    ProcessPendingSubscription(flow, topic, id, log_id, end);
+  }
+  ScheduleCatchUpReaders();
+}
+
+void TopicTailer::AddSubscriberInternal(TopicHandle topic,
                                         CopilotSub id,
                                         LogID logid,
                                         SequenceNumber seqno) {
   RS_ASSERT(seqno != 0);
   thread_check_.Check();
 
+  // A resubscription starts over.
+  CancelCatchUp(id);
   GetPendingReaderQueue(id)->Write(id, PendingSubscription(logid, seqno));
-  stream_subscriptions_.Insert(id.stream_id, id.sub_id, topic);
+  InsertSubscription(topic, id);
+}
+
+void TopicTailer::InsertSubscription(TopicHandle topic, CopilotSub id) {
+  // An existing subscription keeps its topic.
+  if (!stream_subscriptions_.Find(id.stream_id, id.sub_id)) {
+    topic_table_.Acquire(topic);
+    stream_subscriptions_.Insert(id.stream_id, id.sub_id, topic);
+  }
 }
 
-void TopicTailer::RemoveSubscriberInternal(const TopicUUID& topic,
+void TopicTailer::RemoveSubscriberInternal(TopicHandle topic,
                                            CopilotSub id,
                                            LogID logid) {
   thread_check_.Check();
@@ -1693,6 +2289,7 @@ void TopicTailer::RemoveSubscriberInternal(const TopicUUID& topic,
   }
 
   GetPendingReaderQueue(id)->Remove(id);
+  CancelCatchUp(id);
 }
 
 void TopicTailer::RemoveSubscriberInternal(StreamID stream_id) {
@@ -1701,13 +2298,15 @@ void TopicTailer::RemoveSubscriberInternal(StreamID stream_id) {
   // Remove all subscriptions on this stream.
   stream_subscriptions_.VisitSubscriptions(
     stream_id,
-    [&] (SubscriptionID sub_id, const TopicUUID& topic) {
+    [&] (SubscriptionID sub_id, TopicHandle topic) {
       LogID log_id;
-      Status st = log_router_->GetLogID(topic, &log_id);
+      Status st = log_router_->GetLogID(topic_table_.GetUUID(topic), &log_id);
       if (st.ok()) {
         CopilotSub id(stream_id, sub_id);
         RemoveSubscriberInternal(topic, id, log_id);
       }
+      // Drop the reference of the subscription.
+      topic_table_.Release(topic);
     });
 
   stream_subscriptions_.Remove(stream_id);
@@ -1726,7 +2325,7 @@ LogReader* TopicTailer::FindLogReader(size_t reader_id) {
 
 
 LogReader* TopicTailer::ReaderForNewSubscription(CopilotSub id,
-                                                 const TopicUUID& topic,
+                                                 TopicHandle topic,
                                                  LogID logid,
                                                  SequenceNumber seqno) {
   // Find the best reader for this subscription.
@@ -1743,7 +2342,7 @@ LogReader* TopicTailer::ReaderForNewSubscription(CopilotSub id,
   uint64_t best_cost = kSubscriptionCostRewind;
   for (auto& reader : log_readers_) {
     // Find cost of accepting this new subscription.
-    uint64_t reader_cost = reader->SubscriptionCost(topic, logid, seqno);
+    uint64_t reader_cost = SubscriptionCost(reader.get(), topic, logid, seqno);
     if (reader_cost < best_cost) {
       // This is a better reader.
       best_reader = reader.get();
@@ -1753,29 +2352,53 @@ LogReader* TopicTailer::ReaderForNewSubscription(CopilotSub id,
   return best_reader;
 }
 
+uint64_t TopicTailer::SubscriptionCost(LogReader* reader,
+                                       TopicHandle topic,
+                                       LogID logid,
+                                       SequenceNumber seqno) {
+  uint64_t cost = reader->SubscriptionCost(topic, logid, seqno);
+  const SequenceNumber next_seqno = reader->GetNextSequenceNumber(logid);
+  if (next_seqno != 0 && next_seqno <= seqno) {
+    // The reader is behind, cost it by what it must read to get there.
+    const DataCache& data_cache = *data_cache_;
+    cost = CatchUpCost(next_seqno, seqno, reader->GetReadRate(logid),
+      [&] (SequenceNumber from, SequenceNumber to) {
+        return UncachedDistance(data_cache, logid, from, to);
+      });
+  }
+  return cost;
+}
+
 bool TopicTailer::AttemptReaderMerges(LogReader* src, LogID log_id) {
   // Attempt to merge src reader into all other readers on log_id.
   for (auto& dest : log_readers_) {
     if (src != dest.get() && src->CanMergeInto(dest.get(), log_id)) {
-      // Perform merge.
-      src->MergeInto(dest.get(), log_id);
-      stats_.reader_merges->Add(1);
-
-      // Now check if there are pending subscriptions on the virtual reader.
-      if (pending_reader_->IsLogOpen(log_id)) {
-        // We'll subsume the subscriptions from the virtual reader.
-        src->StealLogSubscriptions(pending_reader_.get(), log_id);
-      }
+      MergeReaders(src, dest.get(), log_id);
       return true;
     }
   }
   return false;
 }
 
+void TopicTailer::MergeReaders(LogReader* src, LogReader* dest, LogID log_id) {
+  src->MergeInto(dest, log_id);
+  stats_.reader_merges->Add(1);
+
+  // Now check if there are pending subscriptions on the virtual reader.
+  if (pending_reader_->IsLogOpen(log_id)) {
+    // We'll subsume the subscriptions from the virtual reader.
+    src->StealLogSubscriptions(pending_reader_.get(), log_id);
+  }
+}
+
 Statistics TopicTailer::GetStatistics() const {
-  stats_.cache_usage->Set(data_cache_.GetUsage()); // update cache statistics
+  // A shared cache is accounted by the first room only, so that its usage is
+  // not counted once per room when statistics of rooms are aggregated.
+  if (!data_cache_->IsShared() || worker_id_ == 0) {
+    stats_.cache_usage->Set(data_cache_->GetUsage()); // update cache statistics
+  }
   Statistics stats = stats_.all;
-  stats.Aggregate(data_cache_.GetStatistics());
+  stats.Aggregate(data_cache_->GetStatistics());
   return stats;
 }
 
@@ -1801,18 +2424,19 @@ TopicTailer::GetPendingReaderQueue(const CopilotSub& sub) {
       cache_readers_[worker_id].get(),
       [this] (Flow* flow, std::pair<CopilotSub, PendingSubscription> item) {
         const auto& id = item.first;
-        TopicUUID* uuid = stream_subscriptions_.Find(id.stream_id, id.sub_id);
-        if (uuid) {
+        TopicHandle* topic =
+          stream_subscriptions_.Find(id.stream_id, id.sub_id);
+        if (topic) {
           const LogID logid = item.second.logid;
           const SequenceNumber seqno = item.second.seqno;
 
           LOG_DEBUG(info_log_,
             "Retrying delivery for %s on %s@%" PRIu64,
             id.ToString().c_str(),
-            uuid->ToString().c_str(),
+            topic_table_.GetUUID(*topic).ToString().c_str(),
             seqno);
 
-          ProcessPendingSubscription(flow, *uuid, id, logid, seqno);
+          ProcessPendingSubscription(flow, *topic, id, logid, seqno);
         }
       });
   }
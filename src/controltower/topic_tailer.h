@@ -5,8 +5,10 @@
 //
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <random>
+#include <unordered_map>
 #include <vector>
 #include "include/Status.h"
 #include "include/Types.h"
@@ -15,8 +17,10 @@
 #include "src/messages/msg_loop.h"
 #include "src/util/storage.h"
 #include "src/util/subscription_map.h"
+#include "src/util/topic_table.h"
 #include "src/util/topic_uuid.h"
 #include "src/util/common/linked_map.h"
+#include "src/util/common/ordered_processor.h"
 #include "src/util/common/statistics.h"
 #include "src/util/common/thread_check.h"
 #include "src/controltower/options.h"
@@ -48,6 +52,9 @@ class TopicTailer {
    * @param log_router For routing topics to logs.
    * @param info_log For logging.
    * @param cache_size_per_room cache size in bytes
+   * @param shared_cache Cache shared by all rooms, see NewDataCache. If
+   *                     provided, cache_size_per_room is ignored.
+   * @param cache_spill Second tier of the cache, shared by all rooms, or null.
    * @param cache_data_from_system_namespaces
    * @param cache_block_size  Number of messages in a cache block
    * @param bloom_bits_per_msg (used in cache)
@@ -64,6 +71,8 @@ class TopicTailer {
     std::shared_ptr<LogRouter> log_router,
     std::shared_ptr<Logger> info_log,
     size_t cache_size_per_room,
+    std::shared_ptr<Cache> shared_cache,
+    std::shared_ptr<DataCacheSpill> cache_spill,
     bool cache_data_from_system_namespaces,
     size_t cache_block_size,
     int bloom_bits_per_msg,
@@ -78,12 +87,15 @@ class TopicTailer {
    * Initialize the TopicTailer first before using it.
    *
    * @param reader_ids IDs of readers on LogTailer.
+   * @param catch_up_reader_ids IDs of readers on LogTailer that read ranges
+   *                            of the backlog of subscriptions far behind.
    * @param max_subscription_lag Maximum number of sequence numbers that a
    *                             subscription can lag behind before being sent
    *                             a gap.
    * @return ok if successful, otherwise error code.
    */
   Status Initialize(const std::vector<size_t>& reader_ids,
+                    const std::vector<size_t>& catch_up_reader_ids,
                     int64_t max_subscription_lag);
 
   /**
@@ -167,6 +179,18 @@ class TopicTailer {
    */
   SequenceNumber GetTailSeqnoEstimate(LogID log_id) const;
 
+  /**
+   * Finds the tail seqno of a log, and invokes the callback with it on the
+   * room thread. Uses the estimate if there is one, otherwise waits for the
+   * storage request on the log, which is shared with concurrent requests
+   * and subscriptions at 0.
+   *
+   * @param log_id Log to find tail seqno of.
+   * @param callback Invoked with the tail seqno.
+   */
+  void FindTailSeqno(LogID log_id,
+                     std::function<void(Status, SequenceNumber)> callback);
+
   /**
    * Get human-readable information about a particular log.
    */
@@ -206,6 +230,53 @@ class TopicTailer {
     SequenceNumber seqno;
   };
 
+  // A record, or a malignant gap if data is null, read by a catch-up reader
+  // on the topic of the subscription being caught up.
+  struct CatchUpRecord {
+    std::unique_ptr<MessageData> data;
+    GapType type;
+    SequenceNumber to;
+  };
+
+  typedef std::vector<CatchUpRecord> CatchUpRange;
+
+  // A subscription far behind the tail, whose backlog is read in ranges by
+  // catch-up readers in parallel, before it is handed to the log readers.
+  struct CatchUp {
+    TopicHandle topic;
+    LogID log_id;
+    // Start of the first range not yet given to a reader.
+    SequenceNumber next_range;
+    // Seqno the subscription is handed to the log readers at.
+    SequenceNumber end;
+    // Previous seqno for the next record delivered.
+    SequenceNumber prev_seqno;
+    // Number of ranges given to readers, and delivered in order.
+    uint64_t ranges_started;
+    uint64_t ranges_delivered;
+    // Puts ranges read back in order.
+    std::unique_ptr<OrderedProcessor<CatchUpRange>> ordered;
+    // Records of ranges put in order, to be delivered.
+    CatchUpRange ready;
+  };
+
+  // A LogTailer reader reserved for catch-up ranges.
+  struct CatchUpReader {
+    explicit CatchUpReader(size_t _reader_id)
+    : reader_id(_reader_id), active(false) {}
+
+    size_t reader_id;
+    // Whether the reader is reading a range for the subscription id.
+    bool active;
+    CopilotSub id;
+    // Number of the range within the subscription backlog.
+    uint64_t index;
+    // Last seqno of the range.
+    SequenceNumber to;
+    // Records read so far.
+    CatchUpRange records;
+  };
+
   // private constructor
   TopicTailer(BaseEnv* env,
               MsgLoop* msg_loop,
@@ -214,6 +285,8 @@ class TopicTailer {
               std::shared_ptr<LogRouter> log_router,
               std::shared_ptr<Logger> info_log,
               size_t cache_size_per_room,
+              std::shared_ptr<Cache> shared_cache,
+              std::shared_ptr<DataCacheSpill> cache_spill,
               bool cache_data_from_system_namespaces,
               size_t cache_block_size,
               int bloom_bits_per_msg,
@@ -224,22 +297,28 @@ class TopicTailer {
               ControlTowerOptions::TopicTailer options);
 
   void AddTailSubscriber(Flow* flow,
-                         const TopicUUID& topic,
+                         TopicHandle topic,
                          CopilotSub id,
                          LogID logid,
                          SequenceNumber seqno);
 
-  void AddSubscriberInternal(const TopicUUID& topic,
+  void AddSubscriberInternal(TopicHandle topic,
                              CopilotSub id,
                              LogID logid,
                              SequenceNumber start);
 
-  void RemoveSubscriberInternal(const TopicUUID& topic,
+  void RemoveSubscriberInternal(TopicHandle topic,
                                 CopilotSub id,
                                 LogID logid);
 
   void RemoveSubscriberInternal(StreamID stream_id);
 
+  /**
+   * Records the topic of a subscription, unless the subscription exists.
+   * The subscription acquires a reference to the topic.
+   */
+  void InsertSubscription(TopicHandle topic, CopilotSub id);
+
   /**
    * Finds the LogReader* with given reader_id, or nullptr if none found.
    */
@@ -249,10 +328,80 @@ class TopicTailer {
    * Assign a new subscription (id + topic) to a LogReader.
    */
   LogReader* ReaderForNewSubscription(CopilotSub id,
-                                      const TopicUUID& topic,
+                                      TopicHandle topic,
                                       LogID logid,
                                       SequenceNumber seqno);
 
+  /**
+   * Returns the cost of a reader accepting a new subscription (lower better),
+   * taking into account what the reader will find in the cache and how fast
+   * it is reading.
+   */
+  uint64_t SubscriptionCost(LogReader* reader,
+                            TopicHandle topic,
+                            LogID logid,
+                            SequenceNumber seqno);
+
+  /**
+   * Estimates the number of records in [from, to) of a log that must be read
+   * from the log, as opposed to the cache.
+   */
+  static uint64_t UncachedDistance(const DataCache& data_cache,
+                                   LogID log_id,
+                                   SequenceNumber from,
+                                   SequenceNumber to);
+
+  /**
+   * Estimates the number of records in [from, to) of some log that must be
+   * read from the log, see UncachedDistance.
+   */
+  typedef std::function<uint64_t(SequenceNumber, SequenceNumber)>
+    DistanceFunction;
+
+  /**
+   * Position and recent read rate of a reader on a log.
+   */
+  struct ReaderProgress {
+    SequenceNumber next_seqno;
+    double read_rate;
+  };
+
+  /**
+   * Returns the cost for a reader at next_seqno, which is not past seqno, of
+   * accepting a new subscription at seqno.
+   */
+  static uint64_t CatchUpCost(SequenceNumber next_seqno,
+                              SequenceNumber seqno,
+                              double read_rate,
+                              const DistanceFunction& uncached_distance);
+
+  /**
+   * Plans which readers of a log to merge, see PlanReaderMerges.
+   *
+   * @param readers Readers of the log, in order of next_seqno.
+   * @param pending Are subscriptions waiting on the virtual reader for the
+   *                log? If so, at least one reader is merged, if any can be.
+   * @param tail_seqno Estimated tail of the log, or 0 if unknown. Readers at
+   *                   the tail are never merged into readers behind them.
+   * @param uncached_distance Cost of reading a range of the log again.
+   * @return Pairs of indices (src, dest) in readers, for merging src into
+   *         dest, in the order to merge them.
+   */
+  static std::vector<std::pair<size_t, size_t>> PlanMerges(
+    const std::vector<ReaderProgress>& readers,
+    bool pending,
+    SequenceNumber tail_seqno,
+    const DistanceFunction& uncached_distance);
+
+  /**
+   * Picks the reader that takes over the subscriptions of a log waiting on
+   * the virtual reader.
+   *
+   * @param log_open Whether each reader is reading the log.
+   * @return Index of the reader, or log_open.size() if there is none.
+   */
+  static size_t PlanPendingSteal(const std::vector<bool>& log_open);
+
   /**
    * Attempt to merge src into all other readers.
    * Merging into another reader means that the other reader will subsume all
@@ -262,12 +411,32 @@ class TopicTailer {
    */
   bool AttemptReaderMerges(LogReader* src, LogID log_id);
 
+  /**
+   * Merges src into dest on log_id, which must not be ahead of src. src then
+   * takes over subscriptions waiting on the virtual reader, if any.
+   */
+  void MergeReaders(LogReader* src, LogReader* dest, LogID log_id);
+
+  /**
+   * Updates reader read rates, and plans merges of readers on each log, so
+   * that fewer readers are open per log. Called on every tick, but each log
+   * is only planned every kPlanMergesTicks ticks, unless subscriptions are
+   * waiting on the virtual reader for it.
+   */
+  void PlanReaders();
+
+  /**
+   * Merges readers of a log into readers behind them, where the records in
+   * between are cheap to read again.
+   */
+  void PlanReaderMerges(LogID log_id);
+
   /**
    * Deliver as much data from cache as possible.
    * seqno is set to the new fast-forwarded sequence number to subscribe to.
    * @return true if all was delivered, or false if caller must retry later.
    */
-  bool DeliverFromCache(Flow* flow, const TopicUUID& topic,
+  bool DeliverFromCache(Flow* flow, TopicHandle topic,
           CopilotSub copilot_sub, LogID logid, SequenceNumber* seqno);
 
   /**
@@ -290,6 +459,12 @@ class TopicTailer {
   /** Returns the number of FindLatestSeqno requests currently in flight. */
   size_t InFlightFindLatestSeqnoRequests() const;
 
+  /**
+   * Sends a FindLatestSeqno request for a log, or queues it if too many are
+   * in flight, unless there is one for the log already.
+   */
+  void RequestLatestSeqno(LogID log_id);
+
   /**
    * Process a record from a log. Not thread safe.
    *
@@ -332,11 +507,61 @@ class TopicTailer {
    * subscription will be added to a pending queue to be re-processed later.
    */
   void ProcessPendingSubscription(Flow* flow,
-                                  const TopicUUID& topic,
+                                  TopicHandle topic,
                                   CopilotSub id,
                                   LogID logid,
                                   SequenceNumber seqno);
 
+  /**
+   * Adds a subscription to the log reader best placed to serve it.
+   */
+  void AddSubscriptionToReader(TopicHandle topic,
+                               CopilotSub id,
+                               LogID logid,
+                               SequenceNumber seqno);
+
+  /**
+   * Starts catching up a subscription with catch-up readers, if it is far
+   * enough behind the tail.
+   *
+   * @return true if the subscription is being caught up.
+   */
+  bool StartCatchUp(TopicHandle topic,
+                    CopilotSub id,
+                    LogID logid,
+                    SequenceNumber seqno);
+
+  /**
+   * Stops catching up a subscription, if it is being caught up.
+   */
+  void CancelCatchUp(CopilotSub id);
+
+  /**
+   * Gives the next ranges of subscriptions being caught up to idle catch-up
+   * readers.
+   */
+  void ScheduleCatchUpReaders();
+
+  /** Finds the catch-up reader with given reader_id, or nullptr if none. */
+  CatchUpReader* FindCatchUpReader(size_t reader_id);
+
+  /** Processes a record read by a catch-up reader. */
+  void ReceiveCatchUpRecord(Flow* flow,
+                            std::unique_ptr<MessageData> data,
+                            CatchUpReader* reader);
+
+  /** Processes a gap read by a catch-up reader. */
+  void ReceiveCatchUpGap(Flow* flow,
+                         GapType type,
+                         SequenceNumber to,
+                         CatchUpReader* reader);
+
+  /**
+   * Delivers the records of a range once all ranges before it have been
+   * delivered, and hands the subscription to the log readers after the last.
+   */
+  void FinishCatchUpRange(Flow* flow, CatchUpReader* reader);
+
   /** Pending reader queue for a subscription */
   ObservableMap<CopilotSub, PendingSubscription>*
   GetPendingReaderQueue(const CopilotSub& sub);
@@ -375,14 +600,23 @@ class TopicTailer {
                      const Message&,
                      std::vector<CopilotSub>)> on_message_;
 
+  // Topics of all subscriptions, interned so that readers and topic
+  // managers key their maps on handles. Every subscription in
+  // stream_subscriptions_ holds one reference to its topic.
+  TopicTable topic_table_;
+
   // Subscription information per topic
   std::unordered_map<LogID, TopicManager> topic_map_;
 
   // Cached tail sequence number per log.
   std::unordered_map<LogID, SequenceNumber> tail_seqno_cached_;
 
+  // Readers for catch-up ranges, and the subscriptions being caught up.
+  std::vector<CatchUpReader> catch_up_readers_;
+  std::unordered_map<CopilotSub, CatchUp> catch_ups_;
+
   // Cache of data read from storage
-  DataCache data_cache_;
+  std::unique_ptr<DataCache> data_cache_;
 
   std::mt19937_64& prng_;
 
@@ -393,12 +627,26 @@ class TopicTailer {
     latest_seqno_queues_;
 
   // Map of subscriptions per stream.
-  SubscriptionMap<TopicUUID> stream_subscriptions_;
+  SubscriptionMap<TopicHandle> stream_subscriptions_;
 
   // The set of copilots awaiting find time response for each log.
+  // Every log with a request in flight or queued has an entry.
   std::unordered_map<LogID, std::vector<CopilotSub>>
     pending_find_time_response_;
 
+  // Callbacks of FindTailSeqno awaiting find time response for each log.
+  std::unordered_map<LogID,
+                     std::vector<std::function<void(Status, SequenceNumber)>>>
+    pending_find_time_callbacks_;
+
+  // Results of recent find time requests, for logs that are not read, in
+  // order of expiry.
+  struct RecentTailSeqno {
+    SequenceNumber seqno;
+    uint64_t expiry_micros;
+  };
+  LinkedMap<LogID, RecentTailSeqno> recent_tail_seqnos_;
+
   // Set of FindLatestSeqno requests that haven't been sent yet.
   LinkedSet<LogID> pending_find_time_requests_;
 
@@ -418,6 +666,9 @@ class TopicTailer {
   // Maps copilots to worker thread index.
   std::function<int(const CopilotSub&)> copilot_worker_;
 
+  // Number of ticks so far, for planning reader merges every few ticks.
+  uint64_t plan_ticks_;
+
   struct Stats {
     Stats() {
       const std::string prefix = "tower.topic_tailer.";
@@ -464,6 +715,28 @@ class TopicTailer {
         all.AddCounter(prefix + "records_served_from_cache");
       reader_merges =
         all.AddCounter(prefix + "reader_merges");
+      planned_reader_merges =
+        all.AddCounter(prefix + "planned_reader_merges");
+      pending_reader_steals =
+        all.AddCounter(prefix + "pending_reader_steals");
+      find_time_requests =
+        all.AddCounter(prefix + "find_time_requests");
+      find_time_requests_coalesced =
+        all.AddCounter(prefix + "find_time_requests_coalesced");
+      find_tail_seqno_requests =
+        all.AddCounter(prefix + "find_tail_seqno_requests");
+      find_tail_seqno_requests_fast =
+        all.AddCounter(prefix + "find_tail_seqno_requests_fast");
+      catch_ups_started =
+        all.AddCounter(prefix + "catch_ups_started");
+      catch_ups_completed =
+        all.AddCounter(prefix + "catch_ups_completed");
+      catch_up_ranges_read =
+        all.AddCounter(prefix + "catch_up_ranges_read");
+      catch_up_records_received =
+        all.AddCounter(prefix + "catch_up_records_received");
+      catch_up_records_delivered =
+        all.AddCounter(prefix + "catch_up_records_delivered");
       cache_reentries =
         all.AddCounter(prefix + "cache_reentries");
       cache_usage =
@@ -496,6 +769,17 @@ class TopicTailer {
     Counter* remove_subscriber_requests;
     Counter* records_served_from_cache;
     Counter* reader_merges;
+    Counter* planned_reader_merges;
+    Counter* pending_reader_steals;
+    Counter* find_time_requests;
+    Counter* find_time_requests_coalesced;
+    Counter* find_tail_seqno_requests;
+    Counter* find_tail_seqno_requests_fast;
+    Counter* catch_ups_started;
+    Counter* catch_ups_completed;
+    Counter* catch_up_ranges_read;
+    Counter* catch_up_records_received;
+    Counter* catch_up_records_delivered;
     Counter* cache_reentries;
     Counter* cache_usage;
     Counter* cache_reader_backoff;
@@ -47,6 +47,10 @@ ControlTower::SanitizeOptions(const ControlTowerOptions& src) {
       result.info_log = std::make_shared<NullLogger>();
     }
   }
+  if (result.topic_tailer.catch_up_range_size == 0) {
+    // Empty ranges would never catch up.
+    result.topic_tailer.catch_up_readers = 0;
+  }
   return result;
 }
 
@@ -79,6 +83,10 @@ ControlTower::ControlTower(const ControlTowerOptions& options):
 }
 
 ControlTower::~ControlTower() {
+  // Blocks evicted while the caches are destroyed need not be spilled.
+  if (cache_spill_) {
+    cache_spill_->Close();
+  }
 }
 
 void ControlTower::Stop() {
@@ -163,18 +171,35 @@ Status ControlTower::Initialize() {
 
     st = log_tailer_[room]->Initialize(std::move(on_record),
                                        std::move(on_gap),
-                                       opt.readers_per_room);
+                                       opt.readers_per_room +
+                                       opt.topic_tailer.catch_up_readers);
     if (!st.ok()) {
       return st;
     }
   }
 
-  // equally distribute the cache among the workers
+  // Either share one cache between all rooms, or equally distribute the
+  // cache among the workers
+  std::shared_ptr<Cache> shared_cache;
   size_t cache_size_per_room = 0;
-  if (opt.topic_tailer.cache_size > 0) {
+  if (opt.topic_tailer.shared_cache) {
+    shared_cache = NewDataCache(opt.topic_tailer.cache_size,
+                                opt.topic_tailer.cache_shard_bits,
+                                opt.topic_tailer.cache_admission_filter);
+  } else if (opt.topic_tailer.cache_size > 0) {
     cache_size_per_room = std::max(opt.topic_tailer.cache_size / num_rooms,
                                    1024UL);
   }
+  if (!opt.topic_tailer.cache_spill_directory.empty()) {
+    st = DataCacheSpill::Open(opt.env,
+                              opt.topic_tailer.cache_spill_directory,
+                              opt.topic_tailer.cache_spill_size,
+                              opt.topic_tailer.cache_spill_segment_size,
+                              &cache_spill_);
+    if (!st.ok()) {
+      return st;
+    }
+  }
 
   // Now create the TopicTailer.
   // One per room with one reader each.
@@ -199,6 +224,8 @@ Status ControlTower::Initialize() {
                                         opt.log_router,
                                         opt.info_log,
                                         cache_size_per_room,
+                                        shared_cache,
+                                        cache_spill_,
                                         opt.topic_tailer.
                                         cache_data_from_system_namespaces,
                                         opt.topic_tailer.cache_block_size,
@@ -208,10 +235,17 @@ Status ControlTower::Initialize() {
                                         opt.topic_tailer,
                                         &topic_tailer);
     if (st.ok()) {
-      // Topic tailer has its own set of reader IDs for the log tailer.
+      // Topic tailer has its own set of reader IDs for the log tailer,
+      // followed by the IDs of its catch-up readers.
       std::vector<size_t> reader_ids(opt.readers_per_room);
       std::iota(reader_ids.begin(), reader_ids.end(), 0);
-      st = topic_tailer->Initialize(reader_ids, opt.max_subscription_lag);
+      std::vector<size_t> catch_up_reader_ids(
+        opt.topic_tailer.catch_up_readers);
+      std::iota(catch_up_reader_ids.begin(), catch_up_reader_ids.end(),
+                opt.readers_per_room);
+      st = topic_tailer->Initialize(reader_ids,
+                                    catch_up_reader_ids,
+                                    opt.max_subscription_lag);
     }
     if (!st.ok()) {
       return st;
@@ -318,7 +352,7 @@ void ControlTower::ProcessFindTailSeqno(std::unique_ptr<Message> msg,
     return;
   }
 
-  // Send FindLatestSeqno request to log tailer.
+  // Find the tail seqno in the room that owns the log.
   auto msg_moved = folly::makeMoveWrapper(std::move(msg));
   auto callback =
     [this, log_id, msg_moved, origin, worker_id]
@@ -358,22 +392,8 @@ void ControlTower::ProcessFindTailSeqno(std::unique_ptr<Message> msg,
   const int room = LogIDToRoom(log_id);
   std::unique_ptr<Command> cmd(
     MakeExecuteCommand([this, room, log_id, callback] () mutable {
-      SequenceNumber seqno = topic_tailer_[room]->GetTailSeqnoEstimate(log_id);
-      if (seqno) {
-        callback(Status::OK(), seqno);
-      } else {
-        Status status = log_tailer_[room]->FindLatestSeqno(log_id, callback);
-        if (status.ok()) {
-          LOG_DEBUG(options_.info_log,
-            "Sent FindLatestSeqno for Log(%" PRIu64 ")",
-            log_id);
-        } else {
-          LOG_ERROR(options_.info_log,
-            "FindLatestSeqno for Log(%" PRIu64 ") failed with: %s",
-            log_id,
-            status.ToString().c_str());
-        }
-      }
+      // Coalesced with other requests on the log, in the room that owns it.
+      topic_tailer_[room]->FindTailSeqno(log_id, std::move(callback));
     }));
   auto& queue = tower_to_room_queues_[worker_id][room];
   if (!queue->Write(cmd)) {
@@ -506,8 +526,12 @@ std::string ControlTower::GetInfoSync(std::vector<std::string> args) {
       } else {
         return "Unknown options for cache {capacity | usage}";
       }
+      // A shared cache is the same in every room, so ask the first one only.
+      const unsigned int num_rooms =
+        options_.topic_tailer.shared_cache ?
+        1 : static_cast<unsigned int>(rooms_.size());
       size_t sum = 0;
-      for (unsigned int room = 0; room < rooms_.size(); room++) {
+      for (unsigned int room = 0; room < num_rooms; room++) {
         std::string result;
         Status st =
           (get_capacity ?
@@ -562,7 +586,10 @@ std::string ControlTower::SetInfoSync(std::vector<std::string> args) {
         // see that the new size is not above some resonable limit, e.g. 1TB
         size_t cache_size_per_room = 0;
         if (newsize <= 1024L * 1024L * 1024L * 1024L) {
-          if (newsize > 0) {
+          if (options_.topic_tailer.shared_cache) {
+            // Every room sets the same capacity of the shared cache.
+            cache_size_per_room = newsize;
+          } else if (newsize > 0) {
             cache_size_per_room = std::max(newsize / rooms_.size(), 1024UL);
           }
           for (unsigned int room = 0; room < rooms_.size(); room++) {
@@ -18,6 +18,7 @@
 namespace rocketspeed {
 
 class ControlRoom;
+class DataCacheSpill;
 class LogTailer;
 class TopicTailer;
 class Statistics;
@@ -98,6 +99,9 @@ class ControlTower {
   std::vector<std::unique_ptr<LogTailer>> log_tailer_;
   std::vector<std::unique_ptr<TopicTailer>> topic_tailer_;
 
+  // Second tier of the cache shared by all topic tailers, if any.
+  std::shared_ptr<DataCacheSpill> cache_spill_;
+
   // Queues for communicating from Tower processor to Rooms.
   std::vector<std::vector<std::shared_ptr<CommandQueue>>>
     tower_to_room_queues_;
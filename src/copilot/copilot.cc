@@ -176,6 +176,17 @@ void Copilot::ProcessDeliver(std::unique_ptr<Message> msg, StreamID origin) {
   }
 }
 
+void Copilot::ProcessDeliverMulticast(std::unique_ptr<Message> msg,
+                                      StreamID origin) {
+  options_.msg_loop->ThreadCheck();
+
+  // Subscriptions may belong to different workers, so split the message.
+  auto multicast = static_cast<MessageDeliverMulticast*>(msg.get());
+  for (auto& data : multicast->Demultiplex()) {
+    ProcessDeliver(std::move(data), origin);
+  }
+}
+
 void Copilot::ProcessGap(std::unique_ptr<Message> msg, StreamID origin) {
   options_.msg_loop->ThreadCheck();
 
@@ -382,6 +393,10 @@ std::map<MessageType, MsgCallbackType> Copilot::InitializeCallbacks() {
       Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
     ProcessDeliver(std::move(msg), origin);
   };
+  cb[MessageType::mDeliverMulticast] = [this](
+      Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
+    ProcessDeliverMulticast(std::move(msg), origin);
+  };
   cb[MessageType::mDeliverGap] = [this](
       Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
     ProcessGap(std::move(msg), origin);
@@ -104,6 +104,7 @@ class Copilot {
 
   // callbacks to process incoming messages
   void ProcessDeliver(std::unique_ptr<Message> msg, StreamID origin);
+  void ProcessDeliverMulticast(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessGap(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessTailSeqno(std::unique_ptr<Message> msg, StreamID origin);
   void ProcessSubscribe(std::unique_ptr<Message> msg, StreamID origin);
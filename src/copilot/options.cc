@@ -23,10 +23,13 @@ CopilotOptions::CopilotOptions()
     rollcall_enabled(true),
     rollcall_max_batch_size_bytes(16 << 10),
     rollcall_flush_latency(500),
+    rollcall_max_flush_latency(5000),
+    rollcall_delta_encoding(false),
     timer_interval_micros(500000),
     resubscriptions_per_second(10000),
     tower_subscriptions_check_period(10 * 60),
-    rebalances_per_second(1000) {
+    rebalances_per_second(1000),
+    multicast_delivery(false) {
 }
 
 }  // namespace rocketspeed
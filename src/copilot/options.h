@@ -89,10 +89,24 @@ struct CopilotOptions {
   // Default: 16KB
   size_t rollcall_max_batch_size_bytes;
 
-  // Time to wait before flushing a rollcall batch.
+  // Time to wait before flushing a rollcall batch. Batches are held open for
+  // longer while appends to the log are slow, so that more subscribe and
+  // unsubscribe pairs cancel out before reaching the log.
   // Default: 500ms
   std::chrono::milliseconds rollcall_flush_latency;
 
+  // Upper bound on the time a rollcall batch is held open while appends are
+  // slow. Never less than rollcall_flush_latency.
+  // Default: 5000ms
+  std::chrono::milliseconds rollcall_max_flush_latency;
+
+  // Write rollcall batches with delta encoded topic names (entry version
+  // '3'), which are smaller for topics sharing prefixes. Rollcall readers
+  // which predate the format drop such batches, so enable this only once all
+  // of them have been upgraded.
+  // Default: false
+  bool rollcall_delta_encoding;
+
   // Time between health check ticks.
   // Default: 500,000 (0.5s)
   uint64_t timer_interval_micros;
@@ -112,6 +126,14 @@ struct CopilotOptions {
   // Default: 1000
   int rebalances_per_second;
 
+  // Deliver a record to all subscriptions of a tenant on the same client
+  // stream in a single MessageDeliverMulticast, rather than in one
+  // MessageDeliverData per subscription. The legacy proxy and older clients
+  // cannot decode MessageDeliverMulticast, so enable this only once no such
+  // client connects to the copilot.
+  // Default: false
+  bool multicast_delivery;
+
   // Create CopilotOptions with default values for all fields
   CopilotOptions();
 };
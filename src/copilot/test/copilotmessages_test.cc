@@ -6,6 +6,9 @@
 
 #include <unistd.h>
 #include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <set>
 #include <string>
@@ -37,6 +40,12 @@ class CopilotTest : public ::testing::Test {
   Env* env_;
   EnvOptions env_options_;
   std::shared_ptr<Logger> info_log_;
+
+  typedef CopilotWorker::Subscriptions Subscriptions;
+
+  // Subscribes and unsubscribes through the copilot, and reads the entries
+  // back from the rollcall topics.
+  void TestRollcall(bool delta_encoding);
 };
 
 TEST_F(CopilotTest, WorkerMapping) {
@@ -118,11 +127,79 @@ TEST_F(CopilotTest, NoLogger) {
   delete copilot;
 }
 
-TEST_F(CopilotTest, Rollcall) {
+TEST_F(CopilotTest, Subscriptions) {
+  Subscriptions subs;
+  std::vector<uint32_t> found;
+
+  // Subscriptions at 0, 5 and 10, on two streams.
+  const uint32_t at0 =
+    subs.Add(1, 0, 0, GuestTenant, SubscriptionID::Unsafe(1));
+  const uint32_t at5 =
+    subs.Add(1, 5, 0, GuestTenant, SubscriptionID::Unsafe(2));
+  const uint32_t at10 =
+    subs.Add(2, 10, 1, GuestTenant, SubscriptionID::Unsafe(1));
+  ASSERT_EQ(subs.Size(), 3u);
+
+  // Records from 0 only reach subscriptions at 0.
+  subs.FindExpecting(0, 7, &found);
+  ASSERT_EQ(found, std::vector<uint32_t>({at0}));
+  subs.FindExpecting(0, 0, &found);
+  ASSERT_EQ(found, std::vector<uint32_t>({at0}));
+
+  // Records from a non-zero seqno reach subscriptions in the range.
+  subs.FindExpecting(5, 10, &found);
+  ASSERT_EQ(found, std::vector<uint32_t>({at5, at10}));
+  subs.FindExpecting(1, 5, &found);
+  ASSERT_EQ(found, std::vector<uint32_t>({at5}));
+  subs.FindExpecting(6, 9, &found);
+  ASSERT_TRUE(found.empty());
+  subs.FindExpecting(10, 5, &found);
+  ASSERT_TRUE(found.empty());
+
+  // A removed subscription frees its slot, which never matches, even for
+  // a range covering the seqno of free slots.
+  subs.Remove(at5);
+  ASSERT_EQ(subs.Size(), 2u);
+  ASSERT_TRUE(!subs.IsLive(at5));
+  ASSERT_TRUE(subs.Find(1, SubscriptionID::Unsafe(2)) ==
+              Subscriptions::kNotFound);
+  subs.FindExpecting(1, std::numeric_limits<SequenceNumber>::max(), &found);
+  ASSERT_EQ(found, std::vector<uint32_t>({at10}));
+  subs.FindExpecting(0, std::numeric_limits<SequenceNumber>::max(), &found);
+  ASSERT_EQ(found, std::vector<uint32_t>({at0}));
+
+  // The free slot is reused, and other subscriptions keep their indices.
+  const uint32_t at7 =
+    subs.Add(2, 7, 1, GuestTenant, SubscriptionID::Unsafe(2));
+  ASSERT_EQ(at7, at5);
+  ASSERT_EQ(subs.Size(), 3u);
+  ASSERT_EQ(subs.Find(1, SubscriptionID::Unsafe(1)), at0);
+  ASSERT_EQ(subs.Find(2, SubscriptionID::Unsafe(1)), at10);
+  ASSERT_EQ(subs.Find(2, SubscriptionID::Unsafe(2)), at7);
+  ASSERT_EQ(subs.seqno(at0), 0u);
+  ASSERT_EQ(subs.seqno(at10), 10u);
+  ASSERT_EQ(subs.stream_id(at7), 2u);
+  ASSERT_EQ(subs.worker_id(at7), 1);
+  subs.FindExpecting(5, 10, &found);
+  ASSERT_EQ(found, std::vector<uint32_t>({at7, at10}));
+
+  // Slots are appended only when none is free.
+  const uint32_t at20 =
+    subs.Add(3, 20, 2, GuestTenant, SubscriptionID::Unsafe(1));
+  ASSERT_EQ(at20, 3u);
+  std::vector<uint32_t> all;
+  subs.ForEach([&](uint32_t index) { all.push_back(index); });
+  ASSERT_EQ(all, std::vector<uint32_t>({at0, at7, at10, at20}));
+}
+
+void CopilotTest::TestRollcall(bool delta_encoding) {
   using namespace std::placeholders;
 
   // Create cluster with pilot, copilot and controltower only.
-  LocalTestCluster cluster(info_log_, true, true, true);
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log_;
+  opts.copilot.rollcall_delta_encoding = delta_encoding;
+  LocalTestCluster cluster(opts);
   ASSERT_OK(cluster.GetStatus());
 
   // Create a Client mock.
@@ -161,6 +238,10 @@ TEST_F(CopilotTest, Rollcall) {
   std::vector<size_t> num_received_per_shard(num_shards, 0);
   auto generic_cb = [&](size_t shard_id, RollcallEntry entry) {
     std::lock_guard<std::mutex> lock(callback_mutex);
+    // Churned topics mostly cancel out, the rest is not accounted for.
+    if (entry.GetTopicName().compare(0, 14, "copilot_churn_") == 0) {
+      return;
+    }
     ASSERT_TRUE(rollcall_entries.size() != num_msg);
     ASSERT_TRUE(entry.GetType() != RollcallEntry::EntryType::Error);
     // Verify that all entries on a topic arrive on the same client.
@@ -199,6 +280,13 @@ TEST_F(CopilotTest, Rollcall) {
     ASSERT_OK(client.SendRequest(msg, &socket, 0));
   }
 
+  // Wait for the subscriptions to reach the log, an unsubscribe in the same
+  // batch would cancel them out.
+  ASSERT_EVENTUALLY_TRUE([&]() {
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    return rollcall_entries.size() == expected;
+  }());
+
   // send unsubscribe messages to copilot
   for (uint64_t i = 0; i < expected; ++i) {
     std::string topic = "copilot_test_" + std::to_string(i);
@@ -210,7 +298,7 @@ TEST_F(CopilotTest, Rollcall) {
 
   // Ensure that all expected entries were received by Rolcall clients.
   ASSERT_TRUE(checkpoint.TimedWait(std::chrono::seconds(10)));
-  std::lock_guard<std::mutex> lock(callback_mutex);
+  std::unique_lock<std::mutex> lock(callback_mutex);
   // Verify that every client got something. This might get flaky when we change
   // topic names or Rollcall sharding hash.
   for (size_t shard_id = 0; shard_id < num_shards; ++shard_id) {
@@ -254,11 +342,218 @@ TEST_F(CopilotTest, Rollcall) {
             num_msg / 2 + num_shards);
   ASSERT_EQ(stats.GetCounterValue("cockpit.messages_received.unsubscribe"),
             num_msg / 2);
+  lock.unlock();
+
+  // Subscribe and immediately unsubscribe, the entries of both requests
+  // cancel out in the rollcall batch.
+  for (uint64_t i = expected; i < 2 * expected; ++i) {
+    std::string topic = "copilot_churn_" + std::to_string(i);
+    MessageSubscribe subscribe(Tenant::GuestTenant,
+                               GuestNamespace,
+                               topic,
+                               1,
+                               SubscriptionID::Unsafe(i));
+    ASSERT_OK(client.SendRequest(subscribe, &socket, 0));
+    MessageUnsubscribe unsubscribe(Tenant::GuestTenant,
+                                   SubscriptionID::Unsafe(i),
+                                   MessageUnsubscribe::Reason::kRequested);
+    ASSERT_OK(client.SendRequest(unsubscribe, &socket, 0));
+  }
+  ASSERT_EVENTUALLY_TRUE(cluster.GetCopilot()->GetStatisticsSync()
+      .GetCounterValue("copilot.numwrites_rollcall_total") ==
+    static_cast<int64_t>(2 * num_msg + num_shards));
+  stats = cluster.GetCopilot()->GetStatisticsSync();
+  ASSERT_GT(stats.GetCounterValue("copilot.rollcall.entries_cancelled"), 0);
+  ASSERT_EQ(stats.GetCounterValue("copilot.numwrites_rollcall_failed"), 0);
 
   // Destroy Rollcall first to avoid dangling callback closures.
   rollcall.reset();
 }
 
+TEST_F(CopilotTest, Rollcall) {
+  TestRollcall(false);
+}
+
+TEST_F(CopilotTest, RollcallDeltaEncoding) {
+  TestRollcall(true);
+}
+
+namespace {
+
+// Control tower mock, which records copilot subscriptions and delivers records
+// on them on request.
+class MockTower {
+ public:
+  MockTower(Env* env, std::shared_ptr<Logger> info_log, std::string name)
+  : env_(env)
+  , loop_(env, EnvOptions(), 0, 1, info_log, name) {
+    loop_.RegisterCallbacks({
+        {MessageType::mSubscribe,
+         [this](Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
+           auto subscribe = static_cast<MessageSubscribe*>(msg.get());
+           std::lock_guard<std::mutex> lock(mutex_);
+           stream_ = origin;
+           sub_id_ = subscribe->GetSubID();
+           start_seqno_ = subscribe->GetStartSequenceNumber();
+           subscribed_.Post();
+         }},
+        {MessageType::mUnsubscribe,
+         [this](Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
+           auto unsubscribe = static_cast<MessageUnsubscribe*>(msg.get());
+           std::lock_guard<std::mutex> lock(mutex_);
+           if (unsubscribe->GetSubID() == sub_id_) {
+             unsubscribed_.Post();
+           }
+         }},
+    });
+  }
+
+  Status Start() {
+    Status st = loop_.Initialize();
+    if (st.ok()) {
+      thread_.reset(new MsgLoopThread(env_, &loop_, "tower_mock"));
+      st = loop_.WaitUntilRunning();
+    }
+    return st;
+  }
+
+  const HostId& GetHostId() const { return loop_.GetHostId(); }
+
+  // Waits for a subscription and returns its start seqno.
+  SequenceNumber WaitForSubscribe() {
+    if (!subscribed_.TimedWait(std::chrono::seconds(5))) {
+      return 0;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return start_seqno_;
+  }
+
+  bool WaitForUnsubscribe(std::chrono::milliseconds timeout) {
+    return unsubscribed_.TimedWait(timeout);
+  }
+
+  Status Deliver(SequenceNumber prev_seqno, SequenceNumber seqno) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MessageDeliverData data(GuestTenant, sub_id_, MsgId(), Slice("payload"));
+    data.SetSequenceNumbers(prev_seqno, seqno);
+    return loop_.SendResponse(data, stream_, 0);
+  }
+
+ private:
+  Env* env_;
+  MsgLoop loop_;
+  std::unique_ptr<MsgLoopThread> thread_;
+  std::mutex mutex_;
+  StreamID stream_ = 0;
+  SubscriptionID sub_id_;
+  SequenceNumber start_seqno_ = 0;
+  port::Semaphore subscribed_;
+  port::Semaphore unsubscribed_;
+};
+
+}  // namespace
+
+TEST_F(CopilotTest, MakeBeforeBreak) {
+  // Cluster only provides the log router.
+  LocalTestCluster cluster(info_log_, true, false, false);
+  ASSERT_OK(cluster.GetStatus());
+
+  MockTower tower_a(env_, info_log_, "tower_a");
+  MockTower tower_b(env_, info_log_, "tower_b");
+  ASSERT_OK(tower_a.Start());
+  ASSERT_OK(tower_b.Start());
+  auto router_to = [](const HostId& host) {
+    std::unordered_map<ControlTowerId, HostId> control_towers;
+    control_towers.emplace(0, host);
+    return std::make_shared<RendezvousHashTowerRouter>(
+        std::move(control_towers), 1);
+  };
+
+  MsgLoop loop(env_, env_options_, 0, 1, info_log_, "copilot");
+  ASSERT_OK(loop.Initialize());
+  CopilotOptions options;
+  options.info_log = info_log_;
+  options.pilots.push_back(HostId::CreateLocal(62777));
+  options.msg_loop = &loop;
+  options.rollcall_enabled = false;
+  options.timer_interval_micros = 10000;
+  options.tower_subscriptions_check_period = std::chrono::seconds(3);
+  options.log_router = cluster.GetLogRouter();
+  options.control_tower_router = router_to(tower_a.GetHostId());
+  Copilot* copilot;
+  ASSERT_OK(Copilot::CreateNewInstance(options, &copilot));
+  std::unique_ptr<MsgLoopThread> copilot_thread(
+      new MsgLoopThread(env_, &loop, "copilot"));
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  // Client mock, which records the seqnos delivered to it.
+  std::mutex received_mutex;
+  std::vector<SequenceNumber> received;
+  MsgLoop client(env_, env_options_, 0, 1, info_log_, "client_mock");
+  client.RegisterCallbacks({
+      {MessageType::mDeliverData,
+       [&](Flow* flow, std::unique_ptr<Message> msg, StreamID) {
+         auto data = static_cast<MessageDeliverData*>(msg.get());
+         std::lock_guard<std::mutex> lock(received_mutex);
+         received.push_back(data->GetSequenceNumber());
+       }},
+  });
+  ASSERT_OK(client.Initialize());
+  MsgLoopThread client_thread(env_, &client, "client_mock");
+  ASSERT_OK(client.WaitUntilRunning());
+  StreamSocket socket(client.CreateOutboundStream(copilot->GetHostId(), 0));
+  auto received_up_to = [&](SequenceNumber seqno) {
+    std::lock_guard<std::mutex> lock(received_mutex);
+    return !received.empty() && received.back() >= seqno;
+  };
+
+  MessageSubscribe subscribe(GuestTenant,
+                             GuestNamespace,
+                             "make_before_break",
+                             1,
+                             SubscriptionID::Unsafe(1));
+  ASSERT_OK(client.SendRequest(subscribe, &socket, 0));
+  ASSERT_EQ(tower_a.WaitForSubscribe(), 1);
+  ASSERT_OK(tower_a.Deliver(1, 1));
+  for (SequenceNumber seqno = 2; seqno <= 5; ++seqno) {
+    ASSERT_OK(tower_a.Deliver(seqno - 1, seqno));
+  }
+  ASSERT_EVENTUALLY_TRUE(received_up_to(5));
+
+  // Move the topic to B, which starts where A is.
+  ASSERT_OK(copilot->UpdateTowerRouter(router_to(tower_b.GetHostId())));
+  ASSERT_EQ(tower_b.WaitForSubscribe(), 6);
+
+  // A keeps delivering ahead of B, and is only unsubscribed once B passes it.
+  ASSERT_OK(tower_a.Deliver(5, 6));
+  ASSERT_OK(tower_a.Deliver(6, 7));
+  ASSERT_EVENTUALLY_TRUE(received_up_to(7));
+  ASSERT_OK(tower_b.Deliver(5, 6));
+  ASSERT_TRUE(!tower_a.WaitForUnsubscribe(std::chrono::milliseconds(100)));
+  ASSERT_OK(tower_b.Deliver(6, 7));
+  ASSERT_TRUE(tower_a.WaitForUnsubscribe(std::chrono::seconds(5)));
+  ASSERT_OK(tower_b.Deliver(7, 8));
+  ASSERT_EVENTUALLY_TRUE(received_up_to(8));
+
+  // Records delivered by both towers reached the subscriber exactly once.
+  {
+    std::lock_guard<std::mutex> lock(received_mutex);
+    ASSERT_EQ(received,
+              std::vector<SequenceNumber>({1, 2, 3, 4, 5, 6, 7, 8}));
+  }
+
+  // Move the topic back to A, which never catches up with B. B is dropped on
+  // the checkup of the topic anyway.
+  ASSERT_OK(copilot->UpdateTowerRouter(router_to(tower_a.GetHostId())));
+  ASSERT_EQ(tower_a.WaitForSubscribe(), 9);
+  ASSERT_TRUE(!tower_b.WaitForUnsubscribe(std::chrono::milliseconds(500)));
+  ASSERT_TRUE(tower_b.WaitForUnsubscribe(std::chrono::seconds(10)));
+
+  copilot_thread.reset();
+  copilot->Stop();
+  delete copilot;
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
@@ -6,6 +6,8 @@
 #define __STDC_FORMAT_MACROS
 #include "worker.h"
 
+#include <algorithm>
+#include <tuple>
 #include <vector>
 
 #include "include/Status.h"
@@ -13,6 +15,8 @@
 
 #include "src/copilot/control_tower_router.h"
 #include "src/copilot/copilot.h"
+#include "src/messages/event_loop.h"
+#include "src/messages/stream.h"
 #include "src/rollcall/rollcall_impl.h"
 
 #include "external/folly/move_wrapper.h"
@@ -49,6 +53,7 @@ CopilotWorker::CopilotWorker(
   options_.info_log->Flush();
 
   client_queues_ = options_.msg_loop->CreateWorkerQueues();
+  client_messages_.resize(client_queues_.size());
   tower_queues_ = options_.msg_loop->CreateWorkerQueues();
 
   // Create Rollcall topic writer
@@ -56,7 +61,8 @@ CopilotWorker::CopilotWorker(
     RS_ASSERT(client);
     rollcall_.reset(new RollcallImpl(std::move(client),
                                      InvalidTenant,
-                                     "copilot.rollcall"));
+                                     "copilot.rollcall",
+                                     options_.rollcall_delta_encoding));
     rollcall_error_queues_ = options_.msg_loop->CreateThreadLocalQueues(myid_);
   }
 }
@@ -159,7 +165,7 @@ void CopilotWorker::ProcessData(std::unique_ptr<Message> message,
               msg->GetSubID().ForLogging());
     return;
   }
-  const TopicUUID uuid = *ptr;
+  const TopicUUID& uuid = topic_table_.GetUUID(*ptr);
 
   // Get the list of subscriptions for this topic.
   LOG_DEBUG(options_.info_log,
@@ -168,7 +174,7 @@ void CopilotWorker::ProcessData(std::unique_ptr<Message> message,
             msg->GetSequenceNumber(),
             uuid.ToString().c_str());
 
-  auto it = topics_.find(uuid);
+  auto it = topics_.find(*ptr);
   if (it != topics_.end()) {
     TopicState& topic = it->second;
     const auto seqno = msg->GetSequenceNumber();
@@ -177,80 +183,165 @@ void CopilotWorker::ProcessData(std::unique_ptr<Message> message,
     // Find tower for this origin and update its state.
     AdvanceTowers(&topic, prev_seqno, seqno, origin, msg->GetSubID());
 
-    // Send to all subscribers.
-    bool delivered_at_least_once = false;
-    for (auto& sub : topic.subscriptions) {
-      StreamID recipient = sub->stream_id;
-
-      // Do not send a response if the seqno is too low.
-      if (sub->seqno > seqno) {
-        LOG_DEBUG(options_.info_log,
-                  "Data not delivered to %llu ID(%llu)"
-                  " (seqno@%" PRIu64 " too low, currently @%" PRIu64 ")",
-                  recipient,
-                  sub->sub_id.ForLogging(),
-                  seqno,
-                  sub->seqno);
-        continue;
-      }
-
-      // or too high.
-      if (sub->seqno < prev_seqno) {
-        LOG_DEBUG(options_.info_log,
-                  "Data not delivered to %llu ID(%llu)"
-                  " (prev_seqno@%" PRIu64 " too high, currently @%" PRIu64 ")",
-                  recipient,
-                  sub->sub_id.ForLogging(),
-                  prev_seqno,
-                  sub->seqno);
-        continue;
+    // Find subscribers the record is for.
+    Subscriptions& subs = topic.subscriptions;
+    subs.FindExpecting(prev_seqno, seqno, &recipients_);
+    if (recipients_.empty()) {
+      LOG_DEBUG(options_.info_log,
+                "Data (%" PRIu64 "-%" PRIu64 "] not delivered to any of %zu"
+                " subscriptions on %s",
+                prev_seqno,
+                seqno,
+                subs.Size(),
+                uuid.ToString().c_str());
+      stats_.data_dropped_out_of_order->Add(1);
+      return;
+    }
+    for (uint32_t index : recipients_) {
+      subs.seqno(index) = seqno + 1;
+    }
+    topic.records_sent += static_cast<uint32_t>(recipients_.size());
+
+    // Group recipients by stream and tenant, so that all subscriptions of a
+    // stream get the record in one message.
+    std::sort(recipients_.begin(), recipients_.end(),
+      [&subs](uint32_t lhs, uint32_t rhs) {
+        return std::make_tuple(subs.stream_id(lhs),
+                               subs.tenant_id(lhs),
+                               subs.sub_id(lhs)) <
+               std::make_tuple(subs.stream_id(rhs),
+                               subs.tenant_id(rhs),
+                               subs.sub_id(rhs));
+      });
+    MessageDeliverMulticast::SubscriptionIDs sub_ids;
+    for (size_t i = 0; i < recipients_.size(); ) {
+      const uint32_t first = recipients_[i];
+      const StreamID stream_id = subs.stream_id(first);
+      const TenantID tenant_id = subs.tenant_id(first);
+      const int worker_id = subs.worker_id(first);
+      size_t end = i + 1;
+      while (end < recipients_.size() &&
+             subs.stream_id(recipients_[end]) == stream_id &&
+             subs.tenant_id(recipients_[end]) == tenant_id) {
+        ++end;
       }
 
-      // or not matching zeroes.
-      if ((sub->seqno == 0 && prev_seqno != 0) ||
-          (sub->seqno != 0 && prev_seqno == 0)) {
-        LOG_DEBUG(options_.info_log,
-                  "Data not delivered to %llu ID(%llu)"
-                  " (prev_seqno@%" PRIu64 " not 0)",
-                  recipient,
-                  sub->sub_id.ForLogging(),
-                  prev_seqno);
-        continue;
+      // The payload is sent straight from the buffer it was received into.
+      if (end - i > 1 && options_.multicast_delivery) {
+        sub_ids.clear();
+        for (size_t j = i; j < end; ++j) {
+          sub_ids.push_back(subs.sub_id(recipients_[j]));
+        }
+        std::unique_ptr<MessageDeliverMulticast> multicast(
+          new MessageDeliverMulticast(tenant_id,
+                                      sub_ids,
+                                      msg->GetMessageID(),
+                                      msg->GetPayload(),
+                                      msg->GetPayloadOwner()));
+        multicast->SetSequenceNumbers(prev_seqno, seqno);
+        SendToClient(worker_id, stream_id, std::move(multicast));
+        stats_.multicast_deliveries->Add(1);
+      } else {
+        for (size_t j = i; j < end; ++j) {
+          std::unique_ptr<MessageDeliverData> data(
+            new MessageDeliverData(tenant_id,
+                                   subs.sub_id(recipients_[j]),
+                                   msg->GetMessageID(),
+                                   msg->GetPayload(),
+                                   msg->GetPayloadOwner()));
+          data->SetSequenceNumbers(prev_seqno, seqno);
+          SendToClient(worker_id, stream_id, std::move(data));
+        }
       }
+      LOG_DEBUG(options_.info_log,
+                "Sent data (%.16s)@%" PRIu64 " for %zu subscriptions %s "
+                "to %llu",
+                msg->GetPayload().ToString().c_str(),
+                msg->GetSequenceNumber(),
+                end - i,
+                uuid.ToString().c_str(),
+                stream_id);
+      i = end;
+    }
+  } else {
+    stats_.data_on_unsubscribed_topic->Add(1);
+  }
+}
 
-      // Mark even if fail to send.
-      // The point is that it wasn't out of order.
-      delivered_at_least_once = true;
+void CopilotWorker::SendToClient(int worker_id,
+                                 StreamID stream,
+                                 std::unique_ptr<Message> msg) {
+  RS_ASSERT(worker_id >= 0 &&
+            static_cast<size_t>(worker_id) < client_messages_.size());
+  auto& messages = client_messages_[worker_id];
+  if (messages.empty()) {
+    client_workers_pending_.push_back(worker_id);
+  }
+  messages.push_back(ClientMessage{stream, std::move(msg)});
 
-      // Send message to the client.
-      MessageDeliverData data(sub->tenant_id,
-                              sub->sub_id,
-                              msg->GetMessageID(),
-                              msg->GetPayload());
-      data.SetSequenceNumbers(prev_seqno, seqno);
-      auto command = MsgLoop::ResponseCommand(data, recipient);
-      if (client_queues_[sub->worker_id]->Write(command)) {
-        sub->seqno = seqno + 1;
-        ++topic.records_sent;
+  // Collect messages of all commands processed in this loop iteration.
+  if (!client_flush_scheduled_) {
+    client_flush_scheduled_ = true;
+    options_.msg_loop->GetEventLoop(myid_)->AddTask(
+      [this]() { FlushClientMessages(); });
+  }
+}
 
-        LOG_DEBUG(options_.info_log,
-                  "Sent data (%.16s)@%" PRIu64 " for ID(%llu) %s to %llu",
-                  msg->GetPayload().ToString().c_str(),
-                  msg->GetSequenceNumber(),
-                  data.GetSubID().ForLogging(),
-                  uuid.ToString().c_str(),
-                  recipient);
-      } else {
-        LOG_WARN(options_.info_log,
-                 "Failed to distribute message to %llu",
-                 recipient);
-      }
+void CopilotWorker::FlushClientMessages() {
+  client_flush_scheduled_ = false;
+  std::vector<int> blocked_workers;
+  for (int worker_id : client_workers_pending_) {
+    auto messages = std::make_shared<std::vector<ClientMessage>>(
+      std::move(client_messages_[worker_id]));
+    client_messages_[worker_id].clear();
+    const size_t num_messages = messages->size();
+
+    // Messages are serialized on the client worker, straight into its
+    // streams.
+    EventLoop* event_loop = options_.msg_loop->GetEventLoop(worker_id);
+    auto info_log = options_.info_log;
+    std::unique_ptr<Command> command(MakeExecuteWithFlowCommand(
+      [event_loop, info_log, messages](Flow* flow) {
+        for (ClientMessage& message : *messages) {
+          Stream* stream = event_loop->GetInboundStream(message.stream);
+          if (!stream) {
+            LOG_DEBUG(info_log,
+                      "Stream: %llu not found, dropping message",
+                      message.stream);
+            continue;
+          }
+          auto serialised = stream->ToTimestampedString(*message.msg);
+          flow->Write(stream, serialised);
+        }
+      }));
+    if (client_queues_[worker_id]->Write(command)) {
+      stats_.client_batches->Add(1);
+      stats_.client_messages->Add(num_messages);
+    } else {
+      // Subscriptions have already advanced past these messages, so they
+      // must not be lost. Keep them for the next attempt.
+      stats_.client_batches_retried->Add(1);
+      LOG_WARN(options_.info_log,
+               "Queue to worker %d is full, retrying %zu messages",
+               worker_id,
+               num_messages);
+      client_messages_[worker_id] = std::move(*messages);
+      blocked_workers.push_back(worker_id);
     }
-    if (!delivered_at_least_once) {
-      stats_.data_dropped_out_of_order->Add(1);
+  }
+  client_workers_pending_ = std::move(blocked_workers);
+
+  if (!client_workers_pending_.empty()) {
+    if (!client_retry_timer_) {
+      client_retry_timer_ =
+        options_.msg_loop->GetEventLoop(myid_)->CreateTimedEventCallback(
+          [this]() {
+            client_retry_timer_->Disable();
+            FlushClientMessages();
+          },
+          std::chrono::milliseconds(10));
     }
-  } else {
-    stats_.data_on_unsubscribed_topic->Add(1);
+    client_retry_timer_->Enable();
   }
 }
 
@@ -268,7 +359,8 @@ void CopilotWorker::ProcessGap(std::unique_ptr<Message> message,
               msg->GetSubID().ForLogging());
     return;
   }
-  const TopicUUID uuid = *ptr;
+  const TopicHandle handle = *ptr;
+  const TopicUUID& uuid = topic_table_.GetUUID(handle);
 
   // Get the list of subscriptions for this topic.
   LOG_DEBUG(options_.info_log,
@@ -276,7 +368,7 @@ void CopilotWorker::ProcessGap(std::unique_ptr<Message> message,
             msg->GetFirstSequenceNumber(),
             msg->GetLastSequenceNumber(),
             uuid.ToString().c_str());
-  auto it = topics_.find(uuid);
+  auto it = topics_.find(handle);
   if (it != topics_.end()) {
     TopicState& topic = it->second;
     const auto prev_seqno = msg->GetFirstSequenceNumber();
@@ -285,72 +377,31 @@ void CopilotWorker::ProcessGap(std::unique_ptr<Message> message,
     // Find tower for this origin and update its state.
     AdvanceTowers(&topic, prev_seqno, next_seqno, origin, msg->GetSubID());
 
-    // Send to all subscribers.
-    bool delivered_at_least_once = false;
-    for (auto& sub : topic.subscriptions) {
-      StreamID recipient = sub->stream_id;
-
-      // Ignore if the seqno is too low.
-      if (sub->seqno > next_seqno) {
-        LOG_DEBUG(options_.info_log,
-                  "Gap ignored for %llu"
-                  " (next_seqno@%" PRIu64 " too low, currently @%" PRIu64 ")",
-                  recipient,
-                  next_seqno,
-                  sub->seqno);
-        continue;
-      }
-
-      // or too high.
-      if (sub->seqno < prev_seqno) {
-        LOG_DEBUG(options_.info_log,
-                  "Gap ignored for %llu"
-                  " (prev_seqno@%" PRIu64 " too high, currently @%" PRIu64 ")",
-                  recipient,
-                  prev_seqno,
-                  sub->seqno);
-        continue;
-      }
-
-      // or not matching zeroes.
-      if ((sub->seqno == 0 && prev_seqno != 0) ||
-          (sub->seqno != 0 && prev_seqno == 0)) {
-        LOG_DEBUG(options_.info_log,
-                  "Gap ignored for %llu"
-                  " (prev_seqno@%" PRIu64 " not 0)",
-                  recipient,
-                  prev_seqno);
-        continue;
-      }
-
-      // Mark even if fail to send.
-      // The point is that it wasn't out of order.
-      delivered_at_least_once = true;
+    // Send to all subscribers expecting the gap.
+    Subscriptions& subs = topic.subscriptions;
+    subs.FindExpecting(prev_seqno, next_seqno, &recipients_);
+    const bool delivered_at_least_once = !recipients_.empty();
+    for (uint32_t index : recipients_) {
+      StreamID recipient = subs.stream_id(index);
 
       // Send message to the client.
-      MessageDeliverGap gap(
-        sub->tenant_id,
-        sub->sub_id,
-        msg->GetGapType());
-      gap.SetSequenceNumbers(prev_seqno, next_seqno);
-      auto command = MsgLoop::ResponseCommand(gap, recipient);
-      if (client_queues_[sub->worker_id]->Write(command)) {
-        sub->seqno = next_seqno + 1;
-        ++topic.gaps_sent;
-
-        LOG_DEBUG(options_.info_log,
-                  "Sent gap %" PRIu64 "-%" PRIu64
-                  " for subscription ID(%llu) %s to %llu",
-                  msg->GetFirstSequenceNumber(),
-                  msg->GetLastSequenceNumber(),
-                  gap.GetSubID().ForLogging(),
-                  uuid.ToString().c_str(),
-                  recipient);
-      } else {
-        LOG_WARN(options_.info_log,
-                 "Failed to distribute gap to %llu",
-                 recipient);
-      }
+      std::unique_ptr<MessageDeliverGap> gap(new MessageDeliverGap(
+        subs.tenant_id(index),
+        subs.sub_id(index),
+        msg->GetGapType()));
+      gap->SetSequenceNumbers(prev_seqno, next_seqno);
+      SendToClient(subs.worker_id(index), recipient, std::move(gap));
+      subs.seqno(index) = next_seqno + 1;
+      ++topic.gaps_sent;
+
+      LOG_DEBUG(options_.info_log,
+                "Sent gap %" PRIu64 "-%" PRIu64
+                " for subscription ID(%llu) %s to %llu",
+                msg->GetFirstSequenceNumber(),
+                msg->GetLastSequenceNumber(),
+                subs.sub_id(index).ForLogging(),
+                uuid.ToString().c_str(),
+                recipient);
     }
 
     if (!delivered_at_least_once) {
@@ -363,7 +414,7 @@ void CopilotWorker::ProcessGap(std::unique_ptr<Message> message,
       // all other subscriptions (e.g. because we have "future" subscriptions).
       // In this case, we need to actually rewind to this older subscription,
       // so we have to (potentially) update subscriptions here.
-      UpdateTowerSubscriptions(uuid, topic);
+      UpdateTowerSubscriptions(handle, topic);
 
       // TODO(pja): if we have a higher subscription, and that subscription has
       // received messages then we can use that as a more accurate tail
@@ -378,13 +429,16 @@ void CopilotWorker::ProcessTailSeqno(std::unique_ptr<Message> message,
                                      StreamID origin) {
   MessageTailSeqno* msg = static_cast<MessageTailSeqno*>(message.get());
   // Get the list of subscriptions for this topic.
-  TopicUUID uuid(msg->GetNamespace(), msg->GetTopicName());
   LOG_DEBUG(options_.info_log,
             "Copilot received tail senqo %" PRIu64 " for %s",
             msg->GetSequenceNumber(),
-            uuid.ToString().c_str());
-  auto it = topics_.find(uuid);
+            TopicUUID(msg->GetNamespace(), msg->GetTopicName())
+              .ToString().c_str());
+  const TopicHandle handle =
+    topic_table_.Find(msg->GetNamespace(), msg->GetTopicName());
+  auto it = topics_.find(handle);
   if (it != topics_.end()) {
+    const TopicUUID& uuid = topic_table_.GetUUID(handle);
     TopicState& topic = it->second;
     const auto next_seqno = msg->GetSequenceNumber();
 
@@ -402,39 +456,32 @@ void CopilotWorker::ProcessTailSeqno(std::unique_ptr<Message> message,
     }
 
     // Send to all subscribers subscribed at 0.
-    for (auto& sub : topic.subscriptions) {
-      StreamID recipient = sub->stream_id;
-
-      if (sub->seqno != 0) {
-        continue;
-      }
+    Subscriptions& subs = topic.subscriptions;
+    subs.FindExpecting(0, 0, &recipients_);
+    for (uint32_t index : recipients_) {
+      StreamID recipient = subs.stream_id(index);
 
       // Send gap to the client.
-      MessageDeliverGap gap(sub->tenant_id,
-                            sub->sub_id,
-                            GapType::kBenign);
-      gap.SetSequenceNumbers(0, next_seqno - 1);
-      auto command = MsgLoop::ResponseCommand(gap, recipient);
-      if (client_queues_[sub->worker_id]->Write(command)) {
-        sub->seqno = next_seqno;
-        ++topic.gaps_sent;
-
-        LOG_DEBUG(options_.info_log,
-                  "Sent tail senqo %" PRIu64
-                  " for subscription ID(%llu) %s to %llu",
-                  next_seqno,
-                  gap.GetSubID().ForLogging(),
-                  uuid.ToString().c_str(),
-                  recipient);
-      } else {
-        LOG_WARN(options_.info_log,
-                 "Failed to distribute tail seqno to %llu",
-                 recipient);
-      }
+      std::unique_ptr<MessageDeliverGap> gap(
+        new MessageDeliverGap(subs.tenant_id(index),
+                              subs.sub_id(index),
+                              GapType::kBenign));
+      gap->SetSequenceNumbers(0, next_seqno - 1);
+      SendToClient(subs.worker_id(index), recipient, std::move(gap));
+      subs.seqno(index) = next_seqno;
+      ++topic.gaps_sent;
+
+      LOG_DEBUG(options_.info_log,
+                "Sent tail senqo %" PRIu64
+                " for subscription ID(%llu) %s to %llu",
+                next_seqno,
+                subs.sub_id(index).ForLogging(),
+                uuid.ToString().c_str(),
+                recipient);
     }
     // Now that we know tail seqno, we may need to actually subscribe to it
     // (if any existing subscription is ahead of that point).
-    UpdateTowerSubscriptions(uuid, topic);
+    UpdateTowerSubscriptions(handle, topic);
   } else {
     stats_.gap_on_unsubscribed_topic->Add(1);
   }
@@ -448,7 +495,15 @@ void CopilotWorker::ProcessSubscribe(const TenantID tenant_id,
                                      const LogID logid,
                                      const int worker_id,
                                      const StreamID subscriber) {
-  TopicUUID uuid(namespace_id, topic_name);
+  // Find/insert topic state.
+  TopicHandle handle = topic_table_.Find(namespace_id, topic_name);
+  auto topic_iter = topics_.find(handle);
+  if (topic_iter == topics_.end()) {
+    handle = topic_table_.Acquire(TopicUUID(namespace_id, topic_name));
+    topic_iter = topics_.emplace(handle, TopicState(logid)).first;
+  }
+  TopicState& topic = topic_iter->second;
+  const TopicUUID& uuid = topic_table_.GetUUID(handle);
   LOG_INFO(options_.info_log,
            "Received subscribe request ID(%llu) for %s@%" PRIu64 " for %llu",
            sub_id.ForLogging(),
@@ -457,17 +512,10 @@ void CopilotWorker::ProcessSubscribe(const TenantID tenant_id,
            subscriber);
 
   // Insert into client-topic map.
-  client_subscriptions_[subscriber]
-      .emplace(sub_id, TopicInfo{topic_name.ToString(),
-                                 namespace_id.ToString(),
-                                 logid});
-
-  // Find/insert topic state.
-  auto topic_iter = topics_.find(uuid);
-  if (topic_iter == topics_.end()) {
-    topic_iter = topics_.emplace(uuid, TopicState(logid)).first;
+  if (client_subscriptions_[subscriber]
+        .emplace(sub_id, TopicInfo{handle, logid}).second) {
+    topic_table_.Acquire(handle);
   }
-  TopicState& topic = topic_iter->second;
 
   bool skip_update = false;
 
@@ -490,10 +538,10 @@ void CopilotWorker::ProcessSubscribe(const TenantID tenant_id,
         start_seqno = tower.next_seqno;
 
         // Also need to send a gap to update client.
-        MessageDeliverGap gap(tenant_id, sub_id, GapType::kBenign);
-        gap.SetSequenceNumbers(0, start_seqno - 1);
-        auto command = MsgLoop::ResponseCommand(gap, subscriber);
-        client_queues_[worker_id]->Write(command);
+        std::unique_ptr<MessageDeliverGap> gap(
+          new MessageDeliverGap(tenant_id, sub_id, GapType::kBenign));
+        gap->SetSequenceNumbers(0, start_seqno - 1);
+        SendToClient(worker_id, subscriber, std::move(gap));
         topic.gaps_sent++;
 
         // Don't need to update control towers since we are using an existing
@@ -507,32 +555,25 @@ void CopilotWorker::ProcessSubscribe(const TenantID tenant_id,
   }
 
   // First check if we already have a subscription for this subscriber.
-  bool found = false;
-  for (auto& sub : topic.subscriptions) {
-    if (sub->stream_id == subscriber && sub->sub_id == sub_id) {
-      // Existing subscription: update sequence number.
-      sub->seqno = start_seqno;
-      RS_ASSERT(sub->worker_id == worker_id);
-      found = true;
-      break;
-    }
-  }
-
-  if (!found) {
+  const uint32_t index = topic.subscriptions.Find(subscriber, sub_id);
+  if (index != Subscriptions::kNotFound) {
+    // Existing subscription: update sequence number.
+    topic.subscriptions.seqno(index) = start_seqno;
+    RS_ASSERT(topic.subscriptions.worker_id(index) == worker_id);
+  } else {
     // No existing subscription, so insert new one.
-    topic.subscriptions.emplace_back(
-      new Subscription(subscriber,
-                       start_seqno,
-                       worker_id,
-                       tenant_id,
-                       sub_id));
+    topic.subscriptions.Add(subscriber,
+                            start_seqno,
+                            worker_id,
+                            tenant_id,
+                            sub_id);
     stats_.incoming_subscriptions->Add(1);
   }
 
   if (!skip_update) {
     // Update the copilot's subscriptions on the control tower(s) to reflect
     // this new topic subscription.
-    UpdateTowerSubscriptions(uuid, topic);
+    UpdateTowerSubscriptions(handle, topic);
   }
 
   // Update rollcall topic.
@@ -572,8 +613,7 @@ void CopilotWorker::RemoveSubscription(const TenantID tenant_id,
                                        const SubscriptionID sub_id,
                                        const StreamID subscriber,
                                        const int worker_id) {
-  NamespaceID namespace_id;
-  Topic topic_name;
+  TopicHandle handle;
   LogID logid;
   {  // Remove from client-topic map.
     auto& client_subscriptions = client_subscriptions_[subscriber];
@@ -583,48 +623,44 @@ void CopilotWorker::RemoveSubscription(const TenantID tenant_id,
       // situation.
       return;
     }
-    auto& topic_info = it->second;
-    namespace_id = std::move(topic_info.namespace_id);
-    topic_name = std::move(topic_info.topic_name);
-    logid = topic_info.logid;
+    handle = it->second.topic;
+    logid = it->second.logid;
     client_subscriptions.erase(it);
   }
 
-  TopicUUID uuid(namespace_id, topic_name);
-  auto topic_iter = topics_.find(uuid);
+  auto topic_iter = topics_.find(handle);
   if (topic_iter != topics_.end()) {
     // Find our subscription and remove it.
     TopicState& topic = topic_iter->second;
     auto& subscriptions = topic.subscriptions;
-    for (auto it = subscriptions.begin(); it != subscriptions.end(); ) {
-      Subscription* sub = it->get();
-      if (sub->stream_id == subscriber && sub->sub_id == sub_id) {
-        // This is our subscription, remove it.
-        it = subscriptions.erase(it);
-        stats_.incoming_subscriptions->Add(-1);
-      } else {
-        ++it;
-      }
+    uint32_t index;
+    while ((index = subscriptions.Find(subscriber, sub_id)) !=
+           Subscriptions::kNotFound) {
+      // This is our subscription, remove it.
+      subscriptions.Remove(index);
+      stats_.incoming_subscriptions->Add(-1);
     }
 
     // Unsubscribe from control towers if necessary.
-    if (topic.subscriptions.empty()) {
-      UnsubscribeControlTowers(uuid, topic);
+    if (topic.subscriptions.Empty()) {
+      UnsubscribeControlTowers(topic);
       topic.towers.clear();
     }
 
     // Update rollcall topic.
-    RollcallWrite(sub_id, tenant_id, uuid,
+    RollcallWrite(sub_id, tenant_id, topic_table_.GetUUID(handle),
                   MetadataType::mUnSubscribe,
                   logid, worker_id, subscriber);
 
     // No more subscriptions, so remove from map.
-    if (topic.subscriptions.empty()) {
+    if (topic.subscriptions.Empty()) {
       topics_.erase(topic_iter);
-      CancelResubscribeRequest(uuid);
-      topic_checkup_list_.Erase(uuid);
+      CancelResubscribeRequest(handle);
+      topic_checkup_list_.Erase(handle);
+      topic_table_.Release(handle);
     }
   }
+  topic_table_.Release(handle);
 }
 
 void CopilotWorker::HandleInvalidSubscription(StreamID origin,
@@ -642,46 +678,45 @@ void CopilotWorker::HandleInvalidSubscription(StreamID origin,
              sub_id.ForLogging());
     return;
   }
-  const TopicUUID uuid = *ptr;
+  const TopicHandle handle = *ptr;
 
-  auto it = topics_.find(uuid);
+  auto it = topics_.find(handle);
   if (it != topics_.end()) {
     TopicState& topic = it->second;
+    const TopicUUID& uuid = topic_table_.GetUUID(handle);
 
     // Forward the unsubscribe to all clients.
-    for (auto& sub : topic.subscriptions) {
-      RollcallWrite(sub->sub_id, sub->tenant_id, uuid,
+    const Subscriptions& subs = topic.subscriptions;
+    subs.ForEach([&](uint32_t index) {
+      RollcallWrite(subs.sub_id(index), subs.tenant_id(index), uuid,
                     MetadataType::mUnSubscribe,
-                    topic.log_id, sub->worker_id, sub->stream_id);
-
-      MessageUnsubscribe message(sub->tenant_id,
-                                 sub->sub_id,
-                                 MessageUnsubscribe::Reason::kInvalid);
-      auto cmd = MsgLoop::ResponseCommand(message, sub->stream_id);
-      if (client_queues_[sub->worker_id]->Write(cmd)) {
-        LOG_DEBUG(options_.info_log,
-                  "Sent unsubscribe (invalid) for StreamID(%llu) SubID(%llu)",
-                  sub->stream_id,
-                  sub->sub_id.ForLogging());
-      } else {
-        LOG_WARN(options_.info_log,
-                 "Failed unsubscribe (invalid) for StreamID(%llu) SubID(%llu)",
-                 sub->stream_id,
-                 sub->sub_id.ForLogging());
-      }
-    }
-    stats_.incoming_subscriptions->Add(-int64_t(topic.subscriptions.size()));
+                    topic.log_id, subs.worker_id(index),
+                    subs.stream_id(index));
+
+      std::unique_ptr<MessageUnsubscribe> message(
+        new MessageUnsubscribe(subs.tenant_id(index),
+                               subs.sub_id(index),
+                               MessageUnsubscribe::Reason::kInvalid));
+      SendToClient(subs.worker_id(index),
+                   subs.stream_id(index),
+                   std::move(message));
+      LOG_DEBUG(options_.info_log,
+                "Sent unsubscribe (invalid) for StreamID(%llu) SubID(%llu)",
+                subs.stream_id(index),
+                subs.sub_id(index).ForLogging());
+    });
+    stats_.incoming_subscriptions->Add(-int64_t(topic.subscriptions.Size()));
 
     // Unsubscribe all other control towers too -- we no longer need them.
-    UnsubscribeControlTowers(uuid, topic);
+    UnsubscribeControlTowers(topic);
     topics_.erase(it);
-    CancelResubscribeRequest(uuid);
-    topic_checkup_list_.Erase(uuid);
+    CancelResubscribeRequest(handle);
+    topic_checkup_list_.Erase(handle);
+    topic_table_.Release(handle);
   }
 }
 
-void CopilotWorker::UnsubscribeControlTowers(
-    const TopicUUID& topic_uuid, TopicState& topic) {
+void CopilotWorker::UnsubscribeControlTowers(TopicState& topic) {
 
   const TenantID tenant_id = GuestTenant;
 
@@ -736,8 +771,174 @@ void CopilotWorker::ProcessGoodbye(std::unique_ptr<Message> message,
 void CopilotWorker::ProcessRouterUpdate(
     std::shared_ptr<ControlTowerRouter> router) {
   LOG_VITAL(options_.info_log, "Updating control tower router");
+  std::shared_ptr<ControlTowerRouter> old_router =
+    std::move(control_tower_router_);
   control_tower_router_ = std::move(router);
   control_tower_cache_.clear();
+
+  // Diff the mappings of both routers, only logs which map to different
+  // towers need to move.
+  auto towers_changed = [&] (LogID log_id) {
+    std::vector<HostId const*> old_towers;
+    std::vector<HostId const*> new_towers;
+    if (!old_router ||
+        !old_router->GetControlTowers(log_id, &old_towers).ok()) {
+      return true;
+    }
+    if (!GetControlTowers(log_id, &new_towers).ok()) {
+      // Nowhere to move, resubscriptions take care of it once there are.
+      return false;
+    }
+    return old_towers.size() != new_towers.size() ||
+      !std::is_permutation(old_towers.begin(), old_towers.end(),
+                           new_towers.begin(),
+                           [] (HostId const* lhs, HostId const* rhs) {
+                             return *lhs == *rhs;
+                           });
+  };
+  std::unordered_map<LogID, bool> changed_logs;
+  std::unordered_map<LogID, std::vector<TopicHandle>> moved_topics;
+  for (const auto& handle_topic : topics_) {
+    const LogID log_id = handle_topic.second.log_id;
+    auto it = changed_logs.find(log_id);
+    if (it == changed_logs.end()) {
+      it = changed_logs.emplace(log_id, towers_changed(log_id)).first;
+    }
+    if (it->second) {
+      // Held until the log is rebalanced.
+      topic_table_.Acquire(handle_topic.first);
+      moved_topics[log_id].push_back(handle_topic.first);
+    }
+  }
+  for (auto& log_topics : moved_topics) {
+    pending_rebalances_.emplace_back(log_topics.first,
+                                     std::move(log_topics.second));
+  }
+  stats_.tower_rebalance_logs->Add(moved_topics.size());
+  LOG_INFO(options_.info_log,
+           "Router update moves %zu of %zu logs",
+           moved_topics.size(),
+           changed_logs.size());
+}
+
+size_t CopilotWorker::RebalanceLog(LogID log_id,
+                                   const std::vector<TopicHandle>& topics) {
+  std::vector<HostId const*> recipients;
+  if (!GetControlTowers(log_id, &recipients).ok() || recipients.empty()) {
+    return 0;
+  }
+
+  // Find connections to the towers once for all topics of the log.
+  using TowerConnection = std::pair<StreamSocket*, int>;  // socket + worker_id
+  autovector<TowerConnection, kMaxTowerConnections> tower_conns;
+  for (HostId const* recipient : recipients) {
+    int outgoing_worker_id = copilot_->GetTowerWorker(log_id, *recipient);
+    auto socket = GetControlTowerSocket(
+        *recipient, options_.msg_loop, outgoing_worker_id);
+    tower_conns.emplace_back(socket, outgoing_worker_id);
+  }
+
+  size_t moved = 0;
+  for (TopicHandle handle : topics) {
+    auto it = topics_.find(handle);
+    if (it == topics_.end() || it->second.log_id != log_id) {
+      continue;
+    }
+    TopicState& topic = it->second;
+
+    // Mark towers the log no longer maps to, and find where the new towers
+    // should start to continue where the replaced ones are. Orphaned topics
+    // are resubscribed to the current towers anyway.
+    bool replacing = false;
+    SequenceNumber seqno = 0;
+    for (TopicState::Tower& tower : topic.towers) {
+      bool current = false;
+      for (const TowerConnection& tower_conn : tower_conns) {
+        current = current || tower_conn.first == tower.stream;
+      }
+      if (current) {
+        tower.flags &= ~TopicState::Tower::Flags::kDraining;
+      } else {
+        tower.flags |= TopicState::Tower::Flags::kDraining;
+        replacing = true;
+        if (tower.next_seqno != 0 &&
+            (seqno == 0 || tower.next_seqno < seqno)) {
+          seqno = tower.next_seqno;
+        }
+      }
+    }
+    if (!replacing) {
+      continue;
+    }
+
+    // Make before break: both deliver until the new towers catch up, and
+    // subscribers drop the records they have already seen.
+    for (const TowerConnection& tower_conn : tower_conns) {
+      StreamSocket* const socket = tower_conn.first;
+      const int outgoing_worker_id = tower_conn.second;
+      if (topic.FindTower(socket)) {
+        continue;
+      }
+      SubscriptionID sub_id =
+        GenerateSubscriptionID(&next_sub_id_state_,
+                               myid_,
+                               options_.msg_loop->GetNumWorkers());
+      if (SendSubscribe(GuestTenant,
+                        handle,
+                        seqno,
+                        socket,
+                        sub_id,
+                        outgoing_worker_id)) {
+        uint32_t flags = TopicState::Tower::Flags::kCatchingUp;
+        if (seqno == 0) {
+          flags |= TopicState::Tower::Flags::kIsAtTail;
+        }
+        topic.towers.emplace_back(socket,
+                                  sub_id,
+                                  seqno,
+                                  outgoing_worker_id,
+                                  flags);
+      }
+    }
+    FinishRebalance(&topic, false);
+    // Replaced towers which never catch up are dropped on the next checkup.
+    topic_checkup_list_.Add(handle);
+    ++moved;
+  }
+  stats_.tower_rebalances_performed->Add(moved);
+  return moved;
+}
+
+void CopilotWorker::FinishRebalance(TopicState* topic, bool force) {
+  RS_ASSERT(topic);
+  if (topic->NumActiveTowers() == 0) {
+    // Keep delivering from replaced towers until there are new ones.
+    return;
+  }
+  auto& towers = topic->towers;
+  for (auto it = towers.begin(); it != towers.end(); ) {
+    bool caught_up = force || it->next_seqno == 0;
+    if (!caught_up && (it->flags & TopicState::Tower::Flags::kDraining)) {
+      caught_up = true;
+      for (const TopicState::Tower& tower : towers) {
+        if (!(tower.flags & TopicState::Tower::Flags::kDraining) &&
+            ((tower.flags & TopicState::Tower::Flags::kCatchingUp) ||
+             tower.next_seqno < it->next_seqno)) {
+          caught_up = false;
+          break;
+        }
+      }
+    }
+    // A tower which cannot be unsubscribed now is kept, rather than left
+    // subscribed on the tower, and unsubscribed on its next record or
+    // checkup.
+    if (caught_up && (it->flags & TopicState::Tower::Flags::kDraining) &&
+        SendUnsubscribe(GuestTenant, it->stream, it->sub_id, it->worker_id)) {
+      it = towers.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
 void CopilotWorker::ProcessTimerTick() {
@@ -747,12 +948,12 @@ void CopilotWorker::ProcessTimerTick() {
   uint64_t count = resubscriptions_per_tick_;
   while (count-- && HasActiveResubscribeRequests()) {
     SafeResubscribeRequest resubscribe_request = PopNextResubscribeRequest();
-    auto topic_it = topics_.find(resubscribe_request->topic_uuid);
+    auto topic_it = topics_.find(resubscribe_request->topic);
     bool topic_valid = topic_it != topics_.end();
     RS_ASSERT(topic_valid);
     if (topic_valid) {
       UpdateTowerSubscriptions(
-        resubscribe_request->topic_uuid,
+        resubscribe_request->topic,
         topic_it->second, /* topic */
         resubscribe_request->sequence_number,
         resubscribe_request->have_zero_sub);
@@ -761,43 +962,63 @@ void CopilotWorker::ProcessTimerTick() {
   }
 
   if (options_.rollcall_enabled) {
-    rollcall_->CheckBatchTimeouts(options_.rollcall_flush_latency);
+    rollcall_->CheckBatchTimeouts(options_.rollcall_flush_latency,
+                                  options_.rollcall_max_flush_latency);
+  }
+
+  // Move topics of logs affected by router updates, a whole log at a time.
+  uint64_t rebalances = 0;
+  while (rebalances < rebalances_per_tick_ && !pending_rebalances_.empty()) {
+    const auto& log_topics = pending_rebalances_.front();
+    RebalanceLog(log_topics.first, log_topics.second);
+    rebalances += std::max<size_t>(1, log_topics.second.size());
+    for (TopicHandle handle : log_topics.second) {
+      topic_table_.Release(handle);
+    }
+    pending_rebalances_.pop_front();
   }
 
   // Get a list of topics/tower subscriptions that are due a check up.
-  std::vector<TopicUUID> updates;
+  std::vector<TopicHandle> updates;
   topic_checkup_list_.GetExpired(
     options_.tower_subscriptions_check_period,
     std::back_inserter(updates),
     static_cast<int>(rebalances_per_tick_));
 
-  for (TopicUUID& uuid : updates) {
-    auto it = topics_.find(uuid);
+  for (TopicHandle handle : updates) {
+    auto it = topics_.find(handle);
     if (it != topics_.end()) {
       if (!CorrectTopicTowers(it->second)) {
         // Remove subscriptions and resubscribe to correct towers.
         const bool force_resub = true;
-        UpdateTowerSubscriptions(uuid, it->second, force_resub);
+        UpdateTowerSubscriptions(handle, it->second, force_resub);
         stats_.tower_rebalances_performed->Add(1);
+      } else {
+        // Drop towers replaced a whole period ago, caught up or not.
+        FinishRebalance(&it->second, true);
       }
       // Put back in the list to check again later.
-      topic_checkup_list_.Add(std::move(uuid));
+      topic_checkup_list_.Add(handle);
     }
   }
   stats_.tower_rebalances_checked->Add(updates.size());
 }
 
 void CopilotWorker::CloseControlTowerStream(StreamID stream) {
+  sub_to_topic_.VisitSubscriptions(stream,
+    [this] (SubscriptionID sub_id, TopicHandle handle) {
+      topic_table_.Release(handle);
+    });
   sub_to_topic_.Remove(stream);
 
   // Removes upstream connection for affected subscriptions.
-  for (auto& uuid_topic : topics_) {
-    const TopicUUID& uuid = uuid_topic.first;
-    TopicState& topic = uuid_topic.second;
+  for (auto& handle_topic : topics_) {
+    const TopicHandle handle = handle_topic.first;
+    TopicState& topic = handle_topic.second;
     for (auto it = topic.towers.begin(); it != topic.towers.end(); ) {
       if (it->stream->GetStreamID() == stream) {
         it = topic.towers.erase(it);
-        ScheduleResubscribeRequest(uuid, topic);
+        ScheduleResubscribeRequest(handle, topic);
       } else {
         ++it;
       }
@@ -819,11 +1040,12 @@ void CopilotWorker::CloseControlTowerStream(StreamID stream) {
 }
 
 bool CopilotWorker::SendSubscribe(TenantID tenant_id,
-                                  TopicUUID uuid,
+                                  TopicHandle topic,
                                   SequenceNumber seqno,
                                   StreamSocket* stream,
                                   SubscriptionID sub_id,
                                   int worker_id) {
+  const TopicUUID& uuid = topic_table_.GetUUID(topic);
   Slice namespace_id;
   Slice topic_name;
   uuid.GetTopicID(&namespace_id, &topic_name);
@@ -838,7 +1060,8 @@ bool CopilotWorker::SendSubscribe(TenantID tenant_id,
               seqno,
               stream->GetStreamID(),
               sub_id.ForLogging());
-    sub_to_topic_.Insert(stream->GetStreamID(), sub_id, std::move(uuid));
+    topic_table_.Acquire(topic);
+    sub_to_topic_.Insert(stream->GetStreamID(), sub_id, topic);
     return true;
   } else {
     LOG_WARN(options_.info_log,
@@ -863,7 +1086,10 @@ bool CopilotWorker::SendUnsubscribe(TenantID tenant_id,
     LOG_DEBUG(options_.info_log,
               "Sent unsubscription to tower stream %llu",
               stream->GetStreamID());
-    sub_to_topic_.Remove(stream->GetStreamID(), sub_id);
+    TopicHandle topic;
+    if (sub_to_topic_.MoveOut(stream->GetStreamID(), sub_id, &topic)) {
+      topic_table_.Release(topic);
+    }
     return true;
   } else {
     LOG_WARN(options_.info_log,
@@ -878,35 +1104,38 @@ SequenceNumber CopilotWorker::FindLowestSequenceNumber(
     const TopicState& topic, bool* have_zero_sub) {
 
   SequenceNumber new_seqno = 0;
-  for (auto& sub : topic.subscriptions) {
-    if (sub->seqno != 0) {
-      if (new_seqno == 0 || sub->seqno < new_seqno) {
-        new_seqno = sub->seqno;
+  const Subscriptions& subs = topic.subscriptions;
+  subs.ForEach([&](uint32_t index) {
+    const SequenceNumber seqno = subs.seqno(index);
+    if (seqno != 0) {
+      if (new_seqno == 0 || seqno < new_seqno) {
+        new_seqno = seqno;
       }
     } else {
       *have_zero_sub = true;
     }
-  }
+  });
   return new_seqno;
 }
 
 
-void CopilotWorker::UpdateTowerSubscriptions(const TopicUUID& uuid,
+void CopilotWorker::UpdateTowerSubscriptions(TopicHandle handle,
                                              TopicState& topic,
                                              bool force_resub) {
   bool have_zero_sub = false;
   SequenceNumber new_seqno = FindLowestSequenceNumber(topic, &have_zero_sub);
 
   UpdateTowerSubscriptions(
-      uuid, topic, new_seqno, have_zero_sub, force_resub);
+      handle, topic, new_seqno, have_zero_sub, force_resub);
 }
 
 void CopilotWorker::UpdateTowerSubscriptions(
-    const TopicUUID& uuid,
+    TopicHandle handle,
     TopicState& topic,
     SequenceNumber new_seqno,
     const bool have_zero_sub,
     bool force_resub) {
+  const TopicUUID& uuid = topic_table_.GetUUID(handle);
 
   LOG_INFO(options_.info_log,
     "Refreshing tower subscriptions for %s",
@@ -942,12 +1171,13 @@ void CopilotWorker::UpdateTowerSubscriptions(
   // subscribe the copilot at 0 without sending a FindTailSeqno request.
   const bool send_latest_request = have_zero_sub && new_seqno != 0;
 
-  bool resub_needed = topic.towers.size() < expected_towers_per_log;
+  // Towers being replaced do not count, they are going away.
+  bool resub_needed = topic.NumActiveTowers() < expected_towers_per_log;
   if (resub_needed) {
     LOG_INFO(options_.info_log,
       "Not enough control tower subscriptions for %s (%zu/%zu), resubscribing",
       uuid.ToString().c_str(),
-      topic.towers.size(),
+      topic.NumActiveTowers(),
       expected_towers_per_log);
   }
 
@@ -1010,7 +1240,7 @@ void CopilotWorker::UpdateTowerSubscriptions(
                                options_.msg_loop->GetNumWorkers());
 
       bool success = SendSubscribe(tenant_id,
-                                   uuid,
+                                   handle,
                                    new_seqno,
                                    socket,
                                    sub_id,
@@ -1061,16 +1291,16 @@ void CopilotWorker::UpdateTowerSubscriptions(
     }
   }
 
-  if (topic.towers.size() < expected_towers_per_log) {
+  if (topic.NumActiveTowers() < expected_towers_per_log) {
     // Still not enough tower subscriptions, so put onto orphan list.
     // This will happen if e.g. sending the subscription failed due to full
     // queue, or if there simply aren't any control towers currently available.
-    ReScheduleResubscribeRequest(uuid, topic, new_seqno, have_zero_sub);
+    ReScheduleResubscribeRequest(handle, topic, new_seqno, have_zero_sub);
   } else {
     if (resub_needed) {
       // We successfully resubscribed to all towers, so add to checkup list
       // (or push to the back of the queue, since subscriptions are up to date).
-      topic_checkup_list_.Add(uuid);
+      topic_checkup_list_.Add(handle);
     }
   }
 }
@@ -1111,9 +1341,9 @@ CopilotWorker::RollcallWrite(const SubscriptionID sub_id,
           ProcessUnsubscribe(tenant_id, sub_id, reason, worker_id, origin);
 
           // Send back message to the client, saying that it should resubscribe.
-          MessageUnsubscribe msg(tenant_id, sub_id, reason);
-          auto unsub_command = MsgLoop::ResponseCommand(msg, origin);
-          client_queues_[worker_id]->Write(unsub_command);
+          std::unique_ptr<MessageUnsubscribe> msg(
+            new MessageUnsubscribe(tenant_id, sub_id, reason));
+          SendToClient(worker_id, origin, std::move(msg));
 
           stats_.rollcall_writes_failed->Add(1);
         }));
@@ -1160,7 +1390,8 @@ CopilotWorker::RollcallWrite(const SubscriptionID sub_id,
     }
   }
 
-  rollcall_->CheckBatchTimeouts(options_.rollcall_flush_latency);
+  rollcall_->CheckBatchTimeouts(options_.rollcall_flush_latency,
+                                options_.rollcall_max_flush_latency);
 }
 
 StreamSocket* CopilotWorker::GetControlTowerSocket(const HostId& tower,
@@ -1197,6 +1428,9 @@ void CopilotWorker::AdvanceTowers(TopicState* topic,
                   tower.next_seqno,
                   next + 1);
         tower.next_seqno = next + 1;
+        tower.flags &= ~TopicState::Tower::Flags::kCatchingUp;
+        // May erase towers, so the loop must not continue.
+        FinishRebalance(topic, false);
       } else {
         stats_.out_of_order_seqno_from_tower->Add(1);
       }
@@ -1226,7 +1460,7 @@ std::string CopilotWorker::GetSubscriptionInfo(std::string filter,
   std::string result;
   for (const auto& entry : topics_) {
     char buffer[4096];
-    const TopicUUID& topic = entry.first;
+    const TopicUUID& topic = topic_table_.GetUUID(entry.first);
     const TopicState& state = entry.second;
     std::string topic_name = topic.ToString();
     if (!strstr(topic_name.c_str(), filter.c_str())) {
@@ -1241,7 +1475,7 @@ std::string CopilotWorker::GetSubscriptionInfo(std::string filter,
                   topic_name.c_str(), state.log_id);
     n += snprintf(buffer + n, sizeof(buffer),
                   "%s.subscription_count: %zu\n",
-                  topic_name.c_str(), state.subscriptions.size());
+                  topic_name.c_str(), state.subscriptions.Size());
     n += snprintf(buffer + n, sizeof(buffer),
                   "%s.records_sent: %" PRIu32 "\n",
                   topic_name.c_str(), state.records_sent);
@@ -1327,15 +1561,15 @@ bool CopilotWorker::HasActiveResubscribeRequests() {
   return !active_resubscribe_requests_by_topic_.empty();
 }
 
-bool CopilotWorker::HasActiveResubscribeRequest(const TopicUUID& topic_uuid) {
+bool CopilotWorker::HasActiveResubscribeRequest(TopicHandle topic) {
   auto active_subscription_it
-    = active_resubscribe_requests_by_topic_.find(topic_uuid);
+    = active_resubscribe_requests_by_topic_.find(topic);
 
   return active_subscription_it != active_resubscribe_requests_by_topic_.end();
 }
 
-void CopilotWorker::CancelResubscribeRequest(const TopicUUID& topic_uuid) {
-  auto request_it = active_resubscribe_requests_by_topic_.find(topic_uuid);
+void CopilotWorker::CancelResubscribeRequest(TopicHandle topic) {
+  auto request_it = active_resubscribe_requests_by_topic_.find(topic);
   if (request_it != active_resubscribe_requests_by_topic_.end()) {
     request_it->second->cancelled = true;
     active_resubscribe_requests_by_topic_.erase(request_it);
@@ -1354,20 +1588,20 @@ CopilotWorker::PopNextResubscribeRequest() {
           current_resubscribe_request_queue_.top()));
 
   current_resubscribe_request_queue_.pop();
-  active_resubscribe_requests_by_topic_.erase(top_request->topic_uuid);
+  active_resubscribe_requests_by_topic_.erase(top_request->topic);
 
   return top_request;
 }
 
 void CopilotWorker::ReScheduleResubscribeRequest(
-    const TopicUUID& topic_uuid,
+    TopicHandle topic,
     const TopicState& topic_state,
     const SequenceNumber new_seqno,
     const bool have_zero_sub) {
 
   // A re-scheduled request should go in the next batch.
   ScheduleResubscribeRequest(
-      topic_uuid,
+      topic,
       topic_state,
       new_seqno,
       have_zero_sub,
@@ -1375,7 +1609,7 @@ void CopilotWorker::ReScheduleResubscribeRequest(
 }
 
 void CopilotWorker::ScheduleResubscribeRequest(
-    const TopicUUID& topic_uuid, const TopicState& topic_state) {
+    TopicHandle topic, const TopicState& topic_state) {
 
   bool have_zero_sub = false;
   auto new_seqno = FindLowestSequenceNumber(topic_state, &have_zero_sub);
@@ -1388,7 +1622,7 @@ void CopilotWorker::ScheduleResubscribeRequest(
           current_resubscribe_request_queue_;
 
   ScheduleResubscribeRequest(
-      topic_uuid,
+      topic,
       topic_state,
       new_seqno,
       have_zero_sub,
@@ -1396,22 +1630,22 @@ void CopilotWorker::ScheduleResubscribeRequest(
 }
 
 void CopilotWorker::ScheduleResubscribeRequest(
-    const TopicUUID& topic_uuid,
+    TopicHandle topic,
     const TopicState& topic_state,
     const SequenceNumber new_seqno,
     const bool have_zero_sub,
     ResubscribeRequestQueue& resubscribe_request_queue) {
 
-  if (HasActiveResubscribeRequest(topic_uuid)) {
+  if (HasActiveResubscribeRequest(topic)) {
     return;
   }
 
   auto request = new ResubscribeRequest(
-      topic_uuid, new_seqno, have_zero_sub, false);
+      topic, new_seqno, have_zero_sub, false);
 
   resubscribe_request_queue.push(SafeResubscribeRequest(request));
   active_resubscribe_requests_by_topic_.insert(
-      std::make_pair(topic_uuid, request));
+      std::make_pair(topic, request));
 }
 
 }  // namespace rocketspeed
@@ -5,6 +5,9 @@
 //
 #pragma once
 
+#include <cstdint>
+#include <deque>
+#include <limits>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -23,6 +26,7 @@
 #include "src/util/subscription_map.h"
 #include "src/util/storage.h"
 #include "src/util/timeout_list.h"
+#include "src/util/topic_table.h"
 #include "src/util/topic_uuid.h"
 
 namespace rocketspeed {
@@ -30,6 +34,7 @@ namespace rocketspeed {
 class ClientImpl;
 class Copilot;
 class ControlTowerRouter;
+class EventCallback;
 class RollcallImpl;
 
 template <typename> class ThreadLocalQueues;
@@ -39,6 +44,7 @@ template <typename> class ThreadLocalQueues;
  * per hardware thread. The workers take load off of the main thread.
  */
 class CopilotWorker {
+ friend class CopilotTest;
  public:
   // Constructs a new CopilotWorker (does not start a thread).
   CopilotWorker(const CopilotOptions& options,
@@ -108,7 +114,7 @@ class CopilotWorker {
   }
 
  private:
-  struct Subscription;
+  class Subscriptions;
   struct TopicState;
 
   struct Stats {
@@ -145,8 +151,18 @@ class CopilotWorker {
         all.AddCounter("copilot.tower_rebalances_checked");
       tower_rebalances_performed =
         all.AddCounter("copilot.tower_rebalances_performed");
+      tower_rebalance_logs =
+        all.AddCounter("copilot.tower_rebalance_logs");
       tail_subscribe_fast_path =
         all.AddCounter("copilot.tail_subscribe_fast_path");
+      client_batches =
+        all.AddCounter("copilot.client_batches");
+      client_messages =
+        all.AddCounter("copilot.client_messages");
+      multicast_deliveries =
+        all.AddCounter("copilot.multicast_deliveries");
+      client_batches_retried =
+        all.AddCounter("copilot.client_batches_retried");
     }
 
     Statistics all;
@@ -167,7 +183,12 @@ class CopilotWorker {
     Counter* orphaned_resubscribes;
     Counter* tower_rebalances_checked;
     Counter* tower_rebalances_performed;
+    Counter* tower_rebalance_logs;
     Counter* tail_subscribe_fast_path;
+    Counter* client_batches;
+    Counter* client_messages;
+    Counter* multicast_deliveries;
+    Counter* client_batches_retried;
   } stats_;
 
   // Add a subscriber to a topic.
@@ -191,6 +212,16 @@ class CopilotWorker {
   void ProcessData(std::unique_ptr<Message> msg,
                    StreamID origin);
 
+  // Queues a message for a client stream handled by a worker. Messages are
+  // sent at the end of the event loop iteration, in one command per worker.
+  void SendToClient(int worker_id,
+                    StreamID stream,
+                    std::unique_ptr<Message> msg);
+
+  // Sends messages queued by SendToClient. Messages for a worker which queue
+  // is full are kept, ahead of later ones, and retried shortly.
+  void FlushClientMessages();
+
   // Forward gap to subscribers.
   void ProcessGap(std::unique_ptr<Message> msg,
                   StreamID origin);
@@ -203,14 +234,27 @@ class CopilotWorker {
   void ProcessGoodbye(std::unique_ptr<Message> msg,
                       StreamID origin);
 
+  // Swaps the router and queues logs that map to different towers under
+  // the new router for rebalancing.
   void ProcessRouterUpdate(std::shared_ptr<ControlTowerRouter> router);
 
+  // Moves tower subscriptions of topics on a log to the towers of the
+  // current router. New towers are subscribed first, at the position of the
+  // replaced ones, which are unsubscribed once the new ones have caught up.
+  // Returns the number of topics moved.
+  size_t RebalanceLog(LogID log_id, const std::vector<TopicHandle>& topics);
+
+  // Unsubscribes towers being replaced on a topic, once all other towers
+  // have delivered up to their position, or unconditionally if forced.
+  // Towers are only forgotten once their unsubscription has been sent.
+  void FinishRebalance(TopicState* topic, bool force);
+
   // Closes stream to a control tower, and updates all affected subscriptions.
   void CloseControlTowerStream(StreamID stream);
 
   /** Sends a subscription message to a control tower. */
   bool SendSubscribe(TenantID tenant_id,
-                     TopicUUID uuid,
+                     TopicHandle topic,
                      SequenceNumber seqno,
                      StreamSocket* stream,
                      SubscriptionID sub_id,
@@ -273,24 +317,137 @@ class CopilotWorker {
   // My worker id
   int myid_;
 
-  // Subscription metadata per client.
-  struct Subscription {
-    Subscription(StreamID id,
-                 SequenceNumber seq_no,
-                 int _worker_id,
-                 TenantID _tenant_id,
-                 SubscriptionID _sub_id)
-    : stream_id(id)
-    , seqno(seq_no)
-    , worker_id(_worker_id)
-    , tenant_id(_tenant_id)
-    , sub_id(_sub_id) {}
-
-    StreamID stream_id;           // The subscriber
-    SequenceNumber seqno;         // Lowest seqno to accept
-    int worker_id;                // The event loop worker for client.
-    TenantID tenant_id;           // Tenant ID of the subscriber.
-    const SubscriptionID sub_id;  // Stream-local ID of this subscription.
+  /**
+   * Subscriptions of clients on a topic, stored column by column, so that
+   * finding the subscriptions a record is for is a scan over sequence
+   * numbers only. A subscription keeps its index until removed, and indices
+   * of removed subscriptions are reused.
+   */
+  class Subscriptions {
+   public:
+    static constexpr uint32_t kNotFound = std::numeric_limits<uint32_t>::max();
+
+    size_t Size() const { return size_; }
+    bool Empty() const { return size_ == 0; }
+
+    /** Adds a subscription, returns its index. */
+    uint32_t Add(StreamID stream_id,
+                 SequenceNumber seqno,
+                 int worker_id,
+                 TenantID tenant_id,
+                 SubscriptionID sub_id) {
+      RS_ASSERT(worker_id >= 0);
+      uint32_t index;
+      if (!free_.empty()) {
+        index = free_.back();
+        free_.pop_back();
+      } else {
+        index = static_cast<uint32_t>(seqnos_.size());
+        seqnos_.emplace_back();
+        stream_ids_.emplace_back();
+        worker_ids_.emplace_back();
+        tenant_ids_.emplace_back();
+        sub_ids_.emplace_back();
+      }
+      seqnos_[index] = seqno;
+      stream_ids_[index] = stream_id;
+      worker_ids_[index] = worker_id;
+      tenant_ids_[index] = tenant_id;
+      sub_ids_[index] = sub_id;
+      ++size_;
+      return index;
+    }
+
+    void Remove(uint32_t index) {
+      RS_ASSERT(IsLive(index));
+      // Free slots never match a record.
+      seqnos_[index] = kFreeSeqno;
+      worker_ids_[index] = -1;
+      free_.push_back(index);
+      --size_;
+    }
+
+    /** Finds a subscription, returns its index or kNotFound. */
+    uint32_t Find(StreamID stream_id, SubscriptionID sub_id) const {
+      for (uint32_t i = 0; i < sub_ids_.size(); ++i) {
+        if (sub_ids_[i] == sub_id && stream_ids_[i] == stream_id &&
+            IsLive(i)) {
+          return i;
+        }
+      }
+      return kNotFound;
+    }
+
+    /**
+     * Finds subscriptions expecting a record (or gap) from prev_seqno to
+     * seqno, i.e. subscribed at a seqno in [prev_seqno, seqno], or at 0 iff
+     * prev_seqno is 0.
+     *
+     * @param out Output for indices of the subscriptions, in order.
+     */
+    void FindExpecting(SequenceNumber prev_seqno,
+                       SequenceNumber seqno,
+                       std::vector<uint32_t>* out) {
+      out->clear();
+      if (prev_seqno > seqno) {
+        return;
+      }
+      // Subscriptions at 0 only get records from 0, and the others only from
+      // a non-zero seqno, so both are one unsigned range check.
+      const SequenceNumber low = prev_seqno;
+      const SequenceNumber span = prev_seqno == 0 ? 0 : seqno - prev_seqno;
+      const size_t n = seqnos_.size();
+      const SequenceNumber* seqnos = seqnos_.data();
+      matches_.resize(n);
+      uint8_t* matches = matches_.data();
+      for (size_t i = 0; i < n; ++i) {
+        matches[i] = (seqnos[i] - low) <= span;
+      }
+      for (uint32_t i = 0; i < n; ++i) {
+        if (matches[i] && IsLive(i)) {
+          out->push_back(i);
+        }
+      }
+    }
+
+    /** Invokes f(index) for each subscription. */
+    template <typename Function>
+    void ForEach(Function f) const {
+      for (uint32_t i = 0; i < seqnos_.size(); ++i) {
+        if (IsLive(i)) {
+          f(i);
+        }
+      }
+    }
+
+    bool IsLive(uint32_t index) const { return worker_ids_[index] >= 0; }
+
+    SequenceNumber& seqno(uint32_t index) { return seqnos_[index]; }
+    SequenceNumber seqno(uint32_t index) const { return seqnos_[index]; }
+    StreamID stream_id(uint32_t index) const { return stream_ids_[index]; }
+    int worker_id(uint32_t index) const { return worker_ids_[index]; }
+    TenantID tenant_id(uint32_t index) const { return tenant_ids_[index]; }
+    SubscriptionID sub_id(uint32_t index) const { return sub_ids_[index]; }
+
+   private:
+    static constexpr SequenceNumber kFreeSeqno =
+      std::numeric_limits<SequenceNumber>::max();
+
+    // Lowest seqno to accept.
+    std::vector<SequenceNumber> seqnos_;
+    // The subscriber.
+    std::vector<StreamID> stream_ids_;
+    // The event loop worker for client, -1 for free slots.
+    std::vector<int> worker_ids_;
+    // Tenant ID of the subscriber.
+    std::vector<TenantID> tenant_ids_;
+    // Stream-local ID of the subscription.
+    std::vector<SubscriptionID> sub_ids_;
+    // Indices of free slots.
+    std::vector<uint32_t> free_;
+    size_t size_ = 0;
+    // Scratch space for FindExpecting.
+    std::vector<uint8_t> matches_;
   };
 
   enum : size_t { kMaxTowerConnections = 2 };
@@ -301,7 +458,9 @@ class CopilotWorker {
     struct Tower {
       enum Flags : uint32_t {
         kDefault = 0,
-        kIsAtTail = 1 << 0  // Set if at tail.
+        kIsAtTail = 1 << 0,   // Set if at tail.
+        kDraining = 1 << 1,   // Set if being replaced after a router update.
+        kCatchingUp = 1 << 2  // Set if replacing, until it first advances.
       };
 
       explicit Tower(StreamSocket* _stream,
@@ -331,10 +490,21 @@ class CopilotWorker {
       return nullptr;
     }
 
+    // Number of towers which are not being replaced.
+    size_t NumActiveTowers() const {
+      size_t count = 0;
+      for (const Tower& tower : towers) {
+        if (!(tower.flags & Tower::Flags::kDraining)) {
+          ++count;
+        }
+      }
+      return count;
+    }
+
     using Towers = autovector<Tower, kMaxTowerConnections>;
 
     LogID log_id;
-    std::vector<std::unique_ptr<Subscription>> subscriptions;
+    Subscriptions subscriptions;
     Towers towers; // Tower subscriptions.
     uint32_t records_sent = 0;
     uint32_t gaps_sent = 0;
@@ -347,15 +517,18 @@ class CopilotWorker {
 
   void HandleInvalidSubscription(StreamID origin, SubscriptionID sub_id);
 
-  void UnsubscribeControlTowers(const TopicUUID& topic_uuid, TopicState& topic);
+  void UnsubscribeControlTowers(TopicState& topic);
+
+  // Interned topics of this worker. Topic handles are held by topics_,
+  // client_subscriptions_, sub_to_topic_ and pending_rebalances_.
+  TopicTable topic_table_;
 
   // State of subscriptions for a single topic.
-  std::unordered_map<TopicUUID, TopicState> topics_;
+  std::unordered_map<TopicHandle, TopicState> topics_;
 
   // Map of client to topics subscribed to.
   struct TopicInfo {
-    Topic topic_name;
-    NamespaceID namespace_id;
+    TopicHandle topic;
     LogID logid;
   };
 
@@ -379,6 +552,25 @@ class CopilotWorker {
   // Queue for each client worker.
   std::vector<std::shared_ptr<CommandQueue>> client_queues_;
 
+  // Message for a client stream.
+  struct ClientMessage {
+    StreamID stream;
+    std::unique_ptr<Message> msg;
+  };
+
+  // Messages queued for each client worker, in order of SendToClient.
+  std::vector<std::vector<ClientMessage>> client_messages_;
+
+  // Workers with queued messages, and whether sending them is scheduled.
+  std::vector<int> client_workers_pending_;
+  bool client_flush_scheduled_{false};
+
+  // Retries sending messages to workers which queues were full.
+  std::unique_ptr<EventCallback> client_retry_timer_;
+
+  // Subscriptions a record is being delivered to, reused between records.
+  std::vector<uint32_t> recipients_;
+
   // Queue for each control tower worker.
   std::vector<std::shared_ptr<CommandQueue>> tower_queues_;
 
@@ -392,7 +584,11 @@ class CopilotWorker {
   // A list of subscriptions to check topic health periodically.
   // For long-living subscriptions, we need to ensure that the subscription
   // is on the correct control tower.
-  TimeoutList<TopicUUID> topic_checkup_list_;
+  TimeoutList<TopicHandle> topic_checkup_list_;
+
+  // Logs whose towers changed in a router update, with their topics at the
+  // time, in order of rebalancing.
+  std::deque<std::pair<LogID, std::vector<TopicHandle>>> pending_rebalances_;
 
   // Cache of control tower mapping per log.
   mutable std::unordered_map<LogID, std::vector<const HostId*>>
@@ -407,16 +603,16 @@ class CopilotWorker {
 
   struct ResubscribeRequest {
     ResubscribeRequest(
-        TopicUUID _topic_uuid,
+        TopicHandle _topic,
         SequenceNumber _sequence_number,
         bool _have_zero_sub,
         bool _cancelled)
-    : topic_uuid(std::move(_topic_uuid))
+    : topic(_topic)
     , sequence_number(_sequence_number)
     , have_zero_sub(_have_zero_sub)
     , cancelled(_cancelled) {}
 
-    const TopicUUID topic_uuid;
+    const TopicHandle topic;  // not valid once cancelled
     const SequenceNumber sequence_number;
     const bool have_zero_sub;
     bool cancelled; // quicker than removing item from middle of priority_queue
@@ -444,10 +640,10 @@ class CopilotWorker {
   ResubscribeRequestQueue current_resubscribe_request_queue_;
   ResubscribeRequestQueue pending_resubscribe_request_queue_;
 
-  std::unordered_map<TopicUUID,ResubscribeRequest*>
+  std::unordered_map<TopicHandle, ResubscribeRequest*>
     active_resubscribe_requests_by_topic_;
 
-  SubscriptionMap<TopicUUID> sub_to_topic_;
+  SubscriptionMap<TopicHandle> sub_to_topic_;
 
   /***
    * Re-subscribe helper methods
@@ -459,16 +655,16 @@ class CopilotWorker {
 
   bool HasActiveResubscribeRequests();
 
-  bool HasActiveResubscribeRequest(const TopicUUID& topic_uuid);
+  bool HasActiveResubscribeRequest(TopicHandle topic);
 
-  void CancelResubscribeRequest(const TopicUUID& topic_uuid);
+  void CancelResubscribeRequest(TopicHandle topic);
 
   SafeResubscribeRequest PopNextResubscribeRequest();
 
   // Called when a re-subscribe request has failed and needs to be re-tried.
   // (At a later time, not immediately).
   void ReScheduleResubscribeRequest(
-      const TopicUUID& topic_uuid,
+      TopicHandle topic,
       const TopicState& topic_state,
       const SequenceNumber new_seqno,
       const bool have_zero_sub);
@@ -476,11 +672,11 @@ class CopilotWorker {
   // Called when a topic needs to be re-subscribed.
   // Calculates the sequence number to re-subscribe at.
   void ScheduleResubscribeRequest(
-      const TopicUUID& topic_uuid, const TopicState& topic_state);
+      TopicHandle topic, const TopicState& topic_state);
 
   // Called when a topic needs to be re-subscribed.
   void ScheduleResubscribeRequest(
-      const TopicUUID& topic_uuid,
+      TopicHandle topic,
       const TopicState& topic_state,
       const SequenceNumber new_seqno,
       const bool have_zero_sub,
@@ -491,13 +687,13 @@ class CopilotWorker {
    */
 
   // Refreshes ustream subscriptions for a topic.
-  void UpdateTowerSubscriptions(const TopicUUID& uuid,
+  void UpdateTowerSubscriptions(TopicHandle handle,
                                 TopicState& topic,
                                 bool force_resub = false);
 
   // Refreshes ustream subscriptions for a topic.
   void UpdateTowerSubscriptions(
-      const TopicUUID& uuid,
+      TopicHandle handle,
       TopicState& topic,
       SequenceNumber new_seqno,
       const bool have_zero_sub,
@@ -12,6 +12,7 @@
 #include "include/Types.h"
 #include "src/messages/messages.h"
 #include "src/messages/stream_socket.h"
+#include "src/messages/types.h"
 #include "src/util/common/autovector.h"
 #include "include/HostId.h"
 
@@ -72,11 +73,11 @@ class SendCommand : public Command {
   CommandType GetCommandType() const { return kSendCommand; }
 
   /**
-   * Writes a serialised form of a message to provided string.
+   * Returns a serialised form of a message.
    * Depending on implementation, this call might perform a move of message
-   * content into provided string.
+   * content into returned value.
    */
-  virtual void GetMessage(std::string* out) = 0;
+  virtual SharedTimestampedString GetMessage() = 0;
 
   /**
    * If this is a command to send a mesage to remote hosts, then returns the
@@ -92,7 +93,7 @@ class SendCommand : public Command {
 class SerializedSendCommand : public SendCommand {
  public:
   static std::unique_ptr<SerializedSendCommand> Request(
-      std::string serialized,
+      SharedTimestampedString serialized,
       const SocketList& sockets) {
     Recipients recipients;
     for (const auto& socket : sockets) {
@@ -104,8 +105,14 @@ class SerializedSendCommand : public SendCommand {
         std::move(serialized), std::move(recipients)));
   }
 
-  static std::unique_ptr<SerializedSendCommand> Response(
+  static std::unique_ptr<SerializedSendCommand> Request(
       std::string serialized,
+      const SocketList& sockets) {
+    return Request(Wrap(std::move(serialized)), sockets);
+  }
+
+  static std::unique_ptr<SerializedSendCommand> Response(
+      SharedTimestampedString serialized,
       const StreamList& streams) {
     Recipients recipients;
     for (auto stream : streams) {
@@ -115,20 +122,33 @@ class SerializedSendCommand : public SendCommand {
         std::move(serialized), std::move(recipients)));
   }
 
-  void GetMessage(std::string* out) {
-    out->assign(std::move(message_));
+  static std::unique_ptr<SerializedSendCommand> Response(
+      std::string serialized,
+      const StreamList& streams) {
+    return Response(Wrap(std::move(serialized)), streams);
+  }
+
+  SharedTimestampedString GetMessage() {
+    return std::move(message_);
   }
 
  private:
+  static SharedTimestampedString Wrap(std::string serialized) {
+    auto message = std::make_shared<TimestampedString>();
+    message->string = std::move(serialized);
+    message->issued_time = 0;  // Set by the EventLoop.
+    return message;
+  }
+
   // Hiding, as it's not super convenient to work with this class without
   // std::make_unique.
-  SerializedSendCommand(std::string message, Recipients recipients)
+  SerializedSendCommand(SharedTimestampedString message, Recipients recipients)
       : SendCommand(std::move(recipients)), message_(std::move(message)) {
-    RS_ASSERT(message_.size() > 0);
+    RS_ASSERT(message_ && message_->size() > 0);
   }
-  // Buffer with the message. It's content is moved away on first attempt to get
-  // serialized message.
-  std::string message_;
+  // The serialized message. It's moved away on first attempt to get serialized
+  // message.
+  SharedTimestampedString message_;
 };
 
 /**
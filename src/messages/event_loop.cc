@@ -9,6 +9,7 @@
 #include <limits.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 #include <algorithm>
@@ -31,6 +32,7 @@
 #include "external/folly/move_wrapper.h"
 
 #include "src/messages/serializer.h"
+#include "src/messages/shm_channel.h"
 #include "src/messages/socket_event.h"
 #include "src/messages/stream.h"
 #include "src/messages/stream_socket.h"
@@ -60,6 +62,36 @@ const int EventLoop::kLogSeverityMsg = _EVENT_LOG_MSG;
 const int EventLoop::kLogSeverityWarn = _EVENT_LOG_WARN;
 const int EventLoop::kLogSeverityErr = _EVENT_LOG_ERR;
 
+namespace {
+
+/**
+ * Address of the Unix domain socket accepting local connections for a port,
+ * in the abstract namespace.
+ */
+socklen_t GetLocalAddress(uint16_t port, sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  // Abstract names start with a null byte and are not null-terminated.
+  int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                     "rocketspeed-%u", static_cast<unsigned>(port));
+  return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + len);
+}
+
+bool IsLoopback(const HostId& host) {
+  const sockaddr* addr = host.GetSockaddr();
+  if (addr->sa_family == AF_INET) {
+    auto sin = reinterpret_cast<const sockaddr_in*>(addr);
+    return (ntohl(sin->sin_addr.s_addr) >> 24) == 127;
+  }
+  if (addr->sa_family == AF_INET6) {
+    auto sin6 = reinterpret_cast<const sockaddr_in6*>(addr);
+    return IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr);
+  }
+  return false;
+}
+
+}  // namespace
+
 class AcceptCommand : public Command {
  public:
   explicit AcceptCommand(int fd)
@@ -90,10 +122,9 @@ void EventLoop::HandleSendCommand(Flow* flow,
   SendCommand* send_cmd = static_cast<SendCommand*>(command.get());
 
   auto now = env_->NowMicros();
-  const auto msg = std::make_shared<TimestampedString>();
-  send_cmd->GetMessage(&msg->string);
+  const auto msg = send_cmd->GetMessage();
   msg->issued_time = now;
-  RS_ASSERT(!msg->string.empty());
+  RS_ASSERT(msg->size() > 0);
 
   for (const SendCommand::StreamSpec& spec : send_cmd->GetDestinations()) {
     // Find or create a stream.
@@ -134,6 +165,16 @@ void EventLoop::HandleAcceptCommand(std::unique_ptr<Command> command) {
   AcceptCommand* accept_cmd = static_cast<AcceptCommand*>(command.get());
   // Create SocketEvent and pass ownership to the loop.
   int fd = accept_cmd->DetachFD();
+
+  sockaddr_storage addr;
+  socklen_t addr_len = static_cast<socklen_t>(sizeof(addr));
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) == 0 &&
+      addr.ss_family == AF_UNIX) {
+    // The peer hands over a shared memory channel first.
+    AcceptLocal(fd);
+    return;
+  }
+
   auto owned_socket = SocketEvent::Create(this, fd, options_.protocol_version);
   const auto socket = owned_socket.get();
   if (!socket) {
@@ -149,6 +190,109 @@ void EventLoop::HandleAcceptCommand(std::unique_ptr<Command> command) {
   stats_.accepts->Add(1);
 }
 
+void EventLoop::AcceptLocal(int fd) {
+  thread_check_.Check();
+
+#ifdef OS_LINUX
+  // The abstract socket is open to every process on the host, but only those
+  // of the same user may share memory with this one.
+  ucred cred;
+  socklen_t cred_len = static_cast<socklen_t>(sizeof(cred));
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+      cred.uid != geteuid()) {
+    LOG_WARN(info_log_,
+             "Refused local connection fd(%d) from another user",
+             fd);
+    RejectLocal(fd);
+    return;
+  }
+#endif
+
+  auto handshake_ev = EventCallback::CreateFdReadCallback(
+      this, fd, [this, fd]() { HandleLocalHandshake(fd); });
+  if (!handshake_ev) {
+    LOG_ERROR(info_log_,
+              "Failed to create event for local connection fd(%d)",
+              fd);
+    RejectLocal(fd);
+    return;
+  }
+  handshake_ev->Enable();
+  local_handshakes_.emplace(fd, std::move(handshake_ev));
+  local_handshake_timeout_.Add(fd);
+}
+
+void EventLoop::RejectLocal(int fd) {
+  // The peer then connects over TCP instead. It does so on closure as well,
+  // so there is nothing to do if the reply cannot be written.
+  if (write(fd, &kLocalHandshakeReject, 1) != 1) {
+    LOG_DEBUG(info_log_,
+              "Failed to reject local connection fd(%d): %s",
+              fd,
+              strerror(errno));
+  }
+  close(fd);
+}
+
+void EventLoop::EndLocalHandshake(int fd) {
+  thread_check_.Check();
+
+  // Defer destruction of the event, we might be inside its callback.
+  auto it = local_handshakes_.find(fd);
+  RS_ASSERT(it != local_handshakes_.end());
+  auto handshake_ev = std::move(it->second);
+  local_handshakes_.erase(it);
+  local_handshake_timeout_.Erase(fd);
+  handshake_ev->Disable();
+  AddTask(MakeDeferredDeleter(handshake_ev));
+}
+
+void EventLoop::HandleLocalHandshake(int fd) {
+  thread_check_.Check();
+
+  std::unique_ptr<ShmChannel> channel;
+  Status st = ShmChannel::ReceiveFrom(fd, &channel);
+  if (st.ok() && !channel) {
+    // Not there yet.
+    return;
+  }
+
+  EndLocalHandshake(fd);
+  if (!st.ok()) {
+    LOG_ERROR(info_log_,
+              "Failed to receive channel on local connection fd(%d): %s",
+              fd,
+              st.ToString().c_str());
+    RejectLocal(fd);
+    return;
+  }
+
+  // The peer holds its frames until the channel is accepted.
+  if (write(fd, &kLocalHandshakeAccept, 1) != 1) {
+    LOG_ERROR(info_log_,
+              "Failed to accept channel on local connection fd(%d): %s",
+              fd,
+              strerror(errno));
+    close(fd);
+    return;
+  }
+
+  auto owned_socket = SocketEvent::Create(
+      this, fd, options_.protocol_version, HostId(), std::move(channel));
+  const auto socket = owned_socket.get();
+  if (!socket) {
+    LOG_ERROR(info_log_,
+              "Failed to create SocketEvent for local connection fd(%d)",
+              fd);
+    close(fd);
+    return;
+  }
+  owned_connections_.emplace(socket, std::move(owned_socket));
+
+  stats_.accepts->Add(1);
+  stats_.local_connections->Add(1);
+}
+
 //
 // This callback is fired from the first aritificial timer event
 // in the dispatch loop.
@@ -308,6 +452,29 @@ EventLoop::Initialize() {
     host_id_ = HostId::CreateLocal(static_cast<uint16_t>(port_number_));
 
     evconnlistener_set_error_cb(listener_, &EventLoop::accept_error_cb);
+
+    if (options_.local_transport) {
+      sockaddr_un sun;
+      const socklen_t sun_len =
+          GetLocalAddress(static_cast<uint16_t>(port_number_), &sun);
+      local_listener_ =
+          evconnlistener_new_bind(base_,
+                                  &EventLoop::do_accept,
+                                  reinterpret_cast<void*>(this),
+                                  LEV_OPT_CLOSE_ON_FREE,
+                                  -1,  // backlog
+                                  reinterpret_cast<sockaddr*>(&sun),
+                                  static_cast<int>(sun_len));
+      if (local_listener_ == nullptr) {
+        // Peers will connect over TCP.
+        LOG_WARN(info_log_,
+                 "Failed to listen for local connections on port %d",
+                 port_number_);
+      } else {
+        evconnlistener_set_error_cb(local_listener_,
+                                    &EventLoop::accept_error_cb);
+      }
+    }
   }
 
   // Create a non-persistent event that will run as soon as the dispatch
@@ -432,6 +599,16 @@ void EventLoop::Run() {
             socket->GetFd());
         socket->Close(SocketEvent::ClosureReason::Error);
       }
+
+      // Local connections which never handed over their channel.
+      std::vector<int> expired_handshakes;
+      local_handshake_timeout_.GetExpired(
+          options_.connect_timeout, std::back_inserter(expired_handshakes));
+      for (int fd : expired_handshakes) {
+        LOG_WARN(info_log_, "handshake on local fd(%d) timed out, closing", fd);
+        EndLocalHandshake(fd);
+        RejectLocal(fd);
+      }
     }, options_.connect_timeout);
 
 
@@ -486,6 +663,15 @@ void EventLoop::Run() {
   if (listener_) {
     evconnlistener_free(listener_);
   }
+  if (local_listener_) {
+    evconnlistener_free(local_listener_);
+  }
+  for (auto& entry : local_handshakes_) {
+    entry.second.reset();
+    close(entry.first);
+  }
+  local_handshakes_.clear();
+  local_handshake_timeout_.Clear();
   if (startup_event_) {
     event_free(startup_event_);
   }
@@ -733,7 +919,21 @@ SocketEvent* EventLoop::OpenSocketEvent(const HostId& destination) {
   thread_check_.Check();
 
   int fd;
-  Status st = create_connection(destination, &fd);
+  Status st;
+  std::unique_ptr<ShmChannel> channel;
+  if (options_.local_transport && IsLoopback(destination)) {
+    st = create_local_connection(destination, &fd, &channel);
+    if (!st.ok()) {
+      LOG_INFO(info_log_,
+               "No local connection to: %s, using TCP: %s",
+               destination.ToString().c_str(),
+               st.ToString().c_str());
+    }
+  }
+  const bool local = !!channel;
+  if (!local) {
+    st = create_connection(destination, &fd);
+  }
   if (!st.ok()) {
     LOG_ERROR(info_log_,
               "Failed to connect socket to: %s failed, %s",
@@ -743,8 +943,8 @@ SocketEvent* EventLoop::OpenSocketEvent(const HostId& destination) {
   }
 
   // Create SocketEvent and pass ownership to the loop.
-  auto owned_socket =
-      SocketEvent::Create(this, fd, options_.protocol_version, destination);
+  auto owned_socket = SocketEvent::Create(
+      this, fd, options_.protocol_version, destination, std::move(channel));
   const auto socket = owned_socket.get();
   if (!socket) {
     LOG_ERROR(info_log_,
@@ -757,6 +957,10 @@ SocketEvent* EventLoop::OpenSocketEvent(const HostId& destination) {
   }
   owned_connections_.emplace(socket, std::move(owned_socket));
 
+  if (local) {
+    stats_.local_connections->Add(1);
+  }
+
   // Record the connection in the cache.
   outbound_connections_.emplace(destination, socket);
   // Setup a connect timeout.
@@ -940,10 +1144,8 @@ Status EventLoop::SendCommand(std::unique_ptr<Command>& command) {
 }
 
 Status EventLoop::SendRequest(const Message& msg, StreamSocket* socket) {
-  std::string serial;
-  msg.SerializeToString(&serial);
-  std::unique_ptr<Command> command(
-      SerializedSendCommand::Request(std::move(serial), {socket}));
+  std::unique_ptr<Command> command(SerializedSendCommand::Request(
+      Stream::ToTimestampedString(msg), {socket}));
   Status st = SendCommand(command);
   if (st.ok()) {
     socket->Open();
@@ -952,10 +1154,8 @@ Status EventLoop::SendRequest(const Message& msg, StreamSocket* socket) {
 }
 
 Status EventLoop::SendResponse(const Message& msg, StreamID stream_id) {
-  std::string serial;
-  msg.SerializeToString(&serial);
-  std::unique_ptr<Command> command(
-      SerializedSendCommand::Response(std::move(serial), {stream_id}));
+  std::unique_ptr<Command> command(SerializedSendCommand::Response(
+      Stream::ToTimestampedString(msg), {stream_id}));
   return SendCommand(command);
 }
 
@@ -1051,6 +1251,55 @@ abort_clean:
                          " errno: " + std::to_string(errno));
 }
 
+Status EventLoop::create_local_connection(
+    const HostId& host, int* fd, std::unique_ptr<ShmChannel>* channel) {
+  thread_check_.Check();
+
+  int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sockfd == -1) {
+    return Status::IOError("Failed to create socket, errno: " +
+                           std::to_string(errno));
+  }
+
+  // A non-blocking connect fails right away if nobody listens, or if the
+  // backlog is full.
+  sockaddr_un addr;
+  const socklen_t addr_len = GetLocalAddress(host.GetPort(), &addr);
+  if (evutil_make_socket_nonblocking(sockfd) != 0 ||
+      connect(sockfd, reinterpret_cast<sockaddr*>(&addr), addr_len) == -1) {
+    auto e = errno;
+    close(sockfd);
+    return Status::IOError("Failed to connect, errno: " + std::to_string(e));
+  }
+
+#ifdef OS_LINUX
+  // Any process on the host may bind the abstract name first, so only share
+  // memory with a listener of the same user.
+  ucred cred;
+  socklen_t cred_len = static_cast<socklen_t>(sizeof(cred));
+  if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+      cred.uid != geteuid()) {
+    close(sockfd);
+    return Status::IOError("Local listener belongs to another user");
+  }
+#endif
+
+  std::unique_ptr<ShmChannel> local_channel;
+  Status st =
+      ShmChannel::Create(options_.local_transport_ring_size, &local_channel);
+  if (st.ok()) {
+    st = local_channel->SendTo(sockfd);
+  }
+  if (!st.ok()) {
+    close(sockfd);
+    return st;
+  }
+
+  *fd = sockfd;
+  *channel = std::move(local_channel);
+  return Status::OK();
+}
+
 void EventLoop::EnableDebugThreadUnsafe(DebugCallback log_cb) {
 #if LIBEVENT_VERSION_NUMBER >= 0x02010300
   event_enable_debug_logging(EVENT_DBG_ALL);
@@ -1143,6 +1392,7 @@ EventLoop::Stats::Stats(const std::string& prefix) {
   owned_streams = all.AddCounter(prefix + ".owned_streams");
   outbound_connections = all.AddCounter(prefix + ".outbound_connections");
   all_connections = all.AddCounter(prefix + ".all_connections");
+  local_connections = all.AddCounter(prefix + ".local_connections");
   hbs_sent = all.AddCounter(prefix + ".hbs_sent");
 }
 
@@ -63,6 +63,7 @@ class TimedCallback;
 using TriggerID = uint64_t;
 class TriggerableCallback;
 class SocketEventStats;
+class ShmChannel;
 class Stream;
 class QueueStats;
 template <typename T>
@@ -127,6 +128,20 @@ class EventLoop {
     AcceptCallbackType accept_callback;
     /** A bound on the size of socket's send queue. */
     size_t send_queue_limit = 30000;
+    /**
+     * Size of a socket's receive buffer. A single read fetches as many
+     * messages as fit in the buffer. Large received messages reference the
+     * buffer in place, hence such a message which outlives the read keeps
+     * the buffer it was read into alive.
+     */
+    size_t socket_read_buffer_size = 64 * 1024;
+    /**
+     * Messages smaller than this are copied out of the receive buffer rather
+     * than deserialized in place, so that a small message which is kept
+     * alive doesn't keep the whole receive buffer alive. Larger messages
+     * reference the buffer in place.
+     */
+    size_t socket_copy_message_size = 4 * 1024;
     /**
      * For how long should we keep a connection without streams alive.
      */
@@ -134,6 +149,17 @@ class EventLoop {
     /** Preferred protocol version. */
     uint8_t protocol_version;
 
+    /**
+     * Exchange frames with loops on the same host through shared memory
+     * rather than TCP. The listening loop then accepts local connections on
+     * a Unix domain socket next to its port, over which a connecting loop
+     * hands over a ShmChannel. Connections to loops which don't accept them
+     * fall back to TCP. Linux only.
+     */
+    bool local_transport = false;
+    /** Capacity of each direction of a shared memory connection. */
+    size_t local_transport_ring_size = 1024 * 1024;
+
     /** Send heartbeats every X milliseconds. Set to zero to disable. */
     std::chrono::milliseconds heartbeat_period = std::chrono::seconds(60);
     /** How long a source must be blocked before logging warnings. */
@@ -309,6 +335,11 @@ class EventLoop {
     connect_timeout_.Erase(socket);
   }
 
+  /** Connects to a host over TCP, for a rejected local connection. */
+  Status CreateConnection(access::EventLoop, const HostId& host, int* fd) {
+    return create_connection(host, fd);
+  }
+
   // TODO(t8971722)
   void AddInboundStream(access::EventLoop, Stream* stream);
 
@@ -597,6 +628,13 @@ class EventLoop {
 
   // The connection listener
   evconnlistener* listener_ = nullptr;
+  // The listener for local connections, if local transport is enabled.
+  evconnlistener* local_listener_ = nullptr;
+  // Accepted local connections waiting for their channel, by socket.
+  std::unordered_map<int, std::unique_ptr<EventCallback>> local_handshakes_;
+  // Accepted local connections are closed if they don't hand over their
+  // channel within the connect timeout.
+  TimeoutList<int> local_handshake_timeout_;
 
   // Shutdown event and flag.
   bool shutting_down_ = false;
@@ -703,6 +741,7 @@ class EventLoop {
     Counter* owned_streams;  // number of stream the loop owns
     Counter* outbound_connections;  // number of outbound connections
     Counter* all_connections;       // number of all connections
+    Counter* local_connections;     // number of shared memory connections
     Counter* hbs_sent;              // number of heartbeats sent
   } stats_;
 
@@ -733,8 +772,30 @@ class EventLoop {
   void HandleSendCommand(Flow* flow, std::unique_ptr<Command> command);
   void HandleAcceptCommand(std::unique_ptr<Command> command);
 
+  /** Waits for the channel of an accepted local connection. */
+  void AcceptLocal(int fd);
+
+  /** Rejects an accepted local connection, and closes it. */
+  void RejectLocal(int fd);
+
+  /** Stops waiting for the channel of an accepted local connection. */
+  void EndLocalHandshake(int fd);
+
+  /** Creates a SocketEvent for an accepted local connection. */
+  void HandleLocalHandshake(int fd);
+
   Status create_connection(const HostId& host, int* fd);
 
+  /**
+   * Connects to a loop on the local host, and hands it over a ShmChannel.
+   * Fails if the destination doesn't accept local connections, or listens
+   * as another user. The destination may still reject the channel later,
+   * see SocketEvent.
+   */
+  Status create_local_connection(const HostId& host,
+                                 int* fd,
+                                 std::unique_ptr<ShmChannel>* channel);
+
   // callbacks needed by libevent
   static void do_accept(evconnlistener *listener,
     int fd, sockaddr *address, int socklen,
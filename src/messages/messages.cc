@@ -5,6 +5,7 @@
 //
 #include "messages.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -40,6 +41,7 @@ const char* const kMessageTypeNames[size_t(MessageType::max) + 1] = {
   "tail_seqno",
   "deliver_batch",
   "heartbeat",
+  "deliver_multicast",
 };
 
 MessageType Message::ReadMessageType(Slice slice) {
@@ -183,6 +185,16 @@ Message::CreateNewInstance(Slice* in) {
       break;
     }
 
+    case MessageType::mDeliverMulticast: {
+      std::unique_ptr<MessageDeliverMulticast> msg(
+          new MessageDeliverMulticast());
+      st = msg->DeSerialize(in);
+      if (st.ok()) {
+        return std::unique_ptr<Message>(msg.release());
+      }
+      break;
+    }
+
     default:
       break;
   }
@@ -197,6 +209,12 @@ std::unique_ptr<Message> Message::CreateNewInstance(std::unique_ptr<char[]> in,
 
 std::unique_ptr<Message> Message::CreateNewInstance(std::unique_ptr<char[]> in,
                                                     Slice slice) {
+  std::shared_ptr<char> buffer(in.release(), std::default_delete<char[]>());
+  return CreateNewInstance(std::move(buffer), slice);
+}
+
+std::unique_ptr<Message> Message::CreateNewInstance(std::shared_ptr<char> in,
+                                                    Slice slice) {
   std::unique_ptr<Message> msg = Message::CreateNewInstance(&slice);
   if (msg) {
     msg->buffer_ = std::move(in);
@@ -321,7 +339,6 @@ Status MessageData::DeSerialize(Slice* in) {
   }
 
   // The rest of the message is what goes into log storage.
-  storage_slice_ = *in;
   return DeSerializeStorage(in);
 }
 
@@ -347,6 +364,8 @@ void MessageData::SerializeInternal(std::string* out) const {
 }
 
 Status MessageData::DeSerializeStorage(Slice* in) {
+  const char* storage_begin = in->data();
+
   // extract tenant ID
   if (!GetFixed16(in, &tenantid_)) {
     return Status::InvalidArgument("Bad tenant ID");
@@ -369,6 +388,7 @@ Status MessageData::DeSerializeStorage(Slice* in) {
   if (!GetLengthPrefixedSlice(in, &payload_)) {
     return Status::InvalidArgument("Bad payload");
   }
+  storage_slice_ = Slice(storage_begin, in->data() - storage_begin);
   return Status::OK();
 }
 
@@ -682,11 +702,24 @@ Status MessageDeliverGap::DeSerialize(Slice* in) {
   return Status::OK();
 }
 
-Status MessageDeliverData::Serialize(std::string* out) const {
+std::shared_ptr<const void> MessageDeliverData::GetPayloadOwner() const {
+  if (payload_owner_) {
+    return payload_owner_;
+  }
+  // If deserialized in place, the payload points into the buffer.
+  return buffer_;
+}
+
+void MessageDeliverData::SerializeWithoutPayload(std::string* out) const {
   MessageDeliver::Serialize(out);
   PutLengthPrefixedSlice(out,
                          Slice((const char*)&message_id_, sizeof(message_id_)));
-  PutLengthPrefixedSlice(out, payload_);
+  PutVarint32(out, static_cast<uint32_t>(payload_.size()));
+}
+
+Status MessageDeliverData::Serialize(std::string* out) const {
+  SerializeWithoutPayload(out);
+  out->append(payload_.data(), payload_.size());
   return Status::OK();
 }
 
@@ -740,6 +773,86 @@ Status MessageDeliverBatch::DeSerialize(Slice* in) {
   return Status::OK();
 }
 
+std::shared_ptr<const void> MessageDeliverMulticast::GetPayloadOwner() const {
+  if (payload_owner_) {
+    return payload_owner_;
+  }
+  // If deserialized in place, the payload points into the buffer.
+  return buffer_;
+}
+
+std::vector<std::unique_ptr<MessageDeliverData>>
+MessageDeliverMulticast::Demultiplex() const {
+  auto payload_owner = GetPayloadOwner();
+  std::vector<std::unique_ptr<MessageDeliverData>> messages;
+  messages.reserve(sub_ids_.size());
+  for (SubscriptionID sub_id : sub_ids_) {
+    messages.emplace_back(new MessageDeliverData(
+        tenantid_, sub_id, message_id_, payload_, payload_owner));
+    messages.back()->SetSequenceNumbers(seqno_prev_, seqno_);
+  }
+  return messages;
+}
+
+void MessageDeliverMulticast::SerializeWithoutPayload(std::string* out) const {
+  Message::Serialize(out);
+  PutVarint64(out, sub_ids_.size());
+  for (SubscriptionID sub_id : sub_ids_) {
+    EncodeSubscriptionID(out, sub_id);
+  }
+  PutVarint64(out, seqno_prev_);
+  RS_ASSERT(seqno_ >= seqno_prev_);
+  PutVarint64(out, seqno_ - seqno_prev_);
+  PutLengthPrefixedSlice(out,
+                         Slice((const char*)&message_id_, sizeof(message_id_)));
+  PutVarint32(out, static_cast<uint32_t>(payload_.size()));
+}
+
+Status MessageDeliverMulticast::Serialize(std::string* out) const {
+  SerializeWithoutPayload(out);
+  out->append(payload_.data(), payload_.size());
+  return Status::OK();
+}
+
+Status MessageDeliverMulticast::DeSerialize(Slice* in) {
+  Status st = Message::DeSerialize(in);
+  if (!st.ok()) {
+    return st;
+  }
+  uint64_t len;
+  if (!GetVarint64(in, &len)) {
+    return Status::InvalidArgument("Bad SubscriptionIDs count");
+  }
+  sub_ids_.clear();
+  // Every SubscriptionID takes at least one octet.
+  sub_ids_.reserve(std::min<uint64_t>(len, in->size()));
+  for (uint64_t i = 0; i < len; ++i) {
+    SubscriptionID sub_id;
+    if (!DecodeSubscriptionID(in, &sub_id)) {
+      return Status::InvalidArgument("Bad SubscriptionID");
+    }
+    sub_ids_.push_back(sub_id);
+  }
+  if (!GetVarint64(in, &seqno_prev_)) {
+    return Status::InvalidArgument("Bad previous SequenceNumber");
+  }
+  uint64_t seqno_diff;
+  if (!GetVarint64(in, &seqno_diff)) {
+    return Status::InvalidArgument("Bad difference between SequenceNumbers");
+  }
+  seqno_ = seqno_prev_ + seqno_diff;
+  Slice id_slice;
+  if (!GetLengthPrefixedSlice(in, &id_slice) ||
+      id_slice.size() < sizeof(message_id_)) {
+    return Status::InvalidArgument("Bad Message ID");
+  }
+  memcpy(&message_id_, id_slice.data(), sizeof(message_id_));
+  if (!GetLengthPrefixedSlice(in, &payload_)) {
+    return Status::InvalidArgument("Bad payload");
+  }
+  return Status::OK();
+}
+
 Status MessageHeartbeat::Serialize(std::string* out) const {
   using namespace std::chrono;
   PutFixedEnum8(out, type_);
@@ -50,9 +50,10 @@ enum class MessageType : uint8_t {
   mTailSeqno = 0x0D,     // MessageTailSeqno
   mDeliverBatch = 0x0E,  // MessageDeliverBatch
   mHeartbeat = 0x0F,     // MessageHeartbeat
+  mDeliverMulticast = 0x10,  // MessageDeliverMulticast
 
   min = mPing,
-  max = mHeartbeat,
+  max = mDeliverMulticast,
 };
 
 inline bool ValidateEnum(MessageType e) {
@@ -156,6 +157,15 @@ class Message : private Serializer {
   static std::unique_ptr<Message> CreateNewInstance(std::unique_ptr<char[]> in,
                                                     Slice slice);
 
+  /**
+   * Creates a Message of the appropriate subtype by looking at the
+   * MessageType. Returns nullptr on error. The message shares ownership of
+   * the memory, so that many messages can be deserialized in place from a
+   * single buffer. Uses a subslice of `in` to parse the message.
+   */
+  static std::unique_ptr<Message> CreateNewInstance(std::shared_ptr<char> in,
+                                                    Slice slice);
+
   /*
    * Inherited from Serializer
    */
@@ -182,7 +192,7 @@ class Message : private Serializer {
 
   MessageType type_;                // type of this message
   TenantID tenantid_;               // unique id for tenant
-  std::unique_ptr<char[]> buffer_;  // owned memory for slices
+  std::shared_ptr<char> buffer_;  // (shared) owned memory for slices
 
  private:
   static std::unique_ptr<Message> CreateNewInstance(Slice* in);
@@ -328,6 +338,12 @@ class MessageData : public Message {
    */
   Slice GetPayload() const { return payload_; }
 
+  /**
+   * @return An object which keeps the payload alive, or null if the payload
+   *         is owned by the creator of the message.
+   */
+  std::shared_ptr<const void> GetPayloadOwner() const { return buffer_; }
+
   /**
    * @return the slice containing tenant ID, topic_name and paylodad from
    * buffer_
@@ -808,12 +824,39 @@ class MessageDeliverData final : public MessageDeliver {
       , message_id_(message_id)
       , payload_(payload) {}
 
+  /**
+   * Creates a message, whose payload is kept alive by provided owner, rather
+   * than by the creator of the message. Such payload can be sent without
+   * being copied.
+   */
+  MessageDeliverData(TenantID tenant_id,
+                     SubscriptionID sub_id,
+                     MsgId message_id,
+                     Slice payload,
+                     std::shared_ptr<const void> payload_owner)
+      : MessageDeliver(MessageType::mDeliverData, tenant_id, sub_id)
+      , message_id_(message_id)
+      , payload_(payload)
+      , payload_owner_(std::move(payload_owner)) {}
+
   MessageDeliverData() : MessageDeliver(MessageType::mDeliverData) {}
 
   const MsgId& GetMessageID() const { return message_id_; };
 
   Slice GetPayload() const { return payload_; }
 
+  /**
+   * @return An object which keeps the payload alive, or null if the payload
+   *         is owned by the creator of the message.
+   */
+  std::shared_ptr<const void> GetPayloadOwner() const;
+
+  /**
+   * Serializes the message without the payload octets, appending the payload
+   * to the output yields the regular serialized form.
+   */
+  void SerializeWithoutPayload(std::string* out) const;
+
   virtual Status Serialize(std::string* out) const override;
   Status DeSerialize(Slice* in) override;
 
@@ -822,6 +865,8 @@ class MessageDeliverData final : public MessageDeliver {
   MsgId message_id_;
   /** Payload delivered with the message. */
   Slice payload_;
+  /** Optional owner of the payload. */
+  std::shared_ptr<const void> payload_owner_;
 };
 
 /**
@@ -850,6 +895,81 @@ class MessageDeliverBatch : public Message {
   MessagesVector messages_;
 };
 
+/**
+ * A single record delivered on multiple subscriptions on the same stream.
+ * The payload is serialized once, regardless of the number of subscriptions.
+ */
+class MessageDeliverMulticast final : public Message {
+ public:
+  typedef std::vector<SubscriptionID> SubscriptionIDs;
+
+  MessageDeliverMulticast(TenantID tenant_id,
+                          SubscriptionIDs sub_ids,
+                          MsgId message_id,
+                          Slice payload,
+                          std::shared_ptr<const void> payload_owner = nullptr)
+      : Message(MessageType::mDeliverMulticast, tenant_id)
+      , sub_ids_(std::move(sub_ids))
+      , seqno_prev_(0)
+      , seqno_(0)
+      , message_id_(message_id)
+      , payload_(payload)
+      , payload_owner_(std::move(payload_owner)) {}
+
+  MessageDeliverMulticast() : Message(MessageType::mDeliverMulticast) {}
+
+  const SubscriptionIDs& GetSubIDs() const { return sub_ids_; }
+
+  SequenceNumber GetPrevSequenceNumber() const { return seqno_prev_; }
+
+  SequenceNumber GetSequenceNumber() const { return seqno_; }
+
+  void SetSequenceNumbers(SequenceNumber seqno_prev, SequenceNumber seqno) {
+    RS_ASSERT(seqno_prev <= seqno);
+    seqno_prev_ = seqno_prev;
+    seqno_ = seqno;
+  }
+
+  const MsgId& GetMessageID() const { return message_id_; };
+
+  Slice GetPayload() const { return payload_; }
+
+  /**
+   * @return An object which keeps the payload alive, or null if the payload
+   *         is owned by the creator of the message.
+   */
+  std::shared_ptr<const void> GetPayloadOwner() const;
+
+  /**
+   * Splits the message into one MessageDeliverData per subscription.
+   * Resulting messages share ownership of the payload with this message.
+   */
+  std::vector<std::unique_ptr<MessageDeliverData>> Demultiplex() const;
+
+  /**
+   * Serializes the message without the payload octets, appending the payload
+   * to the output yields the regular serialized form.
+   */
+  void SerializeWithoutPayload(std::string* out) const;
+
+  Status Serialize(std::string* out) const override;
+  Status DeSerialize(Slice* in) override;
+
+ private:
+  /** IDs of subscriptions the record is delivered on. */
+  SubscriptionIDs sub_ids_;
+  /** Sequence number of the previous message on these subscriptions. */
+  SequenceNumber seqno_prev_;
+  /** Sequence number of this message. */
+  SequenceNumber seqno_;
+  /** ID of the message. */
+  MsgId message_id_;
+  /** Payload delivered with the message. */
+  Slice payload_;
+  /** Optional owner of the payload. */
+  std::shared_ptr<const void> payload_owner_;
+};
+
 /*
  * This is a heartbeat message
  */
@@ -10,6 +10,7 @@
 
 #include "src/messages/messages.h"
 #include "src/messages/msg_loop.h"
+#include "src/messages/stream.h"
 #include "src/port/port.h"
 #include "src/util/testharness.h"
 #include "src/messages/flow_control.h"
@@ -29,6 +30,8 @@ class Messaging : public ::testing::Test {
   Env* env_;
   EnvOptions env_options_;
   std::shared_ptr<Logger> info_log_;
+
+  void TestReadBuffering(size_t copy_message_size);
 };
 
 TEST_F(Messaging, Data) {
@@ -66,6 +69,27 @@ TEST_F(Messaging, Data) {
   ASSERT_EQ(data2.GetSequenceNumber(), 2000200020002000ULL);
 }
 
+TEST_F(Messaging, DataPayloadOwner) {
+  MessageData data(MessageType::mDeliver,
+                   Tenant::GuestTenant, "Topic1", GuestNamespace, "Payload1");
+  // Payload is owned by the creator.
+  ASSERT_TRUE(data.GetPayloadOwner() == nullptr);
+
+  std::string str;
+  data.SerializeToString(&str);
+  auto msg = Message::CreateNewInstance(Slice(str).ToUniqueChars(),
+                                        str.size());
+  ASSERT_TRUE(msg != nullptr);
+  auto received = static_cast<MessageData*>(msg.get());
+  Slice payload = received->GetPayload();
+  auto owner = received->GetPayloadOwner();
+  ASSERT_TRUE(owner != nullptr);
+
+  // Payload outlives the message as long as its owner is kept.
+  msg.reset();
+  ASSERT_EQ("Payload1", payload.ToString());
+}
+
 TEST_F(Messaging, DataAck) {
   HostId hostid(HostId::CreateLocal(200));
 
@@ -265,6 +289,64 @@ TEST_F(Messaging, MessageDeliverData) {
   ASSERT_EQ(msg1.GetPayload().ToString(), msg2.GetPayload().ToString());
 }
 
+TEST_F(Messaging, MessageDeliverDataPayloadOwner) {
+  auto owner = std::make_shared<std::string>("shared payload");
+  MessageDeliverData msg1(Tenant::GuestTenant,
+                          SubscriptionID::Unsafe(42),
+                          GUIDGenerator().Generate(),
+                          Slice(*owner),
+                          owner);
+  msg1.SetSequenceNumbers(1, 2);
+  ASSERT_TRUE(msg1.GetPayloadOwner() == owner);
+
+  // Payload is referenced by the serialised message, not copied.
+  auto serialised = Stream::ToTimestampedString(msg1);
+  ASSERT_EQ(owner->data(), serialised->payload.data());
+  ASSERT_TRUE(serialised->payload_owner == owner);
+
+  // Both pieces together form the regular encoding.
+  std::string expected;
+  msg1.SerializeToString(&expected);
+  ASSERT_EQ(expected.size(), serialised->size());
+  ASSERT_EQ(expected,
+            serialised->string + serialised->payload.ToString());
+}
+
+TEST_F(Messaging, MessageDeliverMulticast) {
+  MessageDeliverMulticast::SubscriptionIDs sub_ids;
+  for (uint64_t i = 1; i <= 100; ++i) {
+    sub_ids.push_back(SubscriptionID::Unsafe(i * 1000));
+  }
+  MessageDeliverMulticast msg1(Tenant::GuestTenant,
+                               sub_ids,
+                               GUIDGenerator().Generate(),
+                               Slice("payload"));
+  msg1.SetSequenceNumbers(1000100010001000ULL, 2000200020002000ULL);
+
+  std::string str;
+  msg1.SerializeToString(&str);
+  auto msg2 = Message::CreateNewInstance(Slice(str).ToUniqueChars(),
+                                         str.size());
+  ASSERT_TRUE(msg2 != nullptr);
+  ASSERT_EQ(MessageType::mDeliverMulticast, msg2->GetMessageType());
+  auto multicast = static_cast<MessageDeliverMulticast*>(msg2.get());
+  ASSERT_TRUE(multicast->GetSubIDs() == sub_ids);
+
+  // Each subscription receives its own delivery sharing the payload.
+  auto messages = multicast->Demultiplex();
+  ASSERT_EQ(sub_ids.size(), messages.size());
+  for (size_t i = 0; i < messages.size(); ++i) {
+    const auto& data = messages[i];
+    ASSERT_EQ(msg1.GetTenantID(), data->GetTenantID());
+    ASSERT_EQ(sub_ids[i], data->GetSubID());
+    ASSERT_EQ(msg1.GetPrevSequenceNumber(), data->GetPrevSequenceNumber());
+    ASSERT_EQ(msg1.GetSequenceNumber(), data->GetSequenceNumber());
+    ASSERT_TRUE(msg1.GetMessageID() == data->GetMessageID());
+    ASSERT_EQ(multicast->GetPayload().data(), data->GetPayload().data());
+    ASSERT_TRUE(data->GetPayloadOwner() != nullptr);
+  }
+}
+
 TEST_F(Messaging, MessageDeliverBatch) {
   MessageDeliverBatch::MessagesVector messages;
   messages.emplace_back(new MessageDeliverData(Tenant::GuestTenant,
@@ -400,6 +482,65 @@ TEST_F(Messaging, PingPong) {
   ASSERT_EQ(pings_recv(server), 1 + num_msgs);
 }
 
+void Messaging::TestReadBuffering(size_t copy_message_size) {
+  // Uses a tiny receive buffer, so that frames straddle reads and some do not
+  // fit in the buffer at all.
+  MsgLoop::Options opts;
+  opts.event_loop.socket_read_buffer_size = 64;
+  opts.event_loop.socket_copy_message_size = copy_message_size;
+
+  // Cookies received by the server, in order.
+  std::vector<std::unique_ptr<MessagePing>> received;
+  port::Semaphore checkpoint;
+  MsgLoop server(env_, env_options_, 0, 1, info_log_, "server", opts);
+  server.RegisterCallbacks({
+      {MessageType::mPing,
+       [&](Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
+         // Hold on to the messages, as they reference the receive buffer.
+         received.emplace_back(static_cast<MessagePing*>(msg.release()));
+         checkpoint.Post();
+       }},
+  });
+  ASSERT_OK(server.Initialize());
+  MsgLoopThread t1(env_, &server, "server");
+
+  MsgLoop client(env_, env_options_, 0, 1, info_log_, "client");
+  ASSERT_OK(client.Initialize());
+  MsgLoopThread t2(env_, &client, "client");
+
+  ASSERT_OK(server.WaitUntilRunning());
+  ASSERT_OK(client.WaitUntilRunning());
+
+  StreamSocket socket(client.CreateOutboundStream(server.GetHostId(), 0));
+  std::vector<std::string> cookies;
+  for (size_t size : {0, 1, 10, 63, 64, 65, 1000, 100, 5, 100000, 7}) {
+    cookies.emplace_back(size, static_cast<char>('a' + cookies.size()));
+  }
+  // Send messages back-to-back, so that many of them end up in a single read.
+  for (const auto& cookie : cookies) {
+    MessagePing msg(
+        Tenant::GuestTenant, MessagePing::PingType::Request, cookie);
+    ASSERT_OK(client.SendRequest(msg, &socket, 0));
+  }
+  for (size_t i = 0; i < cookies.size(); ++i) {
+    ASSERT_TRUE(checkpoint.TimedWait(timeout_));
+  }
+  ASSERT_EQ(cookies.size(), received.size());
+  for (size_t i = 0; i < cookies.size(); ++i) {
+    ASSERT_EQ(cookies[i], received[i]->GetCookie());
+  }
+}
+
+TEST_F(Messaging, ReadBuffering) {
+  // All messages are deserialized in place.
+  TestReadBuffering(0);
+}
+
+TEST_F(Messaging, ReadBufferingCopied) {
+  // Messages which fit in the tiny buffer are copied out of it.
+  TestReadBuffering(64);
+}
+
 TEST_F(Messaging, SameStreamsOnDifferentSockets) {
   // Posted on any ping message received by the server.
   port::Semaphore server_ping;
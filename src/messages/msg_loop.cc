@@ -20,6 +20,7 @@
 #include "src/messages/messages.h"
 #include "src/messages/queues.h"
 #include "src/messages/serializer.h"
+#include "src/messages/stream.h"
 #include "src/messages/stream_allocator.h"
 #include "src/port/port.h"
 #include "external/folly/Memory.h"
@@ -336,17 +337,15 @@ Status MsgLoop::SendResponse(const Message& msg,
 std::unique_ptr<Command> MsgLoop::RequestCommand(const Message& msg,
                                                  StreamSocket* socket) {
   // Serialize the message.
-  std::string serial;
-  msg.SerializeToString(&serial);
-  return SerializedSendCommand::Request(std::move(serial), {socket});
+  return SerializedSendCommand::Request(Stream::ToTimestampedString(msg),
+                                        {socket});
 }
 
 std::unique_ptr<Command> MsgLoop::ResponseCommand(const Message& msg,
                                                   StreamID stream) {
   // Serialize the message.
-  std::string serial;
-  msg.SerializeToString(&serial);
-  return SerializedSendCommand::Response(std::move(serial), {stream});
+  return SerializedSendCommand::Response(Stream::ToTimestampedString(msg),
+                                         {stream});
 }
 
 //
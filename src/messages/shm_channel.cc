@@ -0,0 +1,362 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/messages/shm_channel.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <string>
+
+#ifdef OS_LINUX
+#include <sys/eventfd.h>
+#endif
+
+#include "include/Assert.h"
+#include "src/util/common/coding.h"
+
+namespace rocketspeed {
+
+// The consumer's and the producer's positions live on separate cache lines.
+// Positions only ever grow, the offset into the ring is the position modulo
+// the capacity.
+struct ShmChannel::Ring {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  // Set by the producer when it found the ring full.
+  alignas(64) std::atomic<uint32_t> producer_waiting;
+};
+
+constexpr size_t ShmChannel::kNumFds;
+
+size_t ShmChannel::RegionSize(size_t capacity) {
+  return 2 * (sizeof(Ring) + capacity);
+}
+
+namespace {
+
+void Signal(int fd) {
+  uint64_t one = 1;
+  ssize_t n = write(fd, &one, sizeof(one));
+  // Fails with EAGAIN only if the counter is saturated, i.e. signalled.
+  (void)n;
+}
+
+void Clear(int fd) {
+  uint64_t value;
+  ssize_t n = read(fd, &value, sizeof(value));
+  (void)n;
+}
+
+// Handshake sent along with the descriptors: magic and ring capacity.
+constexpr uint32_t kHandshakeMagic = 0x4d485352;  // "RSHM"
+constexpr size_t kHandshakeSize = sizeof(uint32_t) + sizeof(uint64_t);
+
+void CloseAll(const int (&fds)[ShmChannel::kNumFds]) {
+  for (int fd : fds) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+}  // namespace
+
+Status ShmChannel::Create(size_t capacity,
+                          std::unique_ptr<ShmChannel>* channel) {
+#ifdef OS_LINUX
+  size_t rounded = 4096;
+  while (rounded < capacity) {
+    rounded *= 2;
+  }
+  capacity = rounded;
+
+  int fds[kNumFds];
+  std::fill(fds, fds + kNumFds, -1);
+
+  // The segment is unlinked right away, it is shared through descriptors.
+  static std::atomic<uint64_t> next_id{0};
+  const std::string name = "/rocketspeed-" + std::to_string(getpid()) + "-" +
+                           std::to_string(next_id++);
+  fds[0] = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fds[0] < 0) {
+    return Status::IOError("Failed to create shared memory: " +
+                           std::string(strerror(errno)));
+  }
+  shm_unlink(name.c_str());
+  if (ftruncate(fds[0], static_cast<off_t>(RegionSize(capacity))) != 0) {
+    auto e = errno;
+    CloseAll(fds);
+    return Status::IOError("Failed to size shared memory: " +
+                           std::string(strerror(e)));
+  }
+  for (size_t i = 1; i < kNumFds; ++i) {
+    fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[i] < 0) {
+      auto e = errno;
+      CloseAll(fds);
+      return Status::IOError("Failed to create eventfd: " +
+                             std::string(strerror(e)));
+    }
+  }
+
+  void* region = mmap(nullptr, RegionSize(capacity), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fds[0], 0);
+  if (region == MAP_FAILED) {
+    auto e = errno;
+    CloseAll(fds);
+    return Status::IOError("Failed to map shared memory: " +
+                           std::string(strerror(e)));
+  }
+  // Zero-filled memory is a pair of empty rings.
+  char* base = static_cast<char*>(region);
+  new (base) Ring();
+  new (base + sizeof(Ring) + capacity) Ring();
+  channel->reset(new ShmChannel(fds, capacity, region, true));
+  return Status::OK();
+#else
+  (void)capacity;
+  (void)channel;
+  return Status::NotSupported("Shared memory channels require Linux");
+#endif
+}
+
+Status ShmChannel::Attach(const int (&fds)[kNumFds],
+                          size_t capacity,
+                          std::unique_ptr<ShmChannel>* channel) {
+  if (capacity < 4096 || (capacity & (capacity - 1)) != 0) {
+    CloseAll(fds);
+    return Status::InvalidArgument("Invalid channel capacity");
+  }
+  struct stat st;
+  if (fstat(fds[0], &st) != 0 ||
+      static_cast<size_t>(st.st_size) != RegionSize(capacity)) {
+    CloseAll(fds);
+    return Status::InvalidArgument("Shared memory size mismatch");
+  }
+  void* region = mmap(nullptr, RegionSize(capacity), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fds[0], 0);
+  if (region == MAP_FAILED) {
+    auto e = errno;
+    CloseAll(fds);
+    return Status::IOError("Failed to map shared memory: " +
+                           std::string(strerror(e)));
+  }
+  channel->reset(new ShmChannel(fds, capacity, region, false));
+  return Status::OK();
+}
+
+Status ShmChannel::ReceiveFrom(int socket,
+                               std::unique_ptr<ShmChannel>* channel) {
+  char buffer[kHandshakeSize];
+  iovec iov{buffer, sizeof(buffer)};
+  char control[CMSG_SPACE(sizeof(int) * kNumFds)];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+  if (n == -1) {
+    auto e = errno;
+    if (e == EAGAIN || e == EWOULDBLOCK) {
+      return Status::OK();
+    }
+    return Status::IOError(strerror(e));
+  }
+
+  int fds[kNumFds];
+  std::fill(fds, fds + kNumFds, -1);
+  bool received = false;
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int) * kNumFds)) {
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+      received = true;
+    }
+  }
+  if (!received || (msg.msg_flags & MSG_CTRUNC) ||
+      n != static_cast<ssize_t>(kHandshakeSize)) {
+    CloseAll(fds);
+    return Status::IOError("Malformed shared memory handshake");
+  }
+  Slice in(buffer, kHandshakeSize);
+  uint32_t magic;
+  uint64_t capacity;
+  if (!GetFixed32(&in, &magic) || !GetFixed64(&in, &capacity) ||
+      magic != kHandshakeMagic) {
+    CloseAll(fds);
+    return Status::IOError("Malformed shared memory handshake");
+  }
+  return Attach(fds, static_cast<size_t>(capacity), channel);
+}
+
+Status ShmChannel::SendTo(int socket) const {
+  char buffer[kHandshakeSize];
+  EncodeFixed32(buffer, kHandshakeMagic);
+  EncodeFixed64(buffer + sizeof(uint32_t), capacity_);
+  iovec iov{buffer, sizeof(buffer)};
+  char control[CMSG_SPACE(sizeof(int) * kNumFds)];
+  memset(control, 0, sizeof(control));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * kNumFds);
+  memcpy(CMSG_DATA(cmsg), fds_, sizeof(fds_));
+  ssize_t n = sendmsg(socket, &msg, MSG_NOSIGNAL);
+  if (n != static_cast<ssize_t>(kHandshakeSize)) {
+    return Status::IOError("Failed to send shared memory handshake: " +
+                           std::string(n == -1 ? strerror(errno) : "short"));
+  }
+  return Status::OK();
+}
+
+ShmChannel::ShmChannel(const int (&fds)[kNumFds],
+                       size_t capacity,
+                       void* region,
+                       bool creator)
+: capacity_(capacity), region_(region) {
+  std::copy(fds, fds + kNumFds, fds_);
+  char* base = static_cast<char*>(region_);
+  Ring* first = reinterpret_cast<Ring*>(base);
+  Ring* second = reinterpret_cast<Ring*>(base + sizeof(Ring) + capacity_);
+  // The creator writes to the first ring, the peer to the second.
+  tx_ = creator ? first : second;
+  rx_ = creator ? second : first;
+  tx_data_ = reinterpret_cast<char*>(tx_) + sizeof(Ring);
+  rx_data_ = reinterpret_cast<char*>(rx_) + sizeof(Ring);
+  tx_data_fd_ = creator ? fds_[1] : fds_[3];
+  tx_space_fd_ = creator ? fds_[2] : fds_[4];
+  rx_data_fd_ = creator ? fds_[3] : fds_[1];
+  rx_space_fd_ = creator ? fds_[4] : fds_[2];
+  tx_tail_ = tx_->tail.load();
+  rx_head_ = rx_->head.load();
+}
+
+ShmChannel::~ShmChannel() {
+  munmap(region_, RegionSize(capacity_));
+  CloseAll(fds_);
+}
+
+int ShmChannel::GetReadFd() const {
+  return rx_data_fd_;
+}
+
+int ShmChannel::GetWriteFd() const {
+  return tx_space_fd_;
+}
+
+ssize_t ShmChannel::Read(char* buffer, size_t size) {
+  const uint64_t mask = capacity_ - 1;
+  uint64_t head = rx_head_;
+  size_t total = 0;
+  while (total < size) {
+    // Seeing an empty ring here, after publishing the head, guarantees that
+    // the producer sees the ring drained and signals the next write.
+    const uint64_t tail = rx_->tail.load();
+    if (tail == head) {
+      break;
+    }
+    if (tail - head > capacity_) {
+      // The peer wrote a tail behind the head or past the ring.
+      return -1;
+    }
+    const size_t count =
+        std::min(size - total, static_cast<size_t>(tail - head));
+    const size_t offset = static_cast<size_t>(head & mask);
+    const size_t first = std::min(count, capacity_ - offset);
+    memcpy(buffer + total, rx_data_ + offset, first);
+    memcpy(buffer + total + first, rx_data_, count - first);
+    head += count;
+    total += count;
+    rx_head_ = head;
+    rx_->head.store(head);
+    if (rx_->producer_waiting.load() && rx_->producer_waiting.exchange(0)) {
+      Signal(rx_space_fd_);
+    }
+  }
+  return static_cast<ssize_t>(total);
+}
+
+ssize_t ShmChannel::Write(const iovec* iov, int iovcnt) {
+  const uint64_t mask = capacity_ - 1;
+  uint64_t tail = tx_tail_;
+  size_t total = 0;
+  int i = 0;
+  size_t iov_offset = 0;
+  while (i < iovcnt) {
+    const uint64_t head = tx_->head.load();
+    if (tail - head > capacity_) {
+      // The peer wrote a head past the tail or behind the ring.
+      return -1;
+    }
+    size_t room = capacity_ - static_cast<size_t>(tail - head);
+    if (room == 0) {
+      // Ask the consumer for a wake up, then check again in case it has
+      // drained the ring in the meantime.
+      tx_->producer_waiting.store(1);
+      if (tx_->head.load() == head) {
+        break;
+      }
+      continue;
+    }
+
+    // Copy as much as fits.
+    const uint64_t published = tail;
+    while (i < iovcnt && room > 0) {
+      const char* data = static_cast<const char*>(iov[i].iov_base);
+      const size_t count = std::min(room, iov[i].iov_len - iov_offset);
+      const size_t offset = static_cast<size_t>(tail & mask);
+      const size_t first = std::min(count, capacity_ - offset);
+      memcpy(tx_data_ + offset, data + iov_offset, first);
+      memcpy(tx_data_, data + iov_offset + first, count - first);
+      tail += count;
+      room -= count;
+      total += count;
+      iov_offset += count;
+      if (iov_offset == iov[i].iov_len) {
+        ++i;
+        iov_offset = 0;
+      }
+    }
+    tx_tail_ = tail;
+    tx_->tail.store(tail);
+    // Wake up the consumer if it had drained the ring before this write.
+    if (tx_->head.load() == published) {
+      Signal(tx_data_fd_);
+    }
+  }
+  return static_cast<ssize_t>(total);
+}
+
+void ShmChannel::ClearReadEvent() {
+  Clear(rx_data_fd_);
+}
+
+void ShmChannel::ClearWriteEvent() {
+  Clear(tx_space_fd_);
+}
+
+void ShmChannel::RearmReadEvent() {
+  if (rx_->tail.load() != rx_head_) {
+    Signal(rx_data_fd_);
+  }
+}
+
+}  // namespace rocketspeed
@@ -0,0 +1,164 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "include/Status.h"
+
+namespace rocketspeed {
+
+/**
+ * A bidirectional byte channel between two processes on the same host, made
+ * of two single-producer single-consumer rings in one shared memory mapping.
+ *
+ * Every ring comes with two eventfds: the producer signals the data eventfd
+ * when it publishes bytes into a ring the consumer had drained, and the
+ * consumer signals the space eventfd when it frees room in a ring the
+ * producer found full. Both are pollable, so that an EventLoop can wait on
+ * them the same way it waits on a socket. Writing a frame costs a memcpy and
+ * at most one eventfd write per batch.
+ *
+ * The creator of the channel hands its descriptors over to the peer (e.g.
+ * with SCM_RIGHTS), which attaches to the other end. Positions written by the
+ * peer are validated before use, so that a faulty peer breaks the channel
+ * rather than the process.
+ *
+ * Each end must be used from a single thread.
+ */
+class ShmChannel {
+ public:
+  /**
+   * Number of descriptors describing a channel: the shared memory and the
+   * data and space eventfds of both rings.
+   */
+  static constexpr size_t kNumFds = 5;
+
+  /**
+   * Creates a channel and returns the creator's end of it.
+   *
+   * @param capacity Capacity of each ring, rounded up to a power of two.
+   * @param channel Output for the channel.
+   * @return on success returns OK(), otherwise errorcode.
+   */
+  static Status Create(size_t capacity, std::unique_ptr<ShmChannel>* channel);
+
+  /**
+   * Attaches to the peer's end of a channel. Takes ownership of descriptors,
+   * also on failure.
+   *
+   * @param fds Descriptors obtained from GetFds() of the creator's end.
+   * @param capacity Capacity of each ring, as created.
+   * @param channel Output for the channel.
+   * @return on success returns OK(), otherwise errorcode.
+   */
+  static Status Attach(const int (&fds)[kNumFds],
+                       size_t capacity,
+                       std::unique_ptr<ShmChannel>* channel);
+
+  /**
+   * Receives a channel sent by the peer with SendTo, and attaches to it.
+   *
+   * @param socket A non-blocking Unix domain socket.
+   * @param channel Output for the channel, left empty if nothing has been
+   *                received yet.
+   * @return on success returns OK(), otherwise errorcode.
+   */
+  static Status ReceiveFrom(int socket, std::unique_ptr<ShmChannel>* channel);
+
+  ~ShmChannel();
+
+  /**
+   * Sends the descriptors of the channel over a Unix domain socket, for the
+   * peer to attach to the other end with ReceiveFrom.
+   */
+  Status SendTo(int socket) const;
+
+  /** Descriptors to be passed to the peer. */
+  const int (&GetFds() const)[kNumFds] { return fds_; }
+
+  size_t GetCapacity() const { return capacity_; }
+
+  /** A descriptor which becomes readable when there are bytes to read. */
+  int GetReadFd() const;
+
+  /**
+   * A descriptor which becomes readable when there is room to write, after
+   * a write has filled the ring.
+   */
+  int GetWriteFd() const;
+
+  /**
+   * Copies bytes out of the inbound ring.
+   *
+   * @param buffer Buffer to copy to.
+   * @param size Size of the buffer.
+   * @return Number of bytes read, less than size only if the ring has been
+   *         drained, or -1 if the peer corrupted the ring.
+   */
+  ssize_t Read(char* buffer, size_t size);
+
+  /**
+   * Copies as many bytes as fit into the outbound ring, and wakes up the peer.
+   *
+   * @param iov Data to write.
+   * @param iovcnt Number of iovecs.
+   * @return Number of bytes written, or -1 if the peer corrupted the ring.
+   *         If less than the total, the write descriptor becomes readable
+   *         once there is room again.
+   */
+  ssize_t Write(const iovec* iov, int iovcnt);
+
+  /** Resets the read descriptor, must be followed by reads until drained. */
+  void ClearReadEvent();
+
+  /** Resets the write descriptor. */
+  void ClearWriteEvent();
+
+  /**
+   * Makes the read descriptor readable again if there are bytes left to
+   * read, e.g. when the reader stopped before draining the ring.
+   */
+  void RearmReadEvent();
+
+ private:
+  struct Ring;
+
+  /** Size of the shared memory for rings of given capacity. */
+  static size_t RegionSize(size_t capacity);
+
+  ShmChannel(const int (&fds)[kNumFds],
+             size_t capacity,
+             void* region,
+             bool creator);
+
+  const size_t capacity_;
+  /** Shared memory, data and space eventfd of the first ring, then second. */
+  int fds_[kNumFds];
+  void* region_;
+  /** Ring this end writes to, and ring it reads from. */
+  Ring* tx_;
+  Ring* rx_;
+  char* tx_data_;
+  char* rx_data_;
+  int tx_data_fd_;
+  int tx_space_fd_;
+  int rx_data_fd_;
+  int rx_space_fd_;
+  /**
+   * Positions this end owns, the copies in shared memory are only published
+   * for the peer.
+   */
+  uint64_t tx_tail_;
+  uint64_t rx_head_;
+};
+
+}  // namespace rocketspeed
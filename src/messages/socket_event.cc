@@ -7,6 +7,8 @@
 #include "src/messages/socket_event.h"
 
 #include <sys/uio.h>
+#include <algorithm>
+#include <cstring>
 #include <memory>
 
 #include "include/Logger.h"
@@ -58,14 +60,13 @@ struct MessageHeader {
   }
 
   /**
-   * @return Header encoded as string.
+   * Encodes the header into provided buffer.
+   *
+   * @param out Buffer of at least encoding_size bytes.
    */
-  std::string ToString() {
-    std::string result;
-    result.reserve(encoding_size);
-    PutFixed8(&result, version);
-    PutFixed32(&result, size);
-    return result;
+  void EncodeTo(char* out) const {
+    out[0] = static_cast<char>(version);
+    EncodeFixed32(out + sizeof(version), size);
   }
 
   uint8_t version;
@@ -103,15 +104,20 @@ SocketEventStats::SocketEventStats(const std::string& prefix) {
   }
 }
 
-std::unique_ptr<SocketEvent> SocketEvent::Create(EventLoop* event_loop,
-                                                 const int fd,
-                                                 uint8_t protocol_version,
-                                                 HostId destination) {
-  std::unique_ptr<SocketEvent> sev(
-      new SocketEvent(
-          event_loop, fd, protocol_version, std::move(destination)));
-
-  if (!sev->read_ev_ || !sev->write_ev_) {
+std::unique_ptr<SocketEvent> SocketEvent::Create(
+    EventLoop* event_loop,
+    const int fd,
+    uint8_t protocol_version,
+    HostId destination,
+    std::unique_ptr<ShmChannel> channel) {
+  std::unique_ptr<SocketEvent> sev(new SocketEvent(event_loop,
+                                                   fd,
+                                                   protocol_version,
+                                                   std::move(destination),
+                                                   std::move(channel)));
+
+  if (!sev->read_ev_ || !sev->write_ev_ ||
+      (sev->channel_ && !sev->hangup_ev_)) {
     LOG_ERROR(
         event_loop->GetLog(), "Failed to create SocketEvent for fd(%d)", fd);
     // File descriptior is owned by the SocketEvent at this point, noe need to
@@ -119,9 +125,10 @@ std::unique_ptr<SocketEvent> SocketEvent::Create(EventLoop* event_loop,
     return nullptr;
   }
   LOG_INFO(event_loop->GetLog(),
-           "Created SocketEvent(%d, %s)",
+           "Created SocketEvent(%d, %s)%s",
            fd,
-           sev->GetDestination().ToString().c_str());
+           sev->GetDestination().ToString().c_str(),
+           sev->channel_ ? " over shared memory" : "");
   return sev;
 }
 
@@ -147,6 +154,9 @@ void SocketEvent::Close(ClosureReason reason) {
   // Disable read and write events.
   read_ev_->Disable();
   write_ev_->Disable();
+  if (hangup_ev_) {
+    hangup_ev_->Disable();
+  }
 
   // Unregister from the EventLoop.
   // This will perform a deferred destruction of the socket.
@@ -196,7 +206,9 @@ SocketEvent::~SocketEvent() {
 
   read_ev_.reset();
   write_ev_.reset();
+  hangup_ev_.reset();
   hb_timer_.reset();
+  channel_.reset();
   close(fd_);
 }
 
@@ -226,8 +238,19 @@ void SocketEvent::SetReadEnabled(EventLoop* event_loop, bool enabled) {
   RS_ASSERT(event_loop_ == event_loop);
   thread_check_.Check();
 
+  read_enabled_ = enabled;
   if (enabled) {
     read_ev_->Enable();
+    if (channel_) {
+      // The reader might have stopped before draining the channel.
+      channel_->RearmReadEvent();
+    }
+    if (recv_end_ > recv_begin_ && !recv_task_scheduled_) {
+      // Some frames might have been left in the receive buffer when the flow
+      // control stopped us, the read event will not fire for them.
+      recv_task_scheduled_ = true;
+      event_loop_->AddTask([this]() { ProcessReadBufferDeferred(); });
+    }
   } else {
     read_ev_->Disable();
   }
@@ -238,7 +261,7 @@ bool SocketEvent::Write(SerializedOnStream& value) {
 
   LOG_DEBUG(GetLogger(),
             "Writing %zd bytes to SocketEvent(%d, %s)",
-            value.serialised->string.size(),
+            value.serialised->size(),
             fd_,
             destination_.ToString().c_str());
 
@@ -264,24 +287,26 @@ bool SocketEvent::Write(SerializedOnStream& value) {
 
 bool SocketEvent::EnqueueWrite(SerializedOnStream& value) {
   auto now = event_loop_->GetEnv()->NowMicros();
+  const auto& serialised = value.serialised;
 
-  // Serialise stream metadata.
-  auto stream_ser = std::make_shared<TimestampedString>();
-  EncodeOrigin(&stream_ser->string, value.stream_id);
-  stream_ser->issued_time = now;
-  // Serialise message header.
-  size_t frame_size =
-      stream_ser->string.size() + value.serialised->string.size();
+  // Serialise message header and stream metadata into a pooled chunk.
+  size_t frame_size = kOriginEncodedSize + serialised->size();
   MessageHeader header{protocol_version_, static_cast<uint32_t>(frame_size)};
-  auto header_ser = std::make_shared<TimestampedString>();
-  header_ser->string = header.ToString();
-  header_ser->issued_time = now;
-
-  // Add chunks carrying the message header, destinations, and serialised
-  // message to the send queue.
-  send_queue_.emplace_back(std::move(header_ser));
-  send_queue_.emplace_back(std::move(stream_ser));
-  send_queue_.emplace_back(std::move(value.serialised));
+  char* prefix = AllocateFramePrefix();
+  header.EncodeTo(prefix);
+  EncodeOrigin(prefix + kMessageHeaderEncodedSize, value.stream_id);
+
+  // Add chunks carrying the frame prefix, and the serialised message to the
+  // send queue. The message is referenced rather than copied.
+  send_queue_.push_back(
+      SendChunk{Slice(prefix, kFramePrefixSize), prefix_chunk_, now});
+  send_queue_.push_back(SendChunk{
+      Slice(serialised->string), serialised, serialised->issued_time});
+  if (!serialised->payload.empty()) {
+    send_queue_.push_back(SendChunk{serialised->payload,
+                                    serialised->payload_owner,
+                                    serialised->issued_time});
+  }
   // Signal overflow if size limit was matched or exceeded.
 
   const bool has_room =
@@ -291,11 +316,34 @@ bool SocketEvent::EnqueueWrite(SerializedOnStream& value) {
   }
 
   // Enable write event, as we have stuff to write.
-  write_ev_->Enable();
+  if (!local_pending_) {
+    write_ev_->Enable();
+    if (channel_) {
+      // The channel signals room only after it has been filled up.
+      ScheduleChannelFlush();
+    }
+  }
 
   return has_room;
 }
 
+char* SocketEvent::AllocateFramePrefix() {
+  if (!prefix_chunk_ ||
+      prefix_chunk_used_ + kFramePrefixSize > kPrefixChunkSize) {
+    if (prefix_chunk_ && prefix_chunk_.use_count() == 1) {
+      // No queued chunk references the pool, we can reuse it.
+      prefix_chunk_used_ = 0;
+    } else {
+      prefix_chunk_.reset(new char[kPrefixChunkSize],
+                          std::default_delete<char[]>());
+      prefix_chunk_used_ = 0;
+    }
+  }
+  char* prefix = prefix_chunk_.get() + prefix_chunk_used_;
+  prefix_chunk_used_ += kFramePrefixSize;
+  return prefix;
+}
+
 bool SocketEvent::FlushPending() {
   thread_check_.Check();
   return true;
@@ -312,46 +360,29 @@ const std::shared_ptr<Logger>& SocketEvent::GetLogger() const {
   return event_loop_->GetLog();
 }
 
-SocketEvent::SocketEvent(
-    EventLoop* event_loop, int fd, uint8_t protocol_version, HostId destination)
+SocketEvent::SocketEvent(EventLoop* event_loop,
+                         int fd,
+                         uint8_t protocol_version,
+                         HostId destination,
+                         std::unique_ptr<ShmChannel> channel)
 : stats_(event_loop->GetSocketStats())
-, hdr_idx_(0)
-, msg_idx_(0)
-, msg_size_(0)
+, recv_capacity_(0)
+, recv_begin_(0)
+, recv_end_(0)
+, recv_frame_size_(0)
+, read_enabled_(false)
+, recv_task_scheduled_(false)
 , protocol_version_(protocol_version)
 , fd_(fd)
+, channel_(std::move(channel))
 , write_ready_(event_loop->CreateEventTrigger())
 , event_loop_(event_loop)
 , timeout_cancelled_(false)
 , destination_(std::move(destination)) {
   thread_check_.Check();
 
-  // Create read and write events
-  read_ev_ =
-      EventCallback::CreateFdReadCallback(
-        event_loop,
-        fd,
-        [this, fd]() {
-          Status st = ReadCallback();
-          if (!st.ok()) {
-            LOG_INFO(GetLogger(), "fd(%d) read failed: %s",
-                fd, st.ToString().c_str());
-            Close(ClosureReason::Error);
-          }
-        });
-
-  write_ev_ =
-      EventCallback::CreateFdWriteCallback(
-        event_loop,
-        fd,
-        [this, fd]() {
-          Status st = WriteCallback();
-          if (!st.ok()) {
-            LOG_INFO(GetLogger(), "fd(%d) write failed: %s",
-                fd, st.ToString().c_str());
-            Close(ClosureReason::Error);
-          }
-        });
+  local_pending_ = channel_ && !IsInbound();
+  CreateEvents();
 
   // Register the socket with flow control.
   event_loop_->GetFlowControl()->Register<MessageOnStream>(
@@ -383,6 +414,58 @@ SocketEvent::SocketEvent(
   }
 }
 
+void SocketEvent::CreateEvents() {
+  // Create read and write events. A local connection reads when the channel
+  // has data and writes when it has room.
+  const int fd = fd_;
+  const int read_fd = channel_ ? channel_->GetReadFd() : fd;
+  read_ev_ =
+      EventCallback::CreateFdReadCallback(
+        event_loop_,
+        read_fd,
+        [this, fd]() {
+          Status st = ReadCallback();
+          if (!st.ok()) {
+            LOG_INFO(GetLogger(), "fd(%d) read failed: %s",
+                fd, st.ToString().c_str());
+            Close(ClosureReason::Error);
+          }
+        });
+
+  auto write_callback = [this, fd]() {
+    Status st = WriteCallback();
+    if (!st.ok()) {
+      LOG_INFO(GetLogger(), "fd(%d) write failed: %s",
+          fd, st.ToString().c_str());
+      Close(ClosureReason::Error);
+    }
+  };
+  if (channel_) {
+    write_ev_ = EventCallback::CreateFdReadCallback(
+        event_loop_, channel_->GetWriteFd(), std::move(write_callback));
+
+    // Only the reply to the handshake, or closure, is expected on the socket.
+    hangup_ev_ =
+        EventCallback::CreateFdReadCallback(
+          event_loop_,
+          fd,
+          [this, fd]() {
+            Status st = HangupCallback();
+            if (!st.ok()) {
+              LOG_INFO(GetLogger(), "fd(%d) closed: %s",
+                  fd, st.ToString().c_str());
+              Close(ClosureReason::Error);
+            }
+          });
+    if (hangup_ev_) {
+      hangup_ev_->Enable();
+    }
+  } else {
+    write_ev_ = EventCallback::CreateFdWriteCallback(
+        event_loop_, fd, std::move(write_callback));
+  }
+}
+
 void SocketEvent::UnregisterStream(StreamID remote_id, bool force) {
   Stream* stream;
   {  // Remove the stream from the routing data structures, so that all incoming
@@ -448,6 +531,15 @@ Status SocketEvent::WriteCallback() {
     timeout_cancelled_ = true;
   }
 
+  if (channel_) {
+    channel_->ClearWriteEvent();
+    if (send_queue_.empty()) {
+      // Flushed already by the scheduled task.
+      write_ev_->Disable();
+      return Status::OK();
+    }
+  }
+
   RS_ASSERT(send_queue_.size() > 0);
 
   // Sanity check stats.
@@ -469,7 +561,7 @@ Status SocketEvent::WriteCallback() {
       int limit = static_cast<int>(std::min(kMaxIovecs, send_queue_.size()));
       size_t total = 0;
       for (; iovcnt < limit; ++iovcnt) {
-        Slice v(iovcnt != 0 ? Slice(send_queue_[iovcnt]->string) : partial_);
+        Slice v(iovcnt != 0 ? send_queue_[iovcnt].data : partial_);
         iov[iovcnt].iov_base = (void*)v.data();
         iov[iovcnt].iov_len = v.size();
         total += v.size();
@@ -478,7 +570,23 @@ Status SocketEvent::WriteCallback() {
       stats_->write_size_bytes->Record(total);
       stats_->write_size_iovec->Record(iovcnt);
       stats_->socket_writes->Add(1);
-      ssize_t count = writev(fd_, iov, iovcnt);
+      ssize_t count;
+      if (channel_) {
+        count = channel_->Write(iov, iovcnt);
+        if (count == -1) {
+          stats_->write_succeed_bytes->Record(0);
+          stats_->write_succeed_iovec->Record(0);
+          return Status::IOError("Corrupt shared memory channel");
+        }
+        if (count == 0) {
+          // The channel is full, the write event fires once it has room.
+          stats_->write_succeed_bytes->Record(0);
+          stats_->write_succeed_iovec->Record(0);
+          return Status::OK();
+        }
+      } else {
+        count = writev(fd_, iov, iovcnt);
+      }
       if (count == -1) {
         auto e = errno;
         stats_->write_succeed_bytes->Record(0);
@@ -505,7 +613,7 @@ Status SocketEvent::WriteCallback() {
         RS_ASSERT(!send_queue_.empty());
         auto& item = send_queue_.front();
         if (i != 0) {
-          partial_ = Slice(item->string);
+          partial_ = item.data;
         }
         if (written >= partial_.size()) {
           // Fully wrote section.
@@ -517,7 +625,7 @@ Status SocketEvent::WriteCallback() {
           return Status::OK();
         }
         stats_->write_latency->Record(event_loop_->GetEnv()->NowMicros() -
-                                      item->issued_time);
+                                      item.issued_time);
         send_queue_.pop_front();
 
         // We've taken one element from the send queue, now check whether we can
@@ -540,7 +648,7 @@ Status SocketEvent::WriteCallback() {
     // No more partial data to be sent out.
     if (send_queue_.size() > 0) {
       // If there are any new pending messages, start processing it.
-      partial_ = send_queue_.front()->string;
+      partial_ = send_queue_.front().data;
       RS_ASSERT(partial_.size() > 0);
     } else {
       // No more queued messages. Switch off ready-to-write event on socket.
@@ -553,53 +661,49 @@ Status SocketEvent::WriteCallback() {
 Status SocketEvent::ReadCallback() {
   thread_check_.Check();
 
+  if (channel_) {
+    // Reset the wake up, we either drain the channel or rearm it.
+    channel_->ClearReadEvent();
+  }
+
   // This will keep reading while there is data to be read,
   // but not more than 1MB to give other sockets a chance to read.
   ssize_t total_read = 0;
   for (;;) {
+    // Deliver all complete messages, that we've received so far.
+    bool more = true;
+    Status st = ProcessReadBuffer(&more);
+    if (!st.ok()) {
+      return st;
+    }
+    if (!more || closing_) {
+      // We should not read more in the same batch.
+      break;
+    }
+
     if (total_read >= 1024 * 1024) {
       LOG_INFO(GetLogger(), "Reached read limit on fd(%d) for this event", fd_);
       break;
     }
-    if (hdr_idx_ < sizeof(hdr_buf_)) {
-      // Read the header.
-      ssize_t count = sizeof(hdr_buf_) - hdr_idx_;
-      ssize_t n = read(fd_, hdr_buf_ + hdr_idx_, count);
-      // If n == -1 then an error has occurred (don't close on EAGAIN though).
-      // If n == 0 then we have reached EOF.
-      if (n == 0) {
-        return Status::IOError("EOF");
-      }
+
+    // Read as much as fits in the buffer, this is likely more than one frame.
+    ReserveReadBuffer();
+    RS_ASSERT(recv_end_ < recv_capacity_);
+    ssize_t count = recv_capacity_ - recv_end_;
+    if (channel_) {
+      ssize_t n = channel_->Read(recv_buf_.get() + recv_end_, count);
       if (n == -1) {
-        auto e = errno;
-        if (e == EAGAIN || e == EWOULDBLOCK) {
-          return Status::OK();
-        } else {
-          return Status::IOError(strerror(e));
-        }
+        return Status::IOError("Corrupt shared memory channel");
       }
       total_read += n;
-      hdr_idx_ += n;
+      recv_end_ += n;
       if (n < count) {
-        // Still more header to be read, wait for next event.
-        return Status::OK();
-      }
-
-      // Now have read header, prepare msg buffer.
-      Slice hdr_slice(hdr_buf_, sizeof(hdr_buf_));
-      MessageHeader hdr{0, 0};
-      Status st = MessageHeader::Parse(&hdr_slice, &hdr);
-      if (!st.ok()) {
-        return st;
+        // Channel has been drained, the peer wakes us up on the next write.
+        return ProcessReadBuffer(&more);
       }
-      msg_size_ = hdr.size;
-      msg_buf_.reset(new char[msg_size_]);
-      msg_idx_ = 0;
+      continue;
     }
-    RS_ASSERT(msg_idx_ < msg_size_);
-
-    ssize_t count = msg_size_ - msg_idx_;
-    ssize_t n = read(fd_, msg_buf_.get() + msg_idx_, count);
+    ssize_t n = read(fd_, recv_buf_.get() + recv_end_, count);
     // If n == -1 then an error has occurred (don't close on EAGAIN though).
     // If n == 0 then we have reached EOF.
     if (n == 0) {
@@ -614,18 +718,173 @@ Status SocketEvent::ReadCallback() {
       }
     }
     total_read += n;
-    msg_idx_ += n;
+    recv_end_ += n;
     if (n < count) {
-      // Still more message to be read, wait for next event.
+      // Socket has been drained, process what we've got and wait for the next
+      // event.
+      return ProcessReadBuffer(&more);
+    }
+  }
+  if (channel_ && !closing_) {
+    // We've stopped before draining the channel, wake up again.
+    channel_->RearmReadEvent();
+  }
+  return Status::OK();
+}
+
+Status SocketEvent::HangupCallback() {
+  thread_check_.Check();
+
+  // The peer only writes its reply to the handshake to the socket of a local
+  // connection, and otherwise closes it.
+  char byte;
+  ssize_t n = read(fd_, &byte, sizeof(byte));
+  if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return Status::OK();
+  }
+  if (local_pending_) {
+    if (n == 1 && byte == kLocalHandshakeAccept) {
+      local_pending_ = false;
+      if (!send_queue_.empty()) {
+        write_ev_->Enable();
+        ScheduleChannelFlush();
+      }
+      return Status::OK();
+    }
+    // Rejected, or closed before replying.
+    return FallBackToTcp();
+  }
+  if (n == 0) {
+    return Status::IOError("EOF");
+  }
+  if (n == -1) {
+    return Status::IOError(strerror(errno));
+  }
+  return Status::IOError("Unexpected data on local connection");
+}
+
+Status SocketEvent::FallBackToTcp() {
+  LOG_INFO(GetLogger(),
+           "Local connection fd(%d) to %s not accepted, using TCP",
+           fd_,
+           destination_.ToString().c_str());
+
+  int fd;
+  Status st =
+    event_loop_->CreateConnection(access::EventLoop(), destination_, &fd);
+  if (!st.ok()) {
+    return st;
+  }
+
+  // Nothing has been written to the channel yet. We might be inside the
+  // hangup event, so defer destruction of the events, and then of the
+  // channel they wait on.
+  read_ev_->Disable();
+  write_ev_->Disable();
+  hangup_ev_->Disable();
+  event_loop_->AddTask(MakeDeferredDeleter(read_ev_));
+  event_loop_->AddTask(MakeDeferredDeleter(write_ev_));
+  event_loop_->AddTask(MakeDeferredDeleter(hangup_ev_));
+  event_loop_->AddTask(MakeDeferredDeleter(channel_));
+  close(fd_);
+
+  fd_ = fd;
+  local_pending_ = false;
+  CreateEvents();
+  if (!read_ev_ || !write_ev_) {
+    return Status::IOError("Failed to create events");
+  }
+  if (read_enabled_) {
+    read_ev_->Enable();
+  }
+  if (!send_queue_.empty()) {
+    write_ev_->Enable();
+  }
+  return Status::OK();
+}
+
+void SocketEvent::ScheduleChannelFlush() {
+  if (channel_flush_scheduled_ || closing_) {
+    return;
+  }
+  channel_flush_scheduled_ = true;
+  event_loop_->AddTask([this]() {
+    channel_flush_scheduled_ = false;
+    if (closing_) {
+      return;
+    }
+    Status st = WriteCallback();
+    if (!st.ok()) {
+      LOG_INFO(GetLogger(), "fd(%d) write failed: %s",
+          fd_, st.ToString().c_str());
+      Close(ClosureReason::Error);
+    }
+  });
+}
+
+void SocketEvent::ReserveReadBuffer() {
+  // Number of bytes we need to have in the buffer, starting from recv_begin_.
+  const size_t required =
+      recv_frame_size_ ? recv_frame_size_ : kMessageHeaderEncodedSize;
+  if (recv_buf_ && recv_begin_ + required <= recv_capacity_ &&
+      recv_end_ < recv_capacity_) {
+    // There is still some room left at the end of the buffer.
+    return;
+  }
+
+  const size_t pending = recv_end_ - recv_begin_;
+  const size_t capacity =
+      std::max(required, event_loop_->GetOptions().socket_read_buffer_size);
+  if (recv_buf_ && recv_buf_.use_count() == 1 && capacity == recv_capacity_) {
+    // No message references the buffer, we can move the beginning of the
+    // partially read frame to the front.
+    memmove(recv_buf_.get(), recv_buf_.get() + recv_begin_, pending);
+  } else {
+    // Either the buffer doesn't fit the frame, or some of the messages we've
+    // deserialized in place are still alive, in which case they own the old
+    // buffer.
+    std::shared_ptr<char> buf(new char[capacity],
+                              std::default_delete<char[]>());
+    if (pending > 0) {
+      memcpy(buf.get(), recv_buf_.get() + recv_begin_, pending);
+    }
+    recv_buf_ = std::move(buf);
+    recv_capacity_ = capacity;
+  }
+  recv_begin_ = 0;
+  recv_end_ = pending;
+}
+
+Status SocketEvent::ProcessReadBuffer(bool* more) {
+  *more = true;
+  while (!closing_) {
+    const size_t pending = recv_end_ - recv_begin_;
+    if (recv_frame_size_ == 0) {
+      if (pending < kMessageHeaderEncodedSize) {
+        // Still more header to be read, wait for next read.
+        return Status::OK();
+      }
+
+      // Now have read header, figure out the size of the frame.
+      Slice hdr_slice(recv_buf_.get() + recv_begin_, kMessageHeaderEncodedSize);
+      MessageHeader hdr{0, 0};
+      Status st = MessageHeader::Parse(&hdr_slice, &hdr);
+      if (!st.ok()) {
+        return st;
+      }
+      recv_frame_size_ = kMessageHeaderEncodedSize + hdr.size;
+    }
+    if (pending < recv_frame_size_) {
+      // Still more message to be read, wait for next read.
       return Status::OK();
     }
-    // Now have whole message, reset state for next message.
-    hdr_idx_ = 0;
-    msg_idx_ = 0;
-    // No reader state modification shall happen after this point.
 
-    // Process received message.
-    Slice in(msg_buf_.get(), msg_size_);
+    // Now have whole message, advance reader state to the next one.
+    Slice in(recv_buf_.get() + recv_begin_ + kMessageHeaderEncodedSize,
+             recv_frame_size_ - kMessageHeaderEncodedSize);
+    recv_begin_ += recv_frame_size_;
+    recv_frame_size_ = 0;
+    // No reader state modification shall happen after this point.
 
     // Decode the recipients.
     StreamID remote_id = 0;
@@ -633,22 +892,45 @@ Status SocketEvent::ReadCallback() {
       return Status::IOError("Failed to decode origin");
     }
 
-    // Decode the rest of the message.
-    std::unique_ptr<Message> msg =
-        Message::CreateNewInstance(std::move(msg_buf_), in);
+    std::unique_ptr<Message> msg;
+    if (in.size() < event_loop_->GetOptions().socket_copy_message_size) {
+      // Copy small messages out, so that they don't pin the receive buffer.
+      std::unique_ptr<char[]> copy(new char[in.size()]);
+      memcpy(copy.get(), in.data(), in.size());
+      msg = Message::CreateNewInstance(std::move(copy), in.size());
+    } else {
+      // Decode the rest of the message in place.
+      msg = Message::CreateNewInstance(recv_buf_, in);
+    }
     if (!msg) {
       LOG_WARN(GetLogger(), "Failed to decode a message");
       return Status::IOError("Failed to decode a message.");
     }
 
     if (!Receive(remote_id, std::move(msg))) {
-      // We should not read more in the same batch.
-      break;
+      // We should not process more in the same batch.
+      *more = false;
+      return Status::OK();
     }
   }
   return Status::OK();
 }
 
+void SocketEvent::ProcessReadBufferDeferred() {
+  thread_check_.Check();
+  recv_task_scheduled_ = false;
+  if (closing_ || !read_enabled_) {
+    return;
+  }
+  bool more = true;
+  Status st = ProcessReadBuffer(&more);
+  if (!st.ok()) {
+    LOG_INFO(GetLogger(), "fd(%d) read failed: %s",
+        fd_, st.ToString().c_str());
+    Close(ClosureReason::Error);
+  }
+}
+
 bool SocketEvent::Receive(StreamID remote_id, std::unique_ptr<Message> msg) {
   const auto msg_type = msg->GetMessageType();
   RS_ASSERT(ValidateEnum(msg_type));
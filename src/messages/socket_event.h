@@ -15,6 +15,7 @@
 #include "src/messages/messages.h"
 #include "src/port/port.h"
 #include "src/messages/flow_control.h"
+#include "src/messages/shm_channel.h"
 #include "include/HostId.h"
 #include "src/util/common/statistics.h"
 #include "src/util/common/thread_check.h"
@@ -49,6 +50,20 @@ static constexpr size_t kMaxIovecs = 256;
 static constexpr size_t kMessageHeaderEncodedSize =
     sizeof(uint8_t) + sizeof(uint32_t);
 
+/** Size (in octets) of a message header followed by an encoded origin. */
+static constexpr size_t kFramePrefixSize =
+    kMessageHeaderEncodedSize + kOriginEncodedSize;
+
+/** Size (in octets) of a pooled chunk of frame prefixes. */
+static constexpr size_t kPrefixChunkSize = 256 * kFramePrefixSize;
+
+/**
+ * Replies of the acceptor of a local connection, written to the socket once
+ * it has received the channel, or decided not to use it.
+ */
+static constexpr char kLocalHandshakeReject = 0;
+static constexpr char kLocalHandshakeAccept = 1;
+
 class SocketEventStats {
  public:
   explicit SocketEventStats(const std::string& prefix);
@@ -78,11 +93,18 @@ class SocketEvent : public Source<MessageOnStream>,
    * @param protocol_version Version of the protocol to use for this socket.
    * @param destination An optional destination, if present indicates that this
    *                    is an outbound socket.
+   * @param channel An optional shared memory channel to the peer. If present,
+   *                frames are exchanged through the channel, and the socket
+   *                only detects closure of the connection. An outbound
+   *                connection holds its frames until the peer accepts the
+   *                channel, and switches to TCP if it doesn't.
    */
-  static std::unique_ptr<SocketEvent> Create(EventLoop* event_loop,
-                                             int fd,
-                                             uint8_t protocol_version,
-                                             HostId destination = HostId());
+  static std::unique_ptr<SocketEvent> Create(
+      EventLoop* event_loop,
+      int fd,
+      uint8_t protocol_version,
+      HostId destination = HostId(),
+      std::unique_ptr<ShmChannel> channel = nullptr);
 
   /**
    * Closes all streams on the connection and connection itself.
@@ -141,6 +163,8 @@ class SocketEvent : public Source<MessageOnStream>,
 
   int GetFd() const { return fd_; }
 
+  bool IsLocal() const { return !!channel_; }
+
  private:
   ThreadCheck thread_check_;
 
@@ -149,19 +173,44 @@ class SocketEvent : public Source<MessageOnStream>,
   /** Whether the socket is closing or has been closed. */
   bool closing_ = false;
 
-  /** Reader and deserializer state. */
-  size_t hdr_idx_;
-  char hdr_buf_[kMessageHeaderEncodedSize];
-  size_t msg_idx_;
-  size_t msg_size_;
-  std::unique_ptr<char[]> msg_buf_;  // receive buffer
+  /**
+   * Reader and deserializer state.
+   * Large messages are deserialized in place from the receive buffer, hence
+   * every such message shares ownership of the buffer it was read into.
+   */
+  std::shared_ptr<char> recv_buf_;
+  /** Size of the receive buffer. */
+  size_t recv_capacity_;
+  /** Offset of the first byte of the receive buffer not yet processed. */
+  size_t recv_begin_;
+  /** Offset past the last byte read into the receive buffer. */
+  size_t recv_end_;
+  /** Size of the frame at recv_begin_, zero if header wasn't read yet. */
+  size_t recv_frame_size_;
+  /** Whether the read event is enabled by the flow control. */
+  bool read_enabled_;
+  /** Whether processing of buffered frames has been scheduled. */
+  bool recv_task_scheduled_;
 
   /** Version of protocol to use for communication. */
   uint8_t protocol_version_;
 
   /** Writer and serializer state. */
+  /** A chunk of data to be written, together with memory backing it. */
+  struct SendChunk {
+    Slice data;
+    std::shared_ptr<const void> owner;
+    uint64_t issued_time;
+  };
   /** A list of chunks of data to be written. */
-  std::deque<std::shared_ptr<TimestampedString>> send_queue_;
+  std::deque<SendChunk> send_queue_;
+  /**
+   * Pool of memory that frame prefixes (message header and origin) are encoded
+   * into, shared by all chunks referencing it.
+   */
+  std::shared_ptr<char> prefix_chunk_;
+  /** Number of bytes of the prefix pool already handed out. */
+  size_t prefix_chunk_used_ = 0;
   /** The next valid offset in the earliest chunk of data to be written. */
   Slice partial_;
 
@@ -170,6 +219,21 @@ class SocketEvent : public Source<MessageOnStream>,
   std::unique_ptr<EventCallback> read_ev_;
   std::unique_ptr<EventCallback> write_ev_;
 
+  /**
+   * Shared memory channel that replaces the socket for reads and writes, if
+   * the connection is local. Read and write events then wait on the
+   * channel, and the socket is watched for closure only.
+   */
+  std::unique_ptr<ShmChannel> channel_;
+  std::unique_ptr<EventCallback> hangup_ev_;
+  /** Whether writing the send queue to the channel has been scheduled. */
+  bool channel_flush_scheduled_ = false;
+  /**
+   * Whether an outbound local connection awaits the reply of the acceptor.
+   * Frames are only queued meanwhile, so that they can go over TCP instead.
+   */
+  bool local_pending_ = false;
+
   std::unique_ptr<EventCallback> hb_timer_;
 
   /** An EventTrigger to notify that the sink has some spare capacity. */
@@ -209,7 +273,8 @@ class SocketEvent : public Source<MessageOnStream>,
   SocketEvent(EventLoop* event_loop,
               int fd,
               uint8_t protocol_version,
-              HostId destination);
+              HostId destination,
+              std::unique_ptr<ShmChannel> channel);
 
   /**
    * Unregisters a stream with provided remote StreamID from the SocketEvent and
@@ -227,6 +292,48 @@ class SocketEvent : public Source<MessageOnStream>,
   /** Handles read availability events from EventLoop. */
   Status ReadCallback();
 
+  /**
+   * Creates read and write events for the socket, or the channel if any.
+   */
+  void CreateEvents();
+
+  /** Handles readability of the socket of a local connection. */
+  Status HangupCallback();
+
+  /**
+   * Replaces the channel of an outbound local connection, which the peer
+   * rejected, with a TCP connection to the destination.
+   */
+  Status FallBackToTcp();
+
+  /**
+   * Writes the send queue to the channel at the end of the current loop
+   * iteration, so that frames enqueued in one iteration share a wake up.
+   */
+  void ScheduleChannelFlush();
+
+  /**
+   * Makes sure that the receive buffer has room for at least one more byte
+   * and for the whole frame at recv_begin_, if its size is known.
+   * Bytes of frames that have already been processed are discarded.
+   */
+  void ReserveReadBuffer();
+
+  /**
+   * Deserializes and delivers all complete frames in the receive buffer.
+   *
+   * @param more Set to false if no more messages should be delivered in the
+   *             same read callback.
+   * @return ok() unless the connection has to be closed.
+   */
+  Status ProcessReadBuffer(bool* more);
+
+  /**
+   * Delivers frames left in the receive buffer after the read event has been
+   * re-enabled by the flow control.
+   */
+  void ProcessReadBufferDeferred();
+
   /**
    * Handles received messagea
    *
@@ -239,6 +346,12 @@ class SocketEvent : public Source<MessageOnStream>,
 
   bool EnqueueWrite(SerializedOnStream& value);
 
+  /**
+   * Hands out kFramePrefixSize bytes from the frame prefix pool. The memory
+   * remains valid while prefix_chunk_ or any queued chunk references it.
+   */
+  char* AllocateFramePrefix();
+
   /**
    * Check for streams that haven't received a heartbeat.
    */
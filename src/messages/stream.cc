@@ -74,13 +74,54 @@ void Stream::Close() {
   socket_event_ = nullptr;
 }
 
+namespace {
+
+/**
+ * Serializes a message with an owned payload, so that the payload is
+ * referenced rather than copied.
+ *
+ * @return false iff the payload has no owner and must be copied.
+ */
+template <typename DeliverMessage>
+bool SerializeWithoutPayload(const DeliverMessage& message,
+                             SharedTimestampedString* serialised) {
+  auto payload_owner = message.GetPayloadOwner();
+  if (!payload_owner) {
+    return false;
+  }
+  // The payload will outlive the serialised message, no need to copy it.
+  message.SerializeWithoutPayload(&(*serialised)->string);
+  (*serialised)->payload = message.GetPayload();
+  (*serialised)->payload_owner = std::move(payload_owner);
+  return true;
+}
+
+}  // namespace
+
 SharedTimestampedString Stream::ToTimestampedString(const Message& message) {
-  std::string str;
-  message.SerializeToString(&str);
-  return ToTimestampedString(str);
+  auto serialised = ToTimestampedString(std::string());
+  switch (message.GetMessageType()) {
+    case MessageType::mDeliverData:
+      if (SerializeWithoutPayload(
+              static_cast<const MessageDeliverData&>(message), &serialised)) {
+        return serialised;
+      }
+      break;
+    case MessageType::mDeliverMulticast:
+      if (SerializeWithoutPayload(
+              static_cast<const MessageDeliverMulticast&>(message),
+              &serialised)) {
+        return serialised;
+      }
+      break;
+    default:
+      break;
+  }
+  message.SerializeToString(&serialised->string);
+  return serialised;
 }
 
-SharedTimestampedString Stream::ToTimestampedString(const std::string& value) {
+SharedTimestampedString Stream::ToTimestampedString(std::string value) {
   auto serialised = std::make_shared<TimestampedString>();
   serialised->issued_time =
       std::chrono::duration_cast<std::chrono::microseconds>(
@@ -109,7 +150,7 @@ bool Stream::Write(SharedTimestampedString& value) {
 
   LOG_DEBUG(socket_event_->GetLogger(),
             "Writing %zd bytes to Stream(%llu, %llu)",
-            value->string.size(),
+            value->size(),
             local_id_,
             remote_id_);
   // Instead of associating a buffer with each stream, we use the one in the
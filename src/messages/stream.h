@@ -56,8 +56,12 @@ class Stream : public Sink<SharedTimestampedString> {
   /** Inherited from Sink<SharedTimestampedString>. */
   bool Write(SharedTimestampedString& value) final override;
 
+  /**
+   * Serialises a message. Payload of a MessageDeliverData which is backed by
+   * shared memory is referenced rather than copied.
+   */
   static SharedTimestampedString ToTimestampedString(const Message& value);
-  static SharedTimestampedString ToTimestampedString(const std::string& value);
+  static SharedTimestampedString ToTimestampedString(std::string value);
 
   bool Write(const Message& msg) {
     auto ts = ToTimestampedString(msg);
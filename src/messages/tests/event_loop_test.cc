@@ -5,7 +5,12 @@
 //
 #define __STDC_FORMAT_MACROS
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <atomic>
+#include <cstddef>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <unordered_set>
@@ -14,6 +19,7 @@
 #include "include/Logger.h"
 #include "include/Env.h"
 #include "src/messages/event_loop.h"
+#include "src/messages/socket_event.h"
 #include "src/messages/stream.h"
 #include "src/port/port.h"
 #include "src/util/testharness.h"
@@ -278,6 +284,116 @@ TEST_F(EventLoopTest, StreamsFlowControl) {
 #endif  // OS_MACOSX
 }
 
+TEST_F(EventLoopTest, LocalTransport) {
+#ifdef OS_LINUX
+  // Messages in order, some larger than the shared memory rings.
+  const int kNumMessages = 1000;
+  std::vector<std::string> cookies;
+  for (int i = 0; i < kNumMessages; ++i) {
+    const char c = static_cast<char>('a' + i % 26);
+    cookies.push_back(std::string(i % 10 ? 10 : 10000, c));
+  }
+
+  port::Semaphore delivered;
+  std::vector<std::string> received;
+  options.heartbeat_period = std::chrono::milliseconds(0); // disable
+  options.event_callback =
+      [&](Flow* flow, std::unique_ptr<Message> msg, StreamID stream) {
+        auto ping = static_cast<MessagePing*>(msg.get());
+        received.push_back(ping->GetCookie());
+        if (received.size() == kNumMessages) {
+          delivered.Post();
+        }
+      };
+  options.listener_port = 0;
+  options.stats_prefix = "loop";
+  options.local_transport = true;
+  options.local_transport_ring_size = 4096;
+  EventLoop loop(options, std::move(stream_allocator));
+  EventLoop::Runner runner(&loop);
+
+  // A stream to itself goes through shared memory.
+  std::unique_ptr<Stream> stream;
+  Wait([&]() {
+    stream = loop.OpenStream(loop.GetHostId());
+    for (const auto& cookie : cookies) {
+      stream->Write(
+          MessagePing(Tenant::GuestTenant, MessagePing::PingType::Request,
+                      cookie));
+    }
+  }, &loop);
+  ASSERT_TRUE(delivered.TimedWait(positive_timeout));
+  ASSERT_TRUE(received == cookies);
+
+  Wait([&]() {
+    // Both the outbound and the accepted connection.
+    ASSERT_EQ(loop.GetStatistics().GetCounterValue("loop.local_connections"),
+              2);
+    stream.reset();
+  }, &loop);
+#endif  // OS_LINUX
+}
+
+TEST_F(EventLoopTest, LocalTransportFallback) {
+#ifdef OS_LINUX
+  port::Semaphore delivered;
+  options.heartbeat_period = std::chrono::milliseconds(0); // disable
+  options.listener_port = 0;
+
+  // A server without local transport, which abstract name is taken by
+  // another listener.
+  EventLoop::Options server_options = options;
+  server_options.event_callback =
+      [&](Flow* flow, std::unique_ptr<Message> msg, StreamID stream) {
+        delivered.Post();
+      };
+  EventLoop server(server_options, stream_allocator.Split());
+  EventLoop::Runner server_runner(&server);
+  HostId server_host;
+  Wait([&]() { server_host = server.GetHostId(); }, &server);
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  const int len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+                           "rocketspeed-%u",
+                           static_cast<unsigned>(server_host.GetPort()));
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_GE(listener, 0);
+  ASSERT_EQ(bind(listener,
+                 reinterpret_cast<sockaddr*>(&addr),
+                 static_cast<socklen_t>(
+                     offsetof(sockaddr_un, sun_path) + 1 + len)),
+            0);
+  ASSERT_EQ(listen(listener, 4), 0);
+
+  // Clients fall back to TCP when the channel is rejected, or when the
+  // connection is closed without a reply.
+  options.local_transport = true;
+  for (bool reply : {true, false}) {
+    EventLoop client(options, stream_allocator.Split());
+    EventLoop::Runner client_runner(&client);
+    std::unique_ptr<Stream> stream;
+    Wait([&]() {
+      stream = client.OpenStream(server_host);
+      stream->Write(
+          MessagePing(Tenant::GuestTenant, MessagePing::PingType::Request));
+    }, &client);
+
+    const int fd = accept(listener, nullptr, nullptr);
+    ASSERT_GE(fd, 0);
+    if (reply) {
+      ASSERT_EQ(write(fd, &kLocalHandshakeReject, 1), 1);
+    }
+    close(fd);
+    ASSERT_TRUE(delivered.TimedWait(positive_timeout));
+
+    Wait([&]() { stream.reset(); }, &client);
+  }
+  close(listener);
+#endif  // OS_LINUX
+}
+
 TEST_F(EventLoopTest, ExceptionCircuitBreaker) {
   // Tests that throwing an exception within the EventLoop thread does not
   // crash the process. We should be able to still use the EventLoop, but it
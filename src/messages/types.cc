@@ -15,6 +15,12 @@ void EncodeOrigin(std::string* out, const StreamID origin) {
   PutFixed64(out, static_cast<uint64_t>(origin));
 }
 
+void EncodeOrigin(char* out, const StreamID origin) {
+  static_assert(kOriginEncodedSize == sizeof(uint64_t),
+                "Origin size mismatch.");
+  EncodeFixed64(out, static_cast<uint64_t>(origin));
+}
+
 bool DecodeOrigin(Slice* in, StreamID* origin) {
   uint64_t origin_fixed;
   if (!GetFixed64(in, &origin_fixed)) {
@@ -72,6 +78,10 @@ void StreamReceiver::operator()(StreamReceiveArg<Message> arg) {
       ReceiveDeliverBatch(
           PrepareArguments<MessageDeliverBatch>(flow, stream_id, message));
       return;
+    case MessageType::mDeliverMulticast:
+      ReceiveDeliverMulticast(
+          PrepareArguments<MessageDeliverMulticast>(flow, stream_id, message));
+      return;
     case MessageType::mHeartbeat:
       // sockets should swallow heartbeats, they shouldn't be exposed
       // to consumers
@@ -94,6 +104,14 @@ void StreamReceiver::ReceiveDeliverGap(
       PrepareArguments<MessageDeliver>(arg.flow, arg.stream_id, arg.message));
 }
 
+void StreamReceiver::ReceiveDeliverMulticast(
+    StreamReceiveArg<MessageDeliverMulticast> arg) {
+  for (auto& data : arg.message->Demultiplex()) {
+    ReceiveDeliverData(
+        PrepareArguments<MessageDeliverData>(arg.flow, arg.stream_id, data));
+  }
+}
+
 template <typename T, typename M>
 StreamReceiveArg<T> StreamReceiver::PrepareArguments(
     Flow* flow, StreamID stream_id, std::unique_ptr<M>& message) {
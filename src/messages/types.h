@@ -8,6 +8,7 @@
 #include <memory>
 #include <string>
 
+#include "include/Slice.h"
 #include "src/util/common/noncopyable.h"
 #include "src/util/common/nonmovable.h"
 
@@ -27,9 +28,9 @@ class MessageDeliverData;
 class MessageFindTailSeqno;
 class MessageTailSeqno;
 class MessageDeliverBatch;
+class MessageDeliverMulticast;
 template<typename>
 class Sink;
-class Slice;
 
 /**
  * Identifies a stream, which is a pair of unidirectional channels, one in each
@@ -52,6 +53,17 @@ static_assert(sizeof(StreamID) == 8, "Invalid StreamID size.");
  */
 void EncodeOrigin(std::string* out, StreamID origin);
 
+/** Size (in octets) of an encoded stream origin. */
+static constexpr size_t kOriginEncodedSize = sizeof(uint64_t);
+
+/**
+ * Encodes stream ID onto wire.
+ *
+ * @param out Output buffer of at least kOriginEncodedSize octets.
+ * @param origin Origin stream ID.
+ */
+void EncodeOrigin(char* out, StreamID origin);
+
 /**
  * Decodes wire format of stream origin.
  *
@@ -64,6 +76,16 @@ bool DecodeOrigin(Slice* in, StreamID* origin);
 struct TimestampedString {
   std::string string;
   uint64_t issued_time;
+  /**
+   * Optional trailing part of the serialised message, which is referenced in
+   * place rather than copied into the string. The memory is kept alive by
+   * payload_owner.
+   */
+  Slice payload;
+  std::shared_ptr<const void> payload_owner;
+
+  /** @return Size of the serialised message. */
+  size_t size() const { return string.size() + payload.size(); }
 };
 
 typedef std::shared_ptr<TimestampedString> SharedTimestampedString;
@@ -121,6 +143,9 @@ class StreamReceiver : public NonMovable, public NonCopyable {
   virtual void ReceiveFindTailSeqno(StreamReceiveArg<MessageFindTailSeqno>) {}
   virtual void ReceiveTailSeqno(StreamReceiveArg<MessageTailSeqno>) {}
   virtual void ReceiveDeliverBatch(StreamReceiveArg<MessageDeliverBatch>) {}
+  /** By default demultiplexes into ReceiveDeliverData calls. */
+  virtual void ReceiveDeliverMulticast(
+      StreamReceiveArg<MessageDeliverMulticast>);
 
  private:
   template <typename T, typename M>
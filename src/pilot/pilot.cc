@@ -9,6 +9,7 @@
 #include <string>
 #include <thread>
 #include <vector>
+#include "src/messages/event_loop.h"
 #include "src/messages/msg_loop.h"
 #include "src/messages/queues.h"
 #include "src/util/common/object_pool.h"
@@ -28,13 +29,15 @@ class AppendClosure : public PooledObject<AppendClosure> {
                 LogID logid,
                 uint64_t now,
                 int worker_id,
-                StreamID origin)
+                StreamID origin,
+                uint64_t ack_ordinal)
   : pilot_(pilot)
   , msg_(std::move(msg))
   , logid_(logid)
   , append_time_(now)
   , worker_id_(worker_id)
-  , origin_(origin) {
+  , origin_(origin)
+  , ack_ordinal_(ack_ordinal) {
   }
 
   void operator()(Status append_status, SequenceNumber seqno);
@@ -48,6 +51,7 @@ class AppendClosure : public PooledObject<AppendClosure> {
   uint64_t append_time_;
   int worker_id_;
   StreamID origin_;
+  uint64_t ack_ordinal_;
 };
 
 class AppendResponse {
@@ -58,6 +62,7 @@ class AppendResponse {
   LogID log_id;
   uint64_t latency;
   StreamID origin;
+  uint64_t ack_ordinal;
   AppendClosure* closure;
 };
 
@@ -75,6 +80,7 @@ void AppendClosure::operator()(Status append_status, SequenceNumber seqno) {
   response.log_id = logid_;
   response.latency = pilot_->options_.env->NowMicros() - append_time_;
   response.origin = origin_;
+  response.ack_ordinal = ack_ordinal_;
   response.closure = this;
 
   // Send response back to relevant worker.
@@ -210,6 +216,10 @@ void Pilot::ProcessPublish(std::unique_ptr<Message> msg, StreamID origin) {
       msg_data->GetTopicName().ToString().c_str(),
       logid);
 
+  // Reserve the place of the ack on the stream.
+  const uint64_t ack_ordinal =
+    AddPendingAck(&worker_data, msg_data, logid, origin);
+
   // Setup AppendCallback
   uint64_t now = options_.env->NowMicros();
   AppendClosure* closure;
@@ -220,7 +230,8 @@ void Pilot::ProcessPublish(std::unique_ptr<Message> msg, StreamID origin) {
     logid,
     now,
     worker_id,
-    origin);
+    origin,
+    ack_ordinal);
 
   // Asynchronously append to log storage.
   auto append_callback = std::ref(*closure);
@@ -252,7 +263,12 @@ void Pilot::ProcessPublish(std::unique_ptr<Message> msg, StreamID origin) {
       status.ToString().c_str());
     options_.info_log->Flush();
 
-    SendAck(msg_data, 0, MessageDataAck::AckStatus::Failure, origin);
+    CompleteAck(&worker_data,
+                origin,
+                logid,
+                ack_ordinal,
+                0,
+                MessageDataAck::AckStatus::Failure);
 
     // If AppendAsync, the closure will never be invoked, so delete now.
     worker_data.append_closure_pool_->Deallocate(closure);
@@ -263,13 +279,18 @@ void Pilot::AppendCallback(Status append_status,
                            SequenceNumber seqno,
                            std::unique_ptr<MessageData> msg,
                            LogID logid,
-                           StreamID origin) {
+                           StreamID origin,
+                           uint64_t ack_ordinal) {
+  int worker_id = options_.msg_loop->GetThreadWorkerIndex();
+  WorkerData* worker_data = worker_data_[worker_id].get();
   if (append_status.ok()) {
     // Append successful, send success ack.
-    SendAck(msg.get(),
-            seqno,
-            MessageDataAck::AckStatus::Success,
-            origin);
+    CompleteAck(worker_data,
+                origin,
+                logid,
+                ack_ordinal,
+                seqno,
+                MessageDataAck::AckStatus::Success);
     LOG_INFO(options_.info_log,
         "Appended (%.16s) successfully to Topic(%s,%s) in Log(%" PRIu64
         ")@%" PRIu64,
@@ -288,26 +309,97 @@ void Pilot::AppendCallback(Status append_status,
         append_status.ToString().c_str());
 
     // TODO: retry depending on error type.
-    SendAck(msg.get(),
-            0,
-            MessageDataAck::AckStatus::Failure,
-            origin);
+    CompleteAck(worker_data,
+                origin,
+                logid,
+                ack_ordinal,
+                0,
+                MessageDataAck::AckStatus::Failure);
+  }
+}
+
+uint64_t Pilot::AddPendingAck(WorkerData* worker_data,
+                              MessageData* msg,
+                              LogID logid,
+                              StreamID origin) {
+  LogAcks& acks = worker_data->stream_acks_[origin][logid];
+  PendingAck pending;
+  pending.tenant_id = msg->GetTenantID();
+  pending.ack.msgid = msg->GetMessageId();
+  acks.pending.push_back(pending);
+  return acks.first_ordinal + acks.pending.size() - 1;
+}
+
+void Pilot::CompleteAck(WorkerData* worker_data,
+                        StreamID origin,
+                        LogID logid,
+                        uint64_t ack_ordinal,
+                        SequenceNumber seqno,
+                        MessageDataAck::AckStatus status) {
+  auto stream_it = worker_data->stream_acks_.find(origin);
+  RS_ASSERT(stream_it != worker_data->stream_acks_.end());
+  auto it = stream_it->second.find(logid);
+  RS_ASSERT(it != stream_it->second.end());
+  LogAcks& acks = it->second;
+  RS_ASSERT(ack_ordinal >= acks.first_ordinal);
+  RS_ASSERT(ack_ordinal - acks.first_ordinal < acks.pending.size());
+  PendingAck& pending = acks.pending[ack_ordinal - acks.first_ordinal];
+  pending.ack.status = status;
+  pending.ack.seqno = seqno;
+  pending.done = true;
+
+  // Acks are sent in order of publishes to the log, so only the oldest one
+  // unblocks it. Sending is deferred until the end of the event loop
+  // iteration, to collect acks of all appends completed in it.
+  if (ack_ordinal == acks.first_ordinal) {
+    worker_data->ready_logs_.emplace_back(origin, logid);
+    if (!worker_data->acks_scheduled_) {
+      worker_data->acks_scheduled_ = true;
+      worker_data->event_loop_->AddTask(
+        [this, worker_data] () { SendAcks(worker_data); });
+    }
   }
 }
 
-void Pilot::SendAck(MessageData* msg,
-                    SequenceNumber seqno,
-                    MessageDataAck::AckStatus status,
-                    StreamID origin) {
-  MessageDataAck::Ack ack;
-  ack.status = status;
-  ack.msgid = msg->GetMessageId();
-  ack.seqno = seqno;
-
-  // create new message
-  MessageDataAck newmsg(msg->GetTenantID(), {ack});
-  auto cmd = MsgLoop::ResponseCommand(newmsg, origin);
-  options_.msg_loop->SendCommandToSelf(std::move(cmd));
+void Pilot::SendAcks(WorkerData* worker_data) {
+  worker_data->acks_scheduled_ = false;
+
+  // Collect the completed prefix of each ready log, per stream and tenant.
+  std::map<std::pair<StreamID, TenantID>, MessageDataAck::AckVector> batches;
+  for (const auto& ready : worker_data->ready_logs_) {
+    const StreamID origin = ready.first;
+    auto stream_it = worker_data->stream_acks_.find(origin);
+    if (stream_it == worker_data->stream_acks_.end()) {
+      continue;
+    }
+    auto it = stream_it->second.find(ready.second);
+    if (it == stream_it->second.end()) {
+      continue;
+    }
+    LogAcks& acks = it->second;
+    while (!acks.pending.empty() && acks.pending.front().done) {
+      const PendingAck& pending = acks.pending.front();
+      batches[std::make_pair(origin, pending.tenant_id)].push_back(
+        pending.ack);
+      acks.pending.pop_front();
+      ++acks.first_ordinal;
+    }
+    if (acks.pending.empty()) {
+      stream_it->second.erase(it);
+      if (stream_it->second.empty()) {
+        worker_data->stream_acks_.erase(stream_it);
+      }
+    }
+  }
+  worker_data->ready_logs_.clear();
+
+  for (auto& batch : batches) {
+    worker_data->stats_.ack_messages->Add(1);
+    worker_data->stats_.acks_per_message->Record(batch.second.size());
+    MessageDataAck newmsg(batch.first.second, std::move(batch.second));
+    auto cmd = MsgLoop::ResponseCommand(newmsg, batch.first.first);
+    options_.msg_loop->SendCommandToSelf(std::move(cmd));
+  }
 }
 
 Statistics Pilot::GetStatisticsSync() const {
@@ -327,9 +419,11 @@ std::string Pilot::GetInfoSync(std::vector<std::string> args) {
 
 Pilot::WorkerData::WorkerData(MsgLoop* msg_loop, int worker_id, Pilot* pilot)
 : append_closure_pool_(new SharedPooledObjectList<AppendClosure>())
-, prng_(ThreadLocalPRNG()) {
+, prng_(ThreadLocalPRNG())
+, event_loop_(msg_loop->GetEventLoop(worker_id))
+, acks_scheduled_(false) {
   // Register processors.
-  EventLoop* event_loop = msg_loop->GetEventLoop(worker_id);
+  EventLoop* event_loop = event_loop_;
   append_response_queues_.reset(
     new ThreadLocalQueues<AppendResponse>(
       [this, pilot, event_loop] () {
@@ -349,7 +443,8 @@ Pilot::WorkerData::WorkerData(MsgLoop* msg_loop, int worker_id, Pilot* pilot)
                                   response.seqno,
                                   std::move(response.msg),
                                   response.log_id,
-                                  response.origin);
+                                  response.origin,
+                                  response.ack_ordinal);
             append_closure_pool_->Deallocate(response.closure);
           });
       }));
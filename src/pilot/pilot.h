@@ -4,8 +4,10 @@
 // of patent rights can be found in the PATENTS file in the same directory.
 #pragma once
 
+#include <deque>
 #include <memory>
 #include <random>
+#include <unordered_map>
 #include <vector>
 #include "src/messages/messages.h"
 #include "src/messages/stream_socket.h"
@@ -17,6 +19,7 @@ namespace rocketspeed {
 
 class AppendClosure;
 class AppendResponse;
+class EventLoop;
 class Logger;
 class LogStorage;
 class Message;
@@ -51,7 +54,8 @@ class Pilot {
                       SequenceNumber seqno,
                       std::unique_ptr<MessageData> msg,
                       LogID logid,
-                      StreamID origin);
+                      StreamID origin,
+                      uint64_t ack_ordinal);
 
   MsgLoop* GetMsgLoop() {
     return options_.msg_loop;
@@ -65,6 +69,9 @@ class Pilot {
       append_latency = all.AddLatency("pilot.append_latency_us");
       append_requests = all.AddCounter("pilot.append_requests");
       failed_appends = all.AddCounter("pilot.failed_appends");
+      ack_messages = all.AddCounter("pilot.ack_messages");
+      acks_per_message =
+        all.AddHistogram("pilot.acks_per_message", 0, 1000, 1);
 
       FAULT_corrupt_writes = all.AddCounter("pilot.FAULT_corrupt_writes");
     }
@@ -80,15 +87,51 @@ class Pilot {
     // Number of append failures.
     Counter* failed_appends;
 
+    // Number of ack messages sent, and number of acks in each.
+    Counter* ack_messages;
+    Histogram* acks_per_message;
+
     // Number of written corrupt records through fault injection.
     Counter* FAULT_corrupt_writes;
   };
 
-  // Send an ack message to the host for the msgid.
-  void SendAck(MessageData* msg,
-               SequenceNumber seqno,
-               MessageDataAck::AckStatus status,
-               StreamID origin);
+  // Ack of a publish, and whether its append has completed.
+  struct PendingAck {
+    TenantID tenant_id;
+    MessageDataAck::Ack ack;
+    bool done = false;
+  };
+
+  // Acks of publishes to a log on a stream that have not been sent yet, in
+  // order of publishes.
+  struct LogAcks {
+    // Ordinal of the first pending ack.
+    uint64_t first_ordinal = 0;
+    std::deque<PendingAck> pending;
+  };
+
+  struct WorkerData;
+
+  // Reserves the place of the ack for a publish to a log on its stream.
+  // Returns the ordinal of the ack.
+  uint64_t AddPendingAck(WorkerData* worker_data,
+                         MessageData* msg,
+                         LogID logid,
+                         StreamID origin);
+
+  // Records the result of a publish. Acks are sent in order of publishes to
+  // each log on each stream, once all earlier ones to the log are complete,
+  // so that a slow log does not hold back acks of other logs.
+  void CompleteAck(WorkerData* worker_data,
+                   StreamID origin,
+                   LogID logid,
+                   uint64_t ack_ordinal,
+                   SequenceNumber seqno,
+                   MessageDataAck::AckStatus status);
+
+  // Sends the completed acks of ready logs, batched into one message per
+  // stream (and tenant).
+  void SendAcks(WorkerData* worker_data);
 
   // The options used by the Pilot
   PilotOptions options_;
@@ -104,6 +147,16 @@ class Pilot {
     Stats stats_;
     std::mt19937_64& prng_;
     std::shared_ptr<ThreadLocalQueues<AppendResponse>> append_response_queues_;
+    EventLoop* event_loop_;
+
+    // Acks waiting for earlier publishes to their log on their stream, or
+    // to be sent.
+    std::unordered_map<StreamID, std::unordered_map<LogID, LogAcks>>
+      stream_acks_;
+    // Logs of streams with acks to send, and whether sending them is
+    // scheduled.
+    std::vector<std::pair<StreamID, LogID>> ready_logs_;
+    bool acks_scheduled_;
   };
 
   // Per-thread data.
@@ -5,6 +5,9 @@
 //
 #include <unistd.h>
 #include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -12,6 +15,7 @@
 
 #include "src/test/test_cluster.h"
 #include "src/pilot/pilot.h"
+#include "src/util/buffered_storage.h"
 #include "src/util/testharness.h"
 #include "src/util/common/guid_generator.h"
 
@@ -95,6 +99,232 @@ TEST_F(PilotTest, Publish) {
   ASSERT_NE(stats_report.find("pilot.append_latency_us"), std::string::npos);
 }
 
+TEST_F(PilotTest, AcksInOrder) {
+  // Create cluster with pilot only, for its storage.
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log_;
+  opts.start_controltower = false;
+  opts.start_copilot = false;
+  opts.single_log = true;
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+
+  // Appends complete together, and acks are coalesced, only when publishes
+  // are batched by buffered storage.
+  MsgLoop pilot_loop(env_, env_options_, 0, 1, info_log_, "pilot");
+  ASSERT_OK(pilot_loop.Initialize());
+  LogStorage* buffered_storage;
+  ASSERT_OK(BufferedLogStorage::Create(env_,
+                                       info_log_,
+                                       cluster.GetLogStorage(),
+                                       &pilot_loop,
+                                       100,
+                                       std::numeric_limits<size_t>::max(),
+                                       std::chrono::milliseconds(10),
+                                       false,
+                                       BatchCompressionOptions(),
+                                       &buffered_storage));
+  PilotOptions options;
+  options.msg_loop = &pilot_loop;
+  options.info_log = info_log_;
+  options.storage.reset(buffered_storage);
+  options.log_router = cluster.GetLogRouter();
+  Pilot* raw_pilot = nullptr;
+  ASSERT_OK(Pilot::CreateNewInstance(options, &raw_pilot));
+  std::unique_ptr<Pilot> pilot(raw_pilot);
+  std::unique_ptr<MsgLoopThread> pilot_thread(
+    new MsgLoopThread(env_, &pilot_loop, "pilot"));
+  ASSERT_OK(pilot_loop.WaitUntilRunning());
+
+  port::Semaphore checkpoint;
+  static const size_t kNumMessages = 1000;
+  std::vector<MsgId> sent;
+  std::vector<MsgId> acked;
+
+  MsgLoop loop(env_, env_options_, 0, 1, info_log_, "test");
+  StreamSocket socket(loop.CreateOutboundStream(pilot->GetHostId(), 0));
+  loop.RegisterCallbacks({
+      {MessageType::mDataAck,
+       [&](Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
+         auto data_ack = static_cast<MessageDataAck*>(msg.get());
+         for (const auto& ack : data_ack->GetAcks()) {
+           ASSERT_EQ(ack.status, MessageDataAck::AckStatus::Success);
+           acked.push_back(ack.msgid);
+         }
+         if (acked.size() == kNumMessages) {
+           checkpoint.Post();
+         }
+       }},
+  });
+  ASSERT_OK(loop.Initialize());
+  MsgLoopThread t1(env_, &loop, "client");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  // Publishes to the log, completing a batch at a time.
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    std::string payload = std::to_string(i);
+    std::string topic = "test" + std::to_string(i);
+    MessageData data(MessageType::mPublish,
+                     Tenant::GuestTenant,
+                     Slice(topic),
+                     GuestNamespace,
+                     Slice(payload));
+    data.SetMessageId(GUIDGenerator::ThreadLocalGUIDGenerator()->Generate());
+    sent.push_back(data.GetMessageId());
+    ASSERT_OK(loop.SendRequest(data, &socket, 0));
+  }
+
+  // Acks come back in order of publishes, possibly several to a message.
+  ASSERT_TRUE(checkpoint.TimedWait(std::chrono::seconds(20)));
+  ASSERT_TRUE(sent == acked);
+  Statistics stats = pilot->GetStatisticsSync();
+  ASSERT_GT(stats.GetCounterValue("pilot.ack_messages"), 0);
+  ASSERT_LT(stats.GetCounterValue("pilot.ack_messages"),
+            static_cast<int64_t>(kNumMessages));
+
+  // The pilot loop must be stopped first.
+  pilot_thread.reset();
+  pilot->Stop();
+}
+
+// Storage that holds back appends to one log until released.
+class HoldingLogStorage : public LogStorage {
+ public:
+  HoldingLogStorage(std::shared_ptr<LogStorage> storage, LogID held_log)
+  : storage_(std::move(storage)), held_log_(held_log) {}
+
+  Status AppendAsync(LogID id,
+                     const Slice& data,
+                     AppendCallback callback) override {
+    if (id == held_log_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      held_.push_back(std::move(callback));
+      return Status::OK();
+    }
+    return storage_->AppendAsync(id, data, std::move(callback));
+  }
+
+  Status FindTimeAsync(
+      LogID id,
+      std::chrono::milliseconds timestamp,
+      std::function<void(Status, SequenceNumber)> callback) override {
+    return storage_->FindTimeAsync(id, timestamp, std::move(callback));
+  }
+
+  Status CreateAsyncReaders(
+      unsigned int parallelism,
+      std::function<bool(LogRecord&)> record_cb,
+      std::function<bool(const GapRecord&)> gap_cb,
+      std::vector<AsyncLogReader*>* readers) override {
+    return storage_->CreateAsyncReaders(parallelism,
+                                        std::move(record_cb),
+                                        std::move(gap_cb),
+                                        readers);
+  }
+
+  bool CanSubscribePastEnd() const override {
+    return storage_->CanSubscribePastEnd();
+  }
+
+  // Completes the held appends.
+  void Release() {
+    std::vector<AppendCallback> held;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      held.swap(held_);
+    }
+    SequenceNumber seqno = 1;
+    for (auto& callback : held) {
+      callback(Status::OK(), seqno++);
+    }
+  }
+
+ private:
+  std::shared_ptr<LogStorage> storage_;
+  const LogID held_log_;
+  std::mutex mutex_;
+  std::vector<AppendCallback> held_;
+};
+
+TEST_F(PilotTest, SlowLogDoesNotHoldBackAcks) {
+  // Create cluster with pilot only, for its storage.
+  LocalTestCluster cluster(info_log_, false, false, true);
+  ASSERT_OK(cluster.GetStatus());
+
+  // Two topics on different logs.
+  auto router = cluster.GetLogRouter();
+  const std::string slow_topic = "slow";
+  LogID slow_log;
+  ASSERT_OK(router->GetLogID(GuestNamespace, slow_topic, &slow_log));
+  std::string fast_topic;
+  LogID fast_log = slow_log;
+  for (int i = 0; fast_log == slow_log; ++i) {
+    fast_topic = "fast" + std::to_string(i);
+    ASSERT_OK(router->GetLogID(GuestNamespace, fast_topic, &fast_log));
+  }
+
+  MsgLoop pilot_loop(env_, env_options_, 0, 1, info_log_, "pilot");
+  ASSERT_OK(pilot_loop.Initialize());
+  auto storage =
+    std::make_shared<HoldingLogStorage>(cluster.GetLogStorage(), slow_log);
+  PilotOptions options;
+  options.msg_loop = &pilot_loop;
+  options.info_log = info_log_;
+  options.storage = storage;
+  options.log_router = router;
+  Pilot* raw_pilot = nullptr;
+  ASSERT_OK(Pilot::CreateNewInstance(options, &raw_pilot));
+  std::unique_ptr<Pilot> pilot(raw_pilot);
+  std::unique_ptr<MsgLoopThread> pilot_thread(
+    new MsgLoopThread(env_, &pilot_loop, "pilot"));
+  ASSERT_OK(pilot_loop.WaitUntilRunning());
+
+  port::Semaphore ack_sem;
+  std::vector<MsgId> acked;
+  MsgLoop loop(env_, env_options_, 0, 1, info_log_, "test");
+  StreamSocket socket(loop.CreateOutboundStream(pilot->GetHostId(), 0));
+  loop.RegisterCallbacks({
+      {MessageType::mDataAck,
+       [&](Flow* flow, std::unique_ptr<Message> msg, StreamID origin) {
+         auto data_ack = static_cast<MessageDataAck*>(msg.get());
+         for (const auto& ack : data_ack->GetAcks()) {
+           ASSERT_EQ(ack.status, MessageDataAck::AckStatus::Success);
+           acked.push_back(ack.msgid);
+           ack_sem.Post();
+         }
+       }},
+  });
+  ASSERT_OK(loop.Initialize());
+  MsgLoopThread t1(env_, &loop, "client");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  auto publish = [&] (const std::string& topic) {
+    MessageData data(MessageType::mPublish,
+                     Tenant::GuestTenant,
+                     Slice(topic),
+                     GuestNamespace,
+                     Slice("payload"));
+    data.SetMessageId(GUIDGenerator::ThreadLocalGUIDGenerator()->Generate());
+    EXPECT_OK(loop.SendRequest(data, &socket, 0));
+    return data.GetMessageId();
+  };
+
+  // The publish to the fast log is acked while the slow log is stuck.
+  const MsgId slow_id = publish(slow_topic);
+  const MsgId fast_id = publish(fast_topic);
+  ASSERT_TRUE(ack_sem.TimedWait(std::chrono::seconds(5)));
+  ASSERT_EQ(acked, std::vector<MsgId>({fast_id}));
+
+  // Then the slow log completes.
+  storage->Release();
+  ASSERT_TRUE(ack_sem.TimedWait(std::chrono::seconds(5)));
+  ASSERT_EQ(acked, std::vector<MsgId>({fast_id, slow_id}));
+
+  // The pilot loop must be stopped first.
+  pilot_thread.reset();
+  pilot->Stop();
+}
+
 TEST_F(PilotTest, NoLogger) {
   // Create cluster with pilot only (only need this for the log storage).
   LocalTestCluster cluster(info_log_, false, false, true);
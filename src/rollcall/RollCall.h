@@ -73,6 +73,13 @@ class RollcallEntry {
  public:
   static const char ROLLCALL_ENTRY_VERSION_CURRENT = '2';
 
+  /*
+   * Entries of a batch are sorted by topic, and every topic name is encoded
+   * as a suffix of the previous one. Written only when enabled, once all
+   * readers accept it.
+   */
+  static const char ROLLCALL_ENTRY_VERSION_DELTA = '3';
+
   // The types of Rollcall Entries.
   enum EntryType : char {
     Error                 = 'E',
@@ -120,6 +127,14 @@ class RollcallEntry {
 
   void Serialize(std::string* buffer);
   Status DeSerialize(Slice* in);
+
+  /*
+   * Same as above, but the topic name is delta encoded against the topic of
+   * the previous entry in the batch, or an empty one for the first entry.
+   */
+  void Serialize(const Topic& previous, std::string* buffer);
+  Status DeSerialize(const Topic& previous, Slice* in);
+
   ~RollcallEntry() = default;
 
  private:
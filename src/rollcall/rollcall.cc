@@ -6,6 +6,10 @@
 #define __STDC_FORMAT_MACROS
 #include "rollcall_impl.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+
 #include "external/folly/move_wrapper.h"
 
 #include "include/Slice.h"
@@ -30,11 +34,17 @@ Status RollcallStream::Open(ClientOptions client_options,
 
 const NamespaceID RollcallImpl::kRollcallNamespace = "_r";
 
+constexpr size_t RollcallImpl::kEntryOverhead;
+constexpr int RollcallImpl::kAppendLatencyFactor;
+
 RollcallImpl::RollcallImpl(std::shared_ptr<ClientImpl> client,
                            const TenantID tenant_id,
-                           std::string stats_prefix)
+                           std::string stats_prefix,
+                           bool delta_encoding)
     : client_(std::move(client)),
       tenant_id_(tenant_id),
+      delta_encoding_(delta_encoding),
+      append_latency_us_(std::make_shared<std::atomic<uint64_t>>(0)),
       stats_(std::move(stats_prefix)) {
 }
 
@@ -67,13 +77,21 @@ Status RollcallImpl::Subscribe(const NamespaceID& namespace_id,
     Slice in(msg->GetContents());
     if (in.size() >= 2 && in[1] == '_') {
       auto version = in[0];
-      if (version == RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT) {
+      const bool delta =
+        version == RollcallEntry::ROLLCALL_ENTRY_VERSION_DELTA;
+      if (delta || version == RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT) {
         in.remove_prefix(2);
+        Topic previous;
         while (!in.empty()) {
           RollcallEntry rmsg(version);
-          if (!rmsg.DeSerialize(&in).ok()) {
+          Status st = delta ? rmsg.DeSerialize(previous, &in)
+                            : rmsg.DeSerialize(&in);
+          if (!st.ok()) {
             break;
           }
+          if (delta) {
+            previous = rmsg.GetTopicName();
+          }
           callback(std::move(rmsg));
         }
       }
@@ -108,28 +126,37 @@ Status RollcallImpl::WriteEntry(const TenantID tenant_id,
     return Status::OK();
   }
 
-  // Serialize the entry
-  RollcallEntry impl(topic_name.ToString(),
-                     isSubscription
-                         ? RollcallEntry::EntryType::SubscriptionRequest
-                         : RollcallEntry::EntryType::UnSubscriptionRequest);
-
   const RollcallShard shard = GetRollcallShard(nsid, shard_affinity);
   const BatchKey batch_key(shard, std::move(nsid), tenant_id);
 
   Batch& batch = batches_[batch_key];
-  if (batch.payload.empty()) {
-    // First entry -- write batch header.
-    batch.payload.push_back(RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT);
-    batch.payload.push_back('_');
-
-    // Also add to batch timeout list.
+  if (batch.Empty()) {
+    // First entry -- add to batch timeout list.
     batch_timeouts_.Add(batch_key);
   }
-  impl.Serialize(&batch.payload);
-  batch.callbacks.emplace_back(std::move(publish_callback));
 
-  if (batch.payload.size() >= max_batch_size_bytes) {
+  // Entries are serialized on flush, only their net effect is kept.
+  auto it = batch.topics.emplace(topic_name.ToString(), TopicEntries()).first;
+  TopicEntries& entries = it->second;
+  const int delta = isSubscription ? 1 : -1;
+  const size_t entry_bytes = kEntryOverhead + it->first.size();
+  entries.net += delta;
+  if (entries.net * delta <= 0) {
+    // Cancels out the latest entry of the opposite type.
+    batch.cancelled.emplace_back(std::move(entries.callbacks.back()));
+    batch.cancelled.emplace_back(std::move(publish_callback));
+    entries.callbacks.pop_back();
+    batch.size_bytes -= entry_bytes;
+    stats_.entries_cancelled->Add(2);
+    if (entries.net == 0) {
+      batch.topics.erase(it);
+    }
+  } else {
+    entries.callbacks.emplace_back(std::move(publish_callback));
+    batch.size_bytes += entry_bytes;
+  }
+
+  if (batch.size_bytes >= max_batch_size_bytes) {
     FlushBatch(batch_key);
     batch_timeouts_.Erase(batch_key);
     stats_.batch_size_writes->Add(1);
@@ -137,8 +164,16 @@ Status RollcallImpl::WriteEntry(const TenantID tenant_id,
   return Status::OK();
 }
 
-void RollcallImpl::CheckBatchTimeouts(std::chrono::milliseconds timeout) {
+void RollcallImpl::CheckBatchTimeouts(std::chrono::milliseconds timeout,
+                                      std::chrono::milliseconds max_timeout) {
   thread_check_.Check();
+  const auto append_latency =
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      kAppendLatencyFactor *
+      std::chrono::microseconds(append_latency_us_->load()));
+  timeout = std::max(timeout, std::min(append_latency, max_timeout));
+  stats_.batch_timeout_ms->Set(timeout.count());
+
   batch_timeouts_.ProcessExpired(
     timeout,
     [this] (const BatchKey& key) {
@@ -150,39 +185,87 @@ void RollcallImpl::CheckBatchTimeouts(std::chrono::milliseconds timeout) {
 
 Status RollcallImpl::FlushBatch(const BatchKey& key) {
   thread_check_.Check();
-  Status st;
-  Batch& batch = batches_[key];
-  if (!batch.payload.empty()) {
-    // write it out to rollcall topic
-    const RollcallShard shard = std::get<0>(key);
-    const NamespaceID& nsid = std::get<1>(key);
-    const TenantID tenant_id = std::get<2>(key);
-
-    const size_t num_entries = batch.callbacks.size();
-    stats_.batch_size_bytes->Record(batch.payload.size());
-    stats_.batch_size_entries->Record(num_entries);
-    stats_.batch_writes->Add(1);
-    stats_.entry_writes->Add(num_entries);
-
-    auto moved_callbacks = folly::makeMoveWrapper(std::move(batch.callbacks));
-    PublishCallback publish_callback =
-      [moved_callbacks] (std::unique_ptr<ResultStatus> result) {
-        for (auto& callback : *moved_callbacks) {
-          // Invoke all callbacks from the batch.
-          callback(result->GetStatus());
-        }
-      };
-    st = client_->Publish(tenant_id,
+  auto batch_it = batches_.find(key);
+  if (batch_it == batches_.end()) {
+    return Status::OK();
+  }
+  Batch batch = std::move(batch_it->second);
+  batches_.erase(batch_it);
+
+  // Entries that cancelled out have had their effect.
+  for (auto& callback : batch.cancelled) {
+    callback(Status::OK());
+  }
+  if (batch.topics.empty()) {
+    return Status::OK();
+  }
+
+  // Serialize the net effect of the batch, in order of topic names.
+  std::string payload;
+  payload.push_back(delta_encoding_
+                        ? RollcallEntry::ROLLCALL_ENTRY_VERSION_DELTA
+                        : RollcallEntry::ROLLCALL_ENTRY_VERSION_CURRENT);
+  payload.push_back('_');
+  std::vector<std::function<void(Status)>> callbacks;
+  static const Topic kNoTopic;
+  const Topic* previous = &kNoTopic;
+  size_t num_entries = 0;
+  for (auto& topic : batch.topics) {
+    TopicEntries& entries = topic.second;
+    RollcallEntry entry(topic.first,
+                        entries.net > 0
+                            ? RollcallEntry::EntryType::SubscriptionRequest
+                            : RollcallEntry::EntryType::UnSubscriptionRequest);
+    for (int i = 0; i < std::abs(entries.net); ++i) {
+      if (delta_encoding_) {
+        entry.Serialize(*previous, &payload);
+        previous = &topic.first;
+      } else {
+        entry.Serialize(&payload);
+      }
+    }
+    num_entries += std::abs(entries.net);
+    std::move(entries.callbacks.begin(), entries.callbacks.end(),
+              std::back_inserter(callbacks));
+  }
+
+  // write it out to rollcall topic
+  const RollcallShard shard = std::get<0>(key);
+  const NamespaceID& nsid = std::get<1>(key);
+  const TenantID tenant_id = std::get<2>(key);
+
+  stats_.batch_size_bytes->Record(payload.size());
+  stats_.batch_size_entries->Record(num_entries);
+  stats_.batch_writes->Add(1);
+  stats_.entry_writes->Add(num_entries);
+
+  auto moved_callbacks = folly::makeMoveWrapper(std::move(callbacks));
+  auto append_latency_us = append_latency_us_;
+  const auto start = std::chrono::steady_clock::now();
+  PublishCallback publish_callback =
+    [moved_callbacks, append_latency_us, start]
+    (std::unique_ptr<ResultStatus> result) {
+      if (result->GetStatus().ok()) {
+        // Moving average with weight 1/8. Concurrent updates may lose a
+        // sample, which is fine.
+        const uint64_t latency = static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+        const uint64_t average = append_latency_us->load();
+        append_latency_us->store(average - average / 8 + latency / 8);
+      }
+      for (auto& callback : *moved_callbacks) {
+        // Invoke all callbacks from the batch.
+        callback(result->GetStatus());
+      }
+    };
+  return client_->Publish(tenant_id,
                           GetRollcallTopicName(nsid, shard),
                           kRollcallNamespace,
                           TopicOptions(),
-                          Slice(batch.payload),
+                          Slice(payload),
                           std::move(publish_callback),
                           MsgId()).status;
-    batch.payload.clear();
-    batch.callbacks.clear();
-  }
-  return st;
 }
 
 RollcallShard RollcallImpl::GetRollcallShard(const NamespaceID& namespace_id,
@@ -208,6 +291,39 @@ void RollcallEntry::Serialize(std::string* buffer) {
   PutLengthPrefixedSlice(buffer, Slice(topic_name_));
 }
 
+void RollcallEntry::Serialize(const Topic& previous, std::string* buffer) {
+  buffer->push_back(entry_type_);
+  buffer->push_back('_');
+  const size_t max_shared = std::min(previous.size(), topic_name_.size());
+  size_t shared = 0;
+  while (shared < max_shared && previous[shared] == topic_name_[shared]) {
+    ++shared;
+  }
+  PutVarint32(buffer, static_cast<uint32_t>(shared));
+  PutLengthPrefixedSlice(buffer,
+                         Slice(topic_name_.data() + shared,
+                               topic_name_.size() - shared));
+}
+
+Status RollcallEntry::DeSerialize(const Topic& previous, Slice* in) {
+  if (!GetFixedEnum8(in, &entry_type_)) {
+    return Status::InvalidArgument("Invalid rollcall entry type");
+  }
+  if (in->empty() || (*in)[0] != '_') {
+    return Status::InvalidArgument("Invalid rollcall entry format");
+  }
+  in->remove_prefix(1);
+  uint32_t shared;
+  Slice suffix;
+  if (!GetVarint32(in, &shared) || shared > previous.size() ||
+      !GetLengthPrefixedSlice(in, &suffix)) {
+    return Status::InvalidArgument("Invalid rollcall entry topic name");
+  }
+  topic_name_.assign(previous, 0, shared);
+  topic_name_.append(suffix.data(), suffix.size());
+  return Status::OK();
+}
+
 Status RollcallEntry::DeSerialize(Slice* in) {
   if (!GetFixedEnum8(in, &entry_type_)) {
     return Status::InvalidArgument("Invalid rollcall entry type");
@@ -229,8 +345,10 @@ RollcallImpl::Stats::Stats(std::string prefix) {
     all.AddHistogram(prefix + ".batch_size_entries", 0, 1 << 20, 1);
   batch_writes = all.AddCounter(prefix + ".batch_writes");
   entry_writes = all.AddCounter(prefix + ".entry_writes");
+  entries_cancelled = all.AddCounter(prefix + ".entries_cancelled");
   batch_size_writes = all.AddCounter(prefix + ".batch_size_writes");
   batch_timeout_writes = all.AddCounter(prefix + ".batch_timeout_writes");
+  batch_timeout_ms = all.AddCounter(prefix + ".batch_timeout_ms");
 }
 
 }  // namespace rocketspeed
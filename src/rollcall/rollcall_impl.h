@@ -5,8 +5,12 @@
 //
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
 #include <tuple>
+#include <vector>
 
 #include "include/RocketSpeed.h"
 #include "src/rollcall/RollCall.h"
@@ -27,9 +31,14 @@ struct TopicUUID;
  */
 class RollcallImpl : public RollcallStream {
  public:
+  /**
+   * @param delta_encoding Write batches with delta encoded topic names,
+   *                       which readers older than the format cannot read.
+   */
   RollcallImpl(std::shared_ptr<ClientImpl> client,
                TenantID tenant_id,
-               std::string stats_prefix = "rollcall");
+               std::string stats_prefix = "rollcall",
+               bool delta_encoding = false);
 
   RollcallShard GetNumShards(const NamespaceID& namespace_id) override;
 
@@ -40,6 +49,10 @@ class RollcallImpl : public RollcallStream {
   /**
    * Writes an entry to the rollcall topic. This isn't written to RocketSpeed
    * until FlushBatch is called.
+   *
+   * A subscription and an unsubscription on the same topic in one batch
+   * cancel out, neither is written, and both callbacks are invoked with OK
+   * once the batch is flushed.
    */
   Status WriteEntry(const TenantID tenant_id,
                     const TopicUUID& topic,
@@ -49,11 +62,16 @@ class RollcallImpl : public RollcallStream {
                     size_t max_batch_size_bytes);
 
   /**
-   * Flushes all batches that are older than timeout.
+   * Flushes all batches that are older than timeout. The timeout adapts to
+   * the latency of rollcall appends: while appends are slow, batches are
+   * kept open for a few append latencies, up to max_timeout, so that slow
+   * storage gets fewer writes and more entries cancel out.
    *
    * @param timeout Minimum age of batches to flush.
+   * @param max_timeout Maximum age of batches to flush.
    */
-  void CheckBatchTimeouts(std::chrono::milliseconds timeout);
+  void CheckBatchTimeouts(std::chrono::milliseconds timeout,
+                          std::chrono::milliseconds max_timeout);
 
   const Statistics& GetStatistics() const {
     return stats_.all;
@@ -64,11 +82,33 @@ class RollcallImpl : public RollcallStream {
  private:
   static const NamespaceID kRollcallNamespace;
 
+  // Upper bound on the encoding of an entry, excluding the topic name.
+  static constexpr size_t kEntryOverhead = 12;
+
+  // Batches are kept open for this many append latencies.
+  static constexpr int kAppendLatencyFactor = 4;
+
+  // Net effect of the entries on one topic in a batch.
+  struct TopicEntries {
+    // Number of subscriptions less the number of unsubscriptions.
+    int net = 0;
+    // Callbacks of the entries that make up the net effect.
+    std::vector<std::function<void(Status)>> callbacks;
+  };
+
   // A single batch of rollcall entries.
   // These will be written with one RocketSpeed Publish.
   struct Batch {
-    std::string payload;
-    std::vector<std::function<void(Status)>> callbacks;
+    // Ordered by name, so that consecutive names share prefixes.
+    std::map<Topic, TopicEntries> topics;
+    // Callbacks of entries that cancelled out.
+    std::vector<std::function<void(Status)>> cancelled;
+    // Upper bound on the size of the encoded batch.
+    size_t size_bytes = 0;
+
+    bool Empty() const {
+      return topics.empty() && cancelled.empty();
+    }
   };
 
   // Batches are keyed by shard, namespace ID, and tenant ID.
@@ -85,9 +125,13 @@ class RollcallImpl : public RollcallStream {
 
   const std::shared_ptr<ClientImpl> client_;
   const TenantID tenant_id_;
+  const bool delta_encoding_;
   std::unordered_map<BatchKey, Batch, BatchKeyHash> batches_;
   ThreadCheck thread_check_;
   TimeoutList<BatchKey, BatchKeyHash> batch_timeouts_;
+  // Moving average of the latency of rollcall appends in microseconds,
+  // updated from publish callbacks on the client's threads.
+  const std::shared_ptr<std::atomic<uint64_t>> append_latency_us_;
 
   struct Stats {
     explicit Stats(std::string prefix);
@@ -97,8 +141,10 @@ class RollcallImpl : public RollcallStream {
     Histogram* batch_size_entries;
     Counter* batch_writes;
     Counter* entry_writes;
+    Counter* entries_cancelled;
     Counter* batch_size_writes;
     Counter* batch_timeout_writes;
+    Counter* batch_timeout_ms;
   } stats_;
 
   RollcallShard GetRollcallShard(const NamespaceID& namespace_id,
@@ -0,0 +1,58 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+
+#define __STDC_FORMAT_MACROS
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <utility>
+
+#include "include/Logger.h"
+#include "src/server/storage_setup.h"
+#include "src/logdevice/log_router.h"
+#include "src/util/file_storage.h"
+
+#include <gflags/gflags.h>
+
+DEFINE_string(logs, "1..1000", "range of logs");
+DEFINE_string(storage_dir, "rocketspeed_logs",
+  "directory of the local file storage");
+DEFINE_uint64(storage_segment_size, 64 * 1024 * 1024,
+  "size of segment files of the local file storage (bytes)");
+
+namespace rocketspeed {
+
+std::shared_ptr<LogStorage> CreateLogStorage(Env* env,
+                                             std::shared_ptr<Logger> info_log) {
+  FileLogStorage* storage = nullptr;
+  Status st = FileLogStorage::Create(env,
+                                     info_log,
+                                     FLAGS_storage_dir,
+                                     FLAGS_storage_segment_size,
+                                     &storage);
+  if (!st.ok()) {
+    LOG_FATAL(info_log, "Failed to open file storage in %s: %s",
+      FLAGS_storage_dir.c_str(), st.ToString().c_str());
+    return nullptr;
+  }
+  return std::shared_ptr<LogStorage>(storage);
+}
+
+std::shared_ptr<LogRouter> CreateLogRouter() {
+  // Parse and validate log range.
+  LogID first_log, last_log;
+  int ret = sscanf(FLAGS_logs.c_str(), "%" PRIu64 "..%" PRIu64,
+    &first_log, &last_log);
+  if (ret != 2) {
+    fprintf(stderr, "Error: log_range option must be in the form of \"a..b\"");
+    return nullptr;
+  }
+
+  // Logs are spread over the range the same way as with LogDevice.
+  return std::make_shared<LogDeviceLogRouter>(first_log, last_log);
+}
+
+}  // namespace rocketspeed
@@ -34,7 +34,7 @@
 // Common settings
 DEFINE_bool(log_to_stderr, false, "log to stderr (otherwise LOG file)");
 DEFINE_uint64(buffered_storage_max_messages,
-              0,
+              64,
               "how many messages to batch in a storage record, <= 1 disables");
 DEFINE_uint64(buffered_storage_max_bytes,
               std::numeric_limits<size_t>::max(),
@@ -42,6 +42,24 @@ DEFINE_uint64(buffered_storage_max_bytes,
 DEFINE_uint64(buffered_storage_max_latency_us,
               1000,
               "for how long to wait before filling sending unfinished batch");
+DEFINE_bool(buffered_storage_adaptive,
+            true,
+            "size batches by measured append latency, the limits above are "
+            "upper bounds");
+DEFINE_string(buffered_storage_compression,
+              "none",
+              "compression of batches: none, zlib or lz4");
+DEFINE_uint64(buffered_storage_dictionary_bytes,
+              0,
+              "size of per-log compression dictionaries, 0 disables");
+DEFINE_uint64(buffered_storage_dictionary_max_age_s,
+              3600,
+              "age in seconds at which dictionaries are rebuilt, keep well "
+              "under log retention");
+DEFINE_bool(local_transport, false,
+            "exchange messages with loops on the same host over shared memory");
+DEFINE_uint64(local_transport_ring_size, 1024 * 1024,
+              "capacity of each direction of a shared memory connection");
 DEFINE_string(node_location, "",
   "location of this node for SSL: {region}.{dc}.{cluster}.{row}.{rack}");
 
@@ -56,11 +74,15 @@ DEFINE_int64(tower_max_subscription_lag, 10000,
 DEFINE_int32(tower_readers_per_room, 2, "log readers per room");
 DEFINE_int64(tower_cache_size, -1, "cache size in bytes");
 DEFINE_int64(tower_cache_block_size, -1, "number of messages in a cache block");
+DEFINE_bool(tower_cache_admission_filter, true,
+            "admit cache blocks only if looked up as often as their victims");
 DEFINE_int32(bloom_bits_per_msg, -1, "number of bits for bloom per message");
 DEFINE_uint64(tower_min_reader_restart_ms, 30000,
   "minimum time to wait before restarting a log reader");
 DEFINE_uint64(tower_max_reader_restart_ms, 60000,
   "maximum time to wait before restarting a log reader");
+DEFINE_bool(tower_multicast_delivery, false,
+  "deliver a record to many subscriptions of a stream in one message");
 DEFINE_double(FAULT_tower_send_log_record_failure_rate, 0.0,
   "probability of failing to append to topic tailer queue from log storage");
 
@@ -90,6 +112,8 @@ DEFINE_int64(copilot_timer_interval_micros, 500000,
              "microseconds between health check ticks");
 DEFINE_int64(copilot_resubscriptions_per_second, 10000,
              "maximum number of orphaned topic resubscriptions per second");
+DEFINE_bool(copilot_multicast_delivery, false,
+            "deliver a record to subscriptions of a client in one message");
 
 // Rollcall settings
 DEFINE_bool(rollcall, true, "enable RollCall");
@@ -97,6 +121,12 @@ DEFINE_int32(rollcall_max_batch_size_bytes, 16 << 10,
              "max rollcall message size (in bytes) before flush");
 DEFINE_int32(rollcall_flush_latency_ms, 500,
              "time (milliseconds) to automatically flush rollcall writes");
+DEFINE_int32(rollcall_max_flush_latency_ms, 5000,
+             "max time (milliseconds) to hold rollcall writes while the log "
+             "is slow");
+DEFINE_bool(rollcall_delta_encoding, false,
+            "write rollcall entries with delta encoded topic names, only once "
+            "all rollcall readers accept them");
 
 // Supervisor settings
 DEFINE_bool(supervisor, true, "start the supervisor");
@@ -184,6 +214,9 @@ Status RocketSpeed::Initialize(
       "Constructing MsgLoop port=%d workers=%d name=%s socketbuf=%d",
       port, workers, name.c_str(), env_options_.tcp_send_buffer_size);
     MsgLoop::Options options;
+    options.event_loop.local_transport = FLAGS_local_transport;
+    options.event_loop.local_transport_ring_size =
+      FLAGS_local_transport_ring_size;
     return new MsgLoop(env_,
                        env_options_,
                        port,
@@ -260,12 +293,28 @@ Status RocketSpeed::Initialize(
     if (FLAGS_buffered_storage_max_messages > 1 &&
         FLAGS_buffered_storage_max_bytes > 0 &&
         FLAGS_buffered_storage_max_latency_us) {
+      BatchCompressionOptions compression;
+      if (FLAGS_buffered_storage_compression == "zlib") {
+        compression.type = BatchCompression::kZlib;
+      } else if (FLAGS_buffered_storage_compression == "lz4") {
+        compression.type = BatchCompression::kLZ4;
+      } else if (FLAGS_buffered_storage_compression != "none") {
+        return Status::InvalidArgument("Unknown compression: " +
+                                       FLAGS_buffered_storage_compression);
+      }
+      compression.dictionary_bytes = FLAGS_buffered_storage_dictionary_bytes;
+      compression.dictionary_max_age =
+        std::chrono::seconds(FLAGS_buffered_storage_dictionary_max_age_s);
       LOG_VITAL(info_log_,
                 "Using BufferedLogStorage, messages: %" PRIu64
-                ", bytes: %" PRIu64 ", latency: %" PRIu64 " us",
+                ", bytes: %" PRIu64 ", latency: %" PRIu64 " us, adaptive: %s"
+                ", compression: %s, dictionary: %" PRIu64 " bytes",
                 FLAGS_buffered_storage_max_messages,
                 FLAGS_buffered_storage_max_bytes,
-                FLAGS_buffered_storage_max_latency_us);
+                FLAGS_buffered_storage_max_latency_us,
+                FLAGS_buffered_storage_adaptive ? "yes" : "no",
+                FLAGS_buffered_storage_compression.c_str(),
+                FLAGS_buffered_storage_dictionary_bytes);
       LogStorage* raw_storage;
       Status st = BufferedLogStorage::Create(
           env_,
@@ -275,6 +324,8 @@ Status RocketSpeed::Initialize(
           FLAGS_buffered_storage_max_messages,
           FLAGS_buffered_storage_max_bytes,
           std::chrono::microseconds(FLAGS_buffered_storage_max_latency_us),
+          FLAGS_buffered_storage_adaptive,
+          compression,
           &raw_storage);
       if (!st.ok()) {
         return st;
@@ -302,9 +353,12 @@ Status RocketSpeed::Initialize(
     if (FLAGS_tower_cache_block_size != -1) {
       tower_opts.topic_tailer.cache_block_size = FLAGS_tower_cache_block_size;
     }
+    tower_opts.topic_tailer.cache_admission_filter =
+      FLAGS_tower_cache_admission_filter;
     if (FLAGS_bloom_bits_per_msg != -1) {
       tower_opts.topic_tailer.bloom_bits_per_msg = FLAGS_bloom_bits_per_msg;
     }
+    tower_opts.multicast_delivery = FLAGS_tower_multicast_delivery;
     tower_opts.log_tailer.FAULT_send_log_record_failure_rate =
       FLAGS_FAULT_tower_send_log_record_failure_rate;
     tower_opts.log_tailer.min_reader_restart_duration =
@@ -354,9 +408,13 @@ Status RocketSpeed::Initialize(
       FLAGS_rollcall_max_batch_size_bytes;
     copilot_opts.rollcall_flush_latency =
       std::chrono::milliseconds(FLAGS_rollcall_flush_latency_ms);
+    copilot_opts.rollcall_max_flush_latency =
+      std::chrono::milliseconds(FLAGS_rollcall_max_flush_latency_ms);
+    copilot_opts.rollcall_delta_encoding = FLAGS_rollcall_delta_encoding;
     copilot_opts.timer_interval_micros = FLAGS_copilot_timer_interval_micros;
     copilot_opts.resubscriptions_per_second =
       FLAGS_copilot_resubscriptions_per_second;
+    copilot_opts.multicast_delivery = FLAGS_copilot_multicast_delivery;
 
     // TODO(pja) 1 : Configure control tower hosts from config file.
     // Parse comma-separated control_towers hostname.
@@ -2050,8 +2050,8 @@ TEST_F(IntegrationTest, ReadingFromCache) {
 // This test doesn't work with the LogDevice integration test utils since they
 // only support one log, meaning there is no way to balance.
 TEST_F(IntegrationTest, TowerRebalance) {
-  // Tests that subscriptions are rebalanced across control towers gradually
-  // when new towers become available.
+  // Tests that subscriptions are rebalanced across control towers when new
+  // towers become available, without waiting for the periodic checkup.
 
   // Setup local RocketSpeed cluster (pilot + copilot + tower).
   LocalTestCluster::Options opts;
@@ -2061,7 +2061,6 @@ TEST_F(IntegrationTest, TowerRebalance) {
   opts.start_pilot = true;
   opts.copilot.rollcall_enabled = false;
   opts.copilot.timer_interval_micros = 100000;  // 100ms
-  opts.copilot.tower_subscriptions_check_period = std::chrono::seconds(1);
   LocalTestCluster cluster(opts);
   ASSERT_OK(cluster.GetStatus());
 
@@ -2116,6 +2115,10 @@ TEST_F(IntegrationTest, TowerRebalance) {
   ASSERT_NE(GetNumOpenLogs(ct_cluster[0]->GetControlTower()), 0);
   ASSERT_NE(GetNumOpenLogs(ct_cluster[1]->GetControlTower()), 0);
   ASSERT_LT(GetNumOpenLogs(cluster.GetControlTower()), initial_logs_open);
+
+  // Logs were moved on the router update.
+  auto stats = cluster.GetCopilot()->GetStatisticsSync();
+  ASSERT_GT(stats.GetCounterValue("copilot.tower_rebalance_logs"), 0);
 }
 #endif
 
@@ -2274,6 +2277,132 @@ TEST_F(IntegrationTest, VirtualReaderMerge) {
   env_->SleepForMicroseconds(100000);
 }
 
+TEST_F(IntegrationTest, CatchUpReaders) {
+  // Tests that a subscription far behind is caught up in parallel ranges,
+  // in order, and then handed to the regular readers.
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log;
+  opts.single_log = true;
+  opts.tower.topic_tailer.catch_up_readers = 3;
+  opts.tower.topic_tailer.catch_up_min_backlog = 50;
+  opts.tower.topic_tailer.catch_up_range_size = 7;
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+
+  std::unique_ptr<Client> client;
+  ASSERT_OK(cluster.CreateClient(&client));
+
+  // A tail subscription on another topic of the log keeps the tail known.
+  port::Semaphore tail_recv;
+  ASSERT_TRUE(client->Subscribe(GuestTenant, GuestNamespace, "CatchUpTail", 0,
+    [&](std::unique_ptr<MessageReceived>& mr) { tail_recv.Post(); }));
+  env_->SleepForMicroseconds(100000);
+
+  // Publish a backlog, interleaved with the tail topic.
+  const int kNumMessages = 100;
+  SequenceNumber first_seqno = 0;
+  port::Semaphore pub_sem;
+  for (int i = 0; i < kNumMessages; ++i) {
+    for (const char* topic : {"CatchUpTail", "CatchUp"}) {
+      ASSERT_OK(client->Publish(GuestTenant,
+                                topic,
+                                GuestNamespace,
+                                TopicOptions(),
+                                std::to_string(i),
+                                [&, i](std::unique_ptr<ResultStatus> rs) {
+                                  if (i == 0 && first_seqno == 0) {
+                                    first_seqno = rs->GetSequenceNumber();
+                                  }
+                                  pub_sem.Post();
+                                }).status);
+      ASSERT_TRUE(pub_sem.TimedWait(timeout));
+    }
+  }
+  for (int i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(tail_recv.TimedWait(timeout));
+  }
+
+  // Subscribe from the start of the backlog.
+  port::Semaphore recv;
+  std::vector<std::string> received;
+  ASSERT_TRUE(client->Subscribe(GuestTenant, GuestNamespace, "CatchUp",
+    first_seqno,
+    [&](std::unique_ptr<MessageReceived>& mr) {
+      received.push_back(mr->GetContents().ToString());
+      recv.Post();
+    }));
+  for (int i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(recv.TimedWait(timeout));
+  }
+
+  // New messages arrive through the regular readers.
+  ASSERT_OK(client->Publish(GuestTenant, "CatchUp", GuestNamespace,
+                            TopicOptions(),
+                            std::to_string(kNumMessages)).status);
+  ASSERT_TRUE(recv.TimedWait(timeout));
+  ASSERT_EQ(received.size(), kNumMessages + 1);
+  for (int i = 0; i <= kNumMessages; ++i) {
+    ASSERT_EQ(received[i], std::to_string(i));
+  }
+
+  auto stats = cluster.GetControlTower()->GetStatisticsSync();
+  ASSERT_EQ(
+    stats.GetCounterValue("tower.topic_tailer.catch_ups_completed"), 1);
+  ASSERT_GT(
+    stats.GetCounterValue("tower.topic_tailer.catch_up_ranges_read"), 1);
+}
+
+TEST_F(IntegrationTest, TailSeqnoCoalescing) {
+  // Tests that tail subscriptions on a log share one FindLatestSeqno
+  // request, and that its result is reused after the log is closed.
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log;
+  opts.single_log = true;
+  opts.copilot.rollcall_enabled = false;
+  opts.tower.topic_tailer.tail_seqno_cache_ttl = std::chrono::minutes(1);
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+
+  std::unique_ptr<Client> client;
+  ASSERT_OK(cluster.CreateClient(&client));
+
+  const int kNumTopics = 10;
+  port::Semaphore recv;
+  auto subscribe_all = [&] () {
+    std::vector<SubscriptionHandle> handles;
+    for (int i = 0; i < kNumTopics; ++i) {
+      auto handle = client->Subscribe(GuestTenant, GuestNamespace,
+        "TailSeqnoCoalescing" + std::to_string(i), 0,
+        [&](std::unique_ptr<MessageReceived>& mr) { recv.Post(); });
+      EXPECT_TRUE(handle);
+      handles.push_back(std::move(handle));
+    }
+    env_->SleepForMicroseconds(100000);
+    return handles;
+  };
+  auto find_time_requests = [&] () {
+    auto stats = cluster.GetControlTower()->GetStatisticsSync();
+    return stats.GetCounterValue("tower.topic_tailer.find_time_requests");
+  };
+
+  auto handles = subscribe_all();
+  ASSERT_OK(client->Publish(GuestTenant, "TailSeqnoCoalescing0",
+                            GuestNamespace, TopicOptions(), "data").status);
+  ASSERT_TRUE(recv.TimedWait(timeout));
+  ASSERT_EQ(find_time_requests(), 1);
+
+  // Resubscribe after the log has been closed.
+  for (auto& handle : handles) {
+    ASSERT_OK(client->Unsubscribe(std::move(handle)));
+  }
+  env_->SleepForMicroseconds(100000);
+  handles = subscribe_all();
+  ASSERT_OK(client->Publish(GuestTenant, "TailSeqnoCoalescing1",
+                            GuestNamespace, TopicOptions(), "data").status);
+  ASSERT_TRUE(recv.TimedWait(timeout));
+  ASSERT_EQ(find_time_requests(), 1);
+}
+
 TEST_F(IntegrationTest, SmallRoomQueues) {
   // Tests control tower with room queue size 1.
   const size_t kNumMessages = 1000;
@@ -2587,6 +2716,46 @@ TEST_F(IntegrationTest, CopilotTailSubscribeFast) {
   ASSERT_EQ(fast_subs(), 2);
 }
 
+TEST_F(IntegrationTest, CopilotDeliveryBatching) {
+  // Setup local RocketSpeed cluster, with multicast delivery to clients.
+  LocalTestCluster::Options opts;
+  opts.info_log = info_log;
+  opts.copilot.multicast_delivery = true;
+  LocalTestCluster cluster(opts);
+  ASSERT_OK(cluster.GetStatus());
+
+  std::unique_ptr<Client> client;
+  cluster.CreateClient(&client);
+
+  auto copilot_stat = [&](const std::string& name) {
+    auto stats = cluster.GetCopilot()->GetStatisticsSync();
+    return stats.GetCounterValue("copilot." + name);
+  };
+
+  // Many subscriptions on one topic, from one client stream.
+  const size_t kNumSubscriptions = 10;
+  port::Semaphore sem;
+  for (size_t i = 0; i < kNumSubscriptions; ++i) {
+    client->Subscribe(
+        GuestTenant, GuestNamespace, "CopilotDeliveryBatching", 1,
+        [&](std::unique_ptr<MessageReceived>& mr) {
+          ASSERT_EQ(mr->GetContents().ToString(), "data");
+          sem.Post();
+        });
+  }
+  ASSERT_EVENTUALLY_TRUE(
+    copilot_stat("incoming_subscriptions") == kNumSubscriptions);
+
+  // The record reaches all of them in one multicast.
+  client->Publish(GuestTenant, "CopilotDeliveryBatching", GuestNamespace,
+      TopicOptions(), "data");
+  for (size_t i = 0; i < kNumSubscriptions; ++i) {
+    ASSERT_TRUE(sem.TimedWait(timeout));
+  }
+  ASSERT_GE(copilot_stat("multicast_deliveries"), 1);
+  ASSERT_LE(copilot_stat("client_batches"), copilot_stat("client_messages"));
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
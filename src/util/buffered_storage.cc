@@ -5,14 +5,22 @@
 //
 #include "buffered_storage.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
 #include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "external/folly/move_wrapper.h"
 #include "src/messages/msg_loop.h"
+#include "src/port/port.h"
 #include "src/util/common/coding.h"
+#include "src/util/common/hash.h"
 #include "src/util/common/thread_check.h"
 #include "src/util/memory.h"
 #include "src/util/timeout_list.h"
@@ -20,6 +28,143 @@
 
 namespace rocketspeed {
 
+// Batch records start with the number of entries in the batch. Records with
+// no entries are special, with the kind of record following.
+enum class SpecialRecord : uint8_t {
+  // Codec, varint64 seqno of the dictionary record (0 if none), varint32
+  // size of the uncompressed batch, compressed batch.
+  kCompressedBatch = 1,
+  // Dictionary for later batches of the log.
+  kDictionary = 2,
+};
+
+// Maximum size of a zlib dictionary, the size of its window.
+static constexpr size_t kMaxZlibDictionary = 32 * 1024;
+
+static bool IsCompressionSupported(BatchCompression type) {
+  switch (type) {
+    case BatchCompression::kNone:
+      return true;
+    case BatchCompression::kZlib:
+#ifdef ZLIB
+      return true;
+#else
+      return false;
+#endif
+    case BatchCompression::kLZ4:
+#ifdef LZ4
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+// Appends compressed input to output.
+static bool Compress(BatchCompression type,
+                     const Slice& input,
+                     const std::string* dictionary,
+                     std::string* output) {
+  switch (type) {
+    case BatchCompression::kNone:
+      return false;
+    case BatchCompression::kZlib: {
+#ifdef ZLIB
+      z_stream stream;
+      memset(&stream, 0, sizeof(stream));
+      if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return false;
+      }
+      if (dictionary &&
+          deflateSetDictionary(
+            &stream,
+            reinterpret_cast<const Bytef*>(dictionary->data()),
+            static_cast<uInt>(dictionary->size())) != Z_OK) {
+        deflateEnd(&stream);
+        return false;
+      }
+      const size_t offset = output->size();
+      const size_t bound = deflateBound(&stream, input.size());
+      output->resize(offset + bound);
+      stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+      stream.avail_in = static_cast<uInt>(input.size());
+      stream.next_out = reinterpret_cast<Bytef*>(&(*output)[offset]);
+      stream.avail_out = static_cast<uInt>(bound);
+      const int st = deflate(&stream, Z_FINISH);
+      output->resize(offset + (st == Z_STREAM_END ? stream.total_out : 0));
+      deflateEnd(&stream);
+      return st == Z_STREAM_END;
+#else
+      return false;
+#endif
+    }
+    case BatchCompression::kLZ4: {
+      std::string compressed;
+      if (!port::LZ4_Compress(port::CompressionOptions(),
+                              input.data(), input.size(), &compressed)) {
+        return false;
+      }
+      output->append(compressed);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Decompresses input of a known size.
+static bool Uncompress(BatchCompression type,
+                       const Slice& input,
+                       size_t size,
+                       const std::string* dictionary,
+                       std::string* output) {
+  switch (type) {
+    case BatchCompression::kNone:
+      return false;
+    case BatchCompression::kZlib: {
+#ifdef ZLIB
+      z_stream stream;
+      memset(&stream, 0, sizeof(stream));
+      if (inflateInit(&stream) != Z_OK) {
+        return false;
+      }
+      output->resize(size);
+      stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+      stream.avail_in = static_cast<uInt>(input.size());
+      stream.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+      stream.avail_out = static_cast<uInt>(size);
+      int st = inflate(&stream, Z_FINISH);
+      if (st == Z_NEED_DICT && dictionary &&
+          inflateSetDictionary(
+            &stream,
+            reinterpret_cast<const Bytef*>(dictionary->data()),
+            static_cast<uInt>(dictionary->size())) == Z_OK) {
+        st = inflate(&stream, Z_FINISH);
+      }
+      const bool ok = st == Z_STREAM_END && stream.total_out == size;
+      inflateEnd(&stream);
+      return ok;
+#else
+      return false;
+#endif
+    }
+    case BatchCompression::kLZ4: {
+      int decompressed_size = 0;
+      std::unique_ptr<char[]> decompressed(port::LZ4_Uncompress(
+        input.data(), input.size(), &decompressed_size));
+      if (!decompressed ||
+          static_cast<size_t>(decompressed_size) != size) {
+        return false;
+      }
+      output->assign(decompressed.get(), size);
+      return true;
+    }
+  }
+  return false;
+}
+
 class BufferedAsyncLogReader : public AsyncLogReader {
  public:
   BufferedAsyncLogReader(BufferedLogStorage* storage,
@@ -51,19 +196,32 @@ class BufferedLogStorageWorker {
   using clock = std::chrono::steady_clock;
 
   BufferedLogStorageWorker(std::shared_ptr<LogStorage> storage,
+                           MsgLoop* msg_loop,
+                           int worker_id,
                            size_t max_batch_entries,
                            size_t max_batch_bytes,
                            std::chrono::microseconds max_batch_latency,
+                           bool adaptive_batching,
+                           BatchCompressionOptions compression,
                            size_t batch_bits)
   : storage_(std::move(storage))
+  , msg_loop_(msg_loop)
+  , worker_id_(worker_id)
   , max_batch_entries_(max_batch_entries)
   , max_batch_bytes_(max_batch_bytes)
   , max_batch_latency_(max_batch_latency)
+  , adaptive_batching_(adaptive_batching)
+  , compression_(compression)
   , batch_bits_(batch_bits)
   , stats_(max_batch_entries, max_batch_bytes) {}
 
   void Enqueue(LogID log_id, Slice data, AppendCallback callback) {
     thread_check_.Check();
+    AdaptiveState* adaptive = nullptr;
+    if (adaptive_batching_) {
+      adaptive = &adaptive_[log_id];
+      adaptive->RecordArrival(clock::now());
+    }
     auto it = queues_.find(log_id);
     if (it == queues_.end()) {
       // No queue for this log yet, so create one and start timeout.
@@ -80,6 +238,40 @@ class BufferedLogStorageWorker {
     if (it->second.requests.size() >= max_batch_entries_ ||
         it->second.bytes >= max_batch_bytes_) {
       Flush(log_id);
+    } else if (adaptive) {
+      if (adaptive->in_flight == 0) {
+        // Nothing to wait for, so batching would only add latency.
+        stats_.idle_flushes->Add(1);
+        Flush(log_id);
+      } else if (it->second.requests.size() >= adaptive->target_entries) {
+        // As many requests as arrive during an append.
+        Flush(log_id);
+      }
+    }
+  }
+
+  /**
+   * Called on the worker thread when an append to the underlying storage
+   * completes, in adaptive mode.
+   */
+  void AppendCompleted(LogID log_id, std::chrono::microseconds latency) {
+    thread_check_.Check();
+    stats_.append_latency_us->Record(latency.count());
+    auto it = adaptive_.find(log_id);
+    RS_ASSERT(it != adaptive_.end());
+    AdaptiveState& adaptive = it->second;
+    RS_ASSERT(adaptive.in_flight > 0);
+    --adaptive.in_flight;
+    adaptive.RecordLatency(latency, max_batch_entries_);
+    if (adaptive.in_flight == 0) {
+      if (queues_.count(log_id)) {
+        // Requests batched up while waiting for the append.
+        stats_.completion_flushes->Add(1);
+        Flush(log_id);
+      } else {
+        // Idle log, forget about it.
+        adaptive_.erase(it);
+      }
     }
   }
 
@@ -108,6 +300,9 @@ class BufferedLogStorageWorker {
       for (Request& req : it->second.requests) {
         PutLengthPrefixedSlice(encoded.get(), req.data);
       }
+      if (compression_.type != BatchCompression::kNone) {
+        MaybeCompress(log_id, it->second.requests, &encoded);
+      }
 
       stats_.batch_entries->Record(batch_size);
       stats_.batch_bytes->Record(it->second.bytes);
@@ -118,27 +313,193 @@ class BufferedLogStorageWorker {
 
       // Capture the context so that the slices are still valid.
       auto context = folly::makeMoveWrapper(std::move(it->second.requests));
+      queues_.erase(it);
+
+      bool adaptive = false;
+      if (adaptive_batching_) {
+        AdaptiveState& state = adaptive_[log_id];
+        stats_.batch_target_entries->Record(state.target_entries);
+        ++state.in_flight;
+        adaptive = true;
+      }
 
       // Forward encoded string to underlying storage.
       Slice encoded_slice(*encoded);
       // Capture the serialised payload as well.
       auto moved_encoded = folly::makeMoveWrapper(std::move(encoded));
-      storage_->AppendAsync(
+      const auto start = clock::now();
+      Status append_st = storage_->AppendAsync(
         log_id,
         encoded_slice,
-        [this, context, moved_encoded] (Status st, SequenceNumber seqno) {
+        [this, context, moved_encoded, log_id, adaptive, start]
+        (Status st, SequenceNumber seqno) {
+          if (adaptive) {
+            // Latency feeds back into batch sizes on the worker thread.
+            auto latency =
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                clock::now() - start);
+            msg_loop_->SendControlCommand(
+              std::unique_ptr<Command>(MakeExecuteCommand(
+                [this, log_id, latency] () {
+                  AppendCompleted(log_id, latency);
+                })),
+              worker_id_);
+          }
           for (size_t i = 0; i < context->size(); ++i) {
             // Invoke callback on original requests with modified seqno.
             (*context)[i].callback(st, seqno << batch_bits_ | i);
           }
         });
-      queues_.erase(it);
+      if (!append_st.ok() && adaptive) {
+        // The callback will not be invoked.
+        --adaptive_[log_id].in_flight;
+      }
     }
   }
 
   const Statistics& GetStatistics() const { return stats_.all; }
 
  private:
+  // Dictionary state of a log, when compressing with dictionaries.
+  struct DictionaryState {
+    // Recent distinct payloads, oldest first, to build dictionaries from.
+    std::deque<std::string> samples;
+    size_t sample_bytes = 0;
+    // Batches written since the dictionary was built.
+    size_t batches = 0;
+    // Dictionary in use, the seqno of the record it was written in, and when.
+    std::shared_ptr<const std::string> dictionary;
+    SequenceNumber dictionary_seqno = 0;
+    clock::time_point dictionary_time;
+    // A new dictionary is being written.
+    bool writing = false;
+  };
+
+  template <typename Requests>
+  void MaybeCompress(LogID log_id,
+                     const Requests& requests,
+                     std::unique_ptr<std::string>* encoded) {
+    DictionaryState* state = nullptr;
+    if (compression_.dictionary_bytes) {
+      state = &dictionaries_[log_id];
+      AddSamples(state, requests);
+      ++state->batches;
+      // The first dictionary once there are enough samples, then
+      // periodically, so that dictionaries follow the payloads and are not
+      // trimmed from the log while batches still use them.
+      const bool due = state->dictionary
+        ? state->batches >= compression_.dictionary_interval ||
+          clock::now() - state->dictionary_time >=
+            compression_.dictionary_max_age
+        : state->sample_bytes >= compression_.dictionary_bytes;
+      if (due && !state->writing) {
+        WriteDictionary(log_id, state);
+      }
+    }
+    if ((*encoded)->size() < compression_.min_batch_bytes) {
+      return;
+    }
+
+    const std::string* dictionary =
+      state && state->dictionary ? state->dictionary.get() : nullptr;
+    std::unique_ptr<std::string> compressed(new std::string());
+    PutFixed8(compressed.get(), 0);
+    PutFixed8(compressed.get(),
+              static_cast<uint8_t>(SpecialRecord::kCompressedBatch));
+    PutFixed8(compressed.get(), static_cast<uint8_t>(compression_.type));
+    PutVarint64(compressed.get(), dictionary ? state->dictionary_seqno : 0);
+    PutVarint32(compressed.get(), static_cast<uint32_t>((*encoded)->size()));
+    if (!Compress(compression_.type, **encoded, dictionary, compressed.get()) ||
+        compressed->size() >= (*encoded)->size()) {
+      // Incompressible.
+      stats_.uncompressed_batches->Add(1);
+      return;
+    }
+    stats_.compressed_batches->Add(1);
+    stats_.compression_input_bytes->Add((*encoded)->size());
+    stats_.compression_output_bytes->Add(compressed->size());
+    *encoded = std::move(compressed);
+  }
+
+  template <typename Requests>
+  void AddSamples(DictionaryState* state, const Requests& requests) {
+    // Twice the dictionary size, so that it is built from distinct payloads.
+    const size_t max_bytes = 2 * compression_.dictionary_bytes;
+    for (const auto& req : requests) {
+      if (req.data.size() > compression_.dictionary_bytes) {
+        continue;
+      }
+      state->samples.emplace_back(req.data.data(), req.data.size());
+      state->sample_bytes += req.data.size();
+      while (state->sample_bytes > max_bytes) {
+        state->sample_bytes -= state->samples.front().size();
+        state->samples.pop_front();
+      }
+    }
+  }
+
+  void WriteDictionary(LogID log_id, DictionaryState* state) {
+    // zlib favours strings at the end of the dictionary, so the most recent
+    // distinct payloads go last.
+    std::unordered_set<Slice, MurmurHash2<Slice>> seen;
+    std::vector<const std::string*> picked;
+    size_t bytes = 0;
+    for (auto it = state->samples.rbegin(); it != state->samples.rend(); ++it) {
+      if (bytes + it->size() > compression_.dictionary_bytes) {
+        break;
+      }
+      if (seen.insert(Slice(*it)).second) {
+        picked.push_back(&*it);
+        bytes += it->size();
+      }
+    }
+    auto dictionary = std::make_shared<std::string>();
+    dictionary->reserve(bytes);
+    for (auto it = picked.rbegin(); it != picked.rend(); ++it) {
+      dictionary->append(**it);
+    }
+
+    std::unique_ptr<std::string> record(new std::string());
+    PutFixed8(record.get(), 0);
+    PutFixed8(record.get(), static_cast<uint8_t>(SpecialRecord::kDictionary));
+    record->append(*dictionary);
+    Slice record_slice(*record);
+    auto moved_record = folly::makeMoveWrapper(std::move(record));
+    state->writing = true;
+    Status st = storage_->AppendAsync(
+      log_id,
+      record_slice,
+      [this, log_id, dictionary, moved_record]
+      (Status append_st, SequenceNumber seqno) {
+        // Batches use the dictionary once it is durable.
+        msg_loop_->SendControlCommand(
+          std::unique_ptr<Command>(MakeExecuteCommand(
+            [this, log_id, dictionary, append_st, seqno] () {
+              DictionaryWritten(log_id, append_st, dictionary, seqno);
+            })),
+          worker_id_);
+      });
+    if (!st.ok()) {
+      state->writing = false;
+    }
+  }
+
+  void DictionaryWritten(LogID log_id,
+                         Status st,
+                         std::shared_ptr<const std::string> dictionary,
+                         SequenceNumber seqno) {
+    thread_check_.Check();
+    DictionaryState& state = dictionaries_[log_id];
+    state.writing = false;
+    if (st.ok()) {
+      state.dictionary = std::move(dictionary);
+      state.dictionary_seqno = seqno;
+      state.dictionary_time = clock::now();
+      state.batches = 0;
+      stats_.dictionaries_written->Add(1);
+    }
+  }
+
   // Single request.
   // Assumes that the context for the data is captured in the callback,
   // or otherwise available through some higher level organization.
@@ -151,6 +512,45 @@ class BufferedLogStorageWorker {
     AppendCallback callback;
   };
 
+  // Batching state of a log with appends in flight, in adaptive mode.
+  struct AdaptiveState {
+    // Batches sent to the underlying storage and not yet completed.
+    size_t in_flight = 0;
+    // Moving averages of append latency and time between requests.
+    double latency_us = 0;
+    double interval_us = 0;
+    clock::time_point last_arrival;
+    // Number of requests to batch while appends are in flight.
+    size_t target_entries = 1;
+
+    // Weight of the latest sample in the moving averages.
+    static constexpr double kAlpha = 0.125;
+
+    void RecordArrival(clock::time_point now) {
+      if (last_arrival != clock::time_point()) {
+        const double interval = static_cast<double>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+            now - last_arrival).count());
+        interval_us = interval_us == 0
+          ? interval : interval_us + kAlpha * (interval - interval_us);
+      }
+      last_arrival = now;
+    }
+
+    void RecordLatency(std::chrono::microseconds latency, size_t max) {
+      const double sample = static_cast<double>(latency.count());
+      latency_us = latency_us == 0
+        ? sample : latency_us + kAlpha * (sample - latency_us);
+      // Requests expected to arrive during one append.
+      double expected = static_cast<double>(max);
+      if (interval_us > 0) {
+        expected = std::ceil(latency_us / interval_us);
+      }
+      target_entries = static_cast<size_t>(
+        std::max(1.0, std::min(expected, static_cast<double>(max))));
+    }
+  };
+
   // Queue of request that have not yet been sent to underlying storage.
   struct RequestQueue {
     explicit RequestQueue(clock::time_point _timestamp)
@@ -164,17 +564,32 @@ class BufferedLogStorageWorker {
 
   ThreadCheck thread_check_;
   std::unordered_map<LogID, RequestQueue> queues_;
+  std::unordered_map<LogID, AdaptiveState> adaptive_;
+  std::unordered_map<LogID, DictionaryState> dictionaries_;
   TimeoutList<LogID> timeouts_;
   std::shared_ptr<LogStorage> storage_;
+  MsgLoop* const msg_loop_;
+  const int worker_id_;
   size_t max_batch_entries_;
   size_t max_batch_bytes_;
   std::chrono::microseconds max_batch_latency_;
+  const bool adaptive_batching_;
+  const BatchCompressionOptions compression_;
   size_t batch_bits_;
 
   struct Stats {
     Histogram* batch_entries;
     Histogram* batch_bytes;
     Histogram* batch_latency_us;
+    Histogram* batch_target_entries;
+    Histogram* append_latency_us;
+    Counter* idle_flushes;
+    Counter* completion_flushes;
+    Counter* compressed_batches;
+    Counter* uncompressed_batches;
+    Counter* compression_input_bytes;
+    Counter* compression_output_bytes;
+    Counter* dictionaries_written;
     Statistics all;
 
     Stats(size_t max_entries, size_t max_bytes) {
@@ -188,6 +603,23 @@ class BufferedLogStorageWorker {
                                      static_cast<float>(max_bytes),
                                      1.0);
       batch_latency_us = all.AddLatency(pilot_prefix + "batch_latency_us");
+      batch_target_entries =
+        all.AddHistogram(pilot_prefix + "batch_target_entries",
+                         0.0,
+                         static_cast<float>(max_entries),
+                         1.0);
+      append_latency_us = all.AddLatency(pilot_prefix + "append_latency_us");
+      idle_flushes = all.AddCounter(pilot_prefix + "idle_flushes");
+      completion_flushes = all.AddCounter(pilot_prefix + "completion_flushes");
+      compressed_batches = all.AddCounter(pilot_prefix + "compressed_batches");
+      uncompressed_batches =
+        all.AddCounter(pilot_prefix + "uncompressed_batches");
+      compression_input_bytes =
+        all.AddCounter(pilot_prefix + "compression_input_bytes");
+      compression_output_bytes =
+        all.AddCounter(pilot_prefix + "compression_output_bytes");
+      dictionaries_written =
+        all.AddCounter(pilot_prefix + "dictionaries_written");
     }
   } stats_;
 };
@@ -199,14 +631,27 @@ Status BufferedLogStorage::Create(Env* env,
                                   size_t max_batch_entries,
                                   size_t max_batch_bytes,
                                   std::chrono::microseconds max_batch_latency,
+                                  bool adaptive_batching,
+                                  BatchCompressionOptions compression,
                                   LogStorage** storage) {
+  if (!IsCompressionSupported(compression.type)) {
+    return Status::NotSupported("Compression not available in this build");
+  }
+  if (compression.type == BatchCompression::kZlib) {
+    compression.dictionary_bytes =
+      std::min(compression.dictionary_bytes, kMaxZlibDictionary);
+  } else {
+    compression.dictionary_bytes = 0;
+  }
   *storage = new BufferedLogStorage(env,
                                     std::move(info_log),
                                     std::move(wrapped_storage),
                                     msg_loop,
                                     max_batch_entries,
                                     max_batch_bytes,
-                                    max_batch_latency);
+                                    max_batch_latency,
+                                    adaptive_batching,
+                                    compression);
   return Status::OK();
 }
 
@@ -273,14 +718,18 @@ BufferedLogStorage::BufferedLogStorage(
   MsgLoop* msg_loop,
   size_t max_batch_entries,
   size_t max_batch_bytes,
-  std::chrono::microseconds max_batch_latency)
+  std::chrono::microseconds max_batch_latency,
+  bool adaptive_batching,
+  BatchCompressionOptions compression)
 : env_(env)
 , info_log_(std::move(info_log))
 , storage_(std::move(wrapped_storage))
 , msg_loop_(msg_loop)
 , max_batch_entries_(max_batch_entries)
 , max_batch_bytes_(max_batch_bytes)
-, max_batch_latency_(max_batch_latency) {
+, max_batch_latency_(max_batch_latency)
+, adaptive_batching_(adaptive_batching)
+, compression_(compression) {
   ((void)env_);
   // Calculate bits for batch.
   batch_bits_ = 0;
@@ -293,9 +742,13 @@ BufferedLogStorage::BufferedLogStorage(
   for (int i = 0; i < num_workers; ++i) {
     workers_.emplace_back(
       new BufferedLogStorageWorker(storage_,
+                                   msg_loop_,
+                                   i,
                                    max_batch_entries_,
                                    max_batch_bytes_,
                                    max_batch_latency_,
+                                   adaptive_batching_,
+                                   compression_,
                                    batch_bits_));
   }
 
@@ -342,6 +795,63 @@ class ReaderCallbacks {
     if (batch_record.payload.empty()) {
       return true;
     }
+
+    SequenceNumber current_seqno = batch_record.seqno << batch_bits_,
+                   last_seqno = current_seqno + (1 << batch_bits_) - 1;
+    Slice remaining = batch_record.payload;
+    // Deserialize the number of records.
+    uint8_t batch_size = 0;
+    if (GetFixed8(&remaining, &batch_size) && batch_size == 0) {
+      // Compressed batch or dictionary. Nothing has been enqueued yet, so it
+      // may still refuse the record as it is.
+      std::unique_ptr<std::string> decompressed;
+      switch (DecodeSpecial(batch_record, &remaining, &decompressed)) {
+        case Decoded::kBatch:
+          break;
+        case Decoded::kPending:
+          return false;
+        case Decoded::kDictionary:
+          batch_record.context.reset();
+          return EnqueueGap({
+              GapType::kBenign,
+              batch_record.log_id,
+              current_seqno,
+              last_seqno,
+          });
+        case Decoded::kTrimmed:
+          batch_record.context.reset();
+          return EnqueueGap({
+              GapType::kRetention,
+              batch_record.log_id,
+              current_seqno,
+              last_seqno,
+          });
+        case Decoded::kCorrupt:
+          batch_record.context.reset();
+          return EnqueueGap({
+              GapType::kDataLoss,
+              batch_record.log_id,
+              current_seqno,
+              last_seqno,
+          });
+      }
+      // Records point into the decompressed batch, which replaces the
+      // context of the compressed record.
+      batch_record.context.reset();
+      std::shared_ptr<void> shared_context(std::move(decompressed));
+      return EnqueueBatch(batch_record, remaining, shared_context);
+    }
+    if (batch_size == 0) {
+      // There are not pending records, so this gap will be delivered first.
+      batch_record.context.reset();
+      return EnqueueGap({
+          GapType::kDataLoss,
+          batch_record.log_id,
+          current_seqno,
+          last_seqno,
+      });
+    }
+
     // Capture the context in a shared pointer. All records in a batch share
     // the ownership of the batch record.
     std::shared_ptr<void> shared_context(batch_record.context.release(),
@@ -350,11 +860,201 @@ class ReaderCallbacks {
     // false to apply backpressure, see documentation of CreateAsyncReaders.
     // In this case, we will be delivered an empty record with the same sequence
     // number on the next attempt, which is handled above.
+    return EnqueueBatch(batch_record, batch_record.payload, shared_context);
+  }
+
+  bool DeliverGap(const GapRecord& batch_gap) {
+    thread_check_.Check();
+
+    // We never start processing a new record until we're done flushing the
+    // overflow queue and gap.
+    if (!FlushOverflow()) {
+      return false;
+    }
+    RS_ASSERT(overflow_records_.empty());
+
+    // Since a batched gap always maps to a single call of the callback, we can
+    // use backoff straight away.
+    size_t length = batch_gap.to - batch_gap.from + 1;
+    SequenceNumber current_seqno = batch_gap.from << batch_bits_,
+                   last_seqno = current_seqno + (length << batch_bits_) - 1;
+    return buffered_reader_->gap_cb_(
+        {batch_gap.type, batch_gap.log_id, current_seqno, last_seqno});
+  }
+
+ private:
+  // Result of decoding a special record.
+  enum class Decoded {
+    // A batch, decompressed.
+    kBatch,
+    // A dictionary, stored for later batches.
+    kDictionary,
+    // A batch which dictionary is being read.
+    kPending,
+    // A batch which dictionary has been trimmed from the log.
+    kTrimmed,
+    // Could not be decoded.
+    kCorrupt,
+  };
+
+  // Dictionary being read from the log by a separate reader, for a batch
+  // read past the dictionary record.
+  struct DictionaryFetch {
+    std::mutex mutex;
+    bool done = false;
+    // Null if the dictionary is gone.
+    std::shared_ptr<const std::string> dictionary;
+    // The dictionary record fell out of retention.
+    bool trimmed = false;
+  };
+
+  // Number of recent dictionaries of the log kept for batches.
+  static constexpr size_t kMaxDictionaries = 4;
+
+  static bool ParseDictionary(Slice payload, std::string* dictionary) {
+    uint8_t batch_size, kind;
+    if (!GetFixed8(&payload, &batch_size) || batch_size != 0 ||
+        !GetFixed8(&payload, &kind) ||
+        kind != static_cast<uint8_t>(SpecialRecord::kDictionary)) {
+      return false;
+    }
+    dictionary->assign(payload.data(), payload.size());
+    return true;
+  }
+
+  void AddDictionary(SequenceNumber seqno,
+                     std::shared_ptr<const std::string> dictionary) {
+    dictionaries_[seqno] = std::move(dictionary);
+    if (dictionaries_.size() > kMaxDictionaries) {
+      dictionaries_.erase(dictionaries_.begin());
+    }
+  }
+
+  // Decodes a compressed batch or a dictionary, following the zero batch
+  // size in input. Leaves the decompressed batch in input.
+  Decoded DecodeSpecial(const LogRecord& batch_record,
+                        Slice* input,
+                        std::unique_ptr<std::string>* decompressed) {
+    uint8_t kind;
+    if (!GetFixed8(input, &kind)) {
+      return Decoded::kCorrupt;
+    }
+    if (kind == static_cast<uint8_t>(SpecialRecord::kDictionary)) {
+      AddDictionary(batch_record.seqno,
+                    std::make_shared<std::string>(input->ToString()));
+      return Decoded::kDictionary;
+    }
+    uint8_t codec;
+    uint64_t dictionary_seqno;
+    uint32_t size;
+    if (kind != static_cast<uint8_t>(SpecialRecord::kCompressedBatch) ||
+        !GetFixed8(input, &codec) ||
+        !GetVarint64(input, &dictionary_seqno) ||
+        !GetVarint32(input, &size)) {
+      return Decoded::kCorrupt;
+    }
+    std::shared_ptr<const std::string> dictionary;
+    if (dictionary_seqno) {
+      auto it = dictionaries_.find(dictionary_seqno);
+      if (it != dictionaries_.end()) {
+        dictionary = it->second;
+      } else {
+        Decoded fetched = FetchDictionary(batch_record.log_id,
+                                          dictionary_seqno,
+                                          &dictionary);
+        if (fetched != Decoded::kDictionary) {
+          return fetched;
+        }
+      }
+    }
+    decompressed->reset(new std::string());
+    if (!Uncompress(static_cast<BatchCompression>(codec),
+                    *input,
+                    size,
+                    dictionary.get(),
+                    decompressed->get())) {
+      return Decoded::kCorrupt;
+    }
+    *input = Slice(**decompressed);
+    uint8_t batch_size;
+    if (!GetFixed8(input, &batch_size) || batch_size == 0) {
+      return Decoded::kCorrupt;
+    }
+    // Let EnqueueBatch read the batch size again.
+    *input = Slice(**decompressed);
+    return Decoded::kBatch;
+  }
+
+  // Reads a dictionary record that precedes the start of reading.
+  Decoded FetchDictionary(LogID log_id,
+                          SequenceNumber seqno,
+                          std::shared_ptr<const std::string>* dictionary) {
+    if (fetch_ && fetch_seqno_ == seqno) {
+      bool trimmed;
+      {
+        std::lock_guard<std::mutex> lock(fetch_->mutex);
+        if (!fetch_->done) {
+          return Decoded::kPending;
+        }
+        *dictionary = fetch_->dictionary;
+        trimmed = fetch_->trimmed;
+      }
+      fetch_reader_.reset();
+      fetch_.reset();
+      if (!*dictionary) {
+        return trimmed ? Decoded::kTrimmed : Decoded::kCorrupt;
+      }
+      AddDictionary(seqno, *dictionary);
+      return Decoded::kDictionary;
+    }
+
+    fetch_reader_.reset();
+    fetch_.reset();
+    auto fetch = std::make_shared<DictionaryFetch>();
+    std::vector<AsyncLogReader*> readers;
+    Status st =
+      buffered_reader_->buffered_storage_->storage_->CreateAsyncReaders(
+        1,
+        [fetch] (LogRecord& record) {
+          auto parsed = std::make_shared<std::string>();
+          const bool ok = ParseDictionary(record.payload, parsed.get());
+          std::lock_guard<std::mutex> lock(fetch->mutex);
+          if (!fetch->done) {
+            fetch->done = true;
+            if (ok) {
+              fetch->dictionary = std::move(parsed);
+            }
+          }
+          return true;
+        },
+        [fetch] (const GapRecord& gap) {
+          std::lock_guard<std::mutex> lock(fetch->mutex);
+          if (!fetch->done) {
+            fetch->done = true;
+            fetch->trimmed = gap.type == GapType::kRetention;
+          }
+          return true;
+        },
+        &readers);
+    if (!st.ok() || readers.size() != 1) {
+      return Decoded::kCorrupt;
+    }
+    fetch_reader_.reset(readers.front());
+    if (!fetch_reader_->Open(log_id, seqno, seqno).ok()) {
+      fetch_reader_.reset();
+      return Decoded::kCorrupt;
+    }
+    fetch_ = std::move(fetch);
+    fetch_seqno_ = seqno;
+    // The record is delivered again later.
+    return Decoded::kPending;
+  }
 
+  bool EnqueueBatch(const LogRecord& batch_record,
+                    Slice remaining,
+                    const std::shared_ptr<void>& shared_context) {
     SequenceNumber current_seqno = batch_record.seqno << batch_bits_,
                    last_seqno = current_seqno + (1 << batch_bits_) - 1;
-    Slice remaining = batch_record.payload;
-    // Deserialize the number of records.
     uint8_t batch_size;
     if (!GetFixed8(&remaining, &batch_size)) {
       // There are not pending records, so this gap will be delivered first.
@@ -405,25 +1105,6 @@ class ReaderCallbacks {
     return IsOverflowEmpty();
   }
 
-  bool DeliverGap(const GapRecord& batch_gap) {
-    thread_check_.Check();
-
-    // We never start processing a new record until we're done flushing the
-    // overflow queue and gap.
-    if (!FlushOverflow()) {
-      return false;
-    }
-    RS_ASSERT(overflow_records_.empty());
-
-    // Since a batched gap always maps to a single call of the callback, we can
-    // use backoff straight away.
-    size_t length = batch_gap.to - batch_gap.from + 1;
-    SequenceNumber current_seqno = batch_gap.from << batch_bits_,
-                   last_seqno = current_seqno + (length << batch_bits_) - 1;
-    return buffered_reader_->gap_cb_(
-        {batch_gap.type, batch_gap.log_id, current_seqno, last_seqno});
-  }
-
  private:
   BufferedAsyncLogReader* const buffered_reader_;
   const size_t batch_bits_;
@@ -433,6 +1114,12 @@ class ReaderCallbacks {
   bool overflow_gap_present_;
   GapRecord overflow_gap_;
 
+  // Recent dictionaries of the log, by seqno of their record.
+  std::map<SequenceNumber, std::shared_ptr<const std::string>> dictionaries_;
+  SequenceNumber fetch_seqno_ = 0;
+  std::shared_ptr<DictionaryFetch> fetch_;
+  std::unique_ptr<AsyncLogReader> fetch_reader_;
+
   bool EnqueueGap(GapRecord gap) {
     RS_ASSERT(!overflow_gap_present_);
     if (!IsOverflowEmpty() || !buffered_reader_->gap_cb_(gap)) {
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <memory>
 
 #include "src/util/storage.h"
@@ -18,12 +19,60 @@ class MsgLoop;
 
 class BufferedLogStorageWorker;
 
+/** Compression algorithms for batch records. */
+enum class BatchCompression : uint8_t {
+  kNone = 0,
+  kZlib = 1,
+  kLZ4 = 2,
+};
+
+/**
+ * Compression of batch records written by BufferedLogStorage.
+ */
+struct BatchCompressionOptions {
+  /** Algorithm, must be available in the build. */
+  BatchCompression type = BatchCompression::kNone;
+
+  /** Batches smaller than this are written uncompressed. */
+  size_t min_batch_bytes = 128;
+
+  /**
+   * Size of per-log dictionaries, built from recent payloads of the log and
+   * written to the log itself. Zero disables dictionaries. Only zlib uses
+   * dictionaries, and at most 32KB of them.
+   */
+  size_t dictionary_bytes = 0;
+
+  /** Number of batches written to a log before its dictionary is rebuilt. */
+  size_t dictionary_interval = 10000;
+
+  /**
+   * Age at which the dictionary of a log is rebuilt, however few batches
+   * used it. Batches need their dictionary record to be read, so this should
+   * be well under the retention of the logs. Batches which dictionary has
+   * been trimmed are reported as retention gaps.
+   */
+  std::chrono::milliseconds dictionary_max_age = std::chrono::hours(1);
+};
+
 /**
  * BufferedLogStorage wraps another LogStorage implementation, providing
  * buffered writes to increase throughput.
  */
 class BufferedLogStorage : public LogStorage {
  public:
+  /**
+   * Creates a BufferedLogStorage.
+   *
+   * Batches of a log are appended once they reach max_batch_entries or
+   * max_batch_bytes, or have waited for max_batch_latency. With adaptive
+   * batching, these are only upper bounds: a batch is appended right away
+   * when the log has no append in flight, and otherwise once it holds as
+   * many requests as arrive during an append, as measured per log.
+   *
+   * Batches may be compressed, and are decompressed transparently by
+   * readers.
+   */
   static Status Create(Env* env,
                        std::shared_ptr<Logger> info_log,
                        std::shared_ptr<LogStorage> wrapped_storage,
@@ -31,6 +80,8 @@ class BufferedLogStorage : public LogStorage {
                        size_t max_batch_entries,
                        size_t max_batch_bytes,
                        std::chrono::microseconds max_batch_latency,
+                       bool adaptive_batching,
+                       BatchCompressionOptions compression,
                        LogStorage** storage);
 
   Statistics GetStatistics() final;
@@ -57,6 +108,7 @@ class BufferedLogStorage : public LogStorage {
 
  private:
   friend class BufferedAsyncLogReader;
+  friend class ReaderCallbacks;
 
   BufferedLogStorage(Env* env,
                      std::shared_ptr<Logger> info_log,
@@ -64,7 +116,9 @@ class BufferedLogStorage : public LogStorage {
                      MsgLoop* msg_loop,
                      size_t max_batch_entries,
                      size_t max_batch_bytes,
-                     std::chrono::microseconds max_batch_latency);
+                     std::chrono::microseconds max_batch_latency,
+                     bool adaptive_batching,
+                     BatchCompressionOptions compression);
 
   Env* env_;
   std::shared_ptr<Logger> info_log_;
@@ -73,6 +127,8 @@ class BufferedLogStorage : public LogStorage {
   size_t max_batch_entries_;
   size_t max_batch_bytes_;
   std::chrono::microseconds max_batch_latency_;
+  bool adaptive_batching_;
+  BatchCompressionOptions compression_;
   size_t batch_bits_;
   std::vector<std::unique_ptr<BufferedLogStorageWorker>> workers_;
 };
@@ -0,0 +1,5 @@
+#include "build_version.h"
+const char* rocketspeed_build_git_sha = "rocketspeed_build_git_sha:4f8bb19f52cef12131be5d03cc66b07fe1adee60";
+const char* rocketspeed_build_git_datetime = "rocketspeed_build_git_datetime:Fri Oct 16 22:46:54 UTC 2026";
+const char* rocketspeed_build_compile_date = __DATE__;
+const char* rocketspeed_build_compile_time = __TIME__;
@@ -11,9 +11,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <vector>
+
 #include "src/port/port.h"
+#include "src/util/frequency_sketch.h"
 #include "src/util/xxhash.h"
 #include "src/util/common/autovector.h"
+#include "src/util/common/mutexlock.h"
 
 namespace rocketspeed {
 
@@ -44,6 +48,11 @@ namespace {
 // Before destruction, make sure that no handles are in state 1. This means
 // that any successful LRUCache::Lookup/LRUCache::Insert have a matching
 // RUCache::Release (to move into state 2) or LRUCache::Erase (for state 3)
+//
+// With the CLOCK eviction policy, every entry in the hash table (states 1 and
+// 2) is kept on the clock ring instead, and a hit merely sets the referenced
+// bit. The clock hand skips pinned entries, clears the referenced bit of the
+// ones it passes, and evicts the first unpinned entry with the bit cleared.
 
 struct LRUHandle {
   void* value;
@@ -56,6 +65,7 @@ struct LRUHandle {
   uint32_t refs;      // a number of refs to this entry
                       // cache itself is counted as 1
   bool in_cache;      // true, if this entry is referenced by the hash table
+  bool referenced;    // true, if hit since the clock hand last passed it
   uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
   char key_data[1];   // Beginning of key
 
@@ -183,56 +193,80 @@ class HandleTable {
   }
 };
 
-class LRUCache : public Cache {
+// A single shard of the sharded cache. Every operation is guarded by the
+// shard's mutex.
+class LRUCacheShard {
  public:
-  explicit LRUCache(size_t capacity);
-  ~LRUCache();
+  LRUCacheShard(size_t capacity,
+                CacheEvictionPolicy policy,
+                size_t admission_sketch_width);
+  ~LRUCacheShard();
 
   // If current usage is more than new capacity, the function will attempt to
   // free the needed space
-  void SetCapacity(size_t capacity) override;
+  void SetCapacity(size_t capacity);
 
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key,
+                        uint32_t hash,
                         void* value,
                         size_t charge,
-                        void (*deleter)(const Slice& key,
-                                        void* value)) override;
-  Cache::Handle* Lookup(const Slice& key) override;
-  void Release(Cache::Handle* handle) override;
-  void Erase(const Slice& key) override;
-  void* Value(Cache::Handle* handle) override;
-
-  size_t GetCapacity() const override {
-    return capacity_;
+                        void (*deleter)(const Slice& key, void* value));
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  bool Peek(const Slice& key,
+            uint32_t hash,
+            const std::function<void(void* value)>& visit);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+  void EraseUnRefEntries();
+  void Touch(uint32_t hash);
+  bool Admit(uint32_t hash, size_t charge);
+
+  size_t GetUsage() {
+    MutexLock l(&mutex_);
+    return usage_;
   }
 
-  size_t GetUsage() const override { return usage_; }
-
-  size_t GetPinnedUsage() const override {
+  size_t GetPinnedUsage() {
+    MutexLock l(&mutex_);
     RS_ASSERT(usage_ >= lru_usage_);
     return usage_ - lru_usage_;
   }
 
-  void ApplyToAllCacheEntries(void (*callback)(void*, size_t)) override;
-  void ChargeDelta(Handle* handle, size_t delta) override;
+  void ApplyToAllCacheEntries(void (*callback)(void*, size_t));
+  void ChargeDelta(Cache::Handle* handle, size_t delta);
 
  private:
   void LRU_Remove(LRUHandle* e);
   void LRU_Append(LRUHandle* e);
+  // Removes an entry from the clock ring, moving the hand past it if needed.
+  void Clock_Remove(LRUHandle* e);
+  // Inserts an entry just behind the clock hand, so that it is visited last.
+  void Clock_Insert(LRUHandle* e);
   // Just reduce the reference count by 1.
   // Return true if last reference
   bool Unref(LRUHandle* e);
 
+  // Returns the entry that would be evicted first, or nullptr if none.
+  LRUHandle* GetEvictionCandidate();
+
+  // Free some space following the eviction policy until enough space
+  // to hold (usage_ + charge) is freed or nothing more can be evicted
+  void Evict(size_t charge, autovector<LRUHandle*>* deleted);
+
   // Free some space following strict LRU policy until enough space
   // to hold (usage_ + charge) is freed or the lru list is empty
   void EvictFromLRU(size_t charge,
                     autovector<LRUHandle*>* deleted);
 
-  static inline uint32_t HashSlice(const Slice& s) {
-    const unsigned seed = 0x9ee8fcef;
-    return XXH32(s.data(), s.size(), seed);
-  }
+  // Free some space by sweeping the clock hand over the ring until enough
+  // space to hold (usage_ + charge) is freed or every entry is pinned
+  void EvictFromClock(size_t charge,
+                      autovector<LRUHandle*>* deleted);
+
+  const bool clock_;
+
+  port::Mutex mutex_;
 
   // Initialized before use.
   size_t capacity_;
@@ -240,27 +274,49 @@ class LRUCache : public Cache {
   // Memory size for entries residing in the cache
   size_t usage_;
 
-  // Memory size for entries residing only in the LRU list
+  // Memory size for entries referenced only by the cache
   size_t lru_usage_;
 
   // Dummy head of LRU list.
   // lru.prev is newest entry, lru.next is oldest entry.
   // LRU contains items which can be evicted, ie reference only by cache
+  //
+  // With the CLOCK policy this is the head of the clock ring, which holds
+  // every entry in the cache.
   LRUHandle lru_;
 
+  // Next entry to be inspected by the clock hand, may point at lru_.
+  LRUHandle* clock_hand_;
+
+  // Number of entries on the clock ring.
+  size_t clock_size_;
+
+  // Recent access frequency of keys, null without an admission filter.
+  std::unique_ptr<FrequencySketch> sketch_;
+
   HandleTable table_;
 };
 
-LRUCache::LRUCache(size_t capacity) :
-  capacity_(capacity), usage_(0), lru_usage_(0) {
+LRUCacheShard::LRUCacheShard(size_t capacity,
+                             CacheEvictionPolicy policy,
+                             size_t admission_sketch_width)
+: clock_(policy == CacheEvictionPolicy::kClock)
+, capacity_(capacity)
+, usage_(0)
+, lru_usage_(0)
+, clock_size_(0) {
   // Make empty circular linked list
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  clock_hand_ = &lru_;
+  if (admission_sketch_width) {
+    sketch_.reset(new FrequencySketch(admission_sketch_width));
+  }
 }
 
-LRUCache::~LRUCache() {}
+LRUCacheShard::~LRUCacheShard() {}
 
-bool LRUCache::Unref(LRUHandle* e) {
+bool LRUCacheShard::Unref(LRUHandle* e) {
   RS_ASSERT(e->refs > 0);
   e->refs--;
   return e->refs == 0;
@@ -268,13 +324,15 @@ bool LRUCache::Unref(LRUHandle* e) {
 
 // Call deleter and free
 
-void LRUCache::ApplyToAllCacheEntries(void (*callback)(void*, size_t)) {
+void LRUCacheShard::ApplyToAllCacheEntries(void (*callback)(void*, size_t)) {
+  MutexLock l(&mutex_);
   table_.ApplyToAllCacheEntries([callback](LRUHandle* h) {
     callback(h->value, h->charge);
   });
 }
 
-void LRUCache::LRU_Remove(LRUHandle* e) {
+void LRUCacheShard::LRU_Remove(LRUHandle* e) {
+  RS_ASSERT(!clock_);
   RS_ASSERT(e->next != nullptr);
   RS_ASSERT(e->prev != nullptr);
   e->next->prev = e->prev;
@@ -283,8 +341,9 @@ void LRUCache::LRU_Remove(LRUHandle* e) {
   lru_usage_ -= e->charge;
 }
 
-void LRUCache::LRU_Append(LRUHandle* e) {
+void LRUCacheShard::LRU_Append(LRUHandle* e) {
   // Make "e" newest entry by inserting just before lru_
+  RS_ASSERT(!clock_);
   RS_ASSERT(e->next == nullptr);
   RS_ASSERT(e->prev == nullptr);
   e->next = &lru_;
@@ -294,8 +353,40 @@ void LRUCache::LRU_Append(LRUHandle* e) {
   lru_usage_ += e->charge;
 }
 
-void LRUCache::EvictFromLRU(size_t charge,
-                            autovector<LRUHandle*>* deleted) {
+void LRUCacheShard::Clock_Remove(LRUHandle* e) {
+  RS_ASSERT(clock_);
+  RS_ASSERT(e->next != nullptr);
+  RS_ASSERT(e->prev != nullptr);
+  if (clock_hand_ == e) {
+    clock_hand_ = e->next;
+  }
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+  e->prev = e->next = nullptr;
+  --clock_size_;
+}
+
+void LRUCacheShard::Clock_Insert(LRUHandle* e) {
+  RS_ASSERT(clock_);
+  RS_ASSERT(e->next == nullptr);
+  RS_ASSERT(e->prev == nullptr);
+  e->next = clock_hand_;
+  e->prev = clock_hand_->prev;
+  e->prev->next = e;
+  e->next->prev = e;
+  ++clock_size_;
+}
+
+void LRUCacheShard::Evict(size_t charge, autovector<LRUHandle*>* deleted) {
+  if (clock_) {
+    EvictFromClock(charge, deleted);
+  } else {
+    EvictFromLRU(charge, deleted);
+  }
+}
+
+void LRUCacheShard::EvictFromLRU(size_t charge,
+                                 autovector<LRUHandle*>* deleted) {
   while (usage_ + charge > capacity_ && lru_.next != &lru_) {
     LRUHandle* old = lru_.next;
     RS_ASSERT(old->in_cache);
@@ -309,23 +400,104 @@ void LRUCache::EvictFromLRU(size_t charge,
   }
 }
 
-void LRUCache::SetCapacity(size_t capacity) {
+void LRUCacheShard::EvictFromClock(size_t charge,
+                                   autovector<LRUHandle*>* deleted) {
+  // Every entry is visited at most twice: once to clear the referenced bit
+  // and once more to evict it, unless it is pinned.
+  size_t budget = 2 * clock_size_;
+  while (usage_ + charge > capacity_ && clock_size_ > 0 && budget > 0) {
+    LRUHandle* e = clock_hand_;
+    if (e == &lru_) {
+      clock_hand_ = e->next;
+      continue;
+    }
+    --budget;
+    RS_ASSERT(e->in_cache);
+    if (e->refs > 1 || e->referenced) {
+      // Give the entry a second chance.
+      e->referenced = false;
+      clock_hand_ = e->next;
+      continue;
+    }
+    Clock_Remove(e);
+    table_.Remove(e->key(), e->hash);
+    e->in_cache = false;
+    Unref(e);
+    usage_ -= e->charge;
+    lru_usage_ -= e->charge;
+    deleted->push_back(e);
+  }
+}
+
+LRUHandle* LRUCacheShard::GetEvictionCandidate() {
+  if (!clock_) {
+    return lru_.next != &lru_ ? lru_.next : nullptr;
+  }
+  // The hand would evict the first unpinned entry without the referenced
+  // bit, or the first unpinned entry on its second sweep.
+  LRUHandle* unpinned = nullptr;
+  for (LRUHandle* e = clock_hand_; ; e = e->next) {
+    if (e != &lru_ && e->refs == 1) {
+      if (!e->referenced) {
+        return e;
+      }
+      if (!unpinned) {
+        unpinned = e;
+      }
+    }
+    if (e->next == clock_hand_) {
+      break;
+    }
+  }
+  return unpinned;
+}
+
+void LRUCacheShard::Touch(uint32_t hash) {
+  if (sketch_) {
+    MutexLock l(&mutex_);
+    sketch_->Increment(hash);
+  }
+}
+
+bool LRUCacheShard::Admit(uint32_t hash, size_t charge) {
+  if (!sketch_) {
+    return true;
+  }
+  MutexLock l(&mutex_);
+  if (usage_ + charge <= capacity_) {
+    return true;  // nothing would be evicted
+  }
+  LRUHandle* victim = GetEvictionCandidate();
+  if (!victim) {
+    return true;  // nothing can be evicted, the cache goes over capacity
+  }
+  return sketch_->Estimate(hash) >= sketch_->Estimate(victim->hash);
+}
+
+void LRUCacheShard::SetCapacity(size_t capacity) {
   autovector<LRUHandle*> last_reference_list;
   {
+    MutexLock l(&mutex_);
     capacity_ = capacity;
-    EvictFromLRU(0, &last_reference_list);
+    Evict(0, &last_reference_list);
   }
   for (auto entry : last_reference_list) {
     entry->Free();
   }
 }
 
-Cache::Handle* LRUCache::Lookup(const Slice& key) {
-  const uint32_t hash = HashSlice(key);
+Cache::Handle* LRUCacheShard::Lookup(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
   LRUHandle* e = table_.Lookup(key, hash);
   if (e != nullptr) {
     RS_ASSERT(e->in_cache);
-    if (e->refs == 1) {
+    if (clock_) {
+      // Entry stays where it is on the ring, the hand will notice the hit.
+      e->referenced = true;
+      if (e->refs == 1) {
+        lru_usage_ -= e->charge;
+      }
+    } else if (e->refs == 1) {
       LRU_Remove(e);
     }
     e->refs++;
@@ -333,10 +505,24 @@ Cache::Handle* LRUCache::Lookup(const Slice& key) {
   return reinterpret_cast<Cache::Handle*>(e);
 }
 
-void LRUCache::Release(Cache::Handle* handle) {
+bool LRUCacheShard::Peek(const Slice& key,
+                         uint32_t hash,
+                         const std::function<void(void* value)>& visit) {
+  MutexLock l(&mutex_);
+  LRUHandle* e = table_.Lookup(key, hash);
+  if (e == nullptr) {
+    return false;
+  }
+  RS_ASSERT(e->in_cache);
+  visit(e->value);
+  return true;
+}
+
+void LRUCacheShard::Release(Cache::Handle* handle) {
   LRUHandle* e = reinterpret_cast<LRUHandle*>(handle);
   bool last_reference = false;
   {
+    MutexLock l(&mutex_);
     last_reference = Unref(e);
     if (last_reference) {
       usage_ -= e->charge;
@@ -345,14 +531,21 @@ void LRUCache::Release(Cache::Handle* handle) {
       // The item is still in cache, and nobody else holds a reference to it
       if (usage_ > capacity_) {
         // the cache is full
-        // The LRU list must be empty since the cache is full
-        RS_ASSERT(lru_.next == &lru_);
+        if (clock_) {
+          Clock_Remove(e);
+        } else {
+          // The LRU list must be empty since the cache is full
+          RS_ASSERT(lru_.next == &lru_);
+        }
         // take this opportunity and remove the item
         table_.Remove(e->key(), e->hash);
         e->in_cache = false;
         Unref(e);
         usage_ -= e->charge;
         last_reference = true;
+      } else if (clock_) {
+        // the item is already on the ring and may now be evicted
+        lru_usage_ += e->charge;
       } else {
         // put the item on the list to be potentially freed
         LRU_Append(e);
@@ -366,11 +559,9 @@ void LRUCache::Release(Cache::Handle* handle) {
   }
 }
 
-Cache::Handle* LRUCache::Insert(
-    const Slice& key, void* value, size_t charge,
+Cache::Handle* LRUCacheShard::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
     void (*deleter)(const Slice& key, void* value)) {
-  const uint32_t hash = HashSlice(key);
-
   // Allocate the memory.
   // If the cache is full, we'll have to release it
   // It shouldn't happen very often though.
@@ -386,25 +577,38 @@ Cache::Handle* LRUCache::Insert(
   e->refs = 2;  // One from LRUCache, one for the returned handle
   e->next = e->prev = nullptr;
   e->in_cache = true;
+  e->referenced = false;
   memcpy(e->key_data, key.data(), key.size());
 
   {
-    // Free the space following strict LRU policy until enough space
-    // is freed or the lru list is empty
-    EvictFromLRU(charge, &last_reference_list);
+    MutexLock l(&mutex_);
+
+    // Free the space following the eviction policy until enough space
+    // is freed or nothing more can be evicted
+    Evict(charge, &last_reference_list);
 
     // insert into the cache
     // note that the cache might get larger than its capacity if not enough
     // space was freed
     LRUHandle* old = table_.Insert(e);
     usage_ += e->charge;
+    if (clock_) {
+      Clock_Insert(e);
+    }
     if (old != nullptr) {
       old->in_cache = false;
+      if (clock_) {
+        Clock_Remove(old);
+      }
       if (Unref(old)) {
         usage_ -= old->charge;
         // old is on LRU because it's in cache and its reference count
         // was just 1 (Unref returned 0)
-        LRU_Remove(old);
+        if (clock_) {
+          lru_usage_ -= old->charge;
+        } else {
+          LRU_Remove(old);
+        }
         last_reference_list.push_back(old);
       }
     }
@@ -416,19 +620,26 @@ Cache::Handle* LRUCache::Insert(
   return reinterpret_cast<Cache::Handle*>(e);
 }
 
-void LRUCache::Erase(const Slice& key) {
+void LRUCacheShard::Erase(const Slice& key, uint32_t hash) {
   LRUHandle* e;
-  const uint32_t hash = HashSlice(key);
   bool last_reference = false;
   {
+    MutexLock l(&mutex_);
     e = table_.Remove(key, hash);
     if (e != nullptr) {
+      if (clock_) {
+        Clock_Remove(e);
+      }
       last_reference = Unref(e);
       if (last_reference) {
         usage_ -= e->charge;
       }
       if (last_reference && e->in_cache) {
-        LRU_Remove(e);
+        if (clock_) {
+          lru_usage_ -= e->charge;
+        } else {
+          LRU_Remove(e);
+        }
       }
       e->in_cache = false;
     }
@@ -440,35 +651,211 @@ void LRUCache::Erase(const Slice& key) {
   }
 }
 
-void* LRUCache::Value(Cache::Handle* handle) {
-  return reinterpret_cast<LRUHandle*>(handle)->value;
+void LRUCacheShard::EraseUnRefEntries() {
+  autovector<LRUHandle*> last_reference_list;
+  {
+    MutexLock l(&mutex_);
+    LRUHandle* e = lru_.next;
+    while (e != &lru_) {
+      LRUHandle* next = e->next;
+      RS_ASSERT(e->in_cache);
+      if (e->refs == 1) {
+        if (clock_) {
+          Clock_Remove(e);
+          lru_usage_ -= e->charge;
+        } else {
+          LRU_Remove(e);
+        }
+        table_.Remove(e->key(), e->hash);
+        e->in_cache = false;
+        Unref(e);
+        usage_ -= e->charge;
+        last_reference_list.push_back(e);
+      }
+      e = next;
+    }
+  }
+  for (auto entry : last_reference_list) {
+    entry->Free();
+  }
 }
 
-void LRUCache::ChargeDelta(Cache::Handle* handle, size_t delta) {
+void LRUCacheShard::ChargeDelta(Cache::Handle* handle, size_t delta) {
   LRUHandle* e = reinterpret_cast<LRUHandle*>(handle);
 
   // if the cache has exceeded in size, then evict
   autovector<LRUHandle*> last_reference_list;
+  {
+    MutexLock l(&mutex_);
+
+    // Free the space following the eviction policy until enough space
+    // is freed or nothing more can be evicted
+    Evict(delta, &last_reference_list);
+
+    // The cache is this much biger in size now
+    e->charge += delta;
+    usage_ += delta;
 
-  // Free the space following strict LRU policy until enough space
-  // is freed or the lru list is empty
-  EvictFromLRU(delta, &last_reference_list);
+    // Assert that the entry is not in the lru so no need to
+    // modify lru_usage_.
+    RS_ASSERT(e->refs > 1);
+  }
   for (auto entry : last_reference_list) {
     entry->Free();
   }
+}
 
-  // The cache is this much biger in size now
-  e->charge += delta;
-  usage_ += delta;
+// A cache partitioned into a power of two number of shards. The shard of an
+// entry is chosen by the top bits of its key hash, while the hash table in
+// each shard uses the bottom bits.
+class ShardedLRUCache : public Cache {
+ public:
+  ShardedLRUCache(size_t capacity,
+                  int num_shard_bits,
+                  CacheEvictionPolicy policy,
+                  size_t admission_sketch_entries)
+  : num_shard_bits_(num_shard_bits)
+  , capacity_(capacity) {
+    RS_ASSERT(num_shard_bits >= 0 && num_shard_bits < 20);
+    const size_t per_shard = PerShardCapacity(capacity);
+    const size_t sketch_width =
+      (admission_sketch_entries + NumShards() - 1) / NumShards();
+    shards_.reserve(NumShards());
+    for (size_t i = 0; i < NumShards(); ++i) {
+      shards_.emplace_back(new LRUCacheShard(per_shard, policy, sketch_width));
+    }
+  }
 
-  // Assert that the entry is not in the lru so no need to
-  // modify lru_usage_.
-  RS_ASSERT(e->refs > 1);
-}
+  ~ShardedLRUCache() {}
+
+  Cache::Handle* Insert(const Slice& key,
+                        void* value,
+                        size_t charge,
+                        void (*deleter)(const Slice& key,
+                                        void* value)) override {
+    const uint32_t hash = HashSlice(key);
+    return GetShard(hash)->Insert(key, hash, value, charge, deleter);
+  }
+
+  Cache::Handle* Lookup(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    return GetShard(hash)->Lookup(key, hash);
+  }
+
+  bool Peek(const Slice& key,
+            const std::function<void(void* value)>& visit) override {
+    const uint32_t hash = HashSlice(key);
+    return GetShard(hash)->Peek(key, hash, visit);
+  }
+
+  void Release(Cache::Handle* handle) override {
+    GetShard(handle)->Release(handle);
+  }
+
+  void Erase(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    GetShard(hash)->Erase(key, hash);
+  }
+
+  void Touch(const Slice& key) override {
+    const uint32_t hash = HashSlice(key);
+    GetShard(hash)->Touch(hash);
+  }
+
+  bool Admit(const Slice& key, size_t charge) override {
+    const uint32_t hash = HashSlice(key);
+    return GetShard(hash)->Admit(hash, charge);
+  }
+
+  void EraseUnRefEntries() override {
+    for (auto& shard : shards_) {
+      shard->EraseUnRefEntries();
+    }
+  }
+
+  void* Value(Cache::Handle* handle) override {
+    return reinterpret_cast<LRUHandle*>(handle)->value;
+  }
+
+  void SetCapacity(size_t capacity) override {
+    MutexLock l(&capacity_mutex_);
+    const size_t per_shard = PerShardCapacity(capacity);
+    for (auto& shard : shards_) {
+      shard->SetCapacity(per_shard);
+    }
+    capacity_ = capacity;
+  }
+
+  size_t GetCapacity() const override {
+    MutexLock l(&capacity_mutex_);
+    return capacity_;
+  }
+
+  size_t GetUsage() const override {
+    size_t usage = 0;
+    for (auto& shard : shards_) {
+      usage += shard->GetUsage();
+    }
+    return usage;
+  }
+
+  size_t GetPinnedUsage() const override {
+    size_t usage = 0;
+    for (auto& shard : shards_) {
+      usage += shard->GetPinnedUsage();
+    }
+    return usage;
+  }
+
+  void ApplyToAllCacheEntries(void (*callback)(void*, size_t)) override {
+    for (auto& shard : shards_) {
+      shard->ApplyToAllCacheEntries(callback);
+    }
+  }
+
+  void ChargeDelta(Handle* handle, size_t delta) override {
+    GetShard(handle)->ChargeDelta(handle, delta);
+  }
+
+ private:
+  static inline uint32_t HashSlice(const Slice& s) {
+    const unsigned seed = 0x9ee8fcef;
+    return XXH32(s.data(), s.size(), seed);
+  }
+
+  size_t NumShards() const {
+    return size_t(1) << num_shard_bits_;
+  }
+
+  size_t PerShardCapacity(size_t capacity) const {
+    return (capacity + NumShards() - 1) / NumShards();
+  }
+
+  LRUCacheShard* GetShard(uint32_t hash) const {
+    const uint32_t index =
+        num_shard_bits_ > 0 ? hash >> (32 - num_shard_bits_) : 0;
+    return shards_[index].get();
+  }
+
+  LRUCacheShard* GetShard(Cache::Handle* handle) const {
+    return GetShard(reinterpret_cast<LRUHandle*>(handle)->hash);
+  }
+
+  const int num_shard_bits_;
+
+  mutable port::Mutex capacity_mutex_;
+  size_t capacity_;
+
+  std::vector<std::unique_ptr<LRUCacheShard>> shards_;
+};
 }  // end anonymous namespace
 
-std::shared_ptr<Cache> NewLRUCache(size_t capacity) {
-  return std::make_shared<LRUCache>(capacity);
+std::shared_ptr<Cache> NewLRUCache(size_t capacity,
+                                   int num_shard_bits,
+                                   CacheEvictionPolicy policy,
+                                   size_t admission_sketch_entries) {
+  return std::make_shared<ShardedLRUCache>(
+    capacity, num_shard_bits, policy, admission_sketch_entries);
 }
 
 }  // namespace rocketspeed
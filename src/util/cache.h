@@ -6,7 +6,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 //
-// A Cache is an interface that maps keys to values.  It is not thread safe
+// A Cache is an interface that maps keys to values.
 // It may automatically evict entries to make room for new entries.
 // Values have a specified charge against the cache capacity.
 // For example, a cache where the values are variable
@@ -14,10 +14,15 @@
 // the string.
 //
 // A builtin cache implementation with a least-recently-used eviction
-// policy is provided.
+// policy is provided. It is safe to use from multiple threads: entries are
+// partitioned into shards by the hash of their key, and every shard is
+// guarded by its own mutex. A CLOCK (second-chance) eviction policy can be
+// used instead of strict LRU, in which case cache hits only mark an entry
+// as referenced and never reorder the shard's eviction list.
 
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
 #include "include/Slice.h"
@@ -26,9 +31,23 @@ namespace rocketspeed {
 
 class Cache;
 
+// Policy used by the builtin cache to pick entries for eviction.
+enum class CacheEvictionPolicy {
+  kLRU,    // Evict the least recently used entry.
+  kClock,  // Evict the first unreferenced entry found by the clock hand.
+};
+
 // Create a new cache with a fixed size capacity.
+// The cache is partitioned into 2^num_shard_bits shards, each taking an equal
+// part of the capacity.
+// If admission_sketch_entries is non-zero, the cache keeps a TinyLFU
+// frequency sketch sized for that many entries, see Cache::Admit.
 //
-extern std::shared_ptr<Cache> NewLRUCache(size_t capacity);
+extern std::shared_ptr<Cache> NewLRUCache(
+    size_t capacity,
+    int num_shard_bits = 0,
+    CacheEvictionPolicy policy = CacheEvictionPolicy::kLRU,
+    size_t admission_sketch_entries = 0);
 
 class Cache {
  public:
@@ -60,6 +79,14 @@ class Cache {
   // longer needed.
   virtual Handle* Lookup(const Slice& key) = 0;
 
+  // If the cache has a mapping for "key", calls visit with its value and
+  // returns true, else returns false. Unlike Lookup, this does not count as
+  // a use of the entry, which keeps its place in the eviction order.
+  // visit is called with the cache locked, so it must be quick and must not
+  // call back into the cache.
+  virtual bool Peek(const Slice& key,
+                    const std::function<void(void* value)>& visit) = 0;
+
   // Release a mapping returned by a previous Lookup().
   // REQUIRES: handle must not have been released yet.
   // REQUIRES: handle must have been returned by a method on *this.
@@ -76,6 +103,26 @@ class Cache {
   // to it have been released.
   virtual void Erase(const Slice& key) = 0;
 
+  // Records an access to key in the admission filter, whether or not the
+  // key is in the cache. Lookup does not record accesses by itself, so that
+  // callers decide which accesses reflect demand for an entry.
+  virtual void Touch(const Slice& key) {
+    // default implementation is noop
+  }
+
+  // Returns true if an entry for key with the specified charge should be
+  // inserted. When inserting the entry would evict another one, the entry is
+  // only admitted if it was accessed at least as often recently as the entry
+  // that would be evicted. Caches without an admission filter admit
+  // everything. Insert does not check admission by itself.
+  virtual bool Admit(const Slice& key, size_t charge) {
+    return true;
+  }
+
+  // Remove all entries that are not referenced by any handle. Entries that
+  // are in use stay in the cache.
+  virtual void EraseUnRefEntries() = 0;
+
   // sets the maximum configured capacity of the cache. When the new
   // capacity is less than the old capacity and the existing usage is
   // greater than new capacity, the implementation will do its best job to
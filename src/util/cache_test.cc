@@ -5,10 +5,13 @@
 //
 #include "src/util/cache.h"
 
+#include <algorithm>
 #include <forward_list>
+#include <thread>
 #include <vector>
 #include <string>
 #include <iostream>
+#include "src/util/frequency_sketch.h"
 #include "src/util/testharness.h"
 #include "src/util/common/coding.h"
 
@@ -494,6 +497,199 @@ TEST_F(CacheTest, ApplyToAllCacheEntiresTest) {
   ASSERT_TRUE(inserted == callback_state);
 }
 
+TEST_F(CacheTest, ShardedUsage) {
+  // Capacity is split evenly between 16 shards.
+  const size_t kCapacity = 1600;
+  auto cache = NewLRUCache(kCapacity, 4);
+  ASSERT_EQ(kCapacity, cache->GetCapacity());
+
+  const char* value = "abcdef";
+  for (int i = 0; i < 10000; ++i) {
+    cache->Release(cache->Insert(EncodeKey(i), (void*)value, 1, dumbDeleter));
+  }
+  ASSERT_GE(kCapacity, cache->GetUsage());
+  ASSERT_LT(kCapacity * 0.9, cache->GetUsage());
+  ASSERT_EQ(0U, cache->GetPinnedUsage());
+
+  Cache::Handle* h = cache->Insert(EncodeKey(-1), (void*)value, 5, dumbDeleter);
+  ASSERT_EQ(5U, cache->GetPinnedUsage());
+  cache->Release(h);
+
+  cache->SetCapacity(kCapacity / 2);
+  ASSERT_EQ(kCapacity / 2, cache->GetCapacity());
+  ASSERT_GE(kCapacity / 2, cache->GetUsage());
+}
+
+TEST_F(CacheTest, ClockEvictionPolicy) {
+  cache_ = NewLRUCache(kCacheSize, 0, CacheEvictionPolicy::kClock);
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Frequently used entry must be kept around
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_EQ(static_cast<size_t>(kCacheSize), cache_->GetUsage());
+}
+
+TEST_F(CacheTest, PeekDoesNotPromote) {
+  for (auto policy : {CacheEvictionPolicy::kLRU, CacheEvictionPolicy::kClock}) {
+    cache_ = NewLRUCache(kCacheSize, 0, policy);
+    auto peek = [&] (int key) {
+      int value = -1;
+      bool found = cache_->Peek(EncodeKey(key), [&] (void* v) {
+        value = DecodeValue(v);
+      });
+      EXPECT_EQ(found, value != -1);
+      return value;
+    };
+    ASSERT_EQ(-1, peek(100));
+    Insert(100, 101);
+    ASSERT_EQ(101, peek(100));
+    ASSERT_EQ(0U, cache_->GetPinnedUsage());
+
+    // An entry that is only peeked at is evicted like an unused one.
+    for (int i = 0; i < kCacheSize; i++) {
+      Insert(1000+i, 2000+i);
+      peek(100);
+    }
+    ASSERT_EQ(-1, peek(100));
+    ASSERT_EQ(-1, Lookup(100));
+    ASSERT_EQ(2000, peek(1000));
+  }
+}
+
+TEST_F(CacheTest, ClockEntriesArePinned) {
+  cache_ = NewLRUCache(kCacheSize, 0, CacheEvictionPolicy::kClock);
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(1U, cache_->GetPinnedUsage());
+
+  // Pinned entry survives any number of sweeps of the clock hand.
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+  }
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(static_cast<size_t>(kCacheSize), cache_->GetUsage());
+
+  // Replace it while pinned, old value is deleted on release only.
+  deleted_keys_.clear();
+  deleted_values_.clear();
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_TRUE(std::find(deleted_values_.begin(), deleted_values_.end(), 101) ==
+              deleted_values_.end());
+  cache_->Release(h1);
+  ASSERT_TRUE(std::find(deleted_values_.begin(), deleted_values_.end(), 101) !=
+              deleted_values_.end());
+  ASSERT_EQ(0U, cache_->GetPinnedUsage());
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(102, deleted_values_.back());
+}
+
+TEST_F(CacheTest, EraseUnRefEntries) {
+  for (auto policy : {CacheEvictionPolicy::kLRU, CacheEvictionPolicy::kClock}) {
+    cache_ = NewLRUCache(kCacheSize, 2, policy);
+    deleted_keys_.clear();
+    for (int i = 0; i < 10; ++i) {
+      Insert(i, 1000 + i);
+    }
+    Cache::Handle* h = cache_->Lookup(EncodeKey(3));
+    cache_->EraseUnRefEntries();
+    ASSERT_EQ(9U, deleted_keys_.size());
+    ASSERT_EQ(1U, cache_->GetUsage());
+    ASSERT_EQ(1003, Lookup(3));
+    ASSERT_EQ(-1, Lookup(4));
+    cache_->Release(h);
+    cache_->EraseUnRefEntries();
+    ASSERT_EQ(0U, cache_->GetUsage());
+    ASSERT_EQ(-1, Lookup(3));
+  }
+}
+
+TEST_F(CacheTest, FrequencySketch) {
+  FrequencySketch sketch(1000);
+  ASSERT_EQ(1024U, sketch.GetWidth());
+  ASSERT_EQ(0U, sketch.Estimate(1));
+  for (int i = 0; i < 5; ++i) {
+    sketch.Increment(1);
+  }
+  ASSERT_EQ(5U, sketch.Estimate(1));
+  for (int i = 0; i < 100; ++i) {
+    sketch.Increment(2);
+  }
+  ASSERT_EQ(FrequencySketch::kMaxFrequency, sketch.Estimate(2));
+  ASSERT_EQ(5U, sketch.Estimate(1));
+
+  // Counters are halved once enough accesses have been recorded.
+  for (uint32_t i = 0; i < 10 * 1024; ++i) {
+    sketch.Increment(1000 + i);
+  }
+  ASSERT_GE(2U, sketch.Estimate(1));
+  ASSERT_LE(7U, sketch.Estimate(2));
+}
+
+TEST_F(CacheTest, Admission) {
+  for (auto policy : {CacheEvictionPolicy::kLRU, CacheEvictionPolicy::kClock}) {
+    cache_ = NewLRUCache(10, 0, policy, 100);
+    // Everything is admitted while nothing has to be evicted.
+    for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(cache_->Admit(EncodeKey(i), 1));
+      Insert(i, 1000 + i);
+    }
+    // Make all cached keys popular.
+    for (int n = 0; n < 3; ++n) {
+      for (int i = 0; i < 10; ++i) {
+        cache_->Touch(EncodeKey(i));
+      }
+    }
+    // A key looked up once is less popular than any it would evict.
+    cache_->Touch(EncodeKey(100));
+    ASSERT_FALSE(cache_->Admit(EncodeKey(100), 1));
+    // Until it is looked up as often.
+    for (int n = 0; n < 3; ++n) {
+      cache_->Touch(EncodeKey(100));
+    }
+    ASSERT_TRUE(cache_->Admit(EncodeKey(100), 1));
+
+    // Caches without admission filter admit everything.
+    ASSERT_TRUE(cache2_->Admit(EncodeKey(100), kCacheSize2 * 2));
+  }
+}
+
+TEST_F(CacheTest, ConcurrentAccess) {
+  for (auto policy : {CacheEvictionPolicy::kLRU, CacheEvictionPolicy::kClock}) {
+    auto cache = NewLRUCache(1000, 3, policy);
+    const char* value = "abcdef";
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t]() {
+        for (int i = 0; i < 20000; ++i) {
+          std::string key = EncodeKey((i * 7 + t) % 2000);
+          Cache::Handle* h = cache->Lookup(key);
+          if (h == nullptr) {
+            h = cache->Insert(key, (void*)value, 1, dumbDeleter);
+          }
+          ASSERT_EQ(value, cache->Value(h));
+          cache->Release(h);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    ASSERT_GE(1000U, cache->GetUsage());
+    ASSERT_EQ(0U, cache->GetPinnedUsage());
+  }
+}
+
 }  // namespace rocketspeed
 
 int main(int argc, char** argv) {
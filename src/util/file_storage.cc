@@ -0,0 +1,985 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#define __STDC_FORMAT_MACROS
+#include "src/util/file_storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <limits>
+
+#include "include/Logger.h"
+#include "src/util/common/coding.h"
+#include "src/util/memory.h"
+#include "src/util/xxhash.h"
+
+namespace rocketspeed {
+
+constexpr SequenceNumber FileLogStorage::kFirstSeqno;
+constexpr size_t FileLogStorage::kIndexInterval;
+
+// Record header: payload size, checksum, timestamp in microseconds.
+static constexpr size_t kRecordHeaderSize = 16;
+static constexpr unsigned kChecksumSeed = 0x5EC7;
+
+// Maximum number of records delivered from one log before moving on to the
+// next log of the reader.
+static constexpr size_t kMaxReadBatch = 256;
+
+// Name of the file with the trim point in a log directory.
+static const char* const kTrimFile = "TRIM";
+
+static Status IOError(const std::string& context) {
+  return Status::IOError(context + ": " + strerror(errno));
+}
+
+static uint32_t RecordChecksum(const char* payload,
+                               size_t size,
+                               uint64_t timestamp) {
+  return XXH32(payload, size,
+               kChecksumSeed ^ static_cast<unsigned>(timestamp) ^
+               static_cast<unsigned>(size));
+}
+
+// Decodes the record at an offset. Returns false at the end of the records.
+static bool DecodeRecord(const char* data,
+                         size_t size,
+                         size_t offset,
+                         Slice* payload,
+                         uint64_t* timestamp) {
+  if (offset + kRecordHeaderSize > size) {
+    return false;
+  }
+  const char* header = data + offset;
+  const uint32_t payload_size = DecodeFixed32(header);
+  const uint32_t checksum = DecodeFixed32(header + 4);
+  *timestamp = DecodeFixed64(header + 8);
+  if (payload_size > size - offset - kRecordHeaderSize) {
+    return false;
+  }
+  const char* payload_data = header + kRecordHeaderSize;
+  if (checksum != RecordChecksum(payload_data, payload_size, *timestamp)) {
+    return false;
+  }
+  *payload = Slice(payload_data, payload_size);
+  return true;
+}
+
+// A mapped segment file of a log.
+struct FileLogStorage::Segment {
+  Segment(std::string _path,
+          SequenceNumber _first_seqno,
+          const char* _data,
+          size_t _size)
+  : path(std::move(_path))
+  , first_seqno(_first_seqno)
+  , data(_data)
+  , size(_size)
+  , end_seqno(_first_seqno)
+  , end_offset(0)
+  , write_seqno(_first_seqno)
+  , write_offset(0) {}
+
+  ~Segment() {
+    munmap(const_cast<char*>(data), size);
+  }
+
+  const std::string path;
+  const SequenceNumber first_seqno;
+  const char* const data;
+  const size_t size;
+
+  // Committed records, guarded by mutex_.
+  SequenceNumber end_seqno;
+  size_t end_offset;
+  std::vector<IndexEntry> index;
+
+  // Written records, owned by the writer thread.
+  SequenceNumber write_seqno;
+  size_t write_offset;
+  std::vector<IndexEntry> write_index;
+};
+
+struct FileLogStorage::Log {
+  // Guarded by mutex_.
+  std::deque<std::shared_ptr<Segment>> segments;
+  SequenceNumber trim_seqno = 0;
+  SequenceNumber tail_seqno = kFirstSeqno;
+
+  // Owned by the writer thread.
+  std::shared_ptr<Segment> active;
+  int fd = -1;
+  SequenceNumber next_seqno = kFirstSeqno;
+  uint64_t last_timestamp = 0;
+  // Encoded records not written to the active segment yet.
+  std::string buffer;
+  // Segments written to since the last commit, oldest first.
+  std::vector<std::shared_ptr<Segment>> dirty;
+  // Descriptors of full segments, to sync and close on the next commit.
+  std::vector<int> retired_fds;
+  // Set on the first write failure, after which appends to the log fail.
+  Status error;
+
+  ~Log() {
+    for (int retired_fd : retired_fds) {
+      close(retired_fd);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+};
+
+//
+// Reader of logs of a FileLogStorage, delivering records on its own thread.
+//
+class FileAsyncLogReader : public AsyncLogReader {
+ public:
+  FileAsyncLogReader(FileLogStorage* storage,
+                     std::function<bool(LogRecord&)> record_cb,
+                     std::function<bool(const GapRecord&)> gap_cb)
+  : storage_(storage)
+  , record_cb_(std::move(record_cb))
+  , gap_cb_(std::move(gap_cb))
+  , stop_(false) {
+    thread_ = storage_->env_->StartThread([this] () { Run(); },
+                                          "file_reader");
+  }
+
+  ~FileAsyncLogReader() final {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    storage_->NotifyReaders();
+    storage_->env_->WaitForJoin(thread_);
+  }
+
+  Status Open(LogID id,
+              SequenceNumber start_point,
+              SequenceNumber end_point) final {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ReadState& state = logs_[id];
+      state.next_seqno =
+        std::max<SequenceNumber>(start_point, FileLogStorage::kFirstSeqno);
+      state.end_seqno = end_point;
+      state.pos = FileLogStorage::ReadPosition();
+      state.moved = false;
+    }
+    storage_->NotifyReaders();
+    return Status::OK();
+  }
+
+  Status Close(LogID id) final {
+    // Waits for records being delivered, none are delivered after this.
+    std::lock_guard<std::mutex> lock(mutex_);
+    logs_.erase(id);
+    return Status::OK();
+  }
+
+ private:
+  struct ReadState {
+    SequenceNumber next_seqno;
+    SequenceNumber end_seqno;
+    // Position of next_seqno, if it has been sought.
+    FileLogStorage::ReadPosition pos;
+    // The record at next_seqno was refused after its context was moved out,
+    // so it is delivered again without payload.
+    bool moved = false;
+  };
+
+  enum class Progress { kIdle, kMore, kBlocked };
+
+  void Run() {
+    uint64_t generation = 0;
+    while (true) {
+      {
+        std::lock_guard<std::mutex> storage_lock(storage_->mutex_);
+        generation = storage_->commit_generation_;
+      }
+      bool more = false;
+      bool blocked = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_) {
+          break;
+        }
+        for (auto& entry : logs_) {
+          Progress progress = Deliver(entry.first, &entry.second);
+          more = more || progress == Progress::kMore;
+          blocked = blocked || progress == Progress::kBlocked;
+        }
+      }
+      if (!more) {
+        // Retry refused records soon, otherwise wait for commits.
+        storage_->WaitForCommit(generation,
+          std::chrono::milliseconds(blocked ? 1 : 100));
+      }
+    }
+  }
+
+  Progress Deliver(LogID log_id, ReadState* state) {
+    if (state->next_seqno > state->end_seqno) {
+      return Progress::kIdle;
+    }
+
+    SequenceNumber trim_seqno = 0;
+    SequenceNumber tail_seqno = FileLogStorage::kFirstSeqno;
+    {
+      std::lock_guard<std::mutex> lock(storage_->mutex_);
+      auto it = storage_->logs_.find(log_id);
+      if (it != storage_->logs_.end()) {
+        const FileLogStorage::Log& log = *it->second;
+        trim_seqno = log.trim_seqno;
+        tail_seqno = log.tail_seqno;
+        if (state->next_seqno > trim_seqno &&
+            state->next_seqno < tail_seqno) {
+          auto& pos = state->pos;
+          if (pos.segment && pos.seqno == state->next_seqno &&
+              pos.seqno < pos.segment->end_seqno) {
+            // Pick up records committed since.
+            pos.end_seqno = pos.segment->end_seqno;
+          } else if (!storage_->Seek(log, state->next_seqno, &pos)) {
+            pos = FileLogStorage::ReadPosition();
+          }
+        }
+      }
+    }
+
+    if (state->next_seqno <= trim_seqno) {
+      GapRecord gap{GapType::kRetention, log_id, state->next_seqno,
+                    std::min(trim_seqno, state->end_seqno)};
+      if (!gap_cb_(gap)) {
+        return Progress::kBlocked;
+      }
+      state->next_seqno = gap.to + 1;
+      state->pos = FileLogStorage::ReadPosition();
+      return Progress::kMore;
+    }
+    auto& pos = state->pos;
+    if (state->next_seqno >= tail_seqno || !pos.segment) {
+      return Progress::kIdle;
+    }
+
+    if (pos.seqno > state->next_seqno) {
+      // Records lost in recovery.
+      GapRecord gap{GapType::kDataLoss, log_id, state->next_seqno,
+                    std::min(pos.seqno - 1, state->end_seqno)};
+      if (!gap_cb_(gap)) {
+        return Progress::kBlocked;
+      }
+      state->next_seqno = gap.to + 1;
+      return Progress::kMore;
+    }
+
+    const FileLogStorage::Segment& segment = *pos.segment;
+    for (size_t count = 0; count < kMaxReadBatch; ++count) {
+      if (pos.seqno >= pos.end_seqno) {
+        // Continue in the next segment, if any.
+        return pos.seqno < tail_seqno ? Progress::kMore : Progress::kIdle;
+      }
+      if (state->next_seqno > state->end_seqno) {
+        return Progress::kIdle;
+      }
+      Slice payload;
+      uint64_t timestamp;
+      // Records before end_seqno are immutable, no need for the lock.
+      const bool valid = DecodeRecord(segment.data, segment.size,
+                                      pos.offset, &payload, &timestamp);
+      RS_ASSERT(valid);
+      (void)valid;
+
+      LogRecord record;
+      record.log_id = log_id;
+      record.seqno = pos.seqno;
+      record.timestamp = std::chrono::microseconds(timestamp);
+      if (!state->moved) {
+        std::unique_ptr<std::shared_ptr<FileLogStorage::Segment>> context(
+          new std::shared_ptr<FileLogStorage::Segment>(pos.segment));
+        record.payload = payload;
+        record.context = EraseType(std::move(context));
+      }
+      if (!record_cb_(record)) {
+        state->moved = state->moved || !record.context;
+        return Progress::kBlocked;
+      }
+      state->moved = false;
+      pos.offset += kRecordHeaderSize + payload.size();
+      ++pos.seqno;
+      state->next_seqno = pos.seqno;
+    }
+    return Progress::kMore;
+  }
+
+  FileLogStorage* const storage_;
+  const std::function<bool(LogRecord&)> record_cb_;
+  const std::function<bool(const GapRecord&)> gap_cb_;
+
+  // Protects the open logs, held while delivering records.
+  std::mutex mutex_;
+  std::unordered_map<LogID, ReadState> logs_;
+  bool stop_;
+  Env::ThreadId thread_;
+};
+
+Status FileLogStorage::Create(Env* env,
+                              std::shared_ptr<Logger> info_log,
+                              std::string directory,
+                              size_t segment_size,
+                              FileLogStorage** storage) {
+  if (segment_size <= kRecordHeaderSize ||
+      segment_size > std::numeric_limits<uint32_t>::max()) {
+    return Status::InvalidArgument("Invalid segment size");
+  }
+  Status st = env->CreateDirIfMissing(directory);
+  if (!st.ok()) {
+    return st;
+  }
+  std::unique_ptr<FileLogStorage> result(
+    new FileLogStorage(env, std::move(info_log), std::move(directory),
+                       segment_size));
+  st = result->Recover();
+  if (!st.ok()) {
+    return st;
+  }
+  FileLogStorage* raw = result.get();
+  raw->writer_thread_ =
+    env->StartThread([raw] () { raw->WriterLoop(); }, "file_writer");
+  *storage = result.release();
+  return Status::OK();
+}
+
+FileLogStorage::FileLogStorage(Env* env,
+                               std::shared_ptr<Logger> info_log,
+                               std::string directory,
+                               size_t segment_size)
+: env_(env)
+, info_log_(std::move(info_log))
+, directory_(std::move(directory))
+, segment_size_(segment_size)
+, commit_generation_(0)
+, segments_deleted_(0)
+, stop_(false)
+, writer_thread_(0) {
+}
+
+FileLogStorage::~FileLogStorage() {
+  // Pending appends are committed before the writer exits.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  writer_cv_.notify_all();
+  if (writer_thread_) {
+    env_->WaitForJoin(writer_thread_);
+  }
+}
+
+Statistics FileLogStorage::GetStatistics() {
+  // Statistics are owned by the writer thread.
+  std::promise<Statistics> promise;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      return Statistics();
+    }
+    tasks_.emplace_back([this, &promise] () {
+      {
+        std::lock_guard<std::mutex> task_lock(mutex_);
+        stats_.segments_deleted->Set(segments_deleted_);
+      }
+      promise.set_value(stats_.all);
+    });
+  }
+  writer_cv_.notify_one();
+  return promise.get_future().get().MoveThread();
+}
+
+std::string FileLogStorage::LogDirectory(LogID log_id) const {
+  return directory_ + "/" + std::to_string(log_id);
+}
+
+static std::string SegmentName(SequenceNumber first_seqno) {
+  char name[32];
+  snprintf(name, sizeof(name), "%020" PRIu64 ".seg", first_seqno);
+  return name;
+}
+
+Status FileLogStorage::Recover() {
+  std::vector<std::string> children;
+  Status st = env_->GetChildren(directory_, &children);
+  if (!st.ok()) {
+    return st;
+  }
+  for (const std::string& child : children) {
+    if (child.empty() ||
+        child.find_first_not_of("0123456789") != std::string::npos) {
+      continue;
+    }
+    const LogID log_id = strtoull(child.c_str(), nullptr, 10);
+    std::unique_ptr<Log> log(new Log());
+    st = RecoverLog(log_id, log.get());
+    if (!st.ok()) {
+      return st;
+    }
+    logs_.emplace(log_id, std::move(log));
+  }
+  return Status::OK();
+}
+
+Status FileLogStorage::RecoverLog(LogID log_id, Log* log) {
+  const std::string log_dir = LogDirectory(log_id);
+
+  // Trim point.
+  std::string trim_data;
+  if (ReadFileToString(env_, log_dir + "/" + kTrimFile, &trim_data).ok() &&
+      !trim_data.empty()) {
+    log->trim_seqno = strtoull(trim_data.c_str(), nullptr, 10);
+  }
+
+  std::vector<std::string> children;
+  Status st = env_->GetChildren(log_dir, &children);
+  if (!st.ok()) {
+    return st;
+  }
+  std::vector<SequenceNumber> first_seqnos;
+  for (const std::string& child : children) {
+    SequenceNumber first_seqno;
+    char suffix[8];
+    if (sscanf(child.c_str(), "%" SCNu64 ".%7s", &first_seqno, suffix) == 2 &&
+        strcmp(suffix, "seg") == 0) {
+      first_seqnos.push_back(first_seqno);
+    }
+  }
+  std::sort(first_seqnos.begin(), first_seqnos.end());
+
+  for (size_t i = 0; i < first_seqnos.size(); ++i) {
+    const std::string path = log_dir + "/" + SegmentName(first_seqnos[i]);
+    const bool last = i + 1 == first_seqnos.size();
+    int fd = open(path.c_str(), last ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+      return IOError(path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+      close(fd);
+      continue;
+    }
+    const size_t size = static_cast<size_t>(file_stat.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      st = IOError(path);
+      close(fd);
+      return st;
+    }
+    auto segment = std::make_shared<Segment>(
+      path, first_seqnos[i], static_cast<const char*>(data), size);
+
+    // Scan records up to the first invalid one.
+    Slice payload;
+    uint64_t timestamp;
+    while (DecodeRecord(segment->data, size, segment->end_offset,
+                        &payload, &timestamp)) {
+      if ((segment->end_seqno - segment->first_seqno) % kIndexInterval == 0) {
+        segment->index.push_back(
+          {static_cast<uint32_t>(segment->end_offset), timestamp});
+      }
+      segment->end_offset += kRecordHeaderSize + payload.size();
+      ++segment->end_seqno;
+      log->last_timestamp = std::max(log->last_timestamp, timestamp);
+    }
+    segment->write_seqno = segment->end_seqno;
+    segment->write_offset = segment->end_offset;
+
+    if (last) {
+      log->active = segment;
+      log->fd = fd;
+    } else {
+      close(fd);
+    }
+    if (segment->end_seqno - 1 <= log->trim_seqno && !last) {
+      // Entirely trimmed, but not deleted yet.
+      unlink(path.c_str());
+      continue;
+    }
+    log->segments.push_back(std::move(segment));
+  }
+
+  if (!log->segments.empty()) {
+    log->tail_seqno = log->segments.back()->end_seqno;
+  }
+  log->tail_seqno = std::max(log->tail_seqno, log->trim_seqno + 1);
+  log->next_seqno = log->tail_seqno;
+  if (log->active && log->active->write_seqno != log->next_seqno) {
+    // Records after the trim point were lost, start a new segment.
+    close(log->fd);
+    log->fd = -1;
+    log->active.reset();
+  }
+  LOG_INFO(info_log_,
+    "Recovered Log(%" PRIu64 ") with %zu segments, seqnos (%" PRIu64
+    ", %" PRIu64 ")",
+    log_id, log->segments.size(), log->trim_seqno, log->tail_seqno);
+  return Status::OK();
+}
+
+Status FileLogStorage::GetOrCreateLog(LogID log_id, Log** log) {
+  auto it = logs_.find(log_id);
+  if (it == logs_.end()) {
+    Status st = env_->CreateDirIfMissing(LogDirectory(log_id));
+    if (!st.ok()) {
+      return st;
+    }
+    it = logs_.emplace(log_id, std::unique_ptr<Log>(new Log())).first;
+  }
+  *log = it->second.get();
+  return Status::OK();
+}
+
+Status FileLogStorage::CreateSegment(LogID log_id,
+                                     Log* log,
+                                     SequenceNumber first_seqno) {
+  const std::string log_dir = LogDirectory(log_id);
+  const std::string path = log_dir + "/" + SegmentName(first_seqno);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return IOError(path);
+  }
+  if (ftruncate(fd, static_cast<off_t>(segment_size_)) != 0) {
+    Status st = IOError(path);
+    close(fd);
+    return st;
+  }
+  void* data = mmap(nullptr, segment_size_, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    Status st = IOError(path);
+    close(fd);
+    return st;
+  }
+  // Make the new file durable in the directory.
+  int dir_fd = open(log_dir.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  if (log->fd >= 0) {
+    log->retired_fds.push_back(log->fd);
+  }
+  log->fd = fd;
+  log->active = std::make_shared<Segment>(
+    path, first_seqno, static_cast<const char*>(data), segment_size_);
+  log->dirty.push_back(log->active);
+  return Status::OK();
+}
+
+Status FileLogStorage::WriteTrimPoint(LogID log_id, SequenceNumber seqno) {
+  const std::string log_dir = LogDirectory(log_id);
+  const std::string tmp = log_dir + "/" + kTrimFile + ".tmp";
+  Status st = WriteStringToFile(env_, std::to_string(seqno), tmp, true);
+  if (!st.ok()) {
+    return st;
+  }
+  return env_->RenameFile(tmp, log_dir + "/" + kTrimFile);
+}
+
+Status FileLogStorage::AppendAsync(LogID id,
+                                   const Slice& data,
+                                   AppendCallback callback) {
+  if (data.size() + kRecordHeaderSize > segment_size_) {
+    return Status::InvalidArgument("Record larger than segment");
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      return Status::InternalError("Storage is shutting down");
+    }
+    requests_.push_back({id, data, std::move(callback)});
+  }
+  writer_cv_.notify_one();
+  return Status::OK();
+}
+
+Status FileLogStorage::FindTimeAsync(
+    LogID id,
+    std::chrono::milliseconds timestamp,
+    std::function<void(Status, SequenceNumber)> callback) {
+  // Answered on the writer thread, after appends queued before.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      return Status::InternalError("Storage is shutting down");
+    }
+    tasks_.emplace_back([this, id, timestamp, callback] () {
+      uint64_t timestamp_us = std::numeric_limits<uint64_t>::max();
+      if (timestamp != std::chrono::milliseconds::max()) {
+        timestamp_us = static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(timestamp)
+            .count());
+      }
+      SequenceNumber seqno;
+      {
+        std::lock_guard<std::mutex> task_lock(mutex_);
+        seqno = FindTime(id, timestamp_us);
+      }
+      callback(Status::OK(), seqno);
+    });
+  }
+  writer_cv_.notify_one();
+  return Status::OK();
+}
+
+SequenceNumber FileLogStorage::FindTime(LogID log_id,
+                                        uint64_t timestamp) const {
+  auto it = logs_.find(log_id);
+  if (it == logs_.end()) {
+    return kFirstSeqno;
+  }
+  const Log& log = *it->second;
+  if (timestamp == std::numeric_limits<uint64_t>::max()) {
+    // Next sequence number to be committed.
+    return log.tail_seqno;
+  }
+
+  // Last segment starting before the timestamp. There are few segments.
+  auto seg_it = log.segments.rbegin();
+  while (seg_it != log.segments.rend() &&
+         ((*seg_it)->index.empty() ||
+          (*seg_it)->index.front().timestamp >= timestamp)) {
+    ++seg_it;
+  }
+  if (seg_it == log.segments.rend()) {
+    return log.segments.empty() ? log.tail_seqno
+                                : std::max(log.segments.front()->first_seqno,
+                                           log.trim_seqno + 1);
+  }
+  const Segment& segment = **seg_it;
+
+  // Last indexed record before the timestamp, then scan from there.
+  auto index_it = std::partition_point(segment.index.begin(),
+                                       segment.index.end(),
+    [&] (const IndexEntry& entry) { return entry.timestamp < timestamp; });
+  RS_ASSERT(index_it != segment.index.begin());
+  --index_it;
+  SequenceNumber seqno = segment.first_seqno +
+    static_cast<SequenceNumber>(index_it - segment.index.begin()) *
+    kIndexInterval;
+  size_t offset = index_it->offset;
+  Slice payload;
+  uint64_t record_timestamp;
+  while (seqno < segment.end_seqno &&
+         DecodeRecord(segment.data, segment.end_offset, offset,
+                      &payload, &record_timestamp) &&
+         record_timestamp < timestamp) {
+    offset += kRecordHeaderSize + payload.size();
+    ++seqno;
+  }
+  return std::max(seqno, log.trim_seqno + 1);
+}
+
+Status FileLogStorage::Trim(LogID id, SequenceNumber seqno) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Log* log;
+  Status st = GetOrCreateLog(id, &log);
+  if (!st.ok()) {
+    return st;
+  }
+  seqno = std::min(seqno, log->tail_seqno - 1);
+  if (seqno <= log->trim_seqno) {
+    return Status::OK();
+  }
+  st = WriteTrimPoint(id, seqno);
+  if (!st.ok()) {
+    return st;
+  }
+  log->trim_seqno = seqno;
+
+  // Delete trimmed segments, except the one being written. Readers keep
+  // theirs mapped.
+  while (log->segments.size() > 1 &&
+         log->segments.front()->end_seqno - 1 <= seqno) {
+    unlink(log->segments.front()->path.c_str());
+    log->segments.pop_front();
+    ++segments_deleted_;
+  }
+  // Readers deliver the retention gap.
+  ++commit_generation_;
+  reader_cv_.notify_all();
+  return Status::OK();
+}
+
+Status FileLogStorage::CreateAsyncReaders(
+    unsigned int parallelism,
+    std::function<bool(LogRecord&)> record_cb,
+    std::function<bool(const GapRecord&)> gap_cb,
+    std::vector<AsyncLogReader*>* readers) {
+  if (!readers) {
+    return Status::InvalidArgument("out parameter must not be null.");
+  }
+  readers->reserve(readers->size() + parallelism);
+  while (parallelism-- > 0) {
+    readers->push_back(new FileAsyncLogReader(this, record_cb, gap_cb));
+  }
+  return Status::OK();
+}
+
+void FileLogStorage::WriterLoop() {
+  std::vector<AppendRequest> requests;
+  std::vector<std::function<void()>> tasks;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      writer_cv_.wait(lock, [this] () {
+        return stop_ || !requests_.empty() || !tasks_.empty();
+      });
+      if (requests_.empty() && tasks_.empty()) {
+        RS_ASSERT(stop_);
+        break;
+      }
+      // Everything queued while the last group was committed is the next
+      // group.
+      requests.swap(requests_);
+      tasks.swap(tasks_);
+    }
+    if (!requests.empty()) {
+      Commit(&requests);
+      requests.clear();
+    }
+    for (auto& task : tasks) {
+      task();
+    }
+    tasks.clear();
+  }
+}
+
+Status FileLogStorage::WriteRecord(LogID log_id,
+                                   Log* log,
+                                   const Slice& data,
+                                   uint64_t timestamp,
+                                   SequenceNumber* seqno) {
+  const size_t record_size = kRecordHeaderSize + data.size();
+  if (!log->active ||
+      log->active->write_offset + log->buffer.size() + record_size >
+        log->active->size) {
+    Status st = FlushLog(log);
+    if (!st.ok()) {
+      return st;
+    }
+    st = CreateSegment(log_id, log, log->next_seqno);
+    if (!st.ok()) {
+      return st;
+    }
+    stats_.segments_created->Add(1);
+  }
+
+  Segment& segment = *log->active;
+  const SequenceNumber index = log->next_seqno - segment.first_seqno;
+  if (index % kIndexInterval == 0) {
+    segment.write_index.push_back(
+      {static_cast<uint32_t>(segment.write_offset + log->buffer.size()),
+       timestamp});
+  }
+  PutFixed32(&log->buffer, static_cast<uint32_t>(data.size()));
+  PutFixed32(&log->buffer,
+             RecordChecksum(data.data(), data.size(), timestamp));
+  PutFixed64(&log->buffer, timestamp);
+  log->buffer.append(data.data(), data.size());
+  *seqno = log->next_seqno++;
+  return Status::OK();
+}
+
+Status FileLogStorage::FlushLog(Log* log) {
+  if (log->buffer.empty()) {
+    return Status::OK();
+  }
+  Segment& segment = *log->active;
+  const char* data = log->buffer.data();
+  size_t remaining = log->buffer.size();
+  off_t offset = static_cast<off_t>(segment.write_offset);
+  while (remaining > 0) {
+    ssize_t written = pwrite(log->fd, data, remaining, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return IOError(segment.path);
+    }
+    data += written;
+    remaining -= static_cast<size_t>(written);
+    offset += written;
+  }
+  segment.write_offset += log->buffer.size();
+  segment.write_seqno = log->next_seqno;
+  log->buffer.clear();
+  if (log->dirty.empty() || log->dirty.back() != log->active) {
+    log->dirty.push_back(log->active);
+  }
+  return Status::OK();
+}
+
+void FileLogStorage::Commit(std::vector<AppendRequest>* requests) {
+  const uint64_t start = env_->NowMicros();
+  std::vector<std::pair<Log*, LogID>> touched;
+  std::vector<SequenceNumber> seqnos(requests->size(), 0);
+  std::vector<Log*> request_logs(requests->size(), nullptr);
+
+  // Write all records.
+  for (size_t i = 0; i < requests->size(); ++i) {
+    AppendRequest& request = (*requests)[i];
+    Log* log;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      Status st = GetOrCreateLog(request.log_id, &log);
+      if (!st.ok()) {
+        continue;
+      }
+    }
+    request_logs[i] = log;
+    if (!log->error.ok()) {
+      continue;
+    }
+    if (log->buffer.empty() && log->dirty.empty()) {
+      touched.emplace_back(log, request.log_id);
+    }
+    // Timestamps never go back within a log, for FindTimeAsync.
+    log->last_timestamp = std::max(log->last_timestamp, start);
+    Status st = WriteRecord(request.log_id, log, request.data,
+                            log->last_timestamp, &seqnos[i]);
+    if (!st.ok()) {
+      log->error = st;
+    }
+  }
+
+  // Write the rest and sync, then publish.
+  for (auto& entry : touched) {
+    Log* log = entry.first;
+    if (log->error.ok()) {
+      log->error = FlushLog(log);
+    }
+    for (int fd : log->retired_fds) {
+      if (log->error.ok() && fdatasync(fd) != 0) {
+        log->error = IOError("fdatasync");
+      }
+      close(fd);
+    }
+    log->retired_fds.clear();
+    if (log->error.ok() && fdatasync(log->fd) != 0) {
+      log->error = IOError(log->active->path);
+    }
+    if (!log->error.ok()) {
+      LOG_ERROR(info_log_, "Failed to write Log(%" PRIu64 "): %s",
+        entry.second, log->error.ToString().c_str());
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : touched) {
+      Log* log = entry.first;
+      if (log->error.ok()) {
+        for (auto& segment : log->dirty) {
+          if (log->segments.empty() || log->segments.back() != segment) {
+            log->segments.push_back(segment);
+          }
+          segment->end_seqno = segment->write_seqno;
+          segment->end_offset = segment->write_offset;
+          segment->index.insert(segment->index.end(),
+                                segment->write_index.begin(),
+                                segment->write_index.end());
+          segment->write_index.clear();
+        }
+        log->tail_seqno = log->next_seqno;
+      }
+      log->dirty.clear();
+    }
+    ++commit_generation_;
+  }
+  reader_cv_.notify_all();
+
+  stats_.group_commits->Add(1);
+  stats_.commit_records->Record(requests->size());
+  stats_.commit_latency_us->Record(env_->NowMicros() - start);
+
+  for (size_t i = 0; i < requests->size(); ++i) {
+    AppendRequest& request = (*requests)[i];
+    Log* log = request_logs[i];
+    if (!log) {
+      stats_.append_errors->Add(1);
+      request.callback(Status::IOError("Failed to create log"), 0);
+    } else if (!log->error.ok()) {
+      stats_.append_errors->Add(1);
+      request.callback(log->error, 0);
+    } else {
+      stats_.appends->Add(1);
+      stats_.append_bytes->Add(request.data.size());
+      request.callback(Status::OK(), seqnos[i]);
+    }
+  }
+}
+
+bool FileLogStorage::Seek(const Log& log,
+                          SequenceNumber seqno,
+                          ReadPosition* pos) const {
+  // First segment with committed records at or after seqno.
+  auto it = std::partition_point(log.segments.begin(), log.segments.end(),
+    [&] (const std::shared_ptr<Segment>& segment) {
+      return segment->end_seqno <= seqno;
+    });
+  if (it == log.segments.end()) {
+    return false;
+  }
+  const Segment& segment = **it;
+  pos->segment = *it;
+  pos->end_seqno = segment.end_seqno;
+  if (seqno <= segment.first_seqno) {
+    pos->seqno = segment.first_seqno;
+    pos->offset = 0;
+    return true;
+  }
+
+  // Nearest indexed record, then skip records up to seqno.
+  const size_t index = (seqno - segment.first_seqno) / kIndexInterval;
+  RS_ASSERT(index < segment.index.size());
+  pos->seqno = segment.first_seqno + index * kIndexInterval;
+  pos->offset = segment.index[index].offset;
+  while (pos->seqno < seqno) {
+    Slice payload;
+    uint64_t timestamp;
+    const bool valid = DecodeRecord(segment.data, segment.end_offset,
+                                    pos->offset, &payload, &timestamp);
+    RS_ASSERT(valid);
+    (void)valid;
+    pos->offset += kRecordHeaderSize + payload.size();
+    ++pos->seqno;
+  }
+  return true;
+}
+
+void FileLogStorage::WaitForCommit(uint64_t generation,
+                                   std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  reader_cv_.wait_for(lock, timeout, [&] () {
+    return commit_generation_ != generation;
+  });
+}
+
+void FileLogStorage::NotifyReaders() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++commit_generation_;
+  }
+  reader_cv_.notify_all();
+}
+
+}  // namespace rocketspeed
@@ -0,0 +1,219 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "include/Env.h"
+#include "src/util/common/statistics.h"
+#include "src/util/storage.h"
+
+namespace rocketspeed {
+
+class Logger;
+
+/**
+ * FileLogStorage is a LogStorage on the local file system, for single box
+ * deployments and benchmarks that do not have LogDevice.
+ *
+ * Every log is a directory of append-only segment files, each named after
+ * the first sequence number in it. A single thread writes appends to all
+ * logs, committing whatever has been queued as one group: the records are
+ * written, the segments written to are synced with fdatasync, and only then
+ * are the appends acknowledged and made visible to readers.
+ *
+ * Readers read records in place from memory-mapped segments, each on its
+ * own thread, and tail logs as new records are committed. A sparse index of
+ * every kIndexInterval-th record of a segment, with its offset and
+ * timestamp, serves seeks and FindTimeAsync.
+ *
+ * Logs are trimmed by whole segments, and the trim point is persisted, so
+ * trimmed records are never delivered again. On open, segments are
+ * recovered up to the first record that fails its checksum.
+ */
+class FileLogStorage : public LogStorage {
+ public:
+  /** Sequence number of the first record of a log. */
+  static constexpr SequenceNumber kFirstSeqno = 1;
+
+  /** Number of records per entry of the sparse index of a segment. */
+  static constexpr size_t kIndexInterval = 64;
+
+  /**
+   * Opens the storage in a directory, recovering the logs in it.
+   * The directory is created if missing.
+   *
+   * @param env Environment.
+   * @param info_log Logger.
+   * @param directory Directory to keep the logs in.
+   * @param segment_size Size of segment files. Records must fit in one.
+   * @param storage Output for the new storage.
+   * @return on success returns OK(), otherwise errorcode.
+   */
+  static Status Create(Env* env,
+                       std::shared_ptr<Logger> info_log,
+                       std::string directory,
+                       size_t segment_size,
+                       FileLogStorage** storage);
+
+  ~FileLogStorage() final;
+
+  Statistics GetStatistics() final;
+
+  Status AppendAsync(LogID id,
+                     const Slice& data,
+                     AppendCallback callback) final;
+
+  Status FindTimeAsync(LogID id,
+                       std::chrono::milliseconds timestamp,
+                       std::function<void(Status, SequenceNumber)> callback)
+    final;
+
+  /**
+   * Trims a log up to a sequence number, at most up to the last committed
+   * record. Segments are deleted once all their records are trimmed.
+   */
+  Status Trim(LogID id, SequenceNumber seqno) final;
+
+  Status CreateAsyncReaders(
+    unsigned int parallelism,
+    std::function<bool(LogRecord&)> record_cb,
+    std::function<bool(const GapRecord&)> gap_cb,
+    std::vector<AsyncLogReader*>* readers) final;
+
+  bool CanSubscribePastEnd() const final {
+    return true;
+  }
+
+ private:
+  friend class FileAsyncLogReader;
+
+  struct Segment;
+  struct Log;
+
+  /** Offset and timestamp of a record in a segment. */
+  struct IndexEntry {
+    uint32_t offset;
+    uint64_t timestamp;
+  };
+
+  /** Committed range of a segment, from which a reader reads. */
+  struct ReadPosition {
+    std::shared_ptr<Segment> segment;
+    SequenceNumber seqno = 0;
+    size_t offset = 0;
+    SequenceNumber end_seqno = 0;
+  };
+
+  struct AppendRequest {
+    LogID log_id;
+    Slice data;
+    AppendCallback callback;
+  };
+
+  FileLogStorage(Env* env,
+                 std::shared_ptr<Logger> info_log,
+                 std::string directory,
+                 size_t segment_size);
+
+  std::string LogDirectory(LogID log_id) const;
+
+  Status Recover();
+
+  Status RecoverLog(LogID log_id, Log* log);
+
+  /** Finds a log, or creates it and its directory. */
+  Status GetOrCreateLog(LogID log_id, Log** log);
+
+  /** Writes a segment file and maps it, for the writer. */
+  Status CreateSegment(LogID log_id, Log* log, SequenceNumber first_seqno);
+
+  /** Persists the trim point of a log. */
+  Status WriteTrimPoint(LogID log_id, SequenceNumber seqno);
+
+  void WriterLoop();
+
+  /** Writes, syncs and publishes a group of appends. */
+  void Commit(std::vector<AppendRequest>* requests);
+
+  /** Writes a record to a log, for the writer. */
+  Status WriteRecord(LogID log_id,
+                     Log* log,
+                     const Slice& data,
+                     uint64_t timestamp,
+                     SequenceNumber* seqno);
+
+  /** Flushes buffered records of a log to its segment, for the writer. */
+  Status FlushLog(Log* log);
+
+  SequenceNumber FindTime(LogID log_id, uint64_t timestamp) const;
+
+  /**
+   * Positions a reader at the first committed record at or after a seqno.
+   * Returns false if there is none yet. Must hold mutex_.
+   */
+  bool Seek(const Log& log, SequenceNumber seqno, ReadPosition* pos) const;
+
+  /** Waits until a commit happens after generation, or until timeout. */
+  void WaitForCommit(uint64_t generation, std::chrono::milliseconds timeout);
+
+  /** Wakes up readers, e.g. after a log has been opened. */
+  void NotifyReaders();
+
+  Env* const env_;
+  const std::shared_ptr<Logger> info_log_;
+  const std::string directory_;
+  const size_t segment_size_;
+
+  // Protects the logs, their committed state and the request queue.
+  mutable std::mutex mutex_;
+  // Signalled when requests are queued, or on shutdown.
+  std::condition_variable writer_cv_;
+  // Signalled on commits.
+  std::condition_variable reader_cv_;
+  std::unordered_map<LogID, std::unique_ptr<Log>> logs_;
+  std::vector<AppendRequest> requests_;
+  std::vector<std::function<void()>> tasks_;
+  uint64_t commit_generation_;
+  uint64_t segments_deleted_;
+  bool stop_;
+  Env::ThreadId writer_thread_;
+
+  struct Stats {
+    Stats() {
+      const std::string prefix = "file_storage.";
+      appends = all.AddCounter(prefix + "appends");
+      append_bytes = all.AddCounter(prefix + "append_bytes");
+      append_errors = all.AddCounter(prefix + "append_errors");
+      group_commits = all.AddCounter(prefix + "group_commits");
+      segments_created = all.AddCounter(prefix + "segments_created");
+      segments_deleted = all.AddCounter(prefix + "segments_deleted");
+      commit_records =
+        all.AddHistogram(prefix + "commit_records", 0, 100000, 1);
+      commit_latency_us = all.AddLatency(prefix + "commit_latency_us");
+    }
+
+    Statistics all;
+    Counter* appends;
+    Counter* append_bytes;
+    Counter* append_errors;
+    Counter* group_commits;
+    Counter* segments_created;
+    Counter* segments_deleted;
+    Histogram* commit_records;
+    Histogram* commit_latency_us;
+  } stats_;  // owned by the writer thread
+};
+
+}  // namespace rocketspeed
@@ -0,0 +1,76 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/util/frequency_sketch.h"
+
+#include <algorithm>
+
+namespace rocketspeed {
+
+constexpr uint32_t FrequencySketch::kMaxFrequency;
+constexpr int FrequencySketch::kDepth;
+constexpr size_t FrequencySketch::kCountersPerWord;
+
+FrequencySketch::FrequencySketch(size_t width)
+: width_(kCountersPerWord)
+, additions_(0) {
+  while (width_ < width) {
+    width_ *= 2;
+  }
+  table_.resize(kDepth * width_ / kCountersPerWord, 0);
+  sample_size_ = 10 * width_;
+}
+
+void FrequencySketch::GetIndices(uint32_t hash, size_t* indices) const {
+  // Derive per row indices from two halves of a mixed 64-bit hash.
+  const uint64_t mixed = hash * 0x9E3779B97F4A7C15ULL;
+  const uint32_t h1 = static_cast<uint32_t>(mixed);
+  const uint32_t h2 = static_cast<uint32_t>(mixed >> 32) | 1;
+  for (int i = 0; i < kDepth; ++i) {
+    const size_t column = (h1 + i * h2) & (width_ - 1);
+    indices[i] = i * width_ + column;
+  }
+}
+
+void FrequencySketch::Increment(uint32_t hash) {
+  size_t indices[kDepth];
+  GetIndices(hash, indices);
+  uint32_t min = kMaxFrequency;
+  for (int i = 0; i < kDepth; ++i) {
+    min = std::min(min, GetCounter(indices[i]));
+  }
+  if (min == kMaxFrequency) {
+    return;
+  }
+  for (int i = 0; i < kDepth; ++i) {
+    if (GetCounter(indices[i]) == min) {
+      table_[indices[i] / kCountersPerWord] +=
+        uint64_t(1) << Shift(indices[i]);
+    }
+  }
+  if (++additions_ >= sample_size_) {
+    Age();
+  }
+}
+
+uint32_t FrequencySketch::Estimate(uint32_t hash) const {
+  size_t indices[kDepth];
+  GetIndices(hash, indices);
+  uint32_t min = kMaxFrequency;
+  for (int i = 0; i < kDepth; ++i) {
+    min = std::min(min, GetCounter(indices[i]));
+  }
+  return min;
+}
+
+void FrequencySketch::Age() {
+  for (uint64_t& word : table_) {
+    // Halve all 16 counters at once, dropping bits shifted into neighbours.
+    word = (word >> 1) & 0x7777777777777777ULL;
+  }
+  additions_ /= 2;
+}
+
+}  // namespace rocketspeed
@@ -0,0 +1,75 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rocketspeed {
+
+/**
+ * Count-min sketch estimating how often keys were accessed recently.
+ *
+ * Every key maps to one 4-bit counter in each of four rows. Increments are
+ * conservative (only the smallest counters of a key are incremented), and
+ * the estimate is the minimum of the key's counters. Once the number of
+ * increments reaches ten times the number of counters per row, all counters
+ * are halved, so that the sketch forgets keys that are no longer accessed.
+ *
+ * Used as the frequency filter of TinyLFU cache admission. Not thread safe.
+ */
+class FrequencySketch {
+ public:
+  /** Maximum value of an estimate. */
+  static constexpr uint32_t kMaxFrequency = 15;
+
+  /**
+   * Creates a sketch.
+   *
+   * @param width Number of counters per row, rounded up to a power of two.
+   *              Should be at least the number of keys that are tracked.
+   */
+  explicit FrequencySketch(size_t width);
+
+  /** Records an access to a key with the provided hash. */
+  void Increment(uint32_t hash);
+
+  /** Estimates the number of recent accesses to a key, at most 15. */
+  uint32_t Estimate(uint32_t hash) const;
+
+  /** Number of counters per row. */
+  size_t GetWidth() const { return width_; }
+
+ private:
+  static constexpr int kDepth = 4;
+  static constexpr size_t kCountersPerWord = 16;
+
+  /** Computes the index of a key's counter in each row. */
+  void GetIndices(uint32_t hash, size_t* indices) const;
+
+  uint32_t GetCounter(size_t index) const {
+    const uint64_t word = table_[index / kCountersPerWord];
+    return static_cast<uint32_t>(word >> Shift(index)) & 0xF;
+  }
+
+  static size_t Shift(size_t index) {
+    return 4 * (index % kCountersPerWord);
+  }
+
+  /** Halves all counters. */
+  void Age();
+
+  size_t width_;
+  /** Counters of all rows, 16 to a word. */
+  std::vector<uint64_t> table_;
+  /** Number of increments since the counters were last halved. */
+  size_t additions_;
+  /** Number of increments after which counters are halved. */
+  size_t sample_size_;
+};
+
+}  // namespace rocketspeed
@@ -5,7 +5,12 @@
 //
 #define __STDC_FORMAT_MACROS
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "include/Status.h"
 #include "include/Types.h"
@@ -29,6 +34,83 @@ class BufferedLogStorageTest : public ::testing::Test {
   }
 
  protected:
+  // Batches of up to 16 records, so 4 bits of seqno per batch.
+  static constexpr size_t kCompressedBatchEntries = 16;
+  static constexpr size_t kCompressedBatchBits = 4;
+
+  static BatchCompressionOptions CompressionOptions() {
+    BatchCompressionOptions compression;
+    compression.type = BatchCompression::kZlib;
+    compression.dictionary_bytes = 1024;
+    compression.dictionary_interval = 20;
+    return compression;
+  }
+
+  // Null if built without zlib.
+  std::unique_ptr<LogStorage> CreateCompressedStorage(
+      MsgLoop* loop,
+      std::shared_ptr<LogStorage> underlying,
+      BatchCompressionOptions compression) {
+    LogStorage* storage;
+    Status st =
+      BufferedLogStorage::Create(env,
+                                 info_log,
+                                 std::move(underlying),
+                                 loop,
+                                 kCompressedBatchEntries,
+                                 std::numeric_limits<size_t>::max(),
+                                 std::chrono::microseconds(1000),
+                                 false,
+                                 compression,
+                                 &storage);
+    if (st.IsNotSupported()) {
+      return nullptr;
+    }
+    EXPECT_OK(st);
+    return std::unique_ptr<LogStorage>(st.ok() ? storage : nullptr);
+  }
+
+  // Appends small and similar payloads, a batch at a time, and waits for
+  // all appends to complete.
+  void AppendCompressible(LogStorage* storage,
+                          LogID log_id,
+                          std::vector<std::string>* msgs) {
+    const size_t kNumMessages = 1000;
+    msgs->clear();
+    for (size_t i = 0; i < kNumMessages; ++i) {
+      msgs->push_back("{\"user\": " + std::to_string(i % 37) +
+                      ", \"status\": \"online\", \"seq\": " +
+                      std::to_string(i) + "}");
+    }
+    port::Semaphore sem;
+    for (size_t i = 0; i < kNumMessages; ++i) {
+      ASSERT_OK(storage->AppendAsync(log_id, (*msgs)[i],
+        [&sem] (Status status, SequenceNumber seqno) {
+          ASSERT_OK(status);
+          sem.Post();
+        }));
+      if (i % kCompressedBatchEntries == kCompressedBatchEntries - 1) {
+        /* sleep override */
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    for (size_t i = 0; i < kNumMessages; ++i) {
+      ASSERT_TRUE(sem.TimedWait(std::chrono::seconds(1)));
+    }
+  }
+
+  // Index of the first dictionary record, which has a zero batch size and
+  // special record kind 2, or the number of records.
+  static size_t FindDictionary(const std::vector<std::string>& records) {
+    size_t i = 0;
+    while (i < records.size() &&
+           !(records[i].size() >= 2 && records[i][0] == 0 &&
+             records[i][1] == 2)) {
+      ++i;
+    }
+    return i;
+  }
+
   Env* const env;
   std::shared_ptr<rocketspeed::Logger> info_log;
   std::pair<LogID, LogID> log_range;
@@ -51,6 +133,8 @@ TEST_F(BufferedLogStorageTest, Creation) {
                                128,
                                4096,
                                std::chrono::microseconds(10000),
+                               false,
+                               BatchCompressionOptions(),
                                &storage);
   std::unique_ptr<LogStorage> owned_storage(storage);
   ASSERT_OK(st);
@@ -100,6 +184,8 @@ class VerifyingReader : public AsyncLogReader {
     return result;
   }
 
+  SequenceNumber GetNextSeqno() const { return next_seqno_; }
+
   bool DeliverGap(LogID log_id, GapType type, size_t num_seqnos) {
     EXPECT_TRUE(open_log_ == log_id);
     EXPECT_GE(num_seqnos, 1);
@@ -148,20 +234,24 @@ class VerifyingStorage : public LogStorage {
       std::function<bool(LogRecord&)> record_cb,
       std::function<bool(const GapRecord&)> gap_cb,
       std::vector<AsyncLogReader*>* readers) {
-    EXPECT_TRUE(!verify_reader_);
     EXPECT_EQ(1, parallelism);
     verify_reader_ = new VerifyingReader(record_cb, gap_cb);
     readers->push_back(verify_reader_);
+    ++num_readers_;
     return Status::OK();
   }
 
   virtual bool CanSubscribePastEnd() const { return true; }
 
+  // The reader created last, owned by the caller.
   VerifyingReader* GetReader() { return verify_reader_; }
 
+  size_t GetNumReaders() const { return num_readers_; }
+
  private:
   std::function<void(LogID, Slice)> on_append_;
   VerifyingReader* verify_reader_;
+  size_t num_readers_ = 0;
   std::mutex mutex_;
   std::unordered_map<LogID, SequenceNumber> seqnos_;
 };
@@ -198,6 +288,8 @@ TEST_F(BufferedLogStorageTest, SingleBatching) {
                                8,
                                1,
                                std::chrono::microseconds(1),
+                               false,
+                               BatchCompressionOptions(),
                                &storage);
   std::unique_ptr<LogStorage> owned_storage(storage);
   ASSERT_OK(st);
@@ -263,6 +355,8 @@ TEST_F(BufferedLogStorageTest, CountLimitedBatch) {
                                kBatchSize,
                                std::numeric_limits<size_t>::max(),
                                std::chrono::microseconds(1000000),
+                               false,
+                               BatchCompressionOptions(),
                                &storage);
   std::unique_ptr<LogStorage> owned_storage(storage);
   ASSERT_OK(st);
@@ -328,6 +422,8 @@ TEST_F(BufferedLogStorageTest, ByteLimitedBatches) {
                                255,
                                kByteLimit,
                                std::chrono::microseconds(100000),
+                               false,
+                               BatchCompressionOptions(),
                                &storage);
   std::unique_ptr<LogStorage> owned_storage(storage);
   ASSERT_OK(st);
@@ -394,6 +490,8 @@ TEST_F(BufferedLogStorageTest, LatencyLimitedBatches) {
                                255,
                                std::numeric_limits<size_t>::max(),
                                time_limit,
+                               false,
+                               BatchCompressionOptions(),
                                &storage);
   std::unique_ptr<LogStorage> owned_storage(storage);
   ASSERT_OK(st);
@@ -420,6 +518,401 @@ TEST_F(BufferedLogStorageTest, LatencyLimitedBatches) {
   }
 }
 
+// Storage that completes appends after a fixed delay, on its own thread.
+class DelayedStorage : public LogStorage {
+ public:
+  explicit DelayedStorage(std::chrono::milliseconds delay)
+  : delay_(delay)
+  , stop_(false)
+  , thread_([this] () { Run(); }) {}
+
+  ~DelayedStorage() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  Status AppendAsync(LogID id,
+                     const Slice& data,
+                     AppendCallback callback) override {
+    Slice slice(data);
+    uint8_t batch_size;
+    EXPECT_TRUE(GetFixed8(&slice, &batch_size));
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch_sizes_.push_back(batch_size);
+    pending_.emplace_back(std::chrono::steady_clock::now() + delay_,
+                          std::move(callback));
+    cv_.notify_one();
+    return Status::OK();
+  }
+
+  Status FindTimeAsync(
+    LogID id,
+    std::chrono::milliseconds timestamp,
+    std::function<void(Status, SequenceNumber)> callback) override {
+    return Status::NotSupported("");
+  }
+
+  Status CreateAsyncReaders(
+      unsigned int parallelism,
+      std::function<bool(LogRecord&)> record_cb,
+      std::function<bool(const GapRecord&)> gap_cb,
+      std::vector<AsyncLogReader*>* readers) override {
+    return Status::NotSupported("");
+  }
+
+  bool CanSubscribePastEnd() const override { return true; }
+
+  std::vector<size_t> GetBatchSizes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return batch_sizes_;
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    SequenceNumber seqno = 0;
+    while (!stop_) {
+      if (pending_.empty()) {
+        cv_.wait(lock);
+        continue;
+      }
+      auto deadline = pending_.front().first;
+      if (std::chrono::steady_clock::now() < deadline) {
+        cv_.wait_until(lock, deadline);
+        continue;
+      }
+      auto callback = std::move(pending_.front().second);
+      pending_.pop_front();
+      lock.unlock();
+      callback(Status::OK(), seqno++);
+      lock.lock();
+    }
+  }
+
+  const std::chrono::milliseconds delay_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::pair<std::chrono::steady_clock::time_point,
+                       AppendCallback>> pending_;
+  std::vector<size_t> batch_sizes_;
+  bool stop_;
+  std::thread thread_;
+};
+
+TEST_F(BufferedLogStorageTest, AdaptiveBatching) {
+  MsgLoop loop(env, EnvOptions(), -1, 1, info_log, "loop");
+  ASSERT_OK(loop.Initialize());
+
+  auto delayed_storage =
+    std::make_shared<DelayedStorage>(std::chrono::milliseconds(20));
+
+  // The latency limit is far longer than the test, only adaptive batching
+  // flushes batches in time.
+  LogStorage* storage;
+  Status st =
+    BufferedLogStorage::Create(env,
+                               info_log,
+                               delayed_storage,
+                               &loop,
+                               255,
+                               std::numeric_limits<size_t>::max(),
+                               std::chrono::seconds(100),
+                               true,
+                               BatchCompressionOptions(),
+                               &storage);
+  std::unique_ptr<LogStorage> owned_storage(storage);
+  ASSERT_OK(st);
+
+  // Must live shorter than storage.
+  MsgLoopThread t1(env, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  const LogID kLogID = 123;
+  const size_t kNumMessages = 2000;
+  std::string msgs[kNumMessages];  // to keep slice memory around
+  port::Semaphore sem;
+  auto append = [&] (size_t i) {
+    msgs[i] = std::to_string(i);
+    ASSERT_OK(storage->AppendAsync(kLogID, msgs[i],
+      [&sem] (Status status, SequenceNumber seqno) {
+        ASSERT_OK(status);
+        sem.Post();
+      }));
+  };
+
+  // A lone request is not held back.
+  append(0);
+  ASSERT_TRUE(sem.TimedWait(std::chrono::seconds(1)));
+  ASSERT_EQ(delayed_storage->GetBatchSizes(), std::vector<size_t>({1}));
+
+  // Requests arriving while appends are in flight are batched, in batches
+  // sized to the arrival rate.
+  for (size_t i = 1; i < kNumMessages; ++i) {
+    append(i);
+    if (i % 10 == 0) {
+      /* sleep override */
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  for (size_t i = 1; i < kNumMessages; ++i) {
+    ASSERT_TRUE(sem.TimedWait(std::chrono::seconds(1)));
+  }
+  auto batch_sizes = delayed_storage->GetBatchSizes();
+  size_t total = 0;
+  for (size_t batch_size : batch_sizes) {
+    total += batch_size;
+  }
+  ASSERT_EQ(total, kNumMessages);
+  ASSERT_LT(batch_sizes.size(), kNumMessages / 10);
+
+  auto stats = storage->GetStatistics();
+  ASSERT_GT(stats.GetCounterValue(
+    "pilot.buffered_storage.completion_flushes"), 0);
+  ASSERT_GT(stats.GetCounterValue(
+    "pilot.buffered_storage.idle_flushes"), 0);
+}
+
+TEST_F(BufferedLogStorageTest, CompressedBatches) {
+  MsgLoop loop(env, EnvOptions(), -1, 1, info_log, "loop");
+  ASSERT_OK(loop.Initialize());
+
+  // Batch records, in order of appends.
+  std::mutex mutex;
+  std::vector<std::string> appended;
+  auto verify_storage = std::make_shared<VerifyingStorage>(
+    [&] (LogID log_id, Slice slice) {
+      std::lock_guard<std::mutex> lock(mutex);
+      appended.push_back(slice.ToString());
+    });
+
+  std::unique_ptr<LogStorage> storage =
+    CreateCompressedStorage(&loop, verify_storage, CompressionOptions());
+  if (!storage) {
+    // Built without zlib.
+    return;
+  }
+
+  // Must live shorter than storage.
+  MsgLoopThread t1(env, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  const LogID kLogID = 123;
+  std::vector<std::string> msgs;
+  AppendCompressible(storage.get(), kLogID, &msgs);
+
+  auto stats = storage->GetStatistics();
+  ASSERT_GT(stats.GetCounterValue(
+    "pilot.buffered_storage.compressed_batches"), 0);
+  ASSERT_GT(stats.GetCounterValue(
+    "pilot.buffered_storage.dictionaries_written"), 1);
+  ASSERT_LT(3 * stats.GetCounterValue(
+              "pilot.buffered_storage.compression_output_bytes"),
+            stats.GetCounterValue(
+              "pilot.buffered_storage.compression_input_bytes"));
+
+  // Readers see the original payloads, and gaps for dictionaries.
+  std::vector<std::string> received;
+  size_t gaps = 0;
+  std::vector<AsyncLogReader*> readers;
+  ASSERT_OK(storage->CreateAsyncReaders(1,
+    [&] (LogRecord& record) {
+      received.push_back(record.payload.ToString());
+      return true;
+    },
+    [&] (const GapRecord& gap) {
+      EXPECT_TRUE(gap.type == GapType::kBenign);
+      ++gaps;
+      return true;
+    },
+    &readers));
+  std::unique_ptr<AsyncLogReader> reader(readers[0]);
+  ASSERT_OK(reader->Open(kLogID, 0));
+  auto verify_reader = verify_storage->GetReader();
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const std::string& record : appended) {
+    ASSERT_TRUE(verify_reader->DeliverRecord(kLogID, record));
+  }
+  ASSERT_TRUE(received == msgs);
+  ASSERT_GT(gaps, 0);
+}
+
+TEST_F(BufferedLogStorageTest, DictionaryMaxAge) {
+  MsgLoop loop(env, EnvOptions(), -1, 1, info_log, "loop");
+  ASSERT_OK(loop.Initialize());
+
+  auto verify_storage =
+    std::make_shared<VerifyingStorage>([&](LogID log_id, Slice slice) {});
+
+  // Dictionaries are rebuilt by age only.
+  BatchCompressionOptions compression = CompressionOptions();
+  compression.dictionary_interval = std::numeric_limits<size_t>::max();
+  compression.dictionary_max_age = std::chrono::milliseconds(1);
+  std::unique_ptr<LogStorage> storage =
+    CreateCompressedStorage(&loop, verify_storage, compression);
+  if (!storage) {
+    // Built without zlib.
+    return;
+  }
+
+  // Must live shorter than storage.
+  MsgLoopThread t1(env, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  std::vector<std::string> msgs;
+  AppendCompressible(storage.get(), 123, &msgs);
+
+  auto stats = storage->GetStatistics();
+  ASSERT_GT(stats.GetCounterValue(
+    "pilot.buffered_storage.dictionaries_written"), 1);
+}
+
+TEST_F(BufferedLogStorageTest, FetchDictionary) {
+  MsgLoop loop(env, EnvOptions(), -1, 1, info_log, "loop");
+  ASSERT_OK(loop.Initialize());
+
+  // Batch records, in order of appends.
+  std::mutex mutex;
+  std::vector<std::string> appended;
+  auto verify_storage = std::make_shared<VerifyingStorage>(
+    [&] (LogID log_id, Slice slice) {
+      std::lock_guard<std::mutex> lock(mutex);
+      appended.push_back(slice.ToString());
+    });
+
+  std::unique_ptr<LogStorage> storage =
+    CreateCompressedStorage(&loop, verify_storage, CompressionOptions());
+  if (!storage) {
+    // Built without zlib.
+    return;
+  }
+
+  // Must live shorter than storage.
+  MsgLoopThread t1(env, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  const LogID kLogID = 123;
+  std::vector<std::string> msgs;
+  AppendCompressible(storage.get(), kLogID, &msgs);
+
+  // Reading starts past the first dictionary record, so batches using it
+  // wait while it is read from the log by another reader.
+  std::lock_guard<std::mutex> lock(mutex);
+  const size_t start = FindDictionary(appended) + 1;
+  ASSERT_LT(start, appended.size());
+
+  std::vector<std::string> received;
+  std::vector<AsyncLogReader*> readers;
+  ASSERT_OK(storage->CreateAsyncReaders(1,
+    [&] (LogRecord& record) {
+      received.push_back(record.payload.ToString());
+      return true;
+    },
+    [&] (const GapRecord& gap) {
+      EXPECT_TRUE(gap.type == GapType::kBenign);
+      return true;
+    },
+    &readers));
+  std::unique_ptr<AsyncLogReader> reader(readers[0]);
+  ASSERT_OK(reader->Open(kLogID, start << kCompressedBatchBits));
+  auto verify_reader = verify_storage->GetReader();
+  size_t fetches = 0;
+  for (size_t i = start; i < appended.size(); ++i) {
+    if (verify_reader->DeliverRecord(kLogID, appended[i])) {
+      continue;
+    }
+    ++fetches;
+    auto fetch_reader = verify_storage->GetReader();
+    ASSERT_TRUE(fetch_reader != verify_reader);
+    const SequenceNumber seqno = fetch_reader->GetNextSeqno();
+    ASSERT_LT(seqno, start);
+    ASSERT_TRUE(fetch_reader->DeliverRecord(kLogID, appended[seqno]));
+    ASSERT_TRUE(verify_reader->DeliverRecord(kLogID, appended[i]));
+  }
+  ASSERT_GT(fetches, 0);
+
+  // All payloads from the start point.
+  ASSERT_GT(received.size(), 0);
+  ASSERT_LT(received.size(), msgs.size());
+  ASSERT_TRUE(std::equal(received.begin(), received.end(),
+                         msgs.end() - received.size()));
+}
+
+TEST_F(BufferedLogStorageTest, TrimmedDictionary) {
+  MsgLoop loop(env, EnvOptions(), -1, 1, info_log, "loop");
+  ASSERT_OK(loop.Initialize());
+
+  // Batch records, in order of appends.
+  std::mutex mutex;
+  std::vector<std::string> appended;
+  auto verify_storage = std::make_shared<VerifyingStorage>(
+    [&] (LogID log_id, Slice slice) {
+      std::lock_guard<std::mutex> lock(mutex);
+      appended.push_back(slice.ToString());
+    });
+
+  std::unique_ptr<LogStorage> storage =
+    CreateCompressedStorage(&loop, verify_storage, CompressionOptions());
+  if (!storage) {
+    // Built without zlib.
+    return;
+  }
+
+  // Must live shorter than storage.
+  MsgLoopThread t1(env, &loop, "loop");
+  ASSERT_OK(loop.WaitUntilRunning());
+
+  const LogID kLogID = 123;
+  std::vector<std::string> msgs;
+  AppendCompressible(storage.get(), kLogID, &msgs);
+
+  // The first dictionary record has been trimmed, batches using it are
+  // retention gaps rather than data loss.
+  std::lock_guard<std::mutex> lock(mutex);
+  const size_t start = FindDictionary(appended) + 1;
+  ASSERT_LT(start, appended.size());
+
+  std::vector<std::string> received;
+  size_t retention_gaps = 0;
+  std::vector<AsyncLogReader*> readers;
+  ASSERT_OK(storage->CreateAsyncReaders(1,
+    [&] (LogRecord& record) {
+      received.push_back(record.payload.ToString());
+      return true;
+    },
+    [&] (const GapRecord& gap) {
+      EXPECT_TRUE(gap.type != GapType::kDataLoss);
+      if (gap.type == GapType::kRetention) {
+        ++retention_gaps;
+      }
+      return true;
+    },
+    &readers));
+  std::unique_ptr<AsyncLogReader> reader(readers[0]);
+  ASSERT_OK(reader->Open(kLogID, start << kCompressedBatchBits));
+  auto verify_reader = verify_storage->GetReader();
+  size_t fetches = 0;
+  for (size_t i = start; i < appended.size(); ++i) {
+    if (verify_reader->DeliverRecord(kLogID, appended[i])) {
+      continue;
+    }
+    ++fetches;
+    auto fetch_reader = verify_storage->GetReader();
+    ASSERT_TRUE(fetch_reader != verify_reader);
+    ASSERT_TRUE(fetch_reader->DeliverGap(kLogID, GapType::kRetention, 1));
+    ASSERT_TRUE(verify_reader->DeliverRecord(kLogID, appended[i]));
+  }
+  ASSERT_GT(fetches, 0);
+  ASSERT_EQ(retention_gaps, fetches);
+
+  // Batches using later dictionaries are still read.
+  ASSERT_GT(received.size(), 0);
+  ASSERT_EQ(received.back(), msgs.back());
+}
+
 TEST_F(BufferedLogStorageTest, AsyncReader) {
   MsgLoop loop(env, EnvOptions(), -1, 4, info_log, "loop");
   ASSERT_OK(loop.Initialize());
@@ -438,6 +931,8 @@ TEST_F(BufferedLogStorageTest, AsyncReader) {
                                          max_batch_entries,
                                          std::numeric_limits<size_t>::max(),
                                          std::chrono::seconds(1),
+                                         false,
+                                         BatchCompressionOptions(),
                                          &storage);
   std::unique_ptr<LogStorage> owned_storage(storage);
   ASSERT_OK(st);
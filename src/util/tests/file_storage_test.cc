@@ -0,0 +1,299 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/util/file_storage.h"
+#include "src/util/testharness.h"
+
+#include <algorithm>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rocketspeed {
+
+class FileLogStorageTest : public ::testing::Test {
+ public:
+  FileLogStorageTest()
+  : env(Env::Default())
+  , directory(test::TmpDir() + "/file_log_storage") {
+    env->DeleteDirRecursive(directory);
+    EXPECT_OK(test::CreateLogger(env, "FileLogStorageTest", &info_log));
+  }
+
+ protected:
+  // Records and gaps delivered to readers, in order of delivery.
+  struct Delivered {
+    std::mutex mutex;
+    std::vector<std::pair<SequenceNumber, std::string>> records;
+    std::vector<GapRecord> gaps;
+
+    size_t NumRecords() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return records.size();
+    }
+
+    size_t NumGaps() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return gaps.size();
+    }
+  };
+
+  std::unique_ptr<FileLogStorage> Open(size_t segment_size) {
+    FileLogStorage* storage = nullptr;
+    EXPECT_OK(FileLogStorage::Create(env, info_log, directory, segment_size,
+                                     &storage));
+    return std::unique_ptr<FileLogStorage>(storage);
+  }
+
+  std::unique_ptr<AsyncLogReader> CreateReader(FileLogStorage* storage,
+                                               Delivered* delivered) {
+    std::vector<AsyncLogReader*> readers;
+    EXPECT_OK(storage->CreateAsyncReaders(1,
+      [delivered] (LogRecord& record) {
+        std::lock_guard<std::mutex> lock(delivered->mutex);
+        delivered->records.emplace_back(record.seqno,
+                                        record.payload.ToString());
+        return true;
+      },
+      [delivered] (const GapRecord& gap) {
+        std::lock_guard<std::mutex> lock(delivered->mutex);
+        delivered->gaps.push_back(gap);
+        return true;
+      },
+      &readers));
+    EXPECT_EQ(readers.size(), 1);
+    return std::unique_ptr<AsyncLogReader>(readers[0]);
+  }
+
+  // Appends and waits for the seqno.
+  SequenceNumber Append(FileLogStorage* storage,
+                        LogID log_id,
+                        const std::string& data) {
+    std::promise<SequenceNumber> promise;
+    EXPECT_OK(storage->AppendAsync(log_id, data,
+      [&] (Status st, SequenceNumber seqno) {
+        EXPECT_OK(st);
+        promise.set_value(seqno);
+      }));
+    return promise.get_future().get();
+  }
+
+  SequenceNumber FindTime(FileLogStorage* storage,
+                          LogID log_id,
+                          std::chrono::milliseconds timestamp) {
+    std::promise<SequenceNumber> promise;
+    EXPECT_OK(storage->FindTimeAsync(log_id, timestamp,
+      [&] (Status st, SequenceNumber seqno) {
+        EXPECT_OK(st);
+        promise.set_value(seqno);
+      }));
+    return promise.get_future().get();
+  }
+
+  Env* const env;
+  const std::string directory;
+  std::shared_ptr<Logger> info_log;
+};
+
+TEST_F(FileLogStorageTest, AppendRead) {
+  // Small segments, so that logs span many of them.
+  auto storage = Open(4096);
+  Delivered tailing;
+  auto tailer = CreateReader(storage.get(), &tailing);
+  ASSERT_OK(tailer->Open(1));
+
+  // Appends in flight together are committed as a group.
+  const size_t num_records = 1000;
+  std::mutex mutex;
+  std::vector<SequenceNumber> seqnos;
+  // Must outlive the appends.
+  std::vector<std::string> payloads;
+  for (size_t i = 0; i < num_records; ++i) {
+    for (LogID log_id : {1, 2}) {
+      payloads.push_back("log" + std::to_string(log_id) + "." +
+                         std::to_string(i));
+    }
+  }
+  for (size_t i = 0; i < num_records; ++i) {
+    for (LogID log_id : {1, 2}) {
+      ASSERT_OK(storage->AppendAsync(log_id, payloads[2 * i + log_id - 1],
+        [&, log_id] (Status st, SequenceNumber seqno) {
+          ASSERT_OK(st);
+          if (log_id == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            seqnos.push_back(seqno);
+          }
+        }));
+    }
+  }
+  ASSERT_EVENTUALLY_TRUE(tailing.NumRecords() == num_records);
+  ASSERT_EVENTUALLY_TRUE(storage->GetStatistics().GetCounterValue(
+    "file_storage.appends") == 2 * num_records);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(seqnos.size(), num_records);
+    for (size_t i = 0; i < num_records; ++i) {
+      ASSERT_EQ(seqnos[i], FileLogStorage::kFirstSeqno + i);
+    }
+  }
+  auto stats = storage->GetStatistics();
+  ASSERT_GT(stats.GetCounterValue("file_storage.segments_created"), 2);
+  ASSERT_LT(stats.GetCounterValue("file_storage.group_commits"),
+            2 * num_records);
+
+  // Tailing reader got log 1, in order.
+  for (size_t i = 0; i < num_records; ++i) {
+    ASSERT_EQ(tailing.records[i].first, FileLogStorage::kFirstSeqno + i);
+    ASSERT_EQ(tailing.records[i].second, "log1." + std::to_string(i));
+  }
+  ASSERT_EQ(tailing.NumGaps(), 0);
+
+  // Reads of a range of log 2, starting mid segment.
+  Delivered range;
+  auto reader = CreateReader(storage.get(), &range);
+  ASSERT_OK(reader->Open(2, 500, 700));
+  ASSERT_EVENTUALLY_TRUE(range.NumRecords() == 201);
+  ASSERT_EQ(range.records.front().first, 500);
+  ASSERT_EQ(range.records.front().second, "log2.499");
+  ASSERT_EQ(range.records.back().first, 700);
+
+  // Closed logs are not delivered.
+  ASSERT_OK(tailer->Close(1));
+  Append(storage.get(), 1, "closed");
+  env->SleepForMicroseconds(10000);
+  ASSERT_EQ(tailing.NumRecords(), num_records);
+
+  // Records larger than a segment are rejected.
+  const std::string large(4096, 'x');
+  ASSERT_TRUE(!storage->AppendAsync(1, large,
+    [] (Status, SequenceNumber) {}).ok());
+}
+
+TEST_F(FileLogStorageTest, FindTime) {
+  auto storage = Open(4096);
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds::max()),
+            FileLogStorage::kFirstSeqno);
+
+  auto now = [this] () {
+    return std::chrono::milliseconds(env->NowMicros() / 1000);
+  };
+  const auto before = now();
+  for (int i = 0; i < 300; ++i) {
+    Append(storage.get(), 1, std::to_string(i));
+  }
+  env->SleepForMicroseconds(5000);
+  const auto middle = now();
+  env->SleepForMicroseconds(5000);
+  for (int i = 300; i < 600; ++i) {
+    Append(storage.get(), 1, std::to_string(i));
+  }
+
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds(0)), 1);
+  ASSERT_EQ(FindTime(storage.get(), 1, before), 1);
+  ASSERT_EQ(FindTime(storage.get(), 1, middle), 301);
+  ASSERT_EQ(FindTime(storage.get(), 1, now() + std::chrono::seconds(1)),
+            601);
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds::max()),
+            601);
+}
+
+TEST_F(FileLogStorageTest, Trim) {
+  auto storage = Open(4096);
+  for (int i = 0; i < 1000; ++i) {
+    Append(storage.get(), 1, std::to_string(i));
+  }
+  ASSERT_OK(storage->Trim(1, 500));
+  ASSERT_GT(storage->GetStatistics().GetCounterValue(
+    "file_storage.segments_deleted"), 0);
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds(0)), 501);
+
+  // Trimmed records are a retention gap.
+  Delivered delivered;
+  auto reader = CreateReader(storage.get(), &delivered);
+  ASSERT_OK(reader->Open(1, 1));
+  ASSERT_EVENTUALLY_TRUE(delivered.NumRecords() == 500);
+  ASSERT_EQ(delivered.gaps.size(), 1);
+  ASSERT_TRUE(delivered.gaps[0].type == GapType::kRetention);
+  ASSERT_EQ(delivered.gaps[0].from, 1);
+  ASSERT_EQ(delivered.gaps[0].to, 500);
+  ASSERT_EQ(delivered.records.front().first, 501);
+
+  // Trim points are capped at the last record.
+  ASSERT_OK(storage->Trim(1, 5000));
+  ASSERT_EQ(Append(storage.get(), 1, "next"), 1001);
+}
+
+TEST_F(FileLogStorageTest, Backpressure) {
+  auto storage = Open(4096);
+  for (int i = 0; i < 3; ++i) {
+    Append(storage.get(), 1, std::to_string(i));
+  }
+
+  // Refuses each record once, moving out the context of the second one.
+  std::mutex mutex;
+  std::vector<std::pair<SequenceNumber, std::string>> attempts;
+  std::vector<AsyncLogReader*> readers;
+  ASSERT_OK(storage->CreateAsyncReaders(1,
+    [&] (LogRecord& record) {
+      std::lock_guard<std::mutex> lock(mutex);
+      const bool retry = attempts.empty() ||
+                         attempts.back().first != record.seqno;
+      attempts.emplace_back(record.seqno, record.payload.ToString());
+      if (retry && record.seqno == 2) {
+        auto context = std::move(record.context);
+      }
+      return !retry;
+    },
+    [] (const GapRecord&) { return true; },
+    &readers));
+  std::unique_ptr<AsyncLogReader> reader(readers[0]);
+  ASSERT_OK(reader->Open(1, 1));
+  ASSERT_EVENTUALLY_TRUE([&] () {
+    std::lock_guard<std::mutex> lock(mutex);
+    return attempts.size() == 6;
+  }());
+  reader.reset();
+
+  // Moved records come back without payload.
+  std::vector<std::pair<SequenceNumber, std::string>> expected = {
+    {1, "0"}, {1, "0"}, {2, "1"}, {2, ""}, {3, "2"}, {3, "2"},
+  };
+  ASSERT_TRUE(attempts == expected);
+}
+
+TEST_F(FileLogStorageTest, Recovery) {
+  {
+    auto storage = Open(4096);
+    for (int i = 0; i < 1000; ++i) {
+      Append(storage.get(), i % 2 + 1, std::to_string(i));
+    }
+    ASSERT_OK(storage->Trim(2, 100));
+  }
+
+  auto storage = Open(4096);
+  ASSERT_EQ(FindTime(storage.get(), 1, std::chrono::milliseconds::max()),
+            501);
+  ASSERT_EQ(Append(storage.get(), 1, "1000"), 501);
+
+  Delivered delivered;
+  auto reader = CreateReader(storage.get(), &delivered);
+  ASSERT_OK(reader->Open(1, 1));
+  ASSERT_OK(reader->Open(2, 1));
+  ASSERT_EVENTUALLY_TRUE(delivered.NumRecords() == 501 + 400);
+  ASSERT_EQ(delivered.gaps.size(), 1);
+  ASSERT_EQ(delivered.gaps[0].log_id, 2);
+  ASSERT_EQ(delivered.gaps[0].to, 100);
+  // Appended after recovery.
+  ASSERT_TRUE(std::find(delivered.records.begin(), delivered.records.end(),
+    std::make_pair(SequenceNumber(501), std::string("1000"))) !=
+    delivered.records.end());
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests(argc, argv);
+}
@@ -0,0 +1,156 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/util/timer_wheel.h"
+#include "src/util/testharness.h"
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace rocketspeed {
+
+class TimerWheelTest : public ::testing::Test {};
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+typedef std::chrono::milliseconds Millis;
+
+TEST_F(TimerWheelTest, Basic) {
+  const TimePoint start = std::chrono::steady_clock::now();
+  TimerWheel<std::string> timers(Millis(10), start);
+  auto red = timers.Add("red", start + Millis(50));
+  timers.Add("green", start + Millis(25));
+  timers.Add("blue", start + Millis(5000));
+  ASSERT_EQ(timers.Size(), 3);
+  ASSERT_TRUE(timers.IsPending(red));
+
+  std::vector<std::string> expired;
+  auto collect = [&] (std::string colour) { expired.push_back(colour); };
+
+  // Not before the deadline.
+  timers.ProcessExpired(start + Millis(29), collect);
+  ASSERT_TRUE(expired.empty());
+  timers.ProcessExpired(start + Millis(30), collect);
+  ASSERT_EQ(expired, std::vector<std::string>({"green"}));
+
+  ASSERT_TRUE(timers.Cancel(red));
+  ASSERT_TRUE(!timers.Cancel(red));
+  ASSERT_TRUE(!timers.IsPending(red));
+  timers.ProcessExpired(start + Millis(4999), collect);
+  ASSERT_EQ(expired.size(), 1);
+  timers.ProcessExpired(start + Millis(5000), collect);
+  ASSERT_EQ(expired, std::vector<std::string>({"green", "blue"}));
+  ASSERT_TRUE(timers.Empty());
+
+  // Deadlines in the past fire on the next tick.
+  timers.Add("yellow", start);
+  timers.ProcessExpired(start + Millis(5009), collect);
+  ASSERT_EQ(expired.size(), 2);
+  timers.ProcessExpired(start + Millis(5010), collect);
+  ASSERT_EQ(expired.back(), "yellow");
+}
+
+TEST_F(TimerWheelTest, StaleHandle) {
+  const TimePoint start = std::chrono::steady_clock::now();
+  TimerWheel<int> timers(Millis(1), start);
+  auto first = timers.Add(1, start + Millis(1));
+  timers.ProcessExpired(start + Millis(1), [] (int) {});
+  ASSERT_TRUE(!timers.IsPending(first));
+
+  // Storage of the fired timer is reused, but not its handle.
+  auto second = timers.Add(2, start + Millis(10));
+  ASSERT_NE(first, second);
+  ASSERT_TRUE(!timers.Cancel(first));
+  ASSERT_TRUE(timers.IsPending(second));
+  ASSERT_TRUE(!timers.Cancel(TimerWheel<int>::kInvalidHandle));
+}
+
+TEST_F(TimerWheelTest, Reentrant) {
+  // Timers re-armed from their own expiry, like periodic restarts.
+  const TimePoint start = std::chrono::steady_clock::now();
+  TimerWheel<int> timers(Millis(1), start);
+  TimePoint now = start;
+  int fired = 0;
+  timers.Add(0, start + Millis(7));
+  for (int i = 0; i < 1000; ++i) {
+    now += Millis(1);
+    timers.ProcessExpired(now, [&] (int value) {
+      ++fired;
+      timers.Add(value, now + Millis(7));
+    });
+  }
+  ASSERT_EQ(fired, 142);
+  ASSERT_EQ(timers.Size(), 1);
+}
+
+TEST_F(TimerWheelTest, Random) {
+  // Compare against a multimap, with deadlines across all levels.
+  const TimePoint start = std::chrono::steady_clock::now();
+  TimerWheel<int> timers(std::chrono::microseconds(1), start);
+  std::multimap<uint64_t, int> expected;
+  std::map<int, TimerWheel<int>::Handle> handles;
+  std::map<int, uint64_t> deadlines;
+  std::mt19937_64 rng(42);
+  uint64_t now = 0;
+  int next_value = 0;
+
+  for (int i = 0; i < 20000; ++i) {
+    const int action = static_cast<int>(rng() % 10);
+    if (action < 5) {
+      // Deadlines from the next few ticks to beyond the last level.
+      const int bits = static_cast<int>(rng() % 36);
+      const uint64_t deadline = now + 1 + rng() % (uint64_t(1) << bits);
+      const int value = next_value++;
+      handles[value] = timers.Add(value,
+        start + std::chrono::microseconds(deadline));
+      deadlines[value] = deadline;
+      expected.emplace(deadline, value);
+    } else if (action < 7 && !handles.empty()) {
+      auto it = handles.lower_bound(static_cast<int>(rng() % next_value));
+      if (it == handles.end()) {
+        it = handles.begin();
+      }
+      ASSERT_TRUE(timers.Cancel(it->second));
+      auto range = expected.equal_range(deadlines[it->first]);
+      for (auto e = range.first; e != range.second; ++e) {
+        if (e->second == it->first) {
+          expected.erase(e);
+          break;
+        }
+      }
+      handles.erase(it);
+    } else {
+      // Mostly short steps, sometimes a jump to the next pending deadline.
+      if (action == 9 && !expected.empty()) {
+        now = expected.begin()->first;
+      } else {
+        now += rng() % 1000;
+      }
+      std::vector<int> fired;
+      timers.ProcessExpired(start + std::chrono::microseconds(now),
+        [&] (int value) { fired.push_back(value); });
+      std::vector<int> due;
+      while (!expected.empty() && expected.begin()->first <= now) {
+        due.push_back(expected.begin()->second);
+        expected.erase(expected.begin());
+      }
+      std::sort(fired.begin(), fired.end());
+      std::sort(due.begin(), due.end());
+      ASSERT_EQ(fired, due);
+      for (int value : fired) {
+        ASSERT_TRUE(!timers.IsPending(handles[value]));
+        handles.erase(value);
+      }
+    }
+    ASSERT_EQ(timers.Size(), expected.size());
+  }
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests(argc, argv);
+}
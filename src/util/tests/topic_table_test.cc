@@ -0,0 +1,81 @@
+//  Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+//
+#include <map>
+#include <random>
+#include <string>
+
+#include "src/util/topic_table.h"
+#include "src/util/testharness.h"
+
+namespace rocketspeed {
+
+class TopicTableTest : public ::testing::Test {};
+
+TEST_F(TopicTableTest, Basic) {
+  TopicTable table;
+  ASSERT_EQ(table.Find("ns", "topic"), kInvalidTopicHandle);
+
+  TopicHandle a = table.Acquire(TopicUUID("ns", "topic"));
+  TopicHandle b = table.Acquire(TopicUUID("ns", "other"));
+  ASSERT_NE(a, b);
+  ASSERT_EQ(table.Acquire(TopicUUID("ns", "topic")), a);
+  ASSERT_EQ(table.Find("ns", "topic"), a);
+  ASSERT_EQ(table.Find("ns", "other"), b);
+  ASSERT_EQ(table.Find("ns2", "topic"), kInvalidTopicHandle);
+  ASSERT_TRUE(table.GetUUID(a) == TopicUUID("ns", "topic"));
+  ASSERT_EQ(table.GetNumTopics(), 2);
+
+  // Removed with the last reference only.
+  table.Release(a);
+  ASSERT_EQ(table.Find("ns", "topic"), a);
+  table.Acquire(a);
+  table.Release(a);
+  table.Release(a);
+  ASSERT_EQ(table.Find("ns", "topic"), kInvalidTopicHandle);
+  ASSERT_EQ(table.GetNumTopics(), 1);
+
+  // Handles are reused.
+  ASSERT_EQ(table.Acquire(TopicUUID("ns", "third")), a);
+  ASSERT_EQ(table.Find("ns", "other"), b);
+}
+
+TEST_F(TopicTableTest, Random) {
+  // Compare against a map while topics come and go.
+  TopicTable table;
+  std::map<std::string, std::pair<TopicHandle, int>> expected;
+  std::mt19937 rng(42);
+  for (int i = 0; i < 100000; ++i) {
+    const std::string topic = std::to_string(rng() % 2000);
+    auto it = expected.find(topic);
+    if (it == expected.end() || rng() % 2) {
+      TopicHandle handle = table.Acquire(TopicUUID("ns", topic));
+      if (it == expected.end()) {
+        expected.emplace(topic, std::make_pair(handle, 1));
+      } else {
+        ASSERT_EQ(it->second.first, handle);
+        it->second.second++;
+      }
+    } else {
+      table.Release(it->second.first);
+      if (--it->second.second == 0) {
+        expected.erase(it);
+        ASSERT_EQ(table.Find("ns", topic), kInvalidTopicHandle);
+      }
+    }
+  }
+  ASSERT_EQ(table.GetNumTopics(), expected.size());
+  for (const auto& entry : expected) {
+    ASSERT_EQ(table.Find("ns", entry.first), entry.second.first);
+    ASSERT_TRUE(table.GetUUID(entry.second.first) ==
+                TopicUUID("ns", entry.first));
+  }
+}
+
+}  // namespace rocketspeed
+
+int main(int argc, char** argv) {
+  return rocketspeed::test::RunAllTests(argc, argv);
+}
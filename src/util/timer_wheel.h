@@ -0,0 +1,291 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "include/Assert.h"
+
+namespace rocketspeed {
+
+/**
+ * Hierarchical timer wheel, for many timers with arbitrary deadlines.
+ *
+ * Time is divided into ticks of a fixed resolution. Timers due within the
+ * next 256 ticks live in the slots of the first level, and later timers in
+ * coarser levels, from which they are cascaded down as time advances.
+ * Adding and cancelling a timer is O(1), and expiry costs O(1) per elapsed
+ * tick plus the timers that are due or cascaded.
+ *
+ * Timers fire no earlier than their deadline, and at most one resolution
+ * later than it (as observed by ProcessExpired).
+ *
+ * Not thread safe.
+ *
+ * Simple usage example:
+ *
+ *   TimerWheel<std::string> timers(std::chrono::milliseconds(10));
+ *   auto handle = timers.Add("red", now + std::chrono::seconds(5));
+ *   timers.Add("green", now + std::chrono::seconds(1));
+ *   timers.Cancel(handle);
+ *   // 2 seconds later
+ *   timers.ProcessExpired(now + std::chrono::seconds(2),
+ *     [] (std::string colour) { std::cout << colour; });
+ *
+ * Output:
+ *
+ *   green
+ */
+template <typename T>
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * Identifies a timer. Stays invalid once its timer has fired or has been
+   * cancelled, even if the storage of the timer is reused.
+   */
+  typedef uint64_t Handle;
+
+  /** Handle that never refers to a timer. */
+  static constexpr Handle kInvalidHandle = std::numeric_limits<Handle>::max();
+
+  /**
+   * @param resolution Duration of a tick.
+   * @param start Start of the first tick.
+   */
+  explicit TimerWheel(Clock::duration resolution,
+                      Clock::time_point start = Clock::now())
+  : resolution_(resolution)
+  , start_(start)
+  , slots_(kLevels * kSlots, kNil) {
+    RS_ASSERT(resolution_.count() > 0);
+  }
+
+  TimerWheel(TimerWheel&&) = default;
+  TimerWheel& operator=(TimerWheel&&) = default;
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  bool Empty() const { return size_ == 0; }
+  size_t Size() const { return size_; }
+
+  /**
+   * Adds a timer.
+   *
+   * @param value Passed to the expiry callback.
+   * @param deadline Time at which the timer expires.
+   * @return Handle for cancelling the timer.
+   */
+  Handle Add(T value, Clock::time_point deadline) {
+    uint32_t index;
+    if (free_ != kNil) {
+      index = free_;
+      free_ = nodes_[index].next;
+    } else {
+      RS_ASSERT(nodes_.size() < kNil);
+      index = static_cast<uint32_t>(nodes_.size());
+      nodes_.emplace_back();
+    }
+    Node& node = nodes_[index];
+    node.value = std::move(value);
+    // Deadlines in past ticks fire on the next one.
+    node.deadline = std::max(ToTick(deadline, true), current_tick_ + 1);
+    Link(index, current_tick_);
+    ++size_;
+    return (static_cast<Handle>(node.generation) << 32) | index;
+  }
+
+  /**
+   * Cancels a timer.
+   *
+   * @return false if the timer has already fired or been cancelled.
+   */
+  bool Cancel(Handle handle) {
+    if (!IsPending(handle)) {
+      return false;
+    }
+    const uint32_t index = static_cast<uint32_t>(handle);
+    Unlink(index);
+    Free(index);
+    return true;
+  }
+
+  /**
+   * @return true iff the timer has neither fired nor been cancelled.
+   */
+  bool IsPending(Handle handle) const {
+    const uint32_t index = static_cast<uint32_t>(handle);
+    return handle != kInvalidHandle &&
+           index < nodes_.size() &&
+           nodes_[index].slot != kNil &&
+           nodes_[index].generation == static_cast<uint32_t>(handle >> 32);
+  }
+
+  /**
+   * Removes all timers without firing them.
+   */
+  void Clear() {
+    for (uint32_t index = 0; index < nodes_.size(); ++index) {
+      if (nodes_[index].slot != kNil) {
+        Unlink(index);
+        Free(index);
+      }
+    }
+  }
+
+  /**
+   * Advances the wheel to a point in time, and invokes a callback for each
+   * timer that expired by then, in order of tick. Expired timers are removed
+   * before their callback is invoked, so callbacks may add and cancel
+   * timers; new timers fire on a later call.
+   *
+   * @param now Current time.
+   * @param callback Invoked for each expired timer,
+   *                 should take a T parameter e.g. [](T expired_item) {...}
+   */
+  template <typename ExpiryCallback>
+  void ProcessExpired(Clock::time_point now, ExpiryCallback callback) {
+    const uint64_t now_tick = ToTick(now, false);
+    while (current_tick_ < now_tick) {
+      if (size_ == 0) {
+        // Nothing to cascade or fire on the way.
+        current_tick_ = now_tick;
+        break;
+      }
+      const uint64_t tick = current_tick_ + 1;
+
+      // Bring down timers from coarser levels whose slot starts at this
+      // tick, coarsest first, so that they may be cascaded again.
+      for (int level = kLevels - 1; level > 0; --level) {
+        const int shift = level * kSlotBits;
+        if ((tick & ((uint64_t(1) << shift) - 1)) == 0) {
+          const size_t slot = level * kSlots + ((tick >> shift) & kSlotMask);
+          uint32_t index = slots_[slot];
+          slots_[slot] = kNil;
+          while (index != kNil) {
+            const uint32_t next = nodes_[index].next;
+            Link(index, tick);
+            index = next;
+          }
+        }
+      }
+
+      current_tick_ = tick;
+      const size_t slot = tick & kSlotMask;
+      while (slots_[slot] != kNil) {
+        const uint32_t index = slots_[slot];
+        RS_ASSERT(nodes_[index].deadline == tick);
+        Unlink(index);
+        T value = std::move(nodes_[index].value);
+        Free(index);
+        callback(std::move(value));
+      }
+    }
+  }
+
+ private:
+  static constexpr int kSlotBits = 8;
+  static constexpr uint32_t kSlots = 1 << kSlotBits;
+  static constexpr uint64_t kSlotMask = kSlots - 1;
+  static constexpr int kLevels = 4;
+  // Timers further ahead are parked in the last slot of the coarsest level.
+  static constexpr uint64_t kMaxDelta =
+    (uint64_t(1) << (kLevels * kSlotBits)) - 1;
+  static constexpr uint32_t kNil = std::numeric_limits<uint32_t>::max();
+
+  struct Node {
+    T value;
+    uint64_t deadline = 0;
+    uint32_t prev = kNil;
+    uint32_t next = kNil;
+    // Index into slots_, kNil iff the node is free.
+    uint32_t slot = kNil;
+    uint32_t generation = 0;
+  };
+
+  /** Tick containing a point in time, or the first tick after it. */
+  uint64_t ToTick(Clock::time_point time, bool round_up) const {
+    if (time <= start_) {
+      return 0;
+    }
+    const auto elapsed = time - start_;
+    uint64_t tick = static_cast<uint64_t>(elapsed / resolution_);
+    if (round_up && elapsed % resolution_ != Clock::duration::zero()) {
+      ++tick;
+    }
+    return tick;
+  }
+
+  /** Links a node into the slot for its deadline, as seen at tick base. */
+  void Link(uint32_t index, uint64_t base) {
+    Node& node = nodes_[index];
+    RS_ASSERT(node.deadline >= base);
+    const uint64_t deadline = std::min(node.deadline, base + kMaxDelta);
+    const uint64_t delta = deadline - base;
+    int level = 0;
+    while (level + 1 < kLevels &&
+           delta >= (uint64_t(1) << ((level + 1) * kSlotBits))) {
+      ++level;
+    }
+    const uint32_t slot = static_cast<uint32_t>(
+      level * kSlots + ((deadline >> (level * kSlotBits)) & kSlotMask));
+    node.slot = slot;
+    node.prev = kNil;
+    node.next = slots_[slot];
+    if (node.next != kNil) {
+      nodes_[node.next].prev = index;
+    }
+    slots_[slot] = index;
+  }
+
+  void Unlink(uint32_t index) {
+    Node& node = nodes_[index];
+    if (node.prev != kNil) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      slots_[node.slot] = node.next;
+    }
+    if (node.next != kNil) {
+      nodes_[node.next].prev = node.prev;
+    }
+  }
+
+  void Free(uint32_t index) {
+    Node& node = nodes_[index];
+    node.value = T();
+    node.slot = kNil;
+    ++node.generation;
+    node.next = free_;
+    free_ = index;
+    --size_;
+  }
+
+  Clock::duration resolution_;
+  Clock::time_point start_;
+  // Last tick processed.
+  uint64_t current_tick_ = 0;
+  // Timers, linked into slots or into the free list.
+  std::vector<Node> nodes_;
+  uint32_t free_ = kNil;
+  // Head of the list of timers in each slot, level after level.
+  std::vector<uint32_t> slots_;
+  size_t size_ = 0;
+};
+
+template <typename T>
+constexpr typename TimerWheel<T>::Handle TimerWheel<T>::kInvalidHandle;
+
+template <typename T>
+constexpr uint32_t TimerWheel<T>::kNil;
+
+}  // namespace rocketspeed
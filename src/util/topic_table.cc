@@ -0,0 +1,133 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#include "src/util/topic_table.h"
+
+#include <utility>
+
+namespace rocketspeed {
+
+// Initial number of index slots, must be a power of two.
+static constexpr size_t kInitialSlots = 16;
+
+TopicTable::TopicTable()
+: slots_(kInitialSlots, 0) {
+}
+
+template <typename Equals>
+size_t TopicTable::FindSlot(size_t hash, const Equals& equals) const {
+  const size_t mask = slots_.size() - 1;
+  size_t slot = HomeSlot(hash);
+  while (slots_[slot] != 0) {
+    const TopicUUID& uuid = entries_[slots_[slot] - 1].uuid;
+    if (uuid.Hash() == hash && equals(uuid)) {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+TopicHandle TopicTable::Acquire(const TopicUUID& uuid) {
+  thread_check_.Check();
+  const size_t slot = FindSlot(uuid.Hash(),
+    [&] (const TopicUUID& other) { return other == uuid; });
+  if (slots_[slot] != 0) {
+    const TopicHandle handle = slots_[slot] - 1;
+    ++entries_[handle].refs;
+    return handle;
+  }
+
+  TopicHandle handle;
+  if (free_.empty()) {
+    RS_ASSERT(entries_.size() < kInvalidTopicHandle);
+    handle = static_cast<TopicHandle>(entries_.size());
+    entries_.emplace_back();
+  } else {
+    handle = free_.back();
+    free_.pop_back();
+  }
+  entries_[handle].uuid = uuid;
+  entries_[handle].refs = 1;
+  InsertSlot(handle);
+  return handle;
+}
+
+void TopicTable::Acquire(TopicHandle handle) {
+  thread_check_.Check();
+  RS_ASSERT(handle < entries_.size());
+  RS_ASSERT(entries_[handle].refs > 0);
+  ++entries_[handle].refs;
+}
+
+void TopicTable::Release(TopicHandle handle) {
+  thread_check_.Check();
+  RS_ASSERT(handle < entries_.size());
+  Entry& entry = entries_[handle];
+  RS_ASSERT(entry.refs > 0);
+  if (--entry.refs == 0) {
+    EraseSlot(handle);
+    // Free the topic name now rather than when the entry is reused.
+    entry.uuid = TopicUUID();
+    free_.push_back(handle);
+  }
+}
+
+TopicHandle TopicTable::Find(Slice namespace_id, Slice topic_name) const {
+  thread_check_.Check();
+  const auto namespace_topic = std::make_pair(namespace_id, topic_name);
+  const size_t slot = FindSlot(TopicUUID::RoutingHash(namespace_id, topic_name),
+    [&] (const TopicUUID& uuid) { return uuid == namespace_topic; });
+  return slots_[slot] != 0 ? slots_[slot] - 1 : kInvalidTopicHandle;
+}
+
+void TopicTable::InsertSlot(TopicHandle handle) {
+  // Keep the load factor at most 1/2, so that probe sequences stay short.
+  if (2 * (GetNumTopics() + 1) > slots_.size()) {
+    std::vector<uint32_t> old_slots(2 * slots_.size(), 0);
+    old_slots.swap(slots_);
+    for (uint32_t value : old_slots) {
+      if (value != 0) {
+        InsertSlot(value - 1);
+      }
+    }
+  }
+  const size_t mask = slots_.size() - 1;
+  size_t slot = HomeSlot(entries_[handle].uuid.Hash());
+  while (slots_[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  slots_[slot] = handle + 1;
+}
+
+void TopicTable::EraseSlot(TopicHandle handle) {
+  const size_t mask = slots_.size() - 1;
+  size_t slot = HomeSlot(entries_[handle].uuid.Hash());
+  while (slots_[slot] != handle + 1) {
+    RS_ASSERT(slots_[slot] != 0);
+    slot = (slot + 1) & mask;
+  }
+
+  // Shift back following entries of the probe sequence, so that lookups
+  // never stop at the emptied slot before reaching them.
+  size_t next = slot;
+  while (true) {
+    next = (next + 1) & mask;
+    if (slots_[next] == 0) {
+      break;
+    }
+    const size_t home = HomeSlot(entries_[slots_[next] - 1].uuid.Hash());
+    // Move the entry if its home is not cyclically within (slot, next].
+    const bool in_range = slot <= next ? (slot < home && home <= next)
+                                       : (slot < home || home <= next);
+    if (!in_range) {
+      slots_[slot] = slots_[next];
+      slot = next;
+    }
+  }
+  slots_[slot] = 0;
+}
+
+}  // namespace rocketspeed
@@ -0,0 +1,117 @@
+// Copyright (c) 2015, Facebook, Inc.  All rights reserved.
+// This source code is licensed under the BSD-style license found in the
+// LICENSE file in the root directory of this source tree. An additional grant
+// of patent rights can be found in the PATENTS file in the same directory.
+//
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "include/Types.h"
+#include "src/util/common/noncopyable.h"
+#include "src/util/common/thread_check.h"
+#include "src/util/topic_uuid.h"
+
+namespace rocketspeed {
+
+/**
+ * Compact identifier of a topic interned in a TopicTable.
+ * Only meaningful together with the table that issued it.
+ */
+typedef uint32_t TopicHandle;
+
+/** Handle that never refers to a topic. */
+constexpr TopicHandle kInvalidTopicHandle =
+  std::numeric_limits<TopicHandle>::max();
+
+/**
+ * Interns namespace + topic pairs into TopicHandles, so that each topic name
+ * is stored once, and maps of topics compare and hash 32-bit integers.
+ *
+ * Topics are reference counted. A topic is removed from the table when the
+ * last reference is released, after which its handle may be reused.
+ *
+ * Not thread safe, meant to be owned by a single worker.
+ */
+class TopicTable : public NonCopyable {
+ public:
+  TopicTable();
+
+  /**
+   * Interns a topic and acquires a reference to it.
+   *
+   * @param uuid The topic to intern.
+   * @return Handle of the topic.
+   */
+  TopicHandle Acquire(const TopicUUID& uuid);
+
+  /**
+   * Acquires another reference to an interned topic.
+   */
+  void Acquire(TopicHandle handle);
+
+  /**
+   * Releases a reference to an interned topic, and removes the topic once
+   * the last reference is released.
+   */
+  void Release(TopicHandle handle);
+
+  /**
+   * Looks up an interned topic without allocating.
+   *
+   * @return Handle of the topic, or kInvalidTopicHandle if not interned.
+   */
+  TopicHandle Find(Slice namespace_id, Slice topic_name) const;
+
+  /**
+   * @return UUID of an interned topic.
+   */
+  const TopicUUID& GetUUID(TopicHandle handle) const {
+    RS_ASSERT(handle < entries_.size());
+    RS_ASSERT(entries_[handle].refs > 0);
+    return entries_[handle].uuid;
+  }
+
+  /**
+   * @return Number of interned topics.
+   */
+  size_t GetNumTopics() const {
+    return entries_.size() - free_.size();
+  }
+
+ private:
+  struct Entry {
+    TopicUUID uuid;
+    // 0 iff the entry is free.
+    uint32_t refs;
+  };
+
+  /** Index of the slot holding the topic or of the free slot to hold it. */
+  template <typename Equals>
+  size_t FindSlot(size_t hash, const Equals& equals) const;
+
+  /** Inserts a handle into the index, growing it if needed. */
+  void InsertSlot(TopicHandle handle);
+
+  /** Removes a handle from the index. */
+  void EraseSlot(TopicHandle handle);
+
+  size_t HomeSlot(size_t hash) const {
+    return hash & (slots_.size() - 1);
+  }
+
+  /** Interned topics, indexed by handle. */
+  std::vector<Entry> entries_;
+  /** Handles of free entries. */
+  std::vector<TopicHandle> free_;
+  /**
+   * Open addressing index from topic hash to handle + 1, with linear
+   * probing. Zero marks an empty slot. Size is a power of two.
+   */
+  std::vector<uint32_t> slots_;
+  ThreadCheck thread_check_;
+};
+
+}  // namespace rocketspeed